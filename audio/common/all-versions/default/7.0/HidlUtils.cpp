@@ -17,6 +17,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 #define LOG_TAG "HidlUtils"
 #include <log/log.h>
@@ -43,10 +46,168 @@ using namespace ::android::audio::policy::configuration::CPP_VERSION;
         result = status;                                \
     }
 
+namespace {
+
+// Read-only open-addressed hash table, filled once at construction so that lookups need
+// no lock. String keys are looked up without copying the searched string.
+template <typename Key, typename Value>
+class FrozenMap {
+  public:
+    using LookupKey = std::conditional_t<std::is_same_v<Key, std::string>, std::string_view, Key>;
+
+    explicit FrozenMap(std::vector<std::pair<Key, Value>> entries) {
+        size_t capacity = 8;
+        while (capacity < entries.size() * 2) capacity <<= 1;
+        mSlots.resize(capacity);
+        mMask = capacity - 1;
+        for (auto& entry : entries) {
+            Slot& slot = mSlots[findSlot(entry.first)];
+            if (!slot.used) {  // The first of several entries with the same key wins.
+                slot = {true, std::move(entry.first), std::move(entry.second)};
+            }
+        }
+    }
+
+    const Value* find(LookupKey key) const {
+        const Slot& slot = mSlots[findSlot(key)];
+        return slot.used ? &slot.value : nullptr;
+    }
+
+  private:
+    struct Slot {
+        bool used = false;
+        Key key{};
+        Value value{};
+    };
+
+    size_t findSlot(LookupKey key) const {
+        for (size_t i = std::hash<LookupKey>{}(key) & mMask;; i = (i + 1) & mMask) {
+            if (!mSlots[i].used || mSlots[i].key == key) return i;
+        }
+    }
+
+    std::vector<Slot> mSlots;
+    size_t mMask;
+};
+
+std::string_view asView(const hidl_string& str) {
+    return std::string_view(str.c_str(), str.size());
+}
+
+// Conversions between the strings of an xsd enum and the values of a HAL enum, with the
+// same results as the audio_*_from_string and audio_*_to_string functions combined with
+// the xsd::isUnknown* checks. The tables are built once from the xsd value list, so the
+// conversions only parse or compare strings for HAL values that are not in the xsd.
+template <typename HalEnum>
+class EnumConverter {
+  public:
+    using FromString = bool (*)(const char*, HalEnum*);
+    using ToString = const char* (*)(HalEnum);
+
+    template <typename XsdEnum>
+    static EnumConverter make(FromString fromString, ToString toHalString) {
+        std::vector<std::pair<std::string, HalValue>> entries;
+        for (const auto value : xsdc_enum_range<XsdEnum>{}) {
+            std::string str = toString(value);
+            HalEnum halValue{};
+            bool valid = fromString(str.c_str(), &halValue);
+            entries.emplace_back(std::move(str), HalValue{valid, halValue});
+        }
+        StringToHal values(std::move(entries));
+        std::vector<std::pair<uint32_t, std::string>> strings;
+        for (const auto value : xsdc_enum_range<XsdEnum>{}) {
+            const HalValue* halValue = values.find(toString(value));
+            if (!halValue->valid) continue;
+            const char* str = toHalString(halValue->value);
+            if (str != nullptr && values.find(str) != nullptr) {
+                strings.emplace_back(static_cast<uint32_t>(halValue->value), str);
+            }
+        }
+        return EnumConverter(std::move(values), HalToString(std::move(strings)), toHalString);
+    }
+
+    bool isKnown(std::string_view str) const { return mValues.find(str) != nullptr; }
+
+    bool toHal(std::string_view str, HalEnum* halValue) const {
+        const HalValue* entry = mValues.find(str);
+        if (entry == nullptr || !entry->valid) return false;
+        *halValue = entry->value;
+        return true;
+    }
+
+    bool fromHal(HalEnum halValue, hidl_string* str) const {
+        if (const std::string* entry = mStrings.find(static_cast<uint32_t>(halValue));
+            entry != nullptr) {
+            *str = *entry;
+            return true;
+        }
+        *str = mToHalString(halValue);
+        return !str->empty() && isKnown(asView(*str));
+    }
+
+  private:
+    struct HalValue {
+        bool valid;
+        HalEnum value;
+    };
+    using StringToHal = FrozenMap<std::string, HalValue>;
+    using HalToString = FrozenMap<uint32_t, std::string>;
+
+    EnumConverter(StringToHal values, HalToString strings, ToString toHalString)
+        : mValues(std::move(values)), mStrings(std::move(strings)), mToHalString(toHalString) {}
+
+    StringToHal mValues;   // All the xsd strings, whether they have a HAL value or not.
+    HalToString mStrings;  // HAL values of xsd strings that convert back to an xsd string.
+    ToString mToHalString;
+};
+
+struct ConversionTables {
+    // Channel masks convert to strings differently depending on their direction.
+    const EnumConverter<audio_channel_mask_t> inChannelMasks =
+            EnumConverter<audio_channel_mask_t>::make<xsd::AudioChannelMask>(
+                    audio_channel_mask_from_string, audio_channel_in_mask_to_string);
+    const EnumConverter<audio_channel_mask_t> outChannelMasks =
+            EnumConverter<audio_channel_mask_t>::make<xsd::AudioChannelMask>(
+                    audio_channel_mask_from_string, audio_channel_out_mask_to_string);
+    const EnumConverter<audio_channel_mask_t> indexChannelMasks =
+            EnumConverter<audio_channel_mask_t>::make<xsd::AudioChannelMask>(
+                    audio_channel_mask_from_string, audio_channel_index_mask_to_string);
+    const EnumConverter<audio_content_type_t> contentTypes =
+            EnumConverter<audio_content_type_t>::make<xsd::AudioContentType>(
+                    audio_content_type_from_string, audio_content_type_to_string);
+    const EnumConverter<audio_devices_t> devices =
+            EnumConverter<audio_devices_t>::make<xsd::AudioDevice>(audio_device_from_string,
+                                                                  audio_device_to_string);
+    const EnumConverter<audio_format_t> formats =
+            EnumConverter<audio_format_t>::make<xsd::AudioFormat>(audio_format_from_string,
+                                                                 audio_format_to_string);
+    const EnumConverter<audio_gain_mode_t> gainModes =
+            EnumConverter<audio_gain_mode_t>::make<xsd::AudioGainMode>(
+                    audio_gain_mode_from_string, audio_gain_mode_to_string);
+    const EnumConverter<audio_source_t> sources =
+            EnumConverter<audio_source_t>::make<xsd::AudioSource>(audio_source_from_string,
+                                                                 audio_source_to_string);
+    const EnumConverter<audio_stream_type_t> streamTypes =
+            EnumConverter<audio_stream_type_t>::make<xsd::AudioStreamType>(
+                    audio_stream_type_from_string, audio_stream_type_to_string);
+    const EnumConverter<audio_usage_t> usages =
+            EnumConverter<audio_usage_t>::make<xsd::AudioUsage>(audio_usage_from_string,
+                                                               audio_usage_to_string);
+    const EnumConverter<audio_encapsulation_type_t> encapsulationTypes =
+            EnumConverter<audio_encapsulation_type_t>::make<xsd::AudioEncapsulationType>(
+                    audio_encapsulation_type_from_string, audio_encapsulation_type_to_string);
+};
+
+const ConversionTables& tables() {
+    static const ConversionTables sTables;
+    return sTables;
+}
+
+}  // namespace
+
 status_t HidlUtils::audioIndexChannelMaskFromHal(audio_channel_mask_t halChannelMask,
                                                  AudioChannelMask* channelMask) {
-    *channelMask = audio_channel_index_mask_to_string(halChannelMask);
-    if (!channelMask->empty() && !xsd::isUnknownAudioChannelMask(*channelMask)) {
+    if (tables().indexChannelMasks.fromHal(halChannelMask, channelMask)) {
         return NO_ERROR;
     }
     ALOGE("Unknown index channel mask value 0x%X", halChannelMask);
@@ -56,8 +217,7 @@ status_t HidlUtils::audioIndexChannelMaskFromHal(audio_channel_mask_t halChannel
 
 status_t HidlUtils::audioInputChannelMaskFromHal(audio_channel_mask_t halChannelMask,
                                                  AudioChannelMask* channelMask) {
-    *channelMask = audio_channel_in_mask_to_string(halChannelMask);
-    if (!channelMask->empty() && !xsd::isUnknownAudioChannelMask(*channelMask)) {
+    if (tables().inChannelMasks.fromHal(halChannelMask, channelMask)) {
         return NO_ERROR;
     }
     ALOGE("Unknown input channel mask value 0x%X", halChannelMask);
@@ -67,8 +227,7 @@ status_t HidlUtils::audioInputChannelMaskFromHal(audio_channel_mask_t halChannel
 
 status_t HidlUtils::audioOutputChannelMaskFromHal(audio_channel_mask_t halChannelMask,
                                                   AudioChannelMask* channelMask) {
-    *channelMask = audio_channel_out_mask_to_string(halChannelMask);
-    if (!channelMask->empty() && !xsd::isUnknownAudioChannelMask(*channelMask)) {
+    if (tables().outChannelMasks.fromHal(halChannelMask, channelMask)) {
         return NO_ERROR;
     }
     ALOGE("Unknown output channel mask value 0x%X", halChannelMask);
@@ -103,7 +262,7 @@ status_t HidlUtils::audioChannelMasksFromHal(const std::vector<std::string>& hal
     tempChannelMasks.resize(halChannelMasks.size());
     size_t tempPos = 0;
     for (const auto& halChannelMask : halChannelMasks) {
-        if (!halChannelMask.empty() && !xsd::isUnknownAudioChannelMask(halChannelMask)) {
+        if (!halChannelMask.empty() && tables().outChannelMasks.isKnown(halChannelMask)) {
             tempChannelMasks[tempPos++] = halChannelMask;
         }
     }
@@ -118,8 +277,7 @@ status_t HidlUtils::audioChannelMasksFromHal(const std::vector<std::string>& hal
 
 status_t HidlUtils::audioChannelMaskToHal(const AudioChannelMask& channelMask,
                                           audio_channel_mask_t* halChannelMask) {
-    if (!xsd::isUnknownAudioChannelMask(channelMask) &&
-        audio_channel_mask_from_string(channelMask.c_str(), halChannelMask)) {
+    if (tables().outChannelMasks.toHal(asView(channelMask), halChannelMask)) {
         return NO_ERROR;
     }
     ALOGE("Unknown channel mask \"%s\"", channelMask.c_str());
@@ -203,8 +361,7 @@ status_t HidlUtils::audioConfigBaseOptionalToHal(const AudioConfigBaseOptional&
 
 status_t HidlUtils::audioContentTypeFromHal(const audio_content_type_t halContentType,
                                             AudioContentType* contentType) {
-    *contentType = audio_content_type_to_string(halContentType);
-    if (!contentType->empty() && !xsd::isUnknownAudioContentType(*contentType)) {
+    if (tables().contentTypes.fromHal(halContentType, contentType)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio content type value 0x%X", halContentType);
@@ -214,8 +371,7 @@ status_t HidlUtils::audioContentTypeFromHal(const audio_content_type_t halConten
 
 status_t HidlUtils::audioContentTypeToHal(const AudioContentType& contentType,
                                           audio_content_type_t* halContentType) {
-    if (!xsd::isUnknownAudioContentType(contentType) &&
-        audio_content_type_from_string(contentType.c_str(), halContentType)) {
+    if (tables().contentTypes.toHal(asView(contentType), halContentType)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio content type \"%s\"", contentType.c_str());
@@ -224,8 +380,7 @@ status_t HidlUtils::audioContentTypeToHal(const AudioContentType& contentType,
 }
 
 status_t HidlUtils::audioDeviceTypeFromHal(audio_devices_t halDevice, AudioDevice* device) {
-    *device = audio_device_to_string(halDevice);
-    if (!device->empty() && !xsd::isUnknownAudioDevice(*device)) {
+    if (tables().devices.fromHal(halDevice, device)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio device value 0x%X", halDevice);
@@ -234,7 +389,7 @@ status_t HidlUtils::audioDeviceTypeFromHal(audio_devices_t halDevice, AudioDevic
 }
 
 status_t HidlUtils::audioDeviceTypeToHal(const AudioDevice& device, audio_devices_t* halDevice) {
-    if (!xsd::isUnknownAudioDevice(device) && audio_device_from_string(device.c_str(), halDevice)) {
+    if (tables().devices.toHal(asView(device), halDevice)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio device \"%s\"", device.c_str());
@@ -243,8 +398,7 @@ status_t HidlUtils::audioDeviceTypeToHal(const AudioDevice& device, audio_device
 }
 
 status_t HidlUtils::audioFormatFromHal(audio_format_t halFormat, AudioFormat* format) {
-    *format = audio_format_to_string(halFormat);
-    if (!format->empty() && !xsd::isUnknownAudioFormat(*format)) {
+    if (tables().formats.fromHal(halFormat, format)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio format value 0x%X", halFormat);
@@ -257,7 +411,7 @@ status_t HidlUtils::audioFormatsFromHal(const std::vector<std::string>& halForma
     tempFormats.resize(halFormats.size());
     size_t tempPos = 0;
     for (const auto& halFormat : halFormats) {
-        if (!halFormat.empty() && !xsd::isUnknownAudioFormat(halFormat)) {
+        if (!halFormat.empty() && tables().formats.isKnown(halFormat)) {
             tempFormats[tempPos++] = halFormat;
         }
     }
@@ -270,7 +424,7 @@ status_t HidlUtils::audioFormatsFromHal(const std::vector<std::string>& halForma
 }
 
 status_t HidlUtils::audioFormatToHal(const AudioFormat& format, audio_format_t* halFormat) {
-    if (!xsd::isUnknownAudioFormat(format) && audio_format_from_string(format.c_str(), halFormat)) {
+    if (tables().formats.toHal(asView(format), halFormat)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio format \"%s\"", format.c_str());
@@ -285,8 +439,8 @@ status_t HidlUtils::audioGainModeMaskFromHal(audio_gain_mode_t halGainModeMask,
     for (uint32_t bit = 0; halGainModeMask != 0 && bit < sizeof(audio_gain_mode_t) * 8; ++bit) {
         audio_gain_mode_t flag = static_cast<audio_gain_mode_t>(1u << bit);
         if ((flag & halGainModeMask) == flag) {
-            AudioGainMode flagStr = audio_gain_mode_to_string(flag);
-            if (!flagStr.empty() && !xsd::isUnknownAudioGainMode(flagStr)) {
+            AudioGainMode flagStr;
+            if (tables().gainModes.fromHal(flag, &flagStr)) {
                 result.push_back(flagStr);
             } else {
                 ALOGE("Unknown audio gain mode value 0x%X", flag);
@@ -305,8 +459,7 @@ status_t HidlUtils::audioGainModeMaskToHal(const hidl_vec<AudioGainMode>& gainMo
     *halGainModeMask = {};
     for (const auto& gainMode : gainModeMask) {
         audio_gain_mode_t halGainMode;
-        if (!xsd::isUnknownAudioGainMode(gainMode) &&
-            audio_gain_mode_from_string(gainMode.c_str(), &halGainMode)) {
+        if (tables().gainModes.toHal(asView(gainMode), &halGainMode)) {
             *halGainModeMask = static_cast<audio_gain_mode_t>(*halGainModeMask | halGainMode);
         } else {
             ALOGE("Unknown audio gain mode \"%s\"", gainMode.c_str());
@@ -317,8 +470,7 @@ status_t HidlUtils::audioGainModeMaskToHal(const hidl_vec<AudioGainMode>& gainMo
 }
 
 status_t HidlUtils::audioSourceFromHal(audio_source_t halSource, AudioSource* source) {
-    *source = audio_source_to_string(halSource);
-    if (!source->empty() && !xsd::isUnknownAudioSource(*source)) {
+    if (tables().sources.fromHal(halSource, source)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio source value 0x%X", halSource);
@@ -327,7 +479,7 @@ status_t HidlUtils::audioSourceFromHal(audio_source_t halSource, AudioSource* so
 }
 
 status_t HidlUtils::audioSourceToHal(const AudioSource& source, audio_source_t* halSource) {
-    if (!xsd::isUnknownAudioSource(source) && audio_source_from_string(source.c_str(), halSource)) {
+    if (tables().sources.toHal(asView(source), halSource)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio source \"%s\"", source.c_str());
@@ -339,8 +491,7 @@ status_t HidlUtils::audioSourceToHal(const AudioSource& source, audio_source_t*
 status_t HidlUtils::audioStreamTypeFromHal(audio_stream_type_t halStreamType,
                                            AudioStreamType* streamType) {
     if (halStreamType != AUDIO_STREAM_DEFAULT) {
-        *streamType = audio_stream_type_to_string(halStreamType);
-        if (!streamType->empty() && !xsd::isUnknownAudioStreamType(*streamType)) {
+        if (tables().streamTypes.fromHal(halStreamType, streamType)) {
             return NO_ERROR;
         }
         ALOGE("Unknown audio stream type value 0x%X", halStreamType);
@@ -354,8 +505,7 @@ status_t HidlUtils::audioStreamTypeFromHal(audio_stream_type_t halStreamType,
 status_t HidlUtils::audioStreamTypeToHal(const AudioStreamType& streamType,
                                          audio_stream_type_t* halStreamType) {
     if (!streamType.empty()) {
-        if (!xsd::isUnknownAudioStreamType(streamType) &&
-            audio_stream_type_from_string(streamType.c_str(), halStreamType)) {
+        if (tables().streamTypes.toHal(asView(streamType), halStreamType)) {
             return NO_ERROR;
         }
         ALOGE("Unknown audio stream type \"%s\"", streamType.c_str());
@@ -493,8 +643,7 @@ status_t HidlUtils::audioUsageFromHal(audio_usage_t halUsage, AudioUsage* usage)
 #endif
         halUsage = AUDIO_USAGE_NOTIFICATION;
     }
-    *usage = audio_usage_to_string(halUsage);
-    if (!usage->empty() && !xsd::isUnknownAudioUsage(*usage)) {
+    if (tables().usages.fromHal(halUsage, usage)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio usage %d", halUsage);
@@ -503,7 +652,7 @@ status_t HidlUtils::audioUsageFromHal(audio_usage_t halUsage, AudioUsage* usage)
 }
 
 status_t HidlUtils::audioUsageToHal(const AudioUsage& usage, audio_usage_t* halUsage) {
-    if (!xsd::isUnknownAudioUsage(usage) && audio_usage_from_string(usage.c_str(), halUsage)) {
+    if (tables().usages.toHal(asView(usage), halUsage)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio usage \"%s\"", usage.c_str());
@@ -721,8 +870,7 @@ status_t HidlUtils::audioPortExtendedInfoToHal(const AudioPortExtendedInfo& ext,
 
 status_t HidlUtils::encapsulationTypeFromHal(audio_encapsulation_type_t halEncapsulationType,
                                              AudioEncapsulationType* encapsulationType) {
-    *encapsulationType = audio_encapsulation_type_to_string(halEncapsulationType);
-    if (!encapsulationType->empty() && !xsd::isUnknownAudioEncapsulationType(*encapsulationType)) {
+    if (tables().encapsulationTypes.fromHal(halEncapsulationType, encapsulationType)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio encapsulation type value 0x%X", halEncapsulationType);
@@ -731,8 +879,7 @@ status_t HidlUtils::encapsulationTypeFromHal(audio_encapsulation_type_t halEncap
 
 status_t HidlUtils::encapsulationTypeToHal(const AudioEncapsulationType& encapsulationType,
                                            audio_encapsulation_type_t* halEncapsulationType) {
-    if (!xsd::isUnknownAudioEncapsulationType(encapsulationType) &&
-        audio_encapsulation_type_from_string(encapsulationType.c_str(), halEncapsulationType)) {
+    if (tables().encapsulationTypes.toHal(asView(encapsulationType), halEncapsulationType)) {
         return NO_ERROR;
     }
     ALOGE("Unknown audio encapsulation type \"%s\"", encapsulationType.c_str());
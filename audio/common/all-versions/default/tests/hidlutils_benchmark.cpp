@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/benchmark.h"
+
+#include <iterator>
+#include <vector>
+
+#include <HidlUtils.h>
+#include PATH(APM_XSD_ENUMS_H_FILENAME)
+#include <system/audio.h>
+
+using namespace android;
+using namespace ::android::hardware::audio::common::COMMON_TYPES_CPP_VERSION;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::audio::common::COMMON_TYPES_CPP_VERSION::implementation::HidlUtils;
+using ::benchmark::State;
+namespace xsd {
+using namespace ::android::audio::policy::configuration::CPP_VERSION;
+}
+
+namespace {
+
+AudioConfig makeConfig() {
+    AudioConfig config = {};
+    config.base.sampleRateHz = 48000;
+    config.base.format = toString(xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT);
+    config.base.channelMask = toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_7POINT1);
+    return config;
+}
+
+// A device port as listed by the policy of a car audio topology
+AudioPort makeDevicePort() {
+    AudioPort port = {};
+    port.id = 42;
+    port.name = "bus0_media_out";
+    const xsd::AudioFormat formats[] = {xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT,
+                                        xsd::AudioFormat::AUDIO_FORMAT_PCM_24_BIT_PACKED,
+                                        xsd::AudioFormat::AUDIO_FORMAT_PCM_FLOAT};
+    port.transports.resize(std::size(formats));
+    for (size_t i = 0; i < std::size(formats); ++i) {
+        AudioProfile profile;
+        profile.format = toString(formats[i]);
+        profile.sampleRates = hidl_vec<uint32_t>({16000, 44100, 48000});
+        profile.channelMasks = hidl_vec<AudioChannelMask>(
+                {toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_MONO),
+                 toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_STEREO),
+                 toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_5POINT1),
+                 toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_7POINT1)});
+        port.transports[i].audioCapability.profile(profile);
+        port.transports[i].encapsulationType =
+                toString(xsd::AudioEncapsulationType::AUDIO_ENCAPSULATION_TYPE_NONE);
+    }
+    port.gains.resize(1);
+    port.gains[0].mode = hidl_vec<AudioGainMode>(
+            {toString(xsd::AudioGainMode::AUDIO_GAIN_MODE_JOINT),
+             toString(xsd::AudioGainMode::AUDIO_GAIN_MODE_CHANNELS)});
+    port.gains[0].channelMask = toString(xsd::AudioChannelMask::AUDIO_CHANNEL_OUT_STEREO);
+    port.ext.device({});
+    port.ext.device().deviceType = toString(xsd::AudioDevice::AUDIO_DEVICE_OUT_BUS);
+    port.ext.device().address.id("bus0_media_out");
+    return port;
+}
+
+void BM_AudioConfigRoundTrip(State& state) {
+    const AudioConfig config = makeConfig();
+    audio_config_t halConfig;
+    AudioConfig configBack;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(HidlUtils::audioConfigToHal(config, &halConfig));
+        benchmark::DoNotOptimize(
+                HidlUtils::audioConfigFromHal(halConfig, false /*isInput*/, &configBack));
+    }
+}
+BENCHMARK(BM_AudioConfigRoundTrip);
+
+void BM_AudioPortRoundTrip(State& state) {
+    const AudioPort port = makeDevicePort();
+    struct audio_port_v7 halPort;
+    AudioPort portBack;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(HidlUtils::audioPortToHal(port, &halPort));
+        benchmark::DoNotOptimize(HidlUtils::audioPortFromHal(halPort, &portBack));
+    }
+}
+BENCHMARK(BM_AudioPortRoundTrip);
+
+// Listing the ports of a topology with 40 devices, as getAudioPorts does
+void BM_AudioPortsFromHal(State& state) {
+    std::vector<struct audio_port_v7> halPorts(state.range(0));
+    AudioPort port = makeDevicePort();
+    for (auto& halPort : halPorts) {
+        HidlUtils::audioPortToHal(port, &halPort);
+        ++port.id;
+    }
+    hidl_vec<AudioPort> ports(halPorts.size());
+    for (auto _ : state) {
+        for (size_t i = 0; i < halPorts.size(); ++i) {
+            benchmark::DoNotOptimize(HidlUtils::audioPortFromHal(halPorts[i], &ports[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * halPorts.size());
+}
+BENCHMARK(BM_AudioPortsFromHal)->Arg(40);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -204,9 +204,9 @@ status_t updateSpatializerPriority(pid_t tid) {
 
 }  // namespace scheduler
 
-#define SCOPED_STATS()                                                       \
-    ::android::mediautils::ScopedStatistics scopedStatistics {               \
-        std::string("EffectHal::").append(__func__), mEffectHal->mStatistics \
+#define SCOPED_STATS(func)                                               \
+    ::android::mediautils::ScopedStatistics scopedStatistics {           \
+        std::string("EffectHal::").append(func), mEffectHal->mStatistics \
     }
 
 class ProcessThread : public Thread {
@@ -214,6 +214,7 @@ class ProcessThread : public Thread {
     // ProcessThread's lifespan never exceeds Effect's lifespan.
      ProcessThread(std::atomic<bool>* stop, effect_handle_t effect,
                    std::atomic<audio_buffer_t*>* inBuffer, std::atomic<audio_buffer_t*>* outBuffer,
+                   std::atomic<EffectChain*>* chain, EffectProcessGate* gate,
                    Effect::StatusMQ* statusMQ, EventFlag* efGroup, Effect* effectHal)
          : Thread(false /*canCallJava*/),
            mStop(stop),
@@ -221,6 +222,8 @@ class ProcessThread : public Thread {
            mHasProcessReverse((*mEffect)->process_reverse != NULL),
            mInBuffer(inBuffer),
            mOutBuffer(outBuffer),
+           mChain(chain),
+           mGate(gate),
            mStatusMQ(statusMQ),
            mEfGroup(efGroup),
            mEffectHal(effectHal) {}
@@ -232,6 +235,8 @@ class ProcessThread : public Thread {
     bool mHasProcessReverse;
     std::atomic<audio_buffer_t*>* mInBuffer;
     std::atomic<audio_buffer_t*>* mOutBuffer;
+    std::atomic<EffectChain*>* mChain;
+    EffectProcessGate* mGate;
     Effect::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
     Effect* const mEffectHal;
@@ -274,13 +279,22 @@ bool ProcessThread::threadLoop() {
             audio_buffer_t* outBuffer =
                 std::atomic_load_explicit(mOutBuffer, std::memory_order_relaxed);
             if (inBuffer != nullptr && outBuffer != nullptr) {
-                // Time this effect process
-                SCOPED_STATS();
-
+                const char* func = __func__;
                 if (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS)) {
-                    processResult = (*mEffect)->process(mEffect, inBuffer, outBuffer);
+                    // Effects attached to this one run in place on its output. They are
+                    // timed by the chain, not in the statistics of this effect.
+                    EffectChain* chain =
+                            std::atomic_load_explicit(mChain, std::memory_order_acquire);
+                    processResult = EffectChain::process(mGate, chain, outBuffer, [&] {
+                        // Time this effect process
+                        SCOPED_STATS(func);
+                        return (*mEffect)->process(mEffect, inBuffer, outBuffer);
+                    });
                 } else {
-                    processResult = (*mEffect)->process_reverse(mEffect, inBuffer, outBuffer);
+                    processResult = mGate->processReverse([&] {
+                        SCOPED_STATS(func);
+                        return (*mEffect)->process_reverse(mEffect, inBuffer, outBuffer);
+                    });
                 }
                 std::atomic_thread_fence(std::memory_order_release);
             } else {
@@ -292,6 +306,7 @@ bool ProcessThread::threadLoop() {
                     retval = Result::OK;
                     break;
                 case -ENODATA:
+                case -EBUSY:  // attached to a chain, processed by its head
                     retval = Result::INVALID_STATE;
                     break;
                 case -EINVAL:
@@ -319,8 +334,13 @@ const char* Effect::sContextCallFunction = sContextCallToCommand;
 const char* Effect::sContextConversion = "conversion";
 
 Effect::Effect(bool isInput, effect_handle_t handle)
-    : mIsInput(isInput), mHandle(handle), mEfGroup(nullptr), mStopProcessThread(false) {
+    : mIsInput(isInput),
+      mHandle(handle),
+      mEfGroup(nullptr),
+      mStopProcessThread(false),
+      mChainPtr(nullptr) {
     (void)mIsInput;  // prevent 'unused field' warnings in pre-V7 versions.
+    EffectChain::addEffect(mHandle, &mProcessGate);
 }
 
 Effect::~Effect() {
@@ -562,7 +582,8 @@ Return<void> Effect::prepareForProcessing(prepareForProcessing_cb _hidl_cb) {
 
     // Create and launch the thread.
     mProcessThread = new ProcessThread(&mStopProcessThread, mHandle, &mHalInBufferPtr,
-                                       &mHalOutBufferPtr, tempStatusMQ.get(), mEfGroup, this);
+                                       &mHalOutBufferPtr, &mChainPtr, &mProcessGate,
+                                       tempStatusMQ.get(), mEfGroup, this);
     status = mProcessThread->run("effect", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start effect processing thread: %s", strerror(-status));
@@ -596,6 +617,23 @@ Return<Result> Effect::setProcessBuffers(const AudioBuffer& inBuffer,
     return Result::OK;
 }
 
+status_t Effect::setChain(size_t count, const uint64_t* effectIds) {
+    std::vector<effect_handle_t> handles;
+    for (size_t i = 0; i < count; ++i) {
+        effect_handle_t handle = EffectMap::getInstance().get(effectIds[i]);
+        if (handle == nullptr) {
+            ALOGE("%s: unknown effect id %" PRIu64, __func__, effectIds[i]);
+            return BAD_VALUE;
+        }
+        handles.push_back(handle);
+    }
+    if (mChain == nullptr) {
+        mChain = new EffectChain(mHandle);
+        mChainPtr.store(mChain.get(), std::memory_order_release);
+    }
+    return mChain->setStages(handles);
+}
+
 Result Effect::sendCommand(int commandCode, const char* commandName) {
     return sendCommand(commandCode, commandName, 0, NULL);
 }
@@ -877,6 +915,13 @@ Return<void> Effect::command(uint32_t commandId, const hidl_vec<uint8_t>& data,
                 break;  // we have handled 'gtid' here.
             }
             [[fallthrough]];  // allow 'gtid' overload (checked halDataSize and resultMaxSize).
+        case 'echn':  // attach effects processed in place after this one, see EffectChain
+            if (commandId == 'echn' && halDataSize % sizeof(uint64_t) == 0 && resultMaxSize == 0) {
+                status = setChain(halDataSize / sizeof(uint64_t),
+                                  reinterpret_cast<const uint64_t*>(dataPtr));
+                break;
+            }
+            [[fallthrough]];  // allow 'echn' overload (checked halDataSize and resultMaxSize).
         default:
             status = (*mHandle)->command(mHandle, commandId, halDataSize, dataPtr, &halResultSize,
                                          resultPtr);
@@ -951,6 +996,11 @@ Return<Result> Effect::close() {
     if (mEfGroup) {
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_QUIT));
     }
+    EffectChain::removeEffect(mHandle);
+    if (mChain != nullptr) {
+        // Hand the attached effects back to their own processing threads
+        mChain->setStages({});
+    }
 #if MAJOR_VERSION <= 5
     return Result::OK;
 #elif MAJOR_VERSION >= 6
@@ -969,6 +1019,10 @@ Return<void> Effect::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /
         (void)sendCommand(EFFECT_CMD_DUMP, "DUMP", sizeof(cmdData), &cmdData);
         const std::string s = mStatistics->dump();
         if (s.size() != 0) write(cmdData, s.c_str(), s.size());
+        if (mChain != nullptr) {
+            const std::string chain = mChain->dump();
+            write(cmdData, chain.c_str(), chain.size());
+        }
     }
     return Void();
 }
@@ -20,6 +20,7 @@
 #include PATH(android/hardware/audio/effect/FILE_VERSION/IEffect.h)
 
 #include "AudioBufferManager.h"
+#include "EffectChain.h"
 
 #include <atomic>
 #include <memory>
@@ -201,6 +202,12 @@ struct Effect : public IEffect {
     EventFlag* mEfGroup;
     std::atomic<bool> mStopProcessThread;
     sp<Thread> mProcessThread;
+    // Created on the first 'echn' command and kept for the lifetime of the effect, so the
+    // processing thread can use the raw pointer.
+    sp<EffectChain> mChain;
+    std::atomic<EffectChain*> mChainPtr;
+    // Shared by the processing thread and the chain this effect may be attached to
+    EffectProcessGate mProcessGate;
 
     virtual ~Effect();
 
@@ -218,6 +225,8 @@ struct Effect : public IEffect {
                                const void** valueData, std::vector<uint8_t>* halParamBuffer);
 
     Result analyzeCommandStatus(const char* commandName, const char* context, status_t status);
+    // Attach the effects with the given ids to this one, see EffectChain
+    status_t setChain(size_t count, const uint64_t* effectIds);
     void getConfigImpl(int commandCode, const char* commandName, GetConfigCallback cb);
     Result getCurrentConfigImpl(uint32_t featureId, uint32_t configSize,
                                 GetCurrentConfigSuccessCallback onSuccess);
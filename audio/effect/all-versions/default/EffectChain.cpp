@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EffectHAL"
+
+#include "EffectChain.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <android-base/stringprintf.h>
+#include <android/log.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+// Guards the registered effects and the chain membership of attached effects. Taken
+// before the lock of a chain, which is taken before the gate of an effect.
+std::mutex sRegistryLock;
+std::unordered_map<effect_handle_t, EffectProcessGate*> sGateOfEffect;
+std::unordered_map<effect_handle_t, EffectChain*> sChainOfEffect;
+
+}  // namespace
+
+EffectChain::EffectChain(effect_handle_t head) : mHead(head) {}
+
+EffectChain::~EffectChain() {
+    std::lock_guard<std::mutex> registryLock(sRegistryLock);
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto& stage : mStages) {
+        setAttached(stage.gate, false);
+        sChainOfEffect.erase(stage.handle);
+    }
+}
+
+status_t EffectChain::setStages(const std::vector<effect_handle_t>& handles) {
+    if (handles.size() > kMaxStages) {
+        ALOGE("%s: %zu effects exceed the maximum of %zu", __func__, handles.size(), kMaxStages);
+        return BAD_VALUE;
+    }
+    for (size_t i = 0; i < handles.size(); ++i) {
+        if (handles[i] == nullptr || handles[i] == mHead ||
+            std::find(handles.begin(), handles.begin() + i, handles[i]) != handles.begin() + i) {
+            ALOGE("%s: invalid effect %p at position %zu", __func__, handles[i], i);
+            return BAD_VALUE;
+        }
+    }
+
+    std::lock_guard<std::mutex> registryLock(sRegistryLock);
+    std::vector<EffectProcessGate*> gates;
+    for (effect_handle_t handle : handles) {
+        auto gate = sGateOfEffect.find(handle);
+        if (gate == sGateOfEffect.end()) {
+            ALOGE("%s: effect %p is not registered", __func__, handle);
+            return BAD_VALUE;
+        }
+        gates.push_back(gate->second);
+    }
+    for (effect_handle_t handle : handles) {
+        auto it = sChainOfEffect.find(handle);
+        if (it != sChainOfEffect.end() && it->second != this) {
+            std::lock_guard<std::mutex> otherLock(it->second->mLock);
+            it->second->removeStageLocked(handle);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto& stage : mStages) {
+        setAttached(stage.gate, false);
+        sChainOfEffect.erase(stage.handle);
+    }
+    mStages.clear();
+    for (size_t i = 0; i < handles.size(); ++i) {
+        Stage stage;
+        stage.handle = handles[i];
+        stage.gate = gates[i];
+        // Waits for a process call of the effect in progress on its own thread
+        setAttached(stage.gate, true);
+        mStages.push_back(stage);
+        sChainOfEffect[handles[i]] = this;
+    }
+    mNumStages.store(mStages.size(), std::memory_order_relaxed);
+    return OK;
+}
+
+// static
+void EffectChain::addEffect(effect_handle_t handle, EffectProcessGate* gate) {
+    std::lock_guard<std::mutex> registryLock(sRegistryLock);
+    sGateOfEffect[handle] = gate;
+}
+
+// static
+void EffectChain::removeEffect(effect_handle_t handle) {
+    std::lock_guard<std::mutex> registryLock(sRegistryLock);
+    sGateOfEffect.erase(handle);
+    auto it = sChainOfEffect.find(handle);
+    if (it == sChainOfEffect.end()) {
+        return;
+    }
+    {
+        // Waits for a chain pass in progress, so the handle is not used after this returns
+        std::lock_guard<std::mutex> lock(it->second->mLock);
+        it->second->removeStageLocked(handle);
+    }
+    sChainOfEffect.erase(it);
+}
+
+// static
+void EffectChain::setAttached(EffectProcessGate* gate, bool attached) {
+    std::lock_guard<std::mutex> lock(gate->mLock);
+    gate->mAttached = attached;
+}
+
+void EffectChain::removeStageLocked(effect_handle_t handle) {
+    auto it = std::find_if(mStages.begin(), mStages.end(),
+                           [handle](const Stage& stage) { return stage.handle == handle; });
+    if (it == mStages.end()) {
+        return;
+    }
+    setAttached(it->gate, false);
+    mStages.erase(it);
+    mNumStages.store(mStages.size(), std::memory_order_relaxed);
+}
+
+bool EffectChain::processStages(audio_buffer_t* outBuffer) {
+    std::unique_lock<std::mutex> lock(mLock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        mSkipped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    for (auto& stage : mStages) {
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        {
+            // Only contended by reverse processing of the effect on its own thread
+            std::lock_guard<std::mutex> gateLock(stage.gate->mLock);
+            // -ENODATA only means the effect has nothing more to add; the data in place is
+            // still valid for the next stage.
+            stage.lastStatus = (*stage.handle)->process(stage.handle, outBuffer, outBuffer);
+        }
+        const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        ++stage.count;
+        stage.totalNs += elapsed;
+        stage.maxNs = std::max(stage.maxNs, elapsed);
+    }
+    return true;
+}
+
+std::string EffectChain::dump() {
+    std::lock_guard<std::mutex> lock(mLock);
+    std::string s = base::StringPrintf("Effect chain: %zu attached effects, %" PRIu64
+                                       " buffers skipped during reconfiguration\n",
+                                       mStages.size(), mSkipped.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < mStages.size(); ++i) {
+        const Stage& stage = mStages[i];
+        s.append(base::StringPrintf(
+                "  #%zu %p: %" PRIu64 " buffers, mean %.1f us, max %.1f us, last status %d\n", i,
+                stage.handle, stage.count,
+                stage.count > 0 ? stage.totalNs / 1000.0 / stage.count : 0.0,
+                stage.maxNs / 1000.0, stage.lastStatus));
+    }
+    return s;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
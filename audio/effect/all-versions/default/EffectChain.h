@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+#define ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+
+#include <errno.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hardware/audio_effect.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+/**
+ * Serializes the process calls made on one effect by its own processing thread and by the
+ * chain it is attached to, so that they never run concurrently on its handle. While the
+ * effect is attached, the chain head processes it and process requests made to the effect
+ * itself are refused with -EBUSY; reverse processing keeps working.
+ */
+class EffectProcessGate {
+  public:
+    template <typename Fn>
+    int32_t process(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mAttached ? -EBUSY : fn();
+    }
+
+    template <typename Fn>
+    int32_t processReverse(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mLock);
+        return fn();
+    }
+
+  private:
+    friend class EffectChain;
+
+    std::mutex mLock;  // held for the duration of a process call
+    bool mAttached = false;
+};
+
+/**
+ * Ordered list of effects run on the processing thread of the chain head.
+ *
+ * A client that stacks several effects on one session can attach the following effects
+ * to the first one with the 'echn' command. A process request on the head then runs the
+ * head from its input to its output buffer, and every attached effect in place on the
+ * output buffer, so the whole chain costs one wake-up instead of one per effect. The
+ * attached effects must be configured for in-place processing. Their own processing
+ * threads refuse process requests while they are attached, see EffectProcessGate.
+ */
+class EffectChain : public RefBase {
+  public:
+    // Maximum number of effects attached to one head
+    static constexpr size_t kMaxStages = 16;
+
+    explicit EffectChain(effect_handle_t head);
+    ~EffectChain();
+
+    // Replace the attached effects. An effect attached to another chain is moved to this
+    // one. Returns BAD_VALUE if the list contains the head, an effect twice or an effect
+    // that was not added.
+    status_t setStages(const std::vector<effect_handle_t>& handles);
+
+    // Make an effect available for attachment. The gate must outlive the registration.
+    static void addEffect(effect_handle_t handle, EffectProcessGate* gate);
+
+    // Detach an effect from whichever chain it belongs to and unregister it, before its
+    // handle is released
+    static void removeEffect(effect_handle_t handle);
+
+    // Handles a process request on the processing thread of a head: processHead runs
+    // under the gate of the head, then the effects attached to chain, which may be null,
+    // run in place on outBuffer whatever the head returned. -ENODATA only means that the
+    // head has nothing more to add, its output is still valid input for the chain.
+    // Returns the status of the head, or -EBUSY if the head is itself attached.
+    template <typename ProcessHead>
+    static int32_t process(EffectProcessGate* headGate, EffectChain* chain,
+                           audio_buffer_t* outBuffer, ProcessHead&& processHead) {
+        const int32_t status = headGate->process(std::forward<ProcessHead>(processHead));
+        if (status != -EBUSY && chain != nullptr && !chain->isEmpty()) {
+            chain->processStages(outBuffer);
+        }
+        return status;
+    }
+
+    // Called on the processing thread after the head processed inBuffer into outBuffer.
+    // Returns false if the chain is being reconfigured; the attached effects are then
+    // skipped for this buffer instead of blocking the thread.
+    bool processStages(audio_buffer_t* outBuffer);
+
+    bool isEmpty() const { return mNumStages.load(std::memory_order_relaxed) == 0; }
+
+    std::string dump();
+
+  private:
+    struct Stage {
+        effect_handle_t handle;
+        EffectProcessGate* gate;
+        int32_t lastStatus = 0;
+        uint64_t count = 0;
+        nsecs_t totalNs = 0;
+        nsecs_t maxNs = 0;
+    };
+
+    static void setAttached(EffectProcessGate* gate, bool attached);
+    void removeStageLocked(effect_handle_t handle);
+
+    const effect_handle_t mHead;
+    std::mutex mLock;  // guards mStages; only try-locked on the processing thread
+    std::vector<Stage> mStages;
+    std::atomic<size_t> mNumStages{0};
+    std::atomic<uint64_t> mSkipped{0};
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "EffectChain.h"
+
+namespace {
+
+using ::android::BAD_VALUE;
+using ::android::OK;
+using ::android::sp;
+using namespace ::android::hardware::audio::effect::CPP_VERSION::implementation;
+
+constexpr size_t kFrameCount = 32;
+
+// An effect that adds a constant to every sample and returns a configurable status. The
+// interface pointer comes first, so the address of the object is its effect handle.
+class FakeEffect {
+  public:
+    FakeEffect(int16_t increment, int32_t status = 0)
+        : mInterface(&kInterface), mIncrement(increment), mStatus(status) {
+        EffectChain::addEffect(handle(), &mGate);
+    }
+    ~FakeEffect() { EffectChain::removeEffect(handle()); }
+
+    effect_handle_t handle() { return reinterpret_cast<effect_handle_t>(&mInterface); }
+    EffectProcessGate* gate() { return &mGate; }
+    int processCount() const { return mProcessCount; }
+    int reverseCount() const { return mReverseCount; }
+    bool overlapped() const { return mOverlapped; }
+
+    // Process request on the own processing thread of the effect
+    int32_t processAlone(audio_buffer_t* in, audio_buffer_t* out) {
+        return EffectChain::process(&mGate, nullptr, out,
+                                    [&] { return (*handle())->process(handle(), in, out); });
+    }
+
+    int32_t processReverse(audio_buffer_t* in, audio_buffer_t* out) {
+        return mGate.processReverse(
+                [&] { return (*handle())->process_reverse(handle(), in, out); });
+    }
+
+  private:
+    static FakeEffect* fromHandle(effect_handle_t handle) {
+        return reinterpret_cast<FakeEffect*>(handle);
+    }
+
+    static int32_t processImpl(effect_handle_t handle, audio_buffer_t* in, audio_buffer_t* out) {
+        FakeEffect* effect = fromHandle(handle);
+        effect->enter();
+        for (size_t i = 0; i < out->frameCount; ++i) {
+            out->s16[i] = in->s16[i] + effect->mIncrement;
+        }
+        ++effect->mProcessCount;
+        effect->leave();
+        return effect->mStatus;
+    }
+
+    static int32_t processReverseImpl(effect_handle_t handle, audio_buffer_t*,
+                                      audio_buffer_t*) {
+        FakeEffect* effect = fromHandle(handle);
+        effect->enter();
+        ++effect->mReverseCount;
+        effect->leave();
+        return 0;
+    }
+
+    // Records whether two process calls ever ran at the same time
+    void enter() {
+        if (mBusy.exchange(true)) {
+            mOverlapped = true;
+        }
+        std::this_thread::yield();
+    }
+    void leave() { mBusy = false; }
+
+    static constexpr effect_interface_s kInterface = {
+            .process = processImpl,
+            .command = nullptr,
+            .get_descriptor = nullptr,
+            .process_reverse = processReverseImpl,
+    };
+
+    const effect_interface_s* mInterface;  // must be the first member
+    const int16_t mIncrement;
+    const int32_t mStatus;
+    EffectProcessGate mGate;
+    std::atomic<int> mProcessCount{0};
+    std::atomic<int> mReverseCount{0};
+    std::atomic<bool> mBusy{false};
+    std::atomic<bool> mOverlapped{false};
+};
+
+class Buffer {
+  public:
+    explicit Buffer(int16_t value) : mSamples(kFrameCount, value) {
+        mBuffer.frameCount = kFrameCount;
+        mBuffer.s16 = mSamples.data();
+    }
+
+    audio_buffer_t* get() { return &mBuffer; }
+    const std::vector<int16_t>& samples() const { return mSamples; }
+
+  private:
+    std::vector<int16_t> mSamples;
+    audio_buffer_t mBuffer;
+};
+
+class EffectChainTest : public ::testing::Test {
+  protected:
+    // Process request on the processing thread of the head
+    int32_t processChain(audio_buffer_t* in, audio_buffer_t* out) {
+        return EffectChain::process(mHead.gate(), mChain.get(), out, [&] {
+            return (*mHead.handle())->process(mHead.handle(), in, out);
+        });
+    }
+
+    FakeEffect mHead{1, -ENODATA};
+    FakeEffect mFirst{10};
+    FakeEffect mSecond{100, -ENODATA};
+    sp<EffectChain> mChain = new EffectChain(mHead.handle());
+};
+
+TEST_F(EffectChainTest, stagesRunAfterHeadWithoutData) {
+    ASSERT_EQ(OK, mChain->setStages({mFirst.handle(), mSecond.handle()}));
+    Buffer in(0);
+    Buffer out(0);
+    // The head and the last stage have nothing more to add, the stages still run in order
+    EXPECT_EQ(-ENODATA, processChain(in.get(), out.get()));
+    EXPECT_EQ(std::vector<int16_t>(kFrameCount, 111), out.samples());
+    EXPECT_EQ(1, mHead.processCount());
+    EXPECT_EQ(1, mFirst.processCount());
+    EXPECT_EQ(1, mSecond.processCount());
+}
+
+TEST_F(EffectChainTest, attachedEffectRefusesOwnProcessing) {
+    ASSERT_EQ(OK, mChain->setStages({mFirst.handle()}));
+    Buffer in(0);
+    Buffer out(0);
+    EXPECT_EQ(-EBUSY, mFirst.processAlone(in.get(), out.get()));
+    EXPECT_EQ(0, mFirst.processCount());
+    // Reverse processing is not done by the chain and keeps working
+    EXPECT_EQ(0, mFirst.processReverse(in.get(), out.get()));
+    EXPECT_EQ(1, mFirst.reverseCount());
+
+    ASSERT_EQ(OK, mChain->setStages({}));
+    EXPECT_EQ(0, mFirst.processAlone(in.get(), out.get()));
+    EXPECT_EQ(std::vector<int16_t>(kFrameCount, 10), out.samples());
+}
+
+TEST_F(EffectChainTest, removedEffectProcessesAlone) {
+    ASSERT_EQ(OK, mChain->setStages({mFirst.handle(), mSecond.handle()}));
+    EffectChain::removeEffect(mFirst.handle());
+    Buffer in(0);
+    Buffer out(0);
+    EXPECT_EQ(0, mFirst.processAlone(in.get(), out.get()));
+    EXPECT_EQ(-ENODATA, processChain(in.get(), out.get()));
+    EXPECT_EQ(std::vector<int16_t>(kFrameCount, 101), out.samples());
+    EXPECT_EQ(1, mFirst.processCount());
+    // An unregistered effect can't be attached again
+    EXPECT_EQ(BAD_VALUE, mChain->setStages({mFirst.handle()}));
+}
+
+TEST_F(EffectChainTest, effectMovesBetweenChains) {
+    FakeEffect otherHead(0);
+    sp<EffectChain> otherChain = new EffectChain(otherHead.handle());
+    ASSERT_EQ(OK, mChain->setStages({mFirst.handle()}));
+    ASSERT_EQ(OK, otherChain->setStages({mFirst.handle()}));
+    EXPECT_TRUE(mChain->isEmpty());
+    EXPECT_EQ(-EBUSY, mFirst.processAlone(Buffer(0).get(), Buffer(0).get()));
+
+    // Destroying the chain detaches its effects
+    otherChain.clear();
+    EXPECT_EQ(0, mFirst.processAlone(Buffer(0).get(), Buffer(0).get()));
+}
+
+TEST_F(EffectChainTest, rejectsInvalidStages) {
+    EXPECT_EQ(BAD_VALUE, mChain->setStages({mHead.handle()}));
+    EXPECT_EQ(BAD_VALUE, mChain->setStages({mFirst.handle(), mFirst.handle()}));
+    EXPECT_EQ(BAD_VALUE, mChain->setStages({nullptr}));
+    EXPECT_TRUE(mChain->isEmpty());
+}
+
+TEST_F(EffectChainTest, effectNeverRunsConcurrently) {
+    // The effect is attached and detached while its own thread keeps processing and the
+    // head keeps running the chain: its process functions must never overlap.
+    std::atomic<bool> stop{false};
+    std::thread head([&] {
+        Buffer in(0);
+        Buffer out(0);
+        while (!stop) processChain(in.get(), out.get());
+    });
+    std::thread own([&] {
+        Buffer in(0);
+        Buffer out(0);
+        for (int i = 0; !stop; ++i) {
+            if (i % 2) {
+                mFirst.processAlone(in.get(), out.get());
+            } else {
+                mFirst.processReverse(in.get(), out.get());
+            }
+        }
+    });
+    // Until both threads got to process the effect a number of times
+    for (int i = 0; i < 1000 || mFirst.processCount() < 100 || mFirst.reverseCount() < 100;
+         ++i) {
+        EXPECT_EQ(OK, mChain->setStages({mFirst.handle()}));
+        std::this_thread::yield();
+        EXPECT_EQ(OK, mChain->setStages({}));
+        std::this_thread::yield();
+    }
+    stop = true;
+    head.join();
+    own.join();
+    EXPECT_FALSE(mFirst.overlapped());
+}
+
+}  // namespace
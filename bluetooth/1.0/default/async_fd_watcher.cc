@@ -27,13 +27,16 @@
 #include <thread>
 #include <vector>
 #include "fcntl.h"
-#include "sys/select.h"
+#include "sys/epoll.h"
 #include "unistd.h"
 
 static const int INVALID_FD = -1;
 
 static const int BT_RT_PRIORITY = 1;
 
+// Events handled per wake-up; more ready fds are reported by the next wait
+static const int MAX_EVENTS = 8;
+
 namespace android {
 namespace hardware {
 namespace bluetooth {
@@ -48,7 +51,9 @@ int AsyncFdWatcher::WatchFdForNonBlockingReads(
   }
 
   // Start the thread if not started yet
-  return tryStartThread();
+  if (tryStartThread()) return -1;
+
+  return addToEpoll(file_descriptor);
 }
 
 int AsyncFdWatcher::ConfigureTimeout(
@@ -81,6 +86,10 @@ int AsyncFdWatcher::tryStartThread() {
   notification_listen_fd_ = pipe_fds[0];
   notification_write_fd_ = pipe_fds[1];
 
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == INVALID_FD) return -1;
+  if (addToEpoll(notification_listen_fd_)) return -1;
+
   thread_ = std::thread([this]() { ThreadRoutine(); });
   if (!thread_.joinable()) return -1;
 
@@ -107,10 +116,25 @@ int AsyncFdWatcher::stopThread() {
 
   close(notification_listen_fd_);
   close(notification_write_fd_);
+  close(epoll_fd_);
+  epoll_fd_ = INVALID_FD;
 
   return 0;
 }
 
+int AsyncFdWatcher::addToEpoll(int file_descriptor) {
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = file_descriptor;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, file_descriptor, &event) &&
+      errno != EEXIST) {
+    ALOGE("%s unable to watch fd %d: %s", __func__, file_descriptor,
+          strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
 int AsyncFdWatcher::notifyThread() {
   uint8_t buffer[] = {0};
   if (TEMP_FAILURE_RETRY(write(notification_write_fd_, &buffer, 1)) < 0) {
@@ -129,26 +153,14 @@ void AsyncFdWatcher::ThreadRoutine() {
   }
 
   while (running_) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(notification_listen_fd_, &read_fds);
-    int max_read_fd = INVALID_FD;
-    for (auto& it : watched_fds_) {
-      FD_SET(it.first, &read_fds);
-      max_read_fd = std::max(max_read_fd, it.first);
-    }
-
-    struct timeval timeout;
-    struct timeval* timeout_ptr = NULL;
+    int timeout = -1;
     if (timeout_ms_ > std::chrono::milliseconds(0)) {
-      timeout.tv_sec = timeout_ms_.count() / 1000;
-      timeout.tv_usec = (timeout_ms_.count() % 1000) * 1000;
-      timeout_ptr = &timeout;
+      timeout = static_cast<int>(timeout_ms_.count());
     }
 
     // Wait until there is data available to read on some FD.
-    int nfds = std::max(notification_listen_fd_, max_read_fd);
-    int retval = select(nfds + 1, &read_fds, NULL, NULL, timeout_ptr);
+    struct epoll_event events[MAX_EVENTS];
+    int retval = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
 
     // There was some error.
     if (retval < 0) continue;
@@ -166,19 +178,27 @@ void AsyncFdWatcher::ThreadRoutine() {
     }
 
     // Read data from the notification FD.
-    if (FD_ISSET(notification_listen_fd_, &read_fds)) {
-      char buffer[] = {0};
-      TEMP_FAILURE_RETRY(read(notification_listen_fd_, buffer, 1));
-      continue;
+    bool notified = false;
+    for (int i = 0; i < retval; i++) {
+      if (events[i].data.fd == notification_listen_fd_) {
+        char buffer[16];
+        while (TEMP_FAILURE_RETRY(read(notification_listen_fd_, buffer,
+                                       sizeof(buffer))) > 0) {
+        }
+        notified = true;
+      }
     }
+    // The timeout or the running state changed; re-evaluate them first.
+    if (notified) continue;
 
     // Invoke the data ready callbacks if appropriate.
     {
       // Hold the mutex to make sure that the callbacks are still valid.
       std::unique_lock<std::mutex> guard(internal_mutex_);
-      for (auto& it : watched_fds_) {
-        if (FD_ISSET(it.first, &read_fds)) {
-          it.second(it.first);
+      for (int i = 0; i < retval; i++) {
+        auto it = watched_fds_.find(events[i].data.fd);
+        if (it != watched_fds_.end()) {
+          it->second(it->first);
         }
       }
     }
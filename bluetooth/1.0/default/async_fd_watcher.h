@@ -46,6 +46,7 @@ class AsyncFdWatcher {
   int tryStartThread();
   int stopThread();
   int notifyThread();
+  int addToEpoll(int file_descriptor);
   void ThreadRoutine();
 
   std::atomic_bool running_{false};
@@ -56,6 +57,7 @@ class AsyncFdWatcher {
   std::map<int, ReadCallback> watched_fds_;
   int notification_listen_fd_;
   int notification_write_fd_;
+  int epoll_fd_ = -1;
   TimeoutCallback timeout_cb_;
   std::chrono::milliseconds timeout_ms_;
 };
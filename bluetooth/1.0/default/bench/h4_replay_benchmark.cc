@@ -0,0 +1,210 @@
+//
+// Copyright 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Replays inbound HCI traffic through the H4 reader. The traffic is taken from
+// the btsnoop log named by $BT_SNOOP_LOG, or generated when it is not set.
+
+#define LOG_TAG "bt_h4_replay_benchmark"
+
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <log/log.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "async_fd_watcher.h"
+#include "h4_protocol.h"
+
+using ::android::hardware::hidl_vec;
+using ::android::hardware::bluetooth::async::AsyncFdWatcher;
+using ::android::hardware::bluetooth::hci::H4Protocol;
+using ::benchmark::Counter;
+using ::benchmark::State;
+
+namespace {
+
+// H4 framed bytes of the inbound packets, and how many packets they hold
+struct Capture {
+  std::vector<uint8_t> bytes;
+  size_t packets = 0;
+};
+
+uint32_t ReadBe32(const uint8_t* p) {
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Keeps the packets received from the controller in a btsnoop log with the H4
+// datalink (1002).
+bool LoadSnoopLog(const char* path, Capture* capture) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    ALOGE("%s: Can't open %s", __func__, path);
+    return false;
+  }
+
+  uint8_t header[16];
+  bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+            memcmp(header, "btsnoop\0", 8) == 0 &&
+            ReadBe32(header + 12) == 1002;
+  uint8_t record[24];
+  std::vector<uint8_t> data;
+  while (ok && fread(record, sizeof(record), 1, file) == 1) {
+    data.resize(ReadBe32(record + 4));
+    if (fread(data.data(), data.size(), 1, file) != 1) break;
+    bool received = ReadBe32(record + 8) & 1;
+    if (!received || data.empty() || data[0] == HCI_PACKET_TYPE_COMMAND ||
+        data[0] > HCI_PACKET_TYPE_ISO_DATA) {
+      continue;
+    }
+    capture->bytes.insert(capture->bytes.end(), data.begin(), data.end());
+    capture->packets++;
+  }
+  fclose(file);
+  if (!ok) ALOGE("%s: %s is not an H4 btsnoop log", __func__, path);
+  return ok && capture->packets > 0;
+}
+
+// A2DP streaming: full ACL packets with a Number Of Completed Packets event
+// after every few of them.
+void GenerateTraffic(Capture* capture) {
+  const uint8_t event[] = {HCI_PACKET_TYPE_EVENT, 0x13, 5, 1, 0x01, 0x00, 4, 0};
+  const size_t acl_length = 1021;
+  for (int i = 0; i < 256; i++) {
+    if (i % 4 == 0) {
+      capture->bytes.insert(capture->bytes.end(), event, event + sizeof(event));
+      capture->packets++;
+    }
+    const uint8_t preamble[] = {HCI_PACKET_TYPE_ACL_DATA, 0x01, 0x20,
+                                acl_length & 0xff, acl_length >> 8};
+    capture->bytes.insert(capture->bytes.end(), preamble,
+                          preamble + sizeof(preamble));
+    capture->bytes.insert(capture->bytes.end(), acl_length,
+                          static_cast<uint8_t>(i));
+    capture->packets++;
+  }
+}
+
+const Capture& GetCapture() {
+  static const Capture* capture = [] {
+    Capture* c = new Capture;
+    const char* path = getenv("BT_SNOOP_LOG");
+    if (path == nullptr || !LoadSnoopLog(path, c)) {
+      *c = Capture();
+      GenerateTraffic(c);
+    }
+    return c;
+  }();
+  return *capture;
+}
+
+// Writes the capture into a socketpair watched by an AsyncFdWatcher, and waits
+// for the H4 reader to deliver every packet.
+void BM_H4Replay(State& state) {
+  const Capture& capture = GetCapture();
+  int sockfd[2];
+  if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sockfd) != 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+
+  std::mutex mutex;
+  std::condition_variable delivered;
+  size_t packets = 0;
+  auto count = [&](const hidl_vec<uint8_t>&) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (++packets == capture.packets) delivered.notify_one();
+  };
+  H4Protocol h4(sockfd[0], count, count, count, count);
+  AsyncFdWatcher watcher;
+  watcher.WatchFdForNonBlockingReads(sockfd[0],
+                                     [&h4](int fd) { h4.OnDataReady(fd); });
+
+  for (auto _ : state) {
+    std::thread writer([&] {
+      size_t offset = 0;
+      while (offset < capture.bytes.size()) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(sockfd[1],
+                                               capture.bytes.data() + offset,
+                                               capture.bytes.size() - offset));
+        if (ret <= 0) break;
+        offset += ret;
+      }
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      delivered.wait(lock, [&] { return packets == capture.packets; });
+      packets = 0;
+    }
+    writer.join();
+  }
+
+  watcher.StopWatchingFileDescriptors();
+  close(sockfd[0]);
+  close(sockfd[1]);
+
+  state.SetItemsProcessed(state.iterations() * capture.packets);
+  state.SetBytesProcessed(state.iterations() * capture.bytes.size());
+  state.counters["packets"] = capture.packets;
+}
+BENCHMARK(BM_H4Replay)->UseRealTime();
+
+// Splits the capture with the packetizer alone, as if every read returned
+// chunk_size bytes.
+void BM_Packetizer(State& state) {
+  const Capture& capture = GetCapture();
+  const size_t chunk_size = state.range(0);
+  HciPacketType type = HCI_PACKET_TYPE_UNKNOWN;
+  size_t packets = 0;
+  ::android::hardware::bluetooth::hci::HciPacketizer packetizer([&] {
+    packets++;
+    type = HCI_PACKET_TYPE_UNKNOWN;
+  });
+
+  for (auto _ : state) {
+    for (size_t offset = 0; offset < capture.bytes.size();) {
+      size_t end = std::min(offset + chunk_size, capture.bytes.size());
+      while (offset < end) {
+        if (type == HCI_PACKET_TYPE_UNKNOWN) {
+          type = static_cast<HciPacketType>(capture.bytes[offset++]);
+        } else {
+          offset += packetizer.OnDataReady(type, capture.bytes.data() + offset,
+                                           end - offset);
+        }
+      }
+    }
+  }
+
+  if (packets != state.iterations() * capture.packets) {
+    state.SkipWithError("packets lost");
+  }
+  state.SetItemsProcessed(packets);
+  state.SetBytesProcessed(state.iterations() * capture.bytes.size());
+}
+BENCHMARK(BM_Packetizer)->Arg(1)->Arg(64)->Arg(8192);
+
+}  // namespace
+
+BENCHMARK_MAIN();
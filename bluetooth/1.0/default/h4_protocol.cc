@@ -100,34 +100,44 @@ void H4Protocol::OnPacketReady() {
   hci_packet_type_ = HCI_PACKET_TYPE_UNKNOWN;
 }
 
+void H4Protocol::OnPacketTypeReady(uint8_t type) {
+  hci_packet_type_ = static_cast<HciPacketType>(type);
+  if (hci_packet_type_ != HCI_PACKET_TYPE_ACL_DATA &&
+      hci_packet_type_ != HCI_PACKET_TYPE_SCO_DATA &&
+      hci_packet_type_ != HCI_PACKET_TYPE_ISO_DATA &&
+      hci_packet_type_ != HCI_PACKET_TYPE_EVENT) {
+    LOG_ALWAYS_FATAL("%s: Unimplemented packet type %d", __func__,
+                     static_cast<int>(hci_packet_type_));
+  }
+}
+
 void H4Protocol::OnDataReady(int fd) {
-  if (hci_packet_type_ == HCI_PACKET_TYPE_UNKNOWN) {
-    uint8_t buffer[1] = {0};
-    ssize_t bytes_read = TEMP_FAILURE_RETRY(read(fd, buffer, 1));
-    if (bytes_read != 1) {
-      if (bytes_read == 0) {
-        // This is only expected if the UART got closed when shutting down.
-        ALOGE("%s: Unexpected EOF reading the packet type!", __func__);
-        sleep(5);  // Expect to be shut down within 5 seconds.
-        return;
-      } else if (bytes_read < 0) {
-        LOG_ALWAYS_FATAL("%s: Read packet type error: %s", __func__,
-                         strerror(errno));
-      } else {
-        LOG_ALWAYS_FATAL("%s: More bytes read than expected (%u)!", __func__,
-                         static_cast<unsigned int>(bytes_read));
-      }
-    }
-    hci_packet_type_ = static_cast<HciPacketType>(buffer[0]);
-    if (hci_packet_type_ != HCI_PACKET_TYPE_ACL_DATA &&
-        hci_packet_type_ != HCI_PACKET_TYPE_SCO_DATA &&
-        hci_packet_type_ != HCI_PACKET_TYPE_ISO_DATA &&
-        hci_packet_type_ != HCI_PACKET_TYPE_EVENT) {
-      LOG_ALWAYS_FATAL("%s: Unimplemented packet type %d", __func__,
-                       static_cast<int>(hci_packet_type_));
+  // Read whatever the UART has and split it into packets here, instead of
+  // issuing a read for every type byte, preamble and payload.
+  ssize_t bytes_read =
+      TEMP_FAILURE_RETRY(read(fd, read_buffer_, sizeof(read_buffer_)));
+  if (bytes_read == 0) {
+    // This is only expected if the UART got closed when shutting down.
+    ALOGE("%s: Unexpected EOF reading the UART!", __func__);
+    sleep(5);  // Expect to be shut down within 5 seconds.
+    return;
+  }
+  if (bytes_read < 0) {
+    if (errno == EAGAIN) return;
+    LOG_ALWAYS_FATAL("%s: Read error: %s", __func__, strerror(errno));
+  }
+
+  const uint8_t* data = read_buffer_;
+  size_t remaining = bytes_read;
+  while (remaining > 0) {
+    size_t consumed = 1;
+    if (hci_packet_type_ == HCI_PACKET_TYPE_UNKNOWN) {
+      OnPacketTypeReady(data[0]);
+    } else {
+      consumed = hci_packetizer_.OnDataReady(hci_packet_type_, data, remaining);
     }
-  } else {
-    hci_packetizer_.OnDataReady(fd, hci_packet_type_);
+    data += consumed;
+    remaining -= consumed;
   }
 }
 
@@ -46,6 +46,11 @@ class H4Protocol : public HciProtocol {
   void OnDataReady(int fd);
 
  private:
+  // Large enough for several ACL packets, so a burst is read in one call.
+  static constexpr size_t kReadBufferSize = 8192;
+
+  void OnPacketTypeReady(uint8_t type);
+
   int uart_fd_;
 
   PacketReadCallback event_cb_;
@@ -55,6 +60,7 @@ class H4Protocol : public HciProtocol {
 
   HciPacketType hci_packet_type_{HCI_PACKET_TYPE_UNKNOWN};
   hci::HciPacketizer hci_packetizer_;
+  uint8_t read_buffer_[kReadBufferSize];
 };
 
 }  // namespace hci
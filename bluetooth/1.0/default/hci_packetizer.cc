@@ -24,6 +24,8 @@
 #include <unistd.h>
 #include <utils/Log.h>
 
+#include <algorithm>
+
 namespace {
 
 const size_t preamble_size_for_type[] = {0,
@@ -114,6 +116,52 @@ void HciPacketizer::OnDataReady(int fd, HciPacketType packet_type) {
   }
 }
 
+size_t HciPacketizer::OnDataReady(HciPacketType packet_type,
+                                  const uint8_t* data, size_t length) {
+  const size_t preamble_size = preamble_size_for_type[packet_type];
+  size_t consumed = 0;
+
+  if (state_ == HCI_PREAMBLE) {
+    // Hand out a packet that is entirely in the buffer without copying it.
+    if (bytes_read_ == 0 && length >= preamble_size) {
+      size_t packet_length =
+          preamble_size + HciGetPacketLengthForType(packet_type, data);
+      if (length >= packet_length) {
+        packet_.setToExternal(const_cast<uint8_t*>(data), packet_length);
+        packet_ready_cb_();
+        packet_ = hidl_vec<uint8_t>();
+        return packet_length;
+      }
+    }
+
+    size_t bytes = std::min(length, preamble_size - bytes_read_);
+    memcpy(preamble_ + bytes_read_, data, bytes);
+    bytes_read_ += bytes;
+    consumed += bytes;
+    if (bytes_read_ < preamble_size) {
+      return consumed;
+    }
+    size_t packet_length = HciGetPacketLengthForType(packet_type, preamble_);
+    packet_.resize(preamble_size + packet_length);
+    memcpy(packet_.data(), preamble_, preamble_size);
+    bytes_remaining_ = packet_length;
+    state_ = HCI_PAYLOAD;
+    bytes_read_ = 0;
+  }
+
+  size_t bytes = std::min(length - consumed, bytes_remaining_);
+  memcpy(packet_.data() + preamble_size + bytes_read_, data + consumed, bytes);
+  bytes_remaining_ -= bytes;
+  bytes_read_ += bytes;
+  consumed += bytes;
+  if (bytes_remaining_ == 0) {
+    packet_ready_cb_();
+    state_ = HCI_PREAMBLE;
+    bytes_read_ = 0;
+  }
+  return consumed;
+}
+
 }  // namespace hci
 }  // namespace bluetooth
 }  // namespace hardware
@@ -35,6 +35,10 @@ class HciPacketizer {
   HciPacketizer(HciPacketReadyCallback packet_cb)
       : packet_ready_cb_(packet_cb){};
   void OnDataReady(int fd, HciPacketType packet_type);
+  // Consume bytes of a packet already read from the transport. Stops after the
+  // end of the packet and returns the number of bytes used.
+  size_t OnDataReady(HciPacketType packet_type, const uint8_t* data,
+                     size_t length);
   const hidl_vec<uint8_t>& GetPacket() const;
 
  protected:
@@ -122,24 +122,23 @@ class H4ProtocolTest : public ::testing::Test {
     preamble[3] = length & 0xFF;
     preamble[4] = (length >> 8) & 0xFF;
 
-    ALOGD("%s writing", __func__);
-    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
-    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
-
-    ALOGD("%s waiting", __func__);
     std::mutex mutex;
     std::condition_variable done;
     EXPECT_CALL(acl_cb_, Call(HidlVecMatches(preamble + 1, sizeof(preamble) - 1,
                                              payload)))
         .WillOnce(Notify(&mutex, &done));
+    // Hold the lock so the notification can't come before the wait.
+    std::unique_lock<std::mutex> lock(mutex);
+
+    ALOGD("%s writing", __func__);
+    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
+    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
 
+    ALOGD("%s waiting", __func__);
     // Fail if it takes longer than 100 ms.
     auto timeout_time =
         std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-      done.wait_until(lock, timeout_time);
-    }
+    done.wait_until(lock, timeout_time);
   }
 
   void WriteAndExpectInboundScoData(char* payload) {
@@ -147,45 +146,41 @@ class H4ProtocolTest : public ::testing::Test {
     char preamble[4] = {HCI_PACKET_TYPE_SCO_DATA, 20, 17, 0};
     preamble[3] = strlen(payload) & 0xFF;
 
-    ALOGD("%s writing", __func__);
-    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
-    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
-
-    ALOGD("%s waiting", __func__);
     std::mutex mutex;
     std::condition_variable done;
     EXPECT_CALL(sco_cb_, Call(HidlVecMatches(preamble + 1, sizeof(preamble) - 1,
                                              payload)))
         .WillOnce(Notify(&mutex, &done));
+    std::unique_lock<std::mutex> lock(mutex);
 
+    ALOGD("%s writing", __func__);
+    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
+    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
+
+    ALOGD("%s waiting", __func__);
     // Fail if it takes longer than 100 ms.
     auto timeout_time =
         std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-      done.wait_until(lock, timeout_time);
-    }
+    done.wait_until(lock, timeout_time);
   }
 
   void WriteAndExpectInboundEvent(char* payload) {
     // h4 type[1] + event_code[1] + size[1]
     char preamble[3] = {HCI_PACKET_TYPE_EVENT, 9, 0};
     preamble[2] = strlen(payload) & 0xFF;
-    ALOGD("%s writing", __func__);
-    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
-    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
-
-    ALOGD("%s waiting", __func__);
     std::mutex mutex;
     std::condition_variable done;
     EXPECT_CALL(event_cb_, Call(HidlVecMatches(preamble + 1,
                                                sizeof(preamble) - 1, payload)))
         .WillOnce(Notify(&mutex, &done));
+    std::unique_lock<std::mutex> lock(mutex);
 
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-      done.wait(lock);
-    }
+    ALOGD("%s writing", __func__);
+    TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
+    TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
+
+    ALOGD("%s waiting", __func__);
+    done.wait(lock);
   }
 
   void WriteAndExpectInboundIsoData(char* payload) {
@@ -195,24 +190,61 @@ class H4ProtocolTest : public ::testing::Test {
     preamble[3] = length & 0xFF;
     preamble[4] = (length >> 8) & 0x3F;
 
+    std::mutex mutex;
+    std::condition_variable done;
+    EXPECT_CALL(iso_cb_, Call(HidlVecMatches(preamble + 1, sizeof(preamble) - 1,
+                                             payload)))
+        .WillOnce(Notify(&mutex, &done));
+    std::unique_lock<std::mutex> lock(mutex);
+
     ALOGD("%s writing", __func__);
     TEMP_FAILURE_RETRY(write(fake_uart_, preamble, sizeof(preamble)));
     TEMP_FAILURE_RETRY(write(fake_uart_, payload, strlen(payload)));
 
     ALOGD("%s waiting", __func__);
+    // Fail if it takes longer than 100 ms.
+    auto timeout_time =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    done.wait_until(lock, timeout_time);
+  }
+
+  void WriteAndExpectInboundBurst(char* event_payload, char* acl_payload) {
+    // Both packets, split in the middle of the ACL preamble, in one write.
+    char event_preamble[3] = {HCI_PACKET_TYPE_EVENT, 9, 0};
+    event_preamble[2] = strlen(event_payload) & 0xFF;
+    char acl_preamble[5] = {HCI_PACKET_TYPE_ACL_DATA, 19, 92, 0, 0};
+    int acl_length = strlen(acl_payload);
+    acl_preamble[3] = acl_length & 0xFF;
+    acl_preamble[4] = (acl_length >> 8) & 0xFF;
+
+    std::vector<char> burst(event_preamble,
+                            event_preamble + sizeof(event_preamble));
+    burst.insert(burst.end(), event_payload,
+                 event_payload + strlen(event_payload));
+    burst.insert(burst.end(), acl_preamble, acl_preamble + 3);
+
     std::mutex mutex;
     std::condition_variable done;
-    EXPECT_CALL(iso_cb_, Call(HidlVecMatches(preamble + 1, sizeof(preamble) - 1,
-                                             payload)))
+    EXPECT_CALL(event_cb_,
+                Call(HidlVecMatches(event_preamble + 1,
+                                    sizeof(event_preamble) - 1, event_payload)));
+    EXPECT_CALL(acl_cb_, Call(HidlVecMatches(acl_preamble + 1,
+                                             sizeof(acl_preamble) - 1,
+                                             acl_payload)))
         .WillOnce(Notify(&mutex, &done));
+    std::unique_lock<std::mutex> lock(mutex);
 
+    ALOGD("%s writing", __func__);
+    TEMP_FAILURE_RETRY(write(fake_uart_, burst.data(), burst.size()));
+    burst.assign(acl_preamble + 3, acl_preamble + sizeof(acl_preamble));
+    burst.insert(burst.end(), acl_payload, acl_payload + acl_length);
+    TEMP_FAILURE_RETRY(write(fake_uart_, burst.data(), burst.size()));
+
+    ALOGD("%s waiting", __func__);
     // Fail if it takes longer than 100 ms.
     auto timeout_time =
         std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-      done.wait_until(lock, timeout_time);
-    }
+    done.wait_until(lock, timeout_time);
   }
 
   testing::MockFunction<void(const hidl_vec<uint8_t>&)> event_cb_;
@@ -240,6 +272,12 @@ TEST_F(H4ProtocolTest, TestReads) {
   WriteAndExpectInboundIsoData(iso_data);
 }
 
+// Several packets may arrive in a single read from the UART
+TEST_F(H4ProtocolTest, TestReadsBurst) {
+  WriteAndExpectInboundBurst(event_data, acl_data);
+  WriteAndExpectInboundBurst(event_data, acl_data);
+}
+
 }  // namespace implementation
 }  // namespace V1_0
 }  // namespace bluetooth
@@ -19,7 +19,10 @@
 #include "BluetoothAudioProviderFactory.h"
 
 #include <BluetoothAudioCodecs.h>
+#include <BluetoothAudioSessionReport.h>
 #include <android-base/logging.h>
+#include <inttypes.h>
+#include <stdio.h>
 
 #include "A2dpOffloadAudioProvider.h"
 #include "A2dpSoftwareAudioProvider.h"
@@ -135,6 +138,28 @@ ndk::ScopedAStatus BluetoothAudioProviderFactory::getProviderCapabilities(
   return ndk::ScopedAStatus::ok();
 }
 
+binder_status_t BluetoothAudioProviderFactory::dump(int fd, const char** /*args*/,
+                                                    uint32_t /*numArgs*/) {
+  // the sessions with a software data path through the FMQ
+  static constexpr SessionType kSoftwareSessionTypes[] = {
+      SessionType::A2DP_SOFTWARE_ENCODING_DATAPATH,
+      SessionType::A2DP_SOFTWARE_DECODING_DATAPATH,
+      SessionType::HEARING_AID_SOFTWARE_ENCODING_DATAPATH,
+      SessionType::LE_AUDIO_SOFTWARE_ENCODING_DATAPATH,
+      SessionType::LE_AUDIO_SOFTWARE_DECODING_DATAPATH,
+      SessionType::LE_AUDIO_BROADCAST_SOFTWARE_ENCODING_DATAPATH,
+  };
+  dprintf(fd, "Software data path since the session started:\n");
+  for (const SessionType session_type : kSoftwareSessionTypes) {
+    const DataPathCounters counters =
+        BluetoothAudioSessionReport::GetDataPathCounters(session_type);
+    dprintf(fd, "  %s: underruns %" PRIu64 ", overruns %" PRIu64 "\n",
+            toString(session_type).c_str(), counters.underruns,
+            counters.overruns);
+  }
+  return STATUS_OK;
+}
+
 }  // namespace audio
 }  // namespace bluetooth
 }  // namespace hardware
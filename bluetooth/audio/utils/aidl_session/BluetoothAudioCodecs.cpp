@@ -32,6 +32,8 @@
 #include <aidl/android/hardware/bluetooth/audio/SbcChannelMode.h>
 #include <android-base/logging.h>
 
+#include <mutex>
+
 #include "BluetoothLeAudioCodecsProvider.h"
 
 namespace aidl {
@@ -98,12 +100,159 @@ const std::vector<CodecCapabilities> kDefaultOffloadA2dpCodecCapabilities = {
 
 std::vector<LeAudioCodecCapabilitiesSetting> kDefaultOffloadLeAudioCapabilities;
 
-template <class T>
-bool BluetoothAudioCodecs::ContainedInVector(
-    const std::vector<T>& vector, const typename identity<T>::type& target) {
-  return std::find(vector.begin(), vector.end(), target) != vector.end();
+/***
+ * The capabilities above are indexed once into bit masks, so that validating a
+ * configuration is a mask test per parameter instead of a vector scan. Every
+ * value a capability may list has its own bit; values without one are never
+ * supported.
+ ***/
+namespace {
+
+uint64_t SampleRateBit(int32_t sample_rate_hz) {
+  switch (sample_rate_hz) {
+    case 8000: return 1ULL << 0;
+    case 11025: return 1ULL << 1;
+    case 12000: return 1ULL << 2;
+    case 16000: return 1ULL << 3;
+    case 22050: return 1ULL << 4;
+    case 24000: return 1ULL << 5;
+    case 32000: return 1ULL << 6;
+    case 44100: return 1ULL << 7;
+    case 48000: return 1ULL << 8;
+    case 88200: return 1ULL << 9;
+    case 96000: return 1ULL << 10;
+    case 176400: return 1ULL << 11;
+    case 192000: return 1ULL << 12;
+    default: return 0;
+  }
+}
+
+uint64_t BitsPerSampleBit(int32_t bits_per_sample) {
+  switch (bits_per_sample) {
+    case 8: return 1ULL << 0;
+    case 16: return 1ULL << 1;
+    case 24: return 1ULL << 2;
+    case 32: return 1ULL << 3;
+    default: return 0;
+  }
+}
+
+uint64_t FrameDurationBit(int32_t frame_duration_us) {
+  switch (frame_duration_us) {
+    case 2500: return 1ULL << 0;
+    case 5000: return 1ULL << 1;
+    case 7500: return 1ULL << 2;
+    case 10000: return 1ULL << 3;
+    case 20000: return 1ULL << 4;
+    case 40000: return 1ULL << 5;
+    case 60000: return 1ULL << 6;
+    default: return 0;
+  }
+}
+
+// SBC block lengths and numbers of subbands are multiples of 4 up to 16
+uint64_t SbcSizeBit(int32_t size) {
+  return (size > 0 && size <= 16 && size % 4 == 0) ? 1ULL << (size / 4) : 0;
+}
+
+// The AIDL enums used in capabilities are byte-backed and small
+template <class E>
+uint64_t EnumBit(E value) {
+  auto raw = static_cast<int32_t>(value);
+  return (raw >= 0 && raw < 64) ? 1ULL << raw : 0;
+}
+
+template <class T, class BitFn>
+uint64_t MaskOf(const std::vector<T>& values, BitFn bit) {
+  uint64_t mask = 0;
+  for (const auto& value : values) {
+    uint64_t value_bit = bit(value);
+    if (value_bit == 0) {
+      LOG(ERROR) << __func__ << ": capability value "
+                 << static_cast<int32_t>(value) << " has no bit and is ignored";
+    }
+    mask |= value_bit;
+  }
+  return mask;
+}
+
+bool InMask(uint64_t mask, uint64_t bit) { return (mask & bit) != 0; }
+
+struct CodecCapabilityMasks {
+  uint64_t sample_rates = 0;
+  uint64_t bits_per_sample = 0;
+  uint64_t channel_modes = 0;
+  uint64_t frame_durations = 0;
+  // codec specific parameters
+  uint64_t block_lengths = 0;
+  uint64_t subbands = 0;
+  uint64_t alloc_methods = 0;
+  uint64_t object_types = 0;
+  uint64_t quality_indices = 0;
+};
+
+struct CapabilityIndex {
+  CodecCapabilityMasks pcm;
+  CodecCapabilityMasks sbc;
+  CodecCapabilityMasks aac;
+  CodecCapabilityMasks ldac;
+  CodecCapabilityMasks aptx;
+  CodecCapabilityMasks aptx_hd;
+  CodecCapabilityMasks opus;
+};
+
+// Sample rates, bit depths and channel modes, as listed by PCM and aptX
+template <class C>
+CodecCapabilityMasks IndexBasicCapability(const C& capability) {
+  CodecCapabilityMasks masks;
+  masks.sample_rates = MaskOf(capability.sampleRateHz, SampleRateBit);
+  masks.bits_per_sample = MaskOf(capability.bitsPerSample, BitsPerSampleBit);
+  masks.channel_modes = MaskOf(capability.channelMode, EnumBit<ChannelMode>);
+  return masks;
+}
+
+CapabilityIndex BuildCapabilityIndex() {
+  CapabilityIndex index;
+  index.pcm = IndexBasicCapability(kDefaultSoftwarePcmCapabilities);
+
+  const auto& sbc = kDefaultOffloadSbcCapability;
+  index.sbc.sample_rates = MaskOf(sbc.sampleRateHz, SampleRateBit);
+  index.sbc.bits_per_sample = MaskOf(sbc.bitsPerSample, BitsPerSampleBit);
+  index.sbc.channel_modes = MaskOf(sbc.channelMode, EnumBit<SbcChannelMode>);
+  index.sbc.block_lengths = MaskOf(sbc.blockLength, SbcSizeBit);
+  index.sbc.subbands = MaskOf(sbc.numSubbands, SbcSizeBit);
+  index.sbc.alloc_methods = MaskOf(sbc.allocMethod, EnumBit<SbcAllocMethod>);
+
+  const auto& aac = kDefaultOffloadAacCapability;
+  index.aac.sample_rates = MaskOf(aac.sampleRateHz, SampleRateBit);
+  index.aac.bits_per_sample = MaskOf(aac.bitsPerSample, BitsPerSampleBit);
+  index.aac.channel_modes = MaskOf(aac.channelMode, EnumBit<ChannelMode>);
+  index.aac.object_types = MaskOf(aac.objectType, EnumBit<AacObjectType>);
+
+  const auto& ldac = kDefaultOffloadLdacCapability;
+  index.ldac.sample_rates = MaskOf(ldac.sampleRateHz, SampleRateBit);
+  index.ldac.bits_per_sample = MaskOf(ldac.bitsPerSample, BitsPerSampleBit);
+  index.ldac.channel_modes = MaskOf(ldac.channelMode, EnumBit<LdacChannelMode>);
+  index.ldac.quality_indices =
+      MaskOf(ldac.qualityIndex, EnumBit<LdacQualityIndex>);
+
+  index.aptx = IndexBasicCapability(kDefaultOffloadAptxCapability);
+  index.aptx_hd = IndexBasicCapability(kDefaultOffloadAptxHdCapability);
+
+  const auto& opus = kDefaultOffloadOpusCapability;
+  index.opus.sample_rates = MaskOf(opus.samplingFrequencyHz, SampleRateBit);
+  index.opus.frame_durations = MaskOf(opus.frameDurationUs, FrameDurationBit);
+  index.opus.channel_modes = MaskOf(opus.channelMode, EnumBit<ChannelMode>);
+  return index;
 }
 
+const CapabilityIndex& GetCapabilityIndex() {
+  static const CapabilityIndex index = BuildCapabilityIndex();
+  return index;
+}
+
+}  // namespace
+
 bool BluetoothAudioCodecs::IsOffloadSbcConfigurationValid(
     const CodecConfiguration::CodecSpecific& codec_specific) {
   if (codec_specific.getTag() != CodecConfiguration::CodecSpecific::sbcConfig) {
@@ -114,18 +263,13 @@ bool BluetoothAudioCodecs::IsOffloadSbcConfigurationValid(
   const SbcConfiguration sbc_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::sbcConfig>();
 
-  if (ContainedInVector(kDefaultOffloadSbcCapability.sampleRateHz,
-                        sbc_data.sampleRateHz) &&
-      ContainedInVector(kDefaultOffloadSbcCapability.blockLength,
-                        sbc_data.blockLength) &&
-      ContainedInVector(kDefaultOffloadSbcCapability.numSubbands,
-                        sbc_data.numSubbands) &&
-      ContainedInVector(kDefaultOffloadSbcCapability.bitsPerSample,
-                        sbc_data.bitsPerSample) &&
-      ContainedInVector(kDefaultOffloadSbcCapability.channelMode,
-                        sbc_data.channelMode) &&
-      ContainedInVector(kDefaultOffloadSbcCapability.allocMethod,
-                        sbc_data.allocMethod) &&
+  const CodecCapabilityMasks& sbc = GetCapabilityIndex().sbc;
+  if (InMask(sbc.sample_rates, SampleRateBit(sbc_data.sampleRateHz)) &&
+      InMask(sbc.block_lengths, SbcSizeBit(sbc_data.blockLength)) &&
+      InMask(sbc.subbands, SbcSizeBit(sbc_data.numSubbands)) &&
+      InMask(sbc.bits_per_sample, BitsPerSampleBit(sbc_data.bitsPerSample)) &&
+      InMask(sbc.channel_modes, EnumBit(sbc_data.channelMode)) &&
+      InMask(sbc.alloc_methods, EnumBit(sbc_data.allocMethod)) &&
       sbc_data.minBitpool <= sbc_data.maxBitpool &&
       kDefaultOffloadSbcCapability.minBitpool <= sbc_data.minBitpool &&
       kDefaultOffloadSbcCapability.maxBitpool >= sbc_data.maxBitpool) {
@@ -146,14 +290,11 @@ bool BluetoothAudioCodecs::IsOffloadAacConfigurationValid(
   const AacConfiguration aac_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::aacConfig>();
 
-  if (ContainedInVector(kDefaultOffloadAacCapability.sampleRateHz,
-                        aac_data.sampleRateHz) &&
-      ContainedInVector(kDefaultOffloadAacCapability.bitsPerSample,
-                        aac_data.bitsPerSample) &&
-      ContainedInVector(kDefaultOffloadAacCapability.channelMode,
-                        aac_data.channelMode) &&
-      ContainedInVector(kDefaultOffloadAacCapability.objectType,
-                        aac_data.objectType) &&
+  const CodecCapabilityMasks& aac = GetCapabilityIndex().aac;
+  if (InMask(aac.sample_rates, SampleRateBit(aac_data.sampleRateHz)) &&
+      InMask(aac.bits_per_sample, BitsPerSampleBit(aac_data.bitsPerSample)) &&
+      InMask(aac.channel_modes, EnumBit(aac_data.channelMode)) &&
+      InMask(aac.object_types, EnumBit(aac_data.objectType)) &&
       (!aac_data.variableBitRateEnabled ||
        kDefaultOffloadAacCapability.variableBitRateSupported)) {
     return true;
@@ -174,14 +315,11 @@ bool BluetoothAudioCodecs::IsOffloadLdacConfigurationValid(
   const LdacConfiguration ldac_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::ldacConfig>();
 
-  if (ContainedInVector(kDefaultOffloadLdacCapability.sampleRateHz,
-                        ldac_data.sampleRateHz) &&
-      ContainedInVector(kDefaultOffloadLdacCapability.bitsPerSample,
-                        ldac_data.bitsPerSample) &&
-      ContainedInVector(kDefaultOffloadLdacCapability.channelMode,
-                        ldac_data.channelMode) &&
-      ContainedInVector(kDefaultOffloadLdacCapability.qualityIndex,
-                        ldac_data.qualityIndex)) {
+  const CodecCapabilityMasks& ldac = GetCapabilityIndex().ldac;
+  if (InMask(ldac.sample_rates, SampleRateBit(ldac_data.sampleRateHz)) &&
+      InMask(ldac.bits_per_sample, BitsPerSampleBit(ldac_data.bitsPerSample)) &&
+      InMask(ldac.channel_modes, EnumBit(ldac_data.channelMode)) &&
+      InMask(ldac.quality_indices, EnumBit(ldac_data.qualityIndex))) {
     return true;
   }
   LOG(WARNING) << __func__
@@ -200,12 +338,10 @@ bool BluetoothAudioCodecs::IsOffloadAptxConfigurationValid(
   const AptxConfiguration aptx_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::aptxConfig>();
 
-  if (ContainedInVector(kDefaultOffloadAptxCapability.sampleRateHz,
-                        aptx_data.sampleRateHz) &&
-      ContainedInVector(kDefaultOffloadAptxCapability.bitsPerSample,
-                        aptx_data.bitsPerSample) &&
-      ContainedInVector(kDefaultOffloadAptxCapability.channelMode,
-                        aptx_data.channelMode)) {
+  const CodecCapabilityMasks& aptx = GetCapabilityIndex().aptx;
+  if (InMask(aptx.sample_rates, SampleRateBit(aptx_data.sampleRateHz)) &&
+      InMask(aptx.bits_per_sample, BitsPerSampleBit(aptx_data.bitsPerSample)) &&
+      InMask(aptx.channel_modes, EnumBit(aptx_data.channelMode))) {
     return true;
   }
   LOG(WARNING) << __func__
@@ -224,12 +360,11 @@ bool BluetoothAudioCodecs::IsOffloadAptxHdConfigurationValid(
   const AptxConfiguration aptx_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::aptxConfig>();
 
-  if (ContainedInVector(kDefaultOffloadAptxHdCapability.sampleRateHz,
-                        aptx_data.sampleRateHz) &&
-      ContainedInVector(kDefaultOffloadAptxHdCapability.bitsPerSample,
-                        aptx_data.bitsPerSample) &&
-      ContainedInVector(kDefaultOffloadAptxHdCapability.channelMode,
-                        aptx_data.channelMode)) {
+  const CodecCapabilityMasks& aptx_hd = GetCapabilityIndex().aptx_hd;
+  if (InMask(aptx_hd.sample_rates, SampleRateBit(aptx_data.sampleRateHz)) &&
+      InMask(aptx_hd.bits_per_sample,
+             BitsPerSampleBit(aptx_data.bitsPerSample)) &&
+      InMask(aptx_hd.channel_modes, EnumBit(aptx_data.channelMode))) {
     return true;
   }
   LOG(WARNING) << __func__
@@ -248,13 +383,13 @@ bool BluetoothAudioCodecs::IsOffloadOpusConfigurationValid(
   std::optional<OpusConfiguration> opus_data =
       codec_specific.get<CodecConfiguration::CodecSpecific::opusConfig>();
 
+  const CodecCapabilityMasks& opus = GetCapabilityIndex().opus;
   if (opus_data.has_value() &&
-      ContainedInVector(kDefaultOffloadOpusCapability.samplingFrequencyHz,
-                        opus_data->samplingFrequencyHz) &&
-      ContainedInVector(kDefaultOffloadOpusCapability.frameDurationUs,
-                        opus_data->frameDurationUs) &&
-      ContainedInVector(kDefaultOffloadOpusCapability.channelMode,
-                        opus_data->channelMode)) {
+      InMask(opus.sample_rates,
+             SampleRateBit(opus_data->samplingFrequencyHz)) &&
+      InMask(opus.frame_durations,
+             FrameDurationBit(opus_data->frameDurationUs)) &&
+      InMask(opus.channel_modes, EnumBit(opus_data->channelMode))) {
     return true;
   }
   LOG(WARNING) << __func__
@@ -320,12 +455,10 @@ BluetoothAudioCodecs::GetA2dpOffloadCodecCapabilities(
 
 bool BluetoothAudioCodecs::IsSoftwarePcmConfigurationValid(
     const PcmConfiguration& pcm_config) {
-  if (ContainedInVector(kDefaultSoftwarePcmCapabilities.sampleRateHz,
-                        pcm_config.sampleRateHz) &&
-      ContainedInVector(kDefaultSoftwarePcmCapabilities.bitsPerSample,
-                        pcm_config.bitsPerSample) &&
-      ContainedInVector(kDefaultSoftwarePcmCapabilities.channelMode,
-                        pcm_config.channelMode)
+  const CodecCapabilityMasks& pcm = GetCapabilityIndex().pcm;
+  if (InMask(pcm.sample_rates, SampleRateBit(pcm_config.sampleRateHz)) &&
+      InMask(pcm.bits_per_sample, BitsPerSampleBit(pcm_config.bitsPerSample)) &&
+      InMask(pcm.channel_modes, EnumBit(pcm_config.channelMode))
       // data interval is not checked for now
       // && pcm_config.dataIntervalUs != 0
   ) {
@@ -397,13 +530,15 @@ BluetoothAudioCodecs::GetLeAudioOffloadCodecCapabilities(
     return std::vector<LeAudioCodecCapabilitiesSetting>(0);
   }
 
-  if (kDefaultOffloadLeAudioCapabilities.empty()) {
+  // The setting file is parsed once, even when it is missing or invalid
+  static std::once_flag le_audio_capabilities_once;
+  std::call_once(le_audio_capabilities_once, [] {
     auto le_audio_offload_setting =
         BluetoothLeAudioCodecsProvider::ParseFromLeAudioOffloadSettingFile();
     kDefaultOffloadLeAudioCapabilities =
         BluetoothLeAudioCodecsProvider::GetLeAudioCodecCapabilities(
             le_audio_offload_setting);
-  }
+  });
 
   return kDefaultOffloadLeAudioCapabilities;
 }
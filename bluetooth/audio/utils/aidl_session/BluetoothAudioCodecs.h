@@ -48,13 +48,6 @@ class BluetoothAudioCodecs {
   GetLeAudioOffloadCodecCapabilities(const SessionType& session_type);
 
  private:
-  template <typename T>
-  struct identity {
-    typedef T type;
-  };
-  template <class T>
-  static bool ContainedInVector(const std::vector<T>& vector,
-                                const typename identity<T>::type& target);
   template <class T>
   static bool ContainedInBitmask(const T& bitmask, const T& target);
   static bool IsSingleBit(uint32_t bitmasks, uint32_t bitfield);
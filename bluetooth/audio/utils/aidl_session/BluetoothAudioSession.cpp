@@ -21,6 +21,9 @@
 #include <android-base/stringprintf.h>
 #include <android/binder_manager.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "BluetoothAudioSession.h"
 
 namespace aidl {
@@ -29,14 +32,17 @@ namespace hardware {
 namespace bluetooth {
 namespace audio {
 
-static constexpr int kFmqSendTimeoutMs = 1000;  // 1000 ms timeout for sending
-static constexpr int kFmqReceiveTimeoutMs =
-    1000;                               // 1000 ms timeout for receiving
-static constexpr int kWritePollMs = 1;  // polled non-blocking interval
-static constexpr int kReadPollMs = 1;   // polled non-blocking interval
+static constexpr std::chrono::milliseconds kFmqSendTimeout(1000);
+static constexpr std::chrono::milliseconds kFmqReceiveTimeout(1000);
+// wait slice until the Bluetooth stack is seen waking the event flag
+static constexpr std::chrono::milliseconds kPeerPollInterval(1);
+
+// Event flag bits, with the same values as the audio HAL data queues
+static constexpr uint32_t kFmqNotEmpty = 1 << 0;
+static constexpr uint32_t kFmqNotFull = 1 << 1;
 
 BluetoothAudioSession::BluetoothAudioSession(const SessionType& session_type)
-    : session_type_(session_type), stack_iface_(nullptr), data_mq_(nullptr) {}
+    : session_type_(session_type), stack_iface_(nullptr), data_path_(nullptr) {}
 
 /***
  *
@@ -66,6 +72,8 @@ void BluetoothAudioSession::OnSessionStarted(
     latency_modes_ = latency_modes;
     LOG(INFO) << __func__ << " - SessionType=" << toString(session_type_)
               << ", AudioConfiguration=" << audio_config.toString();
+    underruns_ = 0;
+    overruns_ = 0;
     ReportSessionStatus();
     is_streaming_ = false;
   }
@@ -74,7 +82,8 @@ void BluetoothAudioSession::OnSessionStarted(
 void BluetoothAudioSession::OnSessionEnded() {
   std::lock_guard<std::recursive_mutex> guard(mutex_);
   bool toggled = IsSessionReady();
-  LOG(INFO) << __func__ << " - SessionType=" << toString(session_type_);
+  LOG(INFO) << __func__ << " - SessionType=" << toString(session_type_)
+            << ", underruns=" << underruns_ << ", overruns=" << overruns_;
   audio_config_ = nullptr;
   leaudio_connection_map_ = nullptr;
   stack_iface_ = nullptr;
@@ -209,7 +218,7 @@ bool BluetoothAudioSession::IsSessionReady() {
        session_type_ ==
            SessionType::LE_AUDIO_BROADCAST_HARDWARE_OFFLOAD_ENCODING_DATAPATH ||
        session_type_ == SessionType::A2DP_HARDWARE_OFFLOAD_DECODING_DATAPATH ||
-       (data_mq_ != nullptr && data_mq_->isValid()));
+       (data_path_ != nullptr && data_path_->mq->isValid()));
   return stack_iface_ != nullptr && is_mq_valid && audio_config_ != nullptr;
 }
 
@@ -310,18 +319,75 @@ void BluetoothAudioSession::StopStream() {
  ***/
 
 bool BluetoothAudioSession::UpdateDataPath(const DataMQDesc* mq_desc) {
+  if (data_path_ != nullptr) {
+    // unblock the PCM methods still using the previous data path
+    data_path_->closed = true;
+    data_path_->Wake(kFmqNotEmpty | kFmqNotFull);
+    data_path_ = nullptr;
+  }
   if (mq_desc == nullptr) {
     // usecase of reset by nullptr
-    data_mq_ = nullptr;
     return true;
   }
-  std::unique_ptr<DataMQ> temp_mq;
-  temp_mq.reset(new DataMQ(*mq_desc));
-  if (!temp_mq || !temp_mq->isValid()) {
-    data_mq_ = nullptr;
+  auto temp_path = std::make_shared<DataPath>();
+  temp_path->mq.reset(new DataMQ(*mq_desc));
+  if (!temp_path->mq || !temp_path->mq->isValid()) {
     return false;
   }
-  data_mq_ = std::move(temp_mq);
+  if (temp_path->mq->getEventFlagWord() != nullptr &&
+      EventFlag::createEventFlag(temp_path->mq->getEventFlagWord(),
+                                 &temp_path->event_flag) != ::android::OK) {
+    LOG(WARNING) << __func__ << " - SessionType=" << toString(session_type_)
+                 << " failed to create the FMQ event flag, polling instead";
+    temp_path->event_flag = nullptr;
+  }
+  data_path_ = std::move(temp_path);
+  return true;
+}
+
+std::shared_ptr<BluetoothAudioSession::DataPath>
+BluetoothAudioSession::GetDataPath() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (!IsSessionReady()) {
+    return nullptr;
+  }
+  return data_path_;
+}
+
+BluetoothAudioSession::DataPath::~DataPath() {
+  if (event_flag != nullptr) {
+    EventFlag::deleteEventFlag(&event_flag);
+  }
+}
+
+void BluetoothAudioSession::DataPath::Wake(uint32_t bits) {
+  if (event_flag != nullptr) {
+    event_flag->wake(bits);
+  }
+}
+
+bool BluetoothAudioSession::DataPath::Wait(
+    uint32_t bits, std::chrono::steady_clock::time_point deadline) {
+  auto timeout = deadline - std::chrono::steady_clock::now();
+  if (timeout <= timeout.zero()) {
+    return false;
+  }
+  if (event_flag == nullptr || !peer_wakes) {
+    timeout = std::min<std::chrono::steady_clock::duration>(timeout,
+                                                            kPeerPollInterval);
+  }
+  if (event_flag == nullptr) {
+    std::this_thread::sleep_for(timeout);
+    return true;
+  }
+  uint32_t state = 0;
+  ::android::status_t status = event_flag->wait(
+      bits, &state,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(),
+      true /* retry */);
+  if (status == ::android::OK && (state & bits) != 0) {
+    peer_wakes = true;
+  }
   return true;
 }
 
@@ -396,37 +462,32 @@ size_t BluetoothAudioSession::OutWritePcmData(const void* buffer,
   if (buffer == nullptr || bytes <= 0) {
     return 0;
   }
+  std::shared_ptr<DataPath> data_path = GetDataPath();
+  if (data_path == nullptr) {
+    return 0;
+  }
   size_t total_written = 0;
-  int timeout_ms = kFmqSendTimeoutMs;
-  do {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
-    if (!IsSessionReady()) {
-      break;
-    }
-    size_t num_bytes_to_write = data_mq_->availableToWrite();
+  auto deadline = std::chrono::steady_clock::now() + kFmqSendTimeout;
+  while (total_written < bytes && !data_path->closed) {
+    size_t num_bytes_to_write =
+        std::min(data_path->mq->availableToWrite(), bytes - total_written);
     if (num_bytes_to_write) {
-      if (num_bytes_to_write > (bytes - total_written)) {
-        num_bytes_to_write = bytes - total_written;
-      }
-
-      if (!data_mq_->write(
+      if (!data_path->mq->write(
               static_cast<const MQDataType*>(buffer) + total_written,
               num_bytes_to_write)) {
         LOG(ERROR) << "FMQ datapath writing " << total_written << "/" << bytes
                    << " failed";
-        return total_written;
+        break;
       }
       total_written += num_bytes_to_write;
-    } else if (timeout_ms >= kWritePollMs) {
-      lock.unlock();
-      usleep(kWritePollMs * 1000);
-      timeout_ms -= kWritePollMs;
-    } else {
+      data_path->Wake(kFmqNotEmpty);
+    } else if (!data_path->Wait(kFmqNotFull, deadline)) {
+      ++overruns_;
       LOG(DEBUG) << "Data " << total_written << "/" << bytes << " overflow "
-                 << (kFmqSendTimeoutMs - timeout_ms) << " ms";
-      return total_written;
+                 << kFmqSendTimeout.count() << " ms";
+      break;
     }
-  } while (total_written < bytes);
+  }
   return total_written;
 }
 
@@ -434,39 +495,41 @@ size_t BluetoothAudioSession::InReadPcmData(void* buffer, size_t bytes) {
   if (buffer == nullptr || bytes <= 0) {
     return 0;
   }
+  std::shared_ptr<DataPath> data_path = GetDataPath();
+  if (data_path == nullptr) {
+    return 0;
+  }
   size_t total_read = 0;
-  int timeout_ms = kFmqReceiveTimeoutMs;
-  do {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
-    if (!IsSessionReady()) {
-      break;
-    }
-    size_t num_bytes_to_read = data_mq_->availableToRead();
+  auto deadline = std::chrono::steady_clock::now() + kFmqReceiveTimeout;
+  while (total_read < bytes && !data_path->closed) {
+    size_t num_bytes_to_read =
+        std::min(data_path->mq->availableToRead(), bytes - total_read);
     if (num_bytes_to_read) {
-      if (num_bytes_to_read > (bytes - total_read)) {
-        num_bytes_to_read = bytes - total_read;
-      }
-      if (!data_mq_->read(static_cast<MQDataType*>(buffer) + total_read,
-                          num_bytes_to_read)) {
+      if (!data_path->mq->read(static_cast<MQDataType*>(buffer) + total_read,
+                               num_bytes_to_read)) {
         LOG(ERROR) << "FMQ datapath reading " << total_read << "/" << bytes
                    << " failed";
-        return total_read;
+        break;
       }
       total_read += num_bytes_to_read;
-    } else if (timeout_ms >= kReadPollMs) {
-      lock.unlock();
-      usleep(kReadPollMs * 1000);
-      timeout_ms -= kReadPollMs;
-      continue;
-    } else {
-      LOG(DEBUG) << "Data " << total_read << "/" << bytes << " overflow "
-                 << (kFmqReceiveTimeoutMs - timeout_ms) << " ms";
-      return total_read;
+      data_path->Wake(kFmqNotFull);
+    } else if (!data_path->Wait(kFmqNotEmpty, deadline)) {
+      ++underruns_;
+      LOG(DEBUG) << "Data " << total_read << "/" << bytes << " underflow "
+                 << kFmqReceiveTimeout.count() << " ms";
+      break;
     }
-  } while (total_read < bytes);
+  }
   return total_read;
 }
 
+DataPathCounters BluetoothAudioSession::GetDataPathCounters() {
+  DataPathCounters counters;
+  counters.underruns = underruns_;
+  counters.overruns = overruns_;
+  return counters;
+}
+
 /***
  *
  * Other methods
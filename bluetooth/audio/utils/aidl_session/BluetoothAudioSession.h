@@ -23,8 +23,11 @@
 #include <aidl/android/hardware/bluetooth/audio/LatencyMode.h>
 #include <aidl/android/hardware/bluetooth/audio/SessionType.h>
 #include <fmq/AidlMessageQueue.h>
+#include <fmq/EventFlag.h>
 #include <hardware/audio.h>
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
@@ -38,6 +41,7 @@ namespace audio {
 using ::aidl::android::hardware::common::fmq::MQDescriptor;
 using ::aidl::android::hardware::common::fmq::SynchronizedReadWrite;
 using ::android::AidlMessageQueue;
+using ::android::hardware::EventFlag;
 
 using ::aidl::android::hardware::audio::common::SinkMetadata;
 using ::aidl::android::hardware::audio::common::SourceMetadata;
@@ -63,6 +67,16 @@ inline uint16_t ObserversCookieGetUpperBound(SessionType session_type) {
          kObserversCookieSize;
 }
 
+/***
+ * Counters of the software data path, reset when a session starts
+ ***/
+struct DataPathCounters {
+  // InReadPcmData timed out before the Bluetooth stack provided enough data
+  uint64_t underruns = 0;
+  // OutWritePcmData timed out before the Bluetooth stack made enough room
+  uint64_t overruns = 0;
+};
+
 /***
  * This presents the callbacks of started / suspended and session changed,
  * and the bluetooth_audio module uses to receive the status notification
@@ -200,10 +214,13 @@ class BluetoothAudioSession {
   std::vector<LatencyMode> GetSupportedLatencyModes();
   void SetLatencyMode(const LatencyMode& latency_mode);
 
-  // The control function writes stream to FMQ
+  // The control function writes stream to FMQ. Both PCM methods block on the
+  // FMQ event flag until the transfer completes or times out.
   size_t OutWritePcmData(const void* buffer, size_t bytes);
   // The control function read stream from FMQ
   size_t InReadPcmData(void* buffer, size_t bytes);
+  // Underruns and overruns of the PCM methods since the session started
+  DataPathCounters GetDataPathCounters();
 
   // Return if IBluetoothAudioProviderFactory implementation existed
   static bool IsAidlAvailable();
@@ -215,8 +232,25 @@ class BluetoothAudioSession {
 
   // audio control path to use for both software and offloading
   std::shared_ptr<IBluetoothAudioPort> stack_iface_;
-  // audio data path (FMQ) for software encoding
-  std::unique_ptr<DataMQ> data_mq_;
+  // audio data path (FMQ) for software encoding. The PCM methods take a
+  // reference under mutex_ and then transfer data without holding the lock, so
+  // a data path replaced or ended meanwhile stays alive until they return.
+  struct DataPath {
+    std::unique_ptr<DataMQ> mq;
+    EventFlag* event_flag = nullptr;
+    std::atomic<bool> closed = false;
+    // Until the Bluetooth stack wakes the event flag, waits are cut to short
+    // polls, since stacks that do not use the event flag never wake them.
+    std::atomic<bool> peer_wakes = false;
+
+    ~DataPath();
+    void Wake(uint32_t bits);
+    // Returns false once the deadline has passed
+    bool Wait(uint32_t bits, std::chrono::steady_clock::time_point deadline);
+  };
+  std::shared_ptr<DataPath> data_path_;
+  std::atomic<uint64_t> underruns_ = 0;
+  std::atomic<uint64_t> overruns_ = 0;
   // audio data configuration for both software and offloading
   std::unique_ptr<AudioConfiguration> audio_config_;
   std::unique_ptr<AudioConfiguration> leaudio_connection_map_;
@@ -230,6 +264,7 @@ class BluetoothAudioSession {
       observers_;
 
   bool UpdateDataPath(const DataMQDesc* mq_desc);
+  std::shared_ptr<DataPath> GetDataPath();
   bool UpdateAudioConfig(const AudioConfiguration& audio_config);
   // invoking the registered session_changed_cb_
   void ReportSessionStatus();
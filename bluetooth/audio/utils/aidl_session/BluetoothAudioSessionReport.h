@@ -92,6 +92,18 @@ class BluetoothAudioSessionReport {
       session_ptr->ReportLowLatencyModeAllowedChanged(allowed);
     }
   }
+  /***
+   * The API reports the underruns and overruns of the software data path since
+   * the session started
+   ***/
+  static DataPathCounters GetDataPathCounters(const SessionType& session_type) {
+    std::shared_ptr<BluetoothAudioSession> session_ptr =
+        BluetoothAudioSessionInstance::GetSessionInstance(session_type);
+    if (session_ptr != nullptr) {
+      return session_ptr->GetDataPathCounters();
+    }
+    return DataPathCounters();
+  }
 };
 
 }  // namespace audio
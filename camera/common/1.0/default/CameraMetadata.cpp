@@ -116,6 +116,19 @@ void CameraMetadata::clear() {
     }
 }
 
+void CameraMetadata::reset() {
+    if (mLocked) {
+        ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
+        return;
+    }
+    if (mBuffer) {
+        size_t entryCapacity = get_camera_metadata_entry_capacity(mBuffer);
+        size_t dataCapacity = get_camera_metadata_data_capacity(mBuffer);
+        mBuffer = place_camera_metadata(mBuffer, get_camera_metadata_size(mBuffer),
+                entryCapacity, dataCapacity);
+    }
+}
+
 void CameraMetadata::acquire(camera_metadata_t *buffer) {
     if (mLocked) {
         ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+
+#define LOG_TAG "CamComm1.0-MDDelta"
+#include <log/log.h>
+#include <utils/Errors.h>
+
+#include <string.h>
+
+#include "MetadataDelta.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+namespace {
+
+size_t alignTo8(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+bool sameEntry(const camera_metadata_ro_entry& a, const camera_metadata_ro_entry& b) {
+    return a.type == b.type && a.count == b.count &&
+            memcmp(a.data.u8, b.data.u8, a.count * camera_metadata_type_size[a.type]) == 0;
+}
+
+} // anonymous namespace
+
+MetadataDeltaEncoder::MetadataDeltaEncoder(uint32_t keyframeInterval) :
+        mKeyframeInterval(keyframeInterval), mDelta(/*entryCapacity*/16, /*dataCapacity*/256) {}
+
+uint32_t MetadataDeltaEncoder::getChannel(const camera_metadata_t* md, uint32_t partialResult) {
+    // Early partial results usually carry no capture intent and share a channel
+    uint32_t intent = 0xff;
+    camera_metadata_ro_entry entry;
+    if (md != nullptr &&
+            find_camera_metadata_ro_entry(md, ANDROID_CONTROL_CAPTURE_INTENT, &entry) == OK &&
+            entry.count > 0) {
+        intent = entry.data.u8[0];
+    }
+    return (intent << 16) | (partialResult & 0xffff);
+}
+
+status_t MetadataDeltaEncoder::encode(uint32_t channel, const camera_metadata_t* md,
+        std::vector<uint8_t>* out) {
+    if (md == nullptr || out == nullptr) {
+        return BAD_VALUE;
+    }
+
+    mPending = false;
+    mPendingLast.reset();
+    status_t res = mPendingLast.append(md);
+    if (res == OK) {
+        res = mPendingLast.sort();
+    }
+    if (res != OK) {
+        ALOGE("%s: copying result metadata failed: %d", __FUNCTION__, res);
+        return res;
+    }
+
+    Channel& ch = mChannels[channel];
+    bool keyframe = !ch.valid || ch.sinceKeyframe + 1 >= mKeyframeInterval;
+    mDelta.reset();
+    mRemovedTags.clear();
+
+    const camera_metadata_t* cur = mPendingLast.getAndLock();
+    if (!keyframe) {
+        const camera_metadata_t* last = ch.last.getAndLock();
+        camera_metadata_ro_entry entry, prev;
+        size_t count = get_camera_metadata_entry_count(cur);
+        for (size_t i = 0; i < count && !keyframe; i++) {
+            get_camera_metadata_ro_entry(cur, i, &entry);
+            if (find_camera_metadata_ro_entry(last, entry.tag, &prev) == OK &&
+                    sameEntry(entry, prev)) {
+                continue;
+            }
+            if (mDelta.update(entry) != OK) {
+                // Tags the delta can't carry are sent in a keyframe instead
+                keyframe = true;
+            }
+        }
+
+        count = get_camera_metadata_entry_count(last);
+        for (size_t i = 0; i < count && !keyframe; i++) {
+            get_camera_metadata_ro_entry(last, i, &prev);
+            if (find_camera_metadata_ro_entry(cur, prev.tag, &entry) != OK) {
+                mRemovedTags.push_back(prev.tag);
+            }
+        }
+        ch.last.unlock(last);
+    }
+
+    const camera_metadata_t* delta = mDelta.getAndLock();
+    size_t fullSize = get_camera_metadata_compact_size(cur);
+    if (!keyframe) {
+        size_t deltaSize = get_camera_metadata_compact_size(delta) +
+                mRemovedTags.size() * sizeof(uint32_t);
+        // Not worth a delta if most of the result changed
+        keyframe = deltaSize * 2 >= fullSize;
+    }
+    if (keyframe) {
+        mRemovedTags.clear();
+    }
+
+    const camera_metadata_t* body = keyframe ? cur : delta;
+    size_t bodySize = get_camera_metadata_compact_size(body);
+    size_t headerSize = sizeof(MetadataDeltaHeader) +
+            alignTo8(mRemovedTags.size() * sizeof(uint32_t));
+    out->resize(headerSize + bodySize);
+
+    MetadataDeltaHeader header {
+        kMetadataDeltaMagic,
+        channel,
+        ch.sequence,
+        keyframe ? kMetadataDeltaFlagKeyframe : 0,
+        static_cast<uint32_t>(mRemovedTags.size()),
+        0
+    };
+    memcpy(out->data(), &header, sizeof(header));
+    if (!mRemovedTags.empty()) {
+        memcpy(out->data() + sizeof(header), mRemovedTags.data(),
+                mRemovedTags.size() * sizeof(uint32_t));
+    }
+    camera_metadata_t* copy = copy_camera_metadata(out->data() + headerSize, bodySize, body);
+    if (copy != nullptr) {
+        set_camera_metadata_vendor_id(copy, get_camera_metadata_vendor_id(md));
+    }
+
+    mDelta.unlock(delta);
+    mPendingLast.unlock(cur);
+
+    if (copy == nullptr) {
+        ALOGE("%s: copying %zu bytes of metadata failed", __FUNCTION__, bodySize);
+        out->clear();
+        return NO_MEMORY;
+    }
+
+    mPending = true;
+    mPendingKeyframe = keyframe;
+    mPendingChannel = channel;
+    return OK;
+}
+
+void MetadataDeltaEncoder::commit() {
+    if (!mPending) {
+        return;
+    }
+    mPending = false;
+
+    Channel& ch = mChannels[mPendingChannel];
+    // The old base is kept around as the next pending buffer
+    ch.last.swap(mPendingLast);
+    ch.sequence++;
+    ch.valid = true;
+    if (mPendingKeyframe) {
+        ch.sinceKeyframe = 0;
+        mKeyframes++;
+    } else {
+        ch.sinceKeyframe++;
+        mDeltas++;
+    }
+}
+
+void MetadataDeltaEncoder::reset() {
+    mPending = false;
+    for (auto& pair : mChannels) {
+        pair.second.valid = false;
+    }
+}
+
+status_t MetadataDeltaDecoder::decode(const uint8_t* data, size_t size, CameraMetadata* out) {
+    if (data == nullptr || out == nullptr) {
+        return BAD_VALUE;
+    }
+
+    MetadataDeltaHeader header {};
+    bool isDelta = size >= sizeof(header);
+    if (isDelta) {
+        memcpy(&header, data, sizeof(header));
+        isDelta = header.magic == kMetadataDeltaMagic;
+    }
+
+    size_t headerSize = 0;
+    if (isDelta) {
+        if (header.numRemovedTags > (size - sizeof(header)) / sizeof(uint32_t)) {
+            ALOGE("%s: corrupt delta header, %u removed tags in %zu bytes", __FUNCTION__,
+                    header.numRemovedTags, size);
+            return BAD_VALUE;
+        }
+        headerSize = sizeof(header) + alignTo8(header.numRemovedTags * sizeof(uint32_t));
+        if (headerSize > size) {
+            ALOGE("%s: corrupt delta header, %zu bytes", __FUNCTION__, size);
+            return BAD_VALUE;
+        }
+    }
+
+    size_t mdSize = size - headerSize;
+    const uint8_t* mdData = data + headerSize;
+    if (reinterpret_cast<uintptr_t>(mdData) % alignof(uint64_t) != 0) {
+        mAligned.resize((mdSize + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        memcpy(mAligned.data(), mdData, mdSize);
+        mdData = reinterpret_cast<const uint8_t*>(mAligned.data());
+    }
+    const camera_metadata_t* md = reinterpret_cast<const camera_metadata_t*>(mdData);
+    if (validate_camera_metadata_structure(md, &mdSize) != OK) {
+        ALOGE("%s: corrupt result metadata, %zu bytes", __FUNCTION__, mdSize);
+        return BAD_VALUE;
+    }
+
+    if (!isDelta) {
+        *out = md;
+        return OK;
+    }
+
+    Channel& ch = mChannels[header.channel];
+    if (header.flags & kMetadataDeltaFlagKeyframe) {
+        ch.base = md;
+    } else {
+        if (!ch.valid || header.sequence != ch.nextSequence) {
+            ALOGW("%s: channel %x expected sequence %u, got %u; waiting for a keyframe",
+                    __FUNCTION__, header.channel, ch.nextSequence, header.sequence);
+            ch.valid = false;
+            return NOT_ENOUGH_DATA;
+        }
+
+        for (uint32_t i = 0; i < header.numRemovedTags; i++) {
+            uint32_t tag;
+            memcpy(&tag, data + sizeof(header) + i * sizeof(uint32_t), sizeof(tag));
+            ch.base.erase(tag);
+        }
+
+        camera_metadata_ro_entry entry;
+        size_t count = get_camera_metadata_entry_count(md);
+        for (size_t i = 0; i < count; i++) {
+            get_camera_metadata_ro_entry(md, i, &entry);
+            status_t res = ch.base.update(entry);
+            if (res != OK) {
+                ALOGE("%s: applying tag %x of channel %x failed: %d", __FUNCTION__, entry.tag,
+                        header.channel, res);
+                ch.valid = false;
+                return res;
+            }
+        }
+    }
+
+    ch.valid = true;
+    ch.nextSequence = header.sequence + 1;
+    *out = ch.base;
+    return OK;
+}
+
+} // namespace helper
+} // namespace V1_0
+} // namespace common
+} // namespace camera
+} // namespace hardware
+} // namespace android
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CamComm1.0-YuvKernels"
+//#define LOG_NDEBUG 0
+
+#include <log/log.h>
+
+#include <vector>
+
+#include <libyuv.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_KERNELS_HAS_NEON
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define YUV_KERNELS_HAS_SSSE3
+#endif
+
+#include "YuvKernels.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+namespace {
+
+bool isPlanar(const YuvPlanes& planes) {
+    return planes.chromaStep == 1;
+}
+
+bool isSemiPlanar(const YuvPlanes& planes) {
+    // cb and cr share one plane, in either order
+    return planes.chromaStep == 2 &&
+            (planes.cr == planes.cb + 1 || planes.cb == planes.cr + 1);
+}
+
+libyuv::FilterMode toLibyuvFilter(ScaleFilter filter) {
+    switch (filter) {
+        case ScaleFilter::BILINEAR:
+            return libyuv::kFilterBilinear;
+        case ScaleFilter::BOX:
+            return libyuv::kFilterBox;
+        case ScaleFilter::NEAREST:
+        default:
+            return libyuv::kFilterNone;
+    }
+}
+
+// Swap kernels, one row of width chroma sample pairs each
+void swapUvRowC(const uint8_t* src, uint8_t* dst, int width) {
+    for (int i = 0; i < width; i++) {
+        uint8_t first = src[2 * i];
+        dst[2 * i] = src[2 * i + 1];
+        dst[2 * i + 1] = first;
+    }
+}
+
+#ifdef YUV_KERNELS_HAS_NEON
+void swapUvRowNeon(const uint8_t* src, uint8_t* dst, int width) {
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8x16x2_t uv = vld2q_u8(src + 2 * i);
+        uint8x16x2_t vu = {{uv.val[1], uv.val[0]}};
+        vst2q_u8(dst + 2 * i, vu);
+    }
+    swapUvRowC(src + 2 * i, dst + 2 * i, width - i);
+}
+#endif
+
+#ifdef YUV_KERNELS_HAS_SSSE3
+__attribute__((target("ssse3")))
+void swapUvRowSsse3(const uint8_t* src, uint8_t* dst, int width) {
+    const __m128i kSwap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    int i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm_shuffle_epi8(uv, kSwap));
+    }
+    swapUvRowC(src + 2 * i, dst + 2 * i, width - i);
+}
+#endif
+
+struct SwapUvKernel {
+    const char* isa;
+    void (*row)(const uint8_t* src, uint8_t* dst, int width);
+};
+
+const SwapUvKernel& getSwapUvKernel() {
+    static const SwapUvKernel kernel = [] {
+#ifdef YUV_KERNELS_HAS_NEON
+        if (libyuv::TestCpuFlag(libyuv::kCpuHasNEON)) {
+            return SwapUvKernel{"neon", swapUvRowNeon};
+        }
+#endif
+#ifdef YUV_KERNELS_HAS_SSSE3
+        if (libyuv::TestCpuFlag(libyuv::kCpuHasSSSE3)) {
+            return SwapUvKernel{"ssse3", swapUvRowSsse3};
+        }
+#endif
+        return SwapUvKernel{"c", swapUvRowC};
+    }();
+    return kernel;
+}
+
+} // anonymous namespace
+
+int convertFromYu12(const YuvPlanes& in, const YuvPlanes& out, int width, int height) {
+    if (!isPlanar(in)) {
+        ALOGE("%s: input must be planar, chroma step %d", __FUNCTION__, in.chromaStep);
+        return -1;
+    }
+
+    if (isPlanar(out)) {
+        return libyuv::I420Copy(in.y, in.yStride, in.cb, in.cStride, in.cr, in.cStride,
+                out.y, out.yStride, out.cb, out.cStride, out.cr, out.cStride, width, height);
+    }
+    if (!isSemiPlanar(out)) {
+        ALOGE("%s: unsupported output layout, chroma step %d", __FUNCTION__, out.chromaStep);
+        return -1;
+    }
+
+    libyuv::CopyPlane(in.y, in.yStride, out.y, out.yStride, width, height);
+    if (out.cb < out.cr) {
+        // NV12
+        libyuv::MergeUVPlane(in.cb, in.cStride, in.cr, in.cStride, out.cb, out.cStride,
+                (width + 1) / 2, (height + 1) / 2);
+    } else {
+        // NV21
+        libyuv::MergeUVPlane(in.cr, in.cStride, in.cb, in.cStride, out.cr, out.cStride,
+                (width + 1) / 2, (height + 1) / 2);
+    }
+    return 0;
+}
+
+int convertToYu12(const YuvPlanes& in, const YuvPlanes& out, int width, int height) {
+    if (!isPlanar(out)) {
+        ALOGE("%s: output must be planar, chroma step %d", __FUNCTION__, out.chromaStep);
+        return -1;
+    }
+
+    if (isPlanar(in)) {
+        return convertFromYu12(in, out, width, height);
+    }
+    if (!isSemiPlanar(in)) {
+        ALOGE("%s: unsupported input layout, chroma step %d", __FUNCTION__, in.chromaStep);
+        return -1;
+    }
+
+    libyuv::CopyPlane(in.y, in.yStride, out.y, out.yStride, width, height);
+    if (in.cb < in.cr) {
+        libyuv::SplitUVPlane(in.cb, in.cStride, out.cb, out.cStride, out.cr, out.cStride,
+                (width + 1) / 2, (height + 1) / 2);
+    } else {
+        libyuv::SplitUVPlane(in.cr, in.cStride, out.cr, out.cStride, out.cb, out.cStride,
+                (width + 1) / 2, (height + 1) / 2);
+    }
+    return 0;
+}
+
+void swapUvPlane(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+        int width, int height) {
+    auto row = getSwapUvKernel().row;
+    for (int i = 0; i < height; i++) {
+        row(src + i * srcStride, dst + i * dstStride, width);
+    }
+}
+
+int cropScaleConvert(const YuvPlanes& in, int left, int top, int cropWidth, int cropHeight,
+        const YuvPlanes& out, int outWidth, int outHeight, ScaleFilter filter) {
+    if (!isPlanar(in)) {
+        ALOGE("%s: input must be planar, chroma step %d", __FUNCTION__, in.chromaStep);
+        return -1;
+    }
+    if ((left & 1) || (top & 1)) {
+        ALOGE("%s: crop offset (%d, %d) must be even", __FUNCTION__, left, top);
+        return -1;
+    }
+
+    YuvPlanes cropped = in;
+    cropped.y = in.y + top * in.yStride + left;
+    cropped.cb = in.cb + (top / 2) * in.cStride + left / 2;
+    cropped.cr = in.cr + (top / 2) * in.cStride + left / 2;
+    if (cropWidth == outWidth && cropHeight == outHeight) {
+        return convertFromYu12(cropped, out, outWidth, outHeight);
+    }
+
+    libyuv::FilterMode mode = toLibyuvFilter(filter);
+    if (isPlanar(out)) {
+        return libyuv::I420Scale(
+                cropped.y, cropped.yStride, cropped.cb, cropped.cStride,
+                cropped.cr, cropped.cStride, cropWidth, cropHeight,
+                out.y, out.yStride, out.cb, out.cStride, out.cr, out.cStride,
+                outWidth, outHeight, mode);
+    }
+    if (!isSemiPlanar(out)) {
+        ALOGE("%s: unsupported output layout, chroma step %d", __FUNCTION__, out.chromaStep);
+        return -1;
+    }
+
+    // Luma is scaled straight into the output. Chroma goes through a small per-thread
+    // scratch buffer before being interleaved.
+    libyuv::ScalePlane(cropped.y, cropped.yStride, cropWidth, cropHeight,
+            out.y, out.yStride, outWidth, outHeight, mode);
+
+    const int cropChromaWidth = (cropWidth + 1) / 2;
+    const int cropChromaHeight = (cropHeight + 1) / 2;
+    const int outChromaWidth = (outWidth + 1) / 2;
+    const int outChromaHeight = (outHeight + 1) / 2;
+    const size_t chromaSize = static_cast<size_t>(outChromaWidth) * outChromaHeight;
+    thread_local std::vector<uint8_t> scratch;
+    if (scratch.size() < chromaSize * 2) {
+        scratch.resize(chromaSize * 2);
+    }
+    uint8_t* scaledCb = scratch.data();
+    uint8_t* scaledCr = scratch.data() + chromaSize;
+    libyuv::ScalePlane(cropped.cb, cropped.cStride, cropChromaWidth, cropChromaHeight,
+            scaledCb, outChromaWidth, outChromaWidth, outChromaHeight, mode);
+    libyuv::ScalePlane(cropped.cr, cropped.cStride, cropChromaWidth, cropChromaHeight,
+            scaledCr, outChromaWidth, outChromaWidth, outChromaHeight, mode);
+    if (out.cb < out.cr) {
+        libyuv::MergeUVPlane(scaledCb, outChromaWidth, scaledCr, outChromaWidth,
+                out.cb, out.cStride, outChromaWidth, outChromaHeight);
+    } else {
+        libyuv::MergeUVPlane(scaledCr, outChromaWidth, scaledCb, outChromaWidth,
+                out.cr, out.cStride, outChromaWidth, outChromaHeight);
+    }
+    return 0;
+}
+
+const char* getYuvKernelIsa() {
+    return getSwapUvKernel().isa;
+}
+
+} // namespace helper
+} // namespace V1_0
+} // namespace common
+} // namespace camera
+} // namespace hardware
+} // namespace android
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+#include "YuvKernels.h"
+
+using ::android::hardware::camera::common::V1_0::helper::convertFromYu12;
+using ::android::hardware::camera::common::V1_0::helper::convertToYu12;
+using ::android::hardware::camera::common::V1_0::helper::cropScaleConvert;
+using ::android::hardware::camera::common::V1_0::helper::getYuvKernelIsa;
+using ::android::hardware::camera::common::V1_0::helper::ScaleFilter;
+using ::android::hardware::camera::common::V1_0::helper::swapUvPlane;
+using ::android::hardware::camera::common::V1_0::helper::YuvPlanes;
+using ::benchmark::Counter;
+using ::benchmark::State;
+using ::benchmark::internal::Benchmark;
+
+namespace {
+
+enum Layout { YU12, YV12, NV12, NV21 };
+
+// A tightly packed YUV 4:2:0 image
+class Image {
+  public:
+    Image(int width, int height, Layout layout)
+        : mData(width * height * 3 / 2, 0x80) {
+        const int chromaSize = (width / 2) * (height / 2);
+        uint8_t* chroma = mData.data() + width * height;
+        mPlanes.y = mData.data();
+        mPlanes.yStride = width;
+        switch (layout) {
+            case YU12:
+                mPlanes.cb = chroma;
+                mPlanes.cr = chroma + chromaSize;
+                mPlanes.cStride = width / 2;
+                mPlanes.chromaStep = 1;
+                break;
+            case YV12:
+                mPlanes.cr = chroma;
+                mPlanes.cb = chroma + chromaSize;
+                mPlanes.cStride = width / 2;
+                mPlanes.chromaStep = 1;
+                break;
+            case NV12:
+                mPlanes.cb = chroma;
+                mPlanes.cr = chroma + 1;
+                mPlanes.cStride = width;
+                mPlanes.chromaStep = 2;
+                break;
+            case NV21:
+                mPlanes.cr = chroma;
+                mPlanes.cb = chroma + 1;
+                mPlanes.cStride = width;
+                mPlanes.chromaStep = 2;
+                break;
+        }
+    }
+
+    const YuvPlanes& planes() const { return mPlanes; }
+
+  private:
+    std::vector<uint8_t> mData;
+    YuvPlanes mPlanes;
+};
+
+// Common camera stream sizes
+void StreamSizes(Benchmark* b) {
+    b->Args({640, 480})->Args({1280, 720})->Args({1920, 1080})->Args({3840, 2160});
+}
+
+// {input width, input height, output width, output height, filter}
+void ScaleSizes(Benchmark* b) {
+    for (int filter : {static_cast<int>(ScaleFilter::NEAREST),
+                       static_cast<int>(ScaleFilter::BILINEAR),
+                       static_cast<int>(ScaleFilter::BOX)}) {
+        b->Args({1920, 1080, 1280, 720, filter});
+        b->Args({1920, 1080, 640, 480, filter});
+        b->Args({1920, 1080, 320, 240, filter});
+        b->Args({3840, 2160, 1920, 1080, filter});
+    }
+}
+
+void setPixelsProcessed(State& state, int width, int height) {
+    state.counters["Mpix/s"] = Counter(static_cast<double>(width) * height / 1e6,
+                                       Counter::kIsIterationInvariantRate);
+    state.SetLabel(getYuvKernelIsa());
+}
+
+template <Layout kOut>
+void BM_ConvertFromYu12(State& state) {
+    const int width = state.range(0);
+    const int height = state.range(1);
+    Image in(width, height, YU12);
+    Image out(width, height, kOut);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(convertFromYu12(in.planes(), out.planes(), width, height));
+    }
+    setPixelsProcessed(state, width, height);
+}
+BENCHMARK_TEMPLATE(BM_ConvertFromYu12, YV12)->Apply(StreamSizes);
+BENCHMARK_TEMPLATE(BM_ConvertFromYu12, NV12)->Apply(StreamSizes);
+BENCHMARK_TEMPLATE(BM_ConvertFromYu12, NV21)->Apply(StreamSizes);
+
+template <Layout kIn>
+void BM_ConvertToYu12(State& state) {
+    const int width = state.range(0);
+    const int height = state.range(1);
+    Image in(width, height, kIn);
+    Image out(width, height, YU12);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(convertToYu12(in.planes(), out.planes(), width, height));
+    }
+    setPixelsProcessed(state, width, height);
+}
+BENCHMARK_TEMPLATE(BM_ConvertToYu12, NV12)->Apply(StreamSizes);
+BENCHMARK_TEMPLATE(BM_ConvertToYu12, NV21)->Apply(StreamSizes);
+
+void BM_SwapUvPlane(State& state) {
+    const int width = state.range(0);
+    const int height = state.range(1);
+    Image in(width, height, NV12);
+    Image out(width, height, NV21);
+    for (auto _ : state) {
+        swapUvPlane(in.planes().cb, in.planes().cStride, out.planes().cr, out.planes().cStride,
+                    width / 2, height / 2);
+        benchmark::ClobberMemory();
+    }
+    setPixelsProcessed(state, width, height);
+}
+BENCHMARK(BM_SwapUvPlane)->Apply(StreamSizes);
+
+template <Layout kOut>
+void BM_CropScaleConvert(State& state) {
+    const int inWidth = state.range(0);
+    const int inHeight = state.range(1);
+    const int outWidth = state.range(2);
+    const int outHeight = state.range(3);
+    const auto filter = static_cast<ScaleFilter>(state.range(4));
+    Image in(inWidth, inHeight, YU12);
+    Image out(outWidth, outHeight, kOut);
+
+    // Center crop to the output aspect ratio, as the external camera HAL does
+    int cropWidth = inWidth;
+    int cropHeight = inHeight;
+    if (static_cast<int64_t>(inWidth) * outHeight > static_cast<int64_t>(inHeight) * outWidth) {
+        cropWidth = (static_cast<int64_t>(inHeight) * outWidth / outHeight) & ~0x1;
+    } else {
+        cropHeight = (static_cast<int64_t>(inWidth) * outHeight / outWidth) & ~0x1;
+    }
+    const int left = ((inWidth - cropWidth) / 2) & ~0x1;
+    const int top = ((inHeight - cropHeight) / 2) & ~0x1;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cropScaleConvert(in.planes(), left, top, cropWidth, cropHeight,
+                                                  out.planes(), outWidth, outHeight, filter));
+    }
+    setPixelsProcessed(state, outWidth, outHeight);
+}
+BENCHMARK_TEMPLATE(BM_CropScaleConvert, YU12)->Apply(ScaleSizes);
+BENCHMARK_TEMPLATE(BM_CropScaleConvert, NV21)->Apply(ScaleSizes);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -87,6 +87,12 @@ class CameraMetadata {
      */
     void clear();
 
+    /**
+     * Remove all entries but keep the storage, so that the buffer can be
+     * refilled without reallocating
+     */
+    void reset();
+
     /**
      * Acquire a raw metadata buffer from the caller. After this call,
      * the caller no longer owns the raw buffer, and must not free or manipulate it.
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_COMMON_1_0_METADATADELTA_H
+#define CAMERA_COMMON_1_0_METADATADELTA_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "CameraMetadata.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+/**
+ * Delta encoding of capture result metadata sent through the result metadata FMQ.
+ *
+ * Results are grouped in channels, one per capture intent and partial result index,
+ * since consecutive results of a channel mostly carry the same values. A delta blob
+ * is laid out as:
+ *
+ *   MetadataDeltaHeader
+ *   uint32_t removedTags[numRemovedTags], padded to 8 bytes
+ *   camera_metadata_t with the entries added or changed since the previous blob of
+ *   the channel, or all entries for a keyframe
+ *
+ * A blob that does not start with kMetadataDeltaMagic is a plain camera_metadata_t,
+ * so delta and full blobs can share one queue. The reader must decode every blob in
+ * the order it was written.
+ */
+struct MetadataDeltaHeader {
+    uint32_t magic;
+    uint32_t channel;
+    // Per channel, incremented on every blob. A gap invalidates the channel until
+    // its next keyframe.
+    uint32_t sequence;
+    uint32_t flags;
+    uint32_t numRemovedTags;
+    uint32_t reserved;
+};
+
+static const uint32_t kMetadataDeltaMagic = 0x4c444d43; // 'CMDL'
+static const uint32_t kMetadataDeltaFlagKeyframe = 1;
+
+class MetadataDeltaEncoder {
+  public:
+    static const uint32_t kDefaultKeyframeInterval = 30;
+
+    // A keyframe is sent at least every keyframeInterval blobs of a channel
+    explicit MetadataDeltaEncoder(uint32_t keyframeInterval = kDefaultKeyframeInterval);
+
+    static uint32_t getChannel(const camera_metadata_t* md, uint32_t partialResult);
+
+    /**
+     * Encode md into out. The encoder does not advance until commit() is called, so a
+     * blob that could not be delivered is simply encoded again against the same base.
+     */
+    status_t encode(uint32_t channel, const camera_metadata_t* md, std::vector<uint8_t>* out);
+    void commit();
+
+    // Send keyframes on all channels from now on
+    void reset();
+
+    uint64_t getKeyframeCount() const { return mKeyframes; }
+    uint64_t getDeltaCount() const { return mDeltas; }
+
+  private:
+    struct Channel {
+        // Sorted copy of the last committed result
+        CameraMetadata last;
+        uint32_t sequence = 0;
+        uint32_t sinceKeyframe = 0;
+        bool valid = false;
+    };
+
+    const uint32_t mKeyframeInterval;
+    std::unordered_map<uint32_t, Channel> mChannels;
+
+    bool mPending = false;
+    bool mPendingKeyframe = false;
+    uint32_t mPendingChannel = 0;
+    CameraMetadata mPendingLast;
+    CameraMetadata mDelta;
+    std::vector<uint32_t> mRemovedTags;
+
+    uint64_t mKeyframes = 0;
+    uint64_t mDeltas = 0;
+};
+
+class MetadataDeltaDecoder {
+  public:
+    /**
+     * Rebuild the full metadata of a blob read from the result FMQ. Plain blobs are
+     * copied as they are. Returns NOT_ENOUGH_DATA for a delta whose base was missed; the
+     * result metadata of that frame is lost, and the channel resumes at its next keyframe.
+     */
+    status_t decode(const uint8_t* data, size_t size, CameraMetadata* out);
+
+  private:
+    struct Channel {
+        CameraMetadata base;
+        uint32_t nextSequence = 0;
+        bool valid = false;
+    };
+
+    std::unordered_map<uint32_t, Channel> mChannels;
+    std::vector<uint64_t> mAligned;
+};
+
+} // namespace helper
+} // namespace V1_0
+} // namespace common
+} // namespace camera
+} // namespace hardware
+} // namespace android
+
+#endif
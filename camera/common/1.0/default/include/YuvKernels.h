@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_INTERFACES_CAMERA_COMMON_1_0_YUVKERNELS_H
+#define ANDROID_HARDWARE_INTERFACES_CAMERA_COMMON_1_0_YUVKERNELS_H
+
+#include <stdint.h>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+// Crop, scale and format conversion kernels for 8-bit YUV 4:2:0 images. The kernels pick
+// the best implementation for the CPU at runtime (NEON, SSSE3 or plain C).
+
+// Planes of a YUV 4:2:0 image. Planar images (YU12/YV12) have chromaStep 1. Semi-planar
+// images (NV12/NV21) have chromaStep 2, with cb and cr pointing into the same plane.
+struct YuvPlanes {
+    uint8_t* y = nullptr;
+    uint8_t* cb = nullptr;
+    uint8_t* cr = nullptr;
+    int yStride = 0;
+    int cStride = 0;
+    int chromaStep = 1;
+};
+
+enum class ScaleFilter {
+    NEAREST,  // Fastest, aliases on large downscales
+    BILINEAR,
+    BOX,      // Best quality for large downscales such as thumbnails
+};
+
+// Copy a planar YU12 image into out, interleaving the chroma planes if out is semi-planar.
+// Returns 0 on success.
+int convertFromYu12(const YuvPlanes& in, const YuvPlanes& out, int width, int height);
+
+// Copy any YUV 4:2:0 image into the planar image out, deinterleaving the chroma planes if
+// in is semi-planar. Returns 0 on success.
+int convertToYu12(const YuvPlanes& in, const YuvPlanes& out, int width, int height);
+
+// Swap the two channels of an interleaved chroma plane (NV12 <-> NV21). width and height
+// are in chroma samples, src and dst may be the same plane.
+void swapUvPlane(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+        int width, int height);
+
+// Crop the rectangle (left, top, cropWidth, cropHeight) out of the planar image in and
+// scale it to outWidth x outHeight straight into out, which can be planar or semi-planar.
+// left and top must be even. Returns 0 on success.
+int cropScaleConvert(const YuvPlanes& in, int left, int top, int cropWidth, int cropHeight,
+        const YuvPlanes& out, int outWidth, int outHeight, ScaleFilter filter);
+
+// Name of the instruction set the kernels run on, for dumps
+const char* getYuvKernelIsa();
+
+} // namespace helper
+} // namespace V1_0
+} // namespace common
+} // namespace camera
+} // namespace hardware
+} // namespace android
+
+#endif  // ANDROID_HARDWARE_INTERFACES_CAMERA_COMMON_1_0_YUVKERNELS_H
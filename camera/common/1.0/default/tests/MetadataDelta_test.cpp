@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <utils/Errors.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "CameraMetadata.h"
+#include "MetadataDelta.h"
+
+namespace {
+
+using ::android::NOT_ENOUGH_DATA;
+using ::android::OK;
+using ::android::hardware::camera::common::V1_0::helper::CameraMetadata;
+using ::android::hardware::camera::common::V1_0::helper::kMetadataDeltaFlagKeyframe;
+using ::android::hardware::camera::common::V1_0::helper::kMetadataDeltaMagic;
+using ::android::hardware::camera::common::V1_0::helper::MetadataDeltaDecoder;
+using ::android::hardware::camera::common::V1_0::helper::MetadataDeltaEncoder;
+using ::android::hardware::camera::common::V1_0::helper::MetadataDeltaHeader;
+
+constexpr uint32_t kKeyframeInterval = 4;
+constexpr uint32_t kPartialResult = 1;
+
+// A capture result with a few per-frame values and some larger ones that rarely change,
+// so that deltas are much smaller than keyframes
+CameraMetadata makeResult(uint8_t intent, int64_t timestamp, bool withAfState = false) {
+    CameraMetadata md;
+    md.update(ANDROID_CONTROL_CAPTURE_INTENT, &intent, 1);
+    md.update(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+    const int64_t exposureTime = 33333333;
+    md.update(ANDROID_SENSOR_EXPOSURE_TIME, &exposureTime, 1);
+    const int32_t sensitivity = 100;
+    md.update(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1);
+    const float focalLength = 3.5f;
+    md.update(ANDROID_LENS_FOCAL_LENGTH, &focalLength, 1);
+    const uint8_t aeState = ANDROID_CONTROL_AE_STATE_CONVERGED;
+    md.update(ANDROID_CONTROL_AE_STATE, &aeState, 1);
+    std::vector<float> curve(64);
+    for (size_t i = 0; i < curve.size(); i++) {
+        curve[i] = static_cast<float>(i) / curve.size();
+    }
+    md.update(ANDROID_TONEMAP_CURVE_RED, curve.data(), curve.size());
+    md.update(ANDROID_TONEMAP_CURVE_GREEN, curve.data(), curve.size());
+    md.update(ANDROID_TONEMAP_CURVE_BLUE, curve.data(), curve.size());
+    if (withAfState) {
+        const uint8_t afState = ANDROID_CONTROL_AF_STATE_FOCUSED_LOCKED;
+        md.update(ANDROID_CONTROL_AF_STATE, &afState, 1);
+    }
+    return md;
+}
+
+MetadataDeltaHeader getHeader(const std::vector<uint8_t>& blob) {
+    MetadataDeltaHeader header{};
+    EXPECT_GE(blob.size(), sizeof(header));
+    memcpy(&header, blob.data(), std::min(blob.size(), sizeof(header)));
+    EXPECT_EQ(kMetadataDeltaMagic, header.magic);
+    return header;
+}
+
+void expectSameMetadata(const CameraMetadata& expected, const CameraMetadata& actual) {
+    ASSERT_EQ(expected.entryCount(), actual.entryCount());
+    const camera_metadata_t* md = expected.getAndLock();
+    for (size_t i = 0; i < expected.entryCount(); i++) {
+        camera_metadata_ro_entry entry;
+        get_camera_metadata_ro_entry(md, i, &entry);
+        camera_metadata_ro_entry other = actual.find(entry.tag);
+        EXPECT_EQ(entry.count, other.count) << "tag " << std::hex << entry.tag;
+        EXPECT_EQ(entry.type, other.type) << "tag " << std::hex << entry.tag;
+        if (entry.count == other.count && entry.type == other.type) {
+            EXPECT_EQ(0, memcmp(entry.data.u8, other.data.u8,
+                                entry.count * camera_metadata_type_size[entry.type]))
+                    << "tag " << std::hex << entry.tag;
+        }
+    }
+    expected.unlock(md);
+}
+
+class MetadataDeltaTest : public ::testing::Test {
+  protected:
+    // Encodes and commits one result, returning the blob
+    std::vector<uint8_t> send(const CameraMetadata& md) {
+        const camera_metadata_t* raw = md.getAndLock();
+        const uint32_t channel = MetadataDeltaEncoder::getChannel(raw, kPartialResult);
+        std::vector<uint8_t> blob;
+        EXPECT_EQ(OK, mEncoder.encode(channel, raw, &blob));
+        md.unlock(raw);
+        mEncoder.commit();
+        return blob;
+    }
+
+    MetadataDeltaEncoder mEncoder{kKeyframeInterval};
+    MetadataDeltaDecoder mDecoder;
+};
+
+TEST_F(MetadataDeltaTest, roundTripWithKeyframeInterval) {
+    for (uint32_t frame = 0; frame < 3 * kKeyframeInterval; frame++) {
+        SCOPED_TRACE(::testing::Message() << "frame " << frame);
+        // AF state is added on frame 1 and removed again on frame 3
+        CameraMetadata md = makeResult(ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW, 1000 * frame,
+                                       frame == 1 || frame == 2);
+        std::vector<uint8_t> blob = send(md);
+
+        MetadataDeltaHeader header = getHeader(blob);
+        EXPECT_EQ(frame, header.sequence);
+        const bool keyframe = frame % kKeyframeInterval == 0;
+        EXPECT_EQ(keyframe, (header.flags & kMetadataDeltaFlagKeyframe) != 0);
+        EXPECT_EQ(frame == 3 ? 1u : 0u, header.numRemovedTags);
+        if (!keyframe) {
+            // the header and the changed entries only
+            const camera_metadata_t* raw = md.getAndLock();
+            EXPECT_LT(blob.size(), get_camera_metadata_compact_size(raw));
+            md.unlock(raw);
+        }
+
+        CameraMetadata decoded;
+        ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+        expectSameMetadata(md, decoded);
+        EXPECT_EQ(frame == 1 || frame == 2, decoded.exists(ANDROID_CONTROL_AF_STATE));
+    }
+    EXPECT_EQ(3u, mEncoder.getKeyframeCount());
+    EXPECT_EQ(3u * (kKeyframeInterval - 1), mEncoder.getDeltaCount());
+}
+
+TEST_F(MetadataDeltaTest, sequenceGapIsRejectedUntilKeyframe) {
+    std::vector<CameraMetadata> results;
+    for (uint32_t frame = 0; frame <= kKeyframeInterval; frame++) {
+        results.push_back(makeResult(ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW, 1000 * frame));
+    }
+
+    CameraMetadata decoded;
+    std::vector<uint8_t> blob = send(results[0]);
+    ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+
+    // frame 1 is lost on the way
+    send(results[1]);
+
+    // the deltas after the gap cannot be applied
+    for (uint32_t frame = 2; frame < kKeyframeInterval; frame++) {
+        blob = send(results[frame]);
+        ASSERT_EQ(0u, getHeader(blob).flags & kMetadataDeltaFlagKeyframe);
+        EXPECT_EQ(NOT_ENOUGH_DATA, mDecoder.decode(blob.data(), blob.size(), &decoded))
+                << "frame " << frame;
+    }
+
+    // and the channel recovers at the next keyframe
+    blob = send(results[kKeyframeInterval]);
+    ASSERT_NE(0u, getHeader(blob).flags & kMetadataDeltaFlagKeyframe);
+    ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+    expectSameMetadata(results[kKeyframeInterval], decoded);
+}
+
+TEST_F(MetadataDeltaTest, uncommittedBlobIsEncodedAgain) {
+    CameraMetadata first = makeResult(ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW, 0);
+    CameraMetadata second = makeResult(ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW, 1000);
+    CameraMetadata decoded;
+    std::vector<uint8_t> blob = send(first);
+    ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+
+    // The queue was full: the blob is dropped without commit() and encoded again
+    const camera_metadata_t* raw = second.getAndLock();
+    const uint32_t channel = MetadataDeltaEncoder::getChannel(raw, kPartialResult);
+    std::vector<uint8_t> dropped;
+    ASSERT_EQ(OK, mEncoder.encode(channel, raw, &dropped));
+    second.unlock(raw);
+
+    blob = send(second);
+    EXPECT_EQ(dropped, blob);
+    ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+    expectSameMetadata(second, decoded);
+}
+
+TEST_F(MetadataDeltaTest, channelsAreIndependent) {
+    CameraMetadata decoded;
+    for (uint32_t frame = 0; frame < kKeyframeInterval; frame++) {
+        for (uint8_t intent : {ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW,
+                               ANDROID_CONTROL_CAPTURE_INTENT_STILL_CAPTURE}) {
+            CameraMetadata md = makeResult(intent, 1000 * frame + intent);
+            std::vector<uint8_t> blob = send(md);
+            EXPECT_EQ(frame, getHeader(blob).sequence);
+            ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+            expectSameMetadata(md, decoded);
+        }
+    }
+}
+
+TEST_F(MetadataDeltaTest, plainMetadataPassesThrough) {
+    CameraMetadata md = makeResult(ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW, 0);
+    const camera_metadata_t* raw = md.getAndLock();
+    const size_t size = get_camera_metadata_compact_size(raw);
+    std::vector<uint8_t> blob(size);
+    ASSERT_NE(nullptr, copy_camera_metadata(blob.data(), size, raw));
+    md.unlock(raw);
+
+    CameraMetadata decoded;
+    ASSERT_EQ(OK, mDecoder.decode(blob.data(), blob.size(), &decoded));
+    expectSameMetadata(md, decoded);
+}
+
+}  // namespace
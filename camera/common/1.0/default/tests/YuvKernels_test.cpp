@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <libyuv.h>
+
+#include <vector>
+
+#include "YuvKernels.h"
+
+namespace {
+
+using ::android::hardware::camera::common::V1_0::helper::cropScaleConvert;
+using ::android::hardware::camera::common::V1_0::helper::getYuvKernelIsa;
+using ::android::hardware::camera::common::V1_0::helper::ScaleFilter;
+using ::android::hardware::camera::common::V1_0::helper::swapUvPlane;
+using ::android::hardware::camera::common::V1_0::helper::YuvPlanes;
+
+enum Layout { YU12, NV12, NV21 };
+
+// Deterministic, non-repeating byte pattern so that misplaced samples are caught
+void fillPattern(std::vector<uint8_t>* data, uint32_t seed) {
+    for (auto& b : *data) {
+        seed = seed * 1103515245 + 12345;
+        b = static_cast<uint8_t>(seed >> 16);
+    }
+}
+
+// A YUV 4:2:0 image whose lines are padded by `padding` bytes
+class Image {
+  public:
+    Image(int width, int height, Layout layout, int padding = 0) {
+        const int chromaWidth = (width + 1) / 2;
+        const int chromaHeight = (height + 1) / 2;
+        mPlanes.yStride = width + padding;
+        mPlanes.cStride = (layout == YU12 ? chromaWidth : chromaWidth * 2) + padding;
+        const size_t ySize = static_cast<size_t>(mPlanes.yStride) * height;
+        const size_t cSize = static_cast<size_t>(mPlanes.cStride) * chromaHeight;
+        mData.resize(ySize + cSize * (layout == YU12 ? 2 : 1));
+        fillPattern(&mData, width * 31 + height);
+
+        uint8_t* chroma = mData.data() + ySize;
+        mPlanes.y = mData.data();
+        switch (layout) {
+            case YU12:
+                mPlanes.cb = chroma;
+                mPlanes.cr = chroma + cSize;
+                mPlanes.chromaStep = 1;
+                break;
+            case NV12:
+                mPlanes.cb = chroma;
+                mPlanes.cr = chroma + 1;
+                mPlanes.chromaStep = 2;
+                break;
+            case NV21:
+                mPlanes.cr = chroma;
+                mPlanes.cb = chroma + 1;
+                mPlanes.chromaStep = 2;
+                break;
+        }
+    }
+
+    const YuvPlanes& planes() const { return mPlanes; }
+    std::vector<uint8_t>& data() { return mData; }
+
+  private:
+    std::vector<uint8_t> mData;
+    YuvPlanes mPlanes;
+};
+
+// Scalar reference for swapUvPlane
+void swapUvReference(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width,
+                     int height) {
+    for (int row = 0; row < height; row++) {
+        for (int i = 0; i < width; i++) {
+            const uint8_t u = src[row * srcStride + 2 * i];
+            const uint8_t v = src[row * srcStride + 2 * i + 1];
+            dst[row * dstStride + 2 * i] = v;
+            dst[row * dstStride + 2 * i + 1] = u;
+        }
+    }
+}
+
+// Reference for cropScaleConvert: libyuv scales the cropped planes, chroma is then
+// interleaved sample by sample
+void cropScaleReference(const YuvPlanes& in, int left, int top, int cropWidth, int cropHeight,
+                        const YuvPlanes& out, int outWidth, int outHeight, ScaleFilter filter) {
+    const libyuv::FilterMode mode = filter == ScaleFilter::BOX        ? libyuv::kFilterBox
+                                    : filter == ScaleFilter::BILINEAR ? libyuv::kFilterBilinear
+                                                                      : libyuv::kFilterNone;
+    const uint8_t* y = in.y + top * in.yStride + left;
+    const uint8_t* cb = in.cb + (top / 2) * in.cStride + left / 2;
+    const uint8_t* cr = in.cr + (top / 2) * in.cStride + left / 2;
+    const int chromaWidth = (outWidth + 1) / 2;
+    const int chromaHeight = (outHeight + 1) / 2;
+    std::vector<uint8_t> scaledCb(chromaWidth * chromaHeight);
+    std::vector<uint8_t> scaledCr(chromaWidth * chromaHeight);
+    ASSERT_EQ(0, libyuv::I420Scale(y, in.yStride, cb, in.cStride, cr, in.cStride, cropWidth,
+                                   cropHeight, out.y, out.yStride, scaledCb.data(), chromaWidth,
+                                   scaledCr.data(), chromaWidth, outWidth, outHeight, mode));
+    for (int row = 0; row < chromaHeight; row++) {
+        for (int i = 0; i < chromaWidth; i++) {
+            out.cb[row * out.cStride + i * out.chromaStep] = scaledCb[row * chromaWidth + i];
+            out.cr[row * out.cStride + i * out.chromaStep] = scaledCr[row * chromaWidth + i];
+        }
+    }
+}
+
+// Compares the visible pixels of two images with the same size and layout
+void expectSamePixels(const YuvPlanes& expected, const YuvPlanes& actual, int width,
+                      int height) {
+    for (int row = 0; row < height; row++) {
+        for (int i = 0; i < width; i++) {
+            ASSERT_EQ(expected.y[row * expected.yStride + i], actual.y[row * actual.yStride + i])
+                    << "Y at (" << i << ", " << row << ")";
+        }
+    }
+    for (int row = 0; row < (height + 1) / 2; row++) {
+        for (int i = 0; i < (width + 1) / 2; i++) {
+            ASSERT_EQ(expected.cb[row * expected.cStride + i * expected.chromaStep],
+                      actual.cb[row * actual.cStride + i * actual.chromaStep])
+                    << "Cb at (" << i << ", " << row << ")";
+            ASSERT_EQ(expected.cr[row * expected.cStride + i * expected.chromaStep],
+                      actual.cr[row * actual.cStride + i * actual.chromaStep])
+                    << "Cr at (" << i << ", " << row << ")";
+        }
+    }
+}
+
+TEST(YuvKernelsTest, swapUvPlaneMatchesReference) {
+    // Widths around the 8 (SSSE3) and 16 (NEON) sample vector lengths exercise the scalar
+    // tails of the SIMD kernels
+    for (int width = 1; width <= 40; width++) {
+        const int height = 3;
+        const int srcStride = width * 2 + 5;
+        const int dstStride = width * 2 + 3;
+        // one extra byte so that the rows can also be read from an unaligned address
+        std::vector<uint8_t> src(srcStride * height + 1);
+        fillPattern(&src, width);
+        for (int offset = 0; offset <= 1; offset++) {
+            std::vector<uint8_t> expected(dstStride * height, 0);
+            std::vector<uint8_t> actual(dstStride * height, 0);
+            swapUvReference(src.data() + offset, srcStride, expected.data(), dstStride, width,
+                            height);
+            swapUvPlane(src.data() + offset, srcStride, actual.data(), dstStride, width,
+                        height);
+            ASSERT_EQ(expected, actual) << "width " << width << " offset " << offset << " on "
+                                        << getYuvKernelIsa();
+        }
+    }
+}
+
+TEST(YuvKernelsTest, swapUvPlaneInPlace) {
+    for (int width : {7, 8, 9, 15, 16, 17, 33}) {
+        const int stride = width * 2 + 2;
+        const int height = 4;
+        std::vector<uint8_t> plane(stride * height);
+        fillPattern(&plane, width);
+        std::vector<uint8_t> expected = plane;
+        swapUvReference(plane.data(), stride, expected.data(), stride, width, height);
+        swapUvPlane(plane.data(), stride, plane.data(), stride, width, height);
+        ASSERT_EQ(expected, plane) << "width " << width;
+    }
+}
+
+struct CropScaleCase {
+    int inWidth;
+    int inHeight;
+    int left;
+    int top;
+    int cropWidth;
+    int cropHeight;
+    int outWidth;
+    int outHeight;
+};
+
+constexpr CropScaleCase kCropScaleCases[] = {
+        // straight copies, with and without an offset
+        {64, 48, 0, 0, 64, 48, 64, 48},
+        {64, 48, 6, 4, 33, 21, 33, 21},
+        // odd output sizes
+        {64, 48, 0, 0, 64, 48, 31, 17},
+        {97, 65, 2, 2, 91, 59, 45, 29},
+        // crop offsets with down- and upscaling
+        {160, 120, 10, 8, 128, 96, 64, 48},
+        {160, 120, 30, 14, 100, 75, 37, 23},
+        {80, 60, 4, 2, 40, 30, 77, 59},
+};
+
+TEST(YuvKernelsTest, cropScaleConvertMatchesReference) {
+    for (const auto& c : kCropScaleCases) {
+        Image in(c.inWidth, c.inHeight, YU12, /*padding*/ 3);
+        for (Layout layout : {YU12, NV12, NV21}) {
+            for (ScaleFilter filter :
+                 {ScaleFilter::NEAREST, ScaleFilter::BILINEAR, ScaleFilter::BOX}) {
+                Image expected(c.outWidth, c.outHeight, layout, /*padding*/ 5);
+                Image actual(c.outWidth, c.outHeight, layout, /*padding*/ 5);
+                cropScaleReference(in.planes(), c.left, c.top, c.cropWidth, c.cropHeight,
+                                   expected.planes(), c.outWidth, c.outHeight, filter);
+                ASSERT_EQ(0, cropScaleConvert(in.planes(), c.left, c.top, c.cropWidth,
+                                              c.cropHeight, actual.planes(), c.outWidth,
+                                              c.outHeight, filter));
+                SCOPED_TRACE(testing::Message()
+                             << c.inWidth << "x" << c.inHeight << " crop (" << c.left << ", "
+                             << c.top << ") " << c.cropWidth << "x" << c.cropHeight << " to "
+                             << c.outWidth << "x" << c.outHeight << ", layout " << layout
+                             << ", filter " << static_cast<int>(filter));
+                expectSamePixels(expected.planes(), actual.planes(), c.outWidth, c.outHeight);
+            }
+        }
+    }
+}
+
+TEST(YuvKernelsTest, cropScaleConvertRejectsOddOffset) {
+    Image in(64, 48, YU12);
+    Image out(32, 24, NV12);
+    EXPECT_NE(0, cropScaleConvert(in.planes(), 1, 0, 32, 24, out.planes(), 32, 24,
+                                  ScaleFilter::NEAREST));
+    EXPECT_NE(0, cropScaleConvert(in.planes(), 0, 3, 32, 24, out.planes(), 32, 24,
+                                  ScaleFilter::NEAREST));
+}
+
+TEST(YuvKernelsTest, cropScaleConvertRejectsSemiPlanarInput) {
+    Image in(64, 48, NV12);
+    Image out(32, 24, YU12);
+    EXPECT_NE(0, cropScaleConvert(in.planes(), 0, 0, 64, 48, out.planes(), 32, 24,
+                                  ScaleFilter::BILINEAR));
+}
+
+}  // namespace
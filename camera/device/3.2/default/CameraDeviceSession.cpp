@@ -17,6 +17,7 @@
 #define LOG_TAG "CamDevSession@3.2-impl"
 #include <android/log.h>
 
+#include <algorithm>
 #include <set>
 #include <cutils/properties.h>
 #include <utils/Trace.h>
@@ -43,11 +44,246 @@ static constexpr int32_t CAMERA_RESULT_METADATA_QUEUE_SIZE  = 1 << 20 /* 1MB */;
 static constexpr int METADATA_SHRINK_ABS_THRESHOLD = 4096;
 static constexpr int METADATA_SHRINK_REL_THRESHOLD = 2;
 
+// Minimum number of frames tracked in the inflight ring before falling back to the
+// overflow map. Scaled up for devices reporting a deeper pipeline.
+static constexpr size_t MIN_INFLIGHT_FRAMES = 32;
+
+static size_t getInflightFramesCapacity(const camera_metadata_t* deviceInfo) {
+    size_t capacity = MIN_INFLIGHT_FRAMES;
+    camera_metadata_ro_entry entry;
+    if (find_camera_metadata_ro_entry(deviceInfo, ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
+            &entry) == 0 && entry.count > 0) {
+        capacity = std::max(capacity, static_cast<size_t>(entry.data.u8[0]) * 4);
+    }
+    return capacity;
+}
+
 HandleImporter CameraDeviceSession::sHandleImporter;
 buffer_handle_t CameraDeviceSession::sEmptyBuffer = nullptr;
 
 const int CameraDeviceSession::ResultBatcher::NOT_BATCHED;
 
+CameraDeviceSession::InflightFrames::InflightFrames(size_t capacity) :
+        mCapacity(capacity), mSlots(new Slot[capacity]) {}
+
+template <typename F>
+bool CameraDeviceSession::InflightFrames::withFrame(uint32_t frameNumber, bool create, F f) {
+    Slot& slot = mSlots[frameNumber % mCapacity];
+    std::lock_guard<std::mutex> lk(slot.lock);
+    Frame& frame = slot.frame;
+    if (frame.inUse() && frame.frameNumber == frameNumber) {
+        f(frame);
+        return true;
+    }
+
+    bool slotFree = !frame.inUse();
+    if (mOverflowSize > 0 || !slotFree) {
+        std::lock_guard<std::mutex> overflowLock(mOverflowLock);
+        auto it = mOverflow.find(frameNumber);
+        if (it == mOverflow.end()) {
+            if (!create) {
+                return false;
+            }
+            if (!slotFree) {
+                ALOGV("%s: frame %u collides with inflight frame %u", __FUNCTION__,
+                        frameNumber, frame.frameNumber);
+                it = mOverflow.emplace(frameNumber, Frame{}).first;
+                it->second.frameNumber = frameNumber;
+                mOverflowSize++;
+            }
+        }
+        if (it != mOverflow.end()) {
+            f(it->second);
+            if (!it->second.inUse()) {
+                mOverflow.erase(it);
+                mOverflowSize--;
+            }
+            return true;
+        }
+    }
+
+    if (!create) {
+        return false;
+    }
+    frame.frameNumber = frameNumber;
+    f(frame);
+    return true;
+}
+
+camera3_stream_buffer_t* CameraDeviceSession::InflightFrames::addInputBuffer(
+        uint32_t frameNumber, int streamId) {
+    camera3_stream_buffer_t* buffer = nullptr;
+    withFrame(frameNumber, /*create*/true, [&](Frame& frame) {
+        if (frame.inputStreamId == -1) {
+            mNumBuffers++;
+        }
+        frame.inputStreamId = streamId;
+        frame.inputBuffer = camera3_stream_buffer_t{};
+        buffer = &frame.inputBuffer;
+    });
+    return buffer;
+}
+
+void CameraDeviceSession::InflightFrames::addOutputBuffer(uint32_t frameNumber, int streamId) {
+    withFrame(frameNumber, /*create*/true, [&](Frame& frame) {
+        frame.outputStreamIds.push_back(streamId);
+        mNumBuffers++;
+    });
+}
+
+bool CameraDeviceSession::InflightFrames::hasBuffer(uint32_t frameNumber, int streamId) {
+    bool found = false;
+    withFrame(frameNumber, /*create*/false, [&](Frame& frame) {
+        found = frame.inputStreamId == streamId ||
+                std::find(frame.outputStreamIds.begin(), frame.outputStreamIds.end(),
+                        streamId) != frame.outputStreamIds.end();
+    });
+    return found;
+}
+
+void CameraDeviceSession::InflightFrames::removeBuffer(uint32_t frameNumber, int streamId) {
+    withFrame(frameNumber, /*create*/false, [&](Frame& frame) {
+        if (frame.inputStreamId == streamId) {
+            frame.inputStreamId = -1;
+            mNumBuffers--;
+            return;
+        }
+        auto it = std::find(frame.outputStreamIds.begin(), frame.outputStreamIds.end(),
+                streamId);
+        if (it != frame.outputStreamIds.end()) {
+            *it = frame.outputStreamIds.back();
+            frame.outputStreamIds.pop_back();
+            mNumBuffers--;
+        }
+    });
+}
+
+void CameraDeviceSession::InflightFrames::removeAllBuffers(uint32_t frameNumber) {
+    withFrame(frameNumber, /*create*/false, [&](Frame& frame) {
+        mNumBuffers -= frame.outputStreamIds.size() + (frame.inputStreamId != -1 ? 1 : 0);
+        frame.inputStreamId = -1;
+        frame.outputStreamIds.clear();
+    });
+}
+
+void CameraDeviceSession::InflightFrames::setAETriggerOverride(
+        uint32_t frameNumber, const AETriggerCancelOverride& o) {
+    withFrame(frameNumber, /*create*/true, [&](Frame& frame) {
+        if (!frame.hasAETriggerOverride) {
+            frame.hasAETriggerOverride = true;
+            mNumAETriggerOverrides++;
+        }
+        frame.aeTriggerOverride = o;
+    });
+}
+
+bool CameraDeviceSession::InflightFrames::getAETriggerOverride(
+        uint32_t frameNumber, bool finalResult, AETriggerCancelOverride* out) {
+    bool found = false;
+    withFrame(frameNumber, /*create*/false, [&](Frame& frame) {
+        if (!frame.hasAETriggerOverride) {
+            return;
+        }
+        found = true;
+        *out = frame.aeTriggerOverride;
+        if (finalResult) {
+            frame.hasAETriggerOverride = false;
+            mNumAETriggerOverrides--;
+        }
+    });
+    return found;
+}
+
+bool CameraDeviceSession::InflightFrames::updateRawBoost(
+        uint32_t frameNumber, bool present, bool finalResult) {
+    bool needDefault = false;
+    withFrame(frameNumber, /*create*/true, [&](Frame& frame) {
+        if (!frame.hasRawBoost) {
+            frame.hasRawBoost = true;
+            frame.rawBoostPresent = false;
+            mNumRawBoosts++;
+        }
+        if (present) {
+            frame.rawBoostPresent = true;
+        }
+        if (finalResult) {
+            needDefault = !frame.rawBoostPresent;
+            frame.hasRawBoost = false;
+            mNumRawBoosts--;
+        }
+    });
+    return needDefault;
+}
+
+void CameraDeviceSession::InflightFrames::removeOverrides(uint32_t frameNumber) {
+    withFrame(frameNumber, /*create*/false, [&](Frame& frame) {
+        if (frame.hasAETriggerOverride) {
+            frame.hasAETriggerOverride = false;
+            mNumAETriggerOverrides--;
+        }
+        if (frame.hasRawBoost) {
+            frame.hasRawBoost = false;
+            mNumRawBoosts--;
+        }
+    });
+}
+
+buffer_handle_t* CameraDeviceSession::CirculatingBuffers::find(uint64_t bufId) {
+    if (bufId < kMaxDenseId) {
+        size_t block = bufId / kBlockSize;
+        if (block >= mBlocks.size() || mBlocks[block] == nullptr) {
+            return nullptr;
+        }
+        buffer_handle_t* entry = &mBlocks[block][bufId % kBlockSize];
+        return (*entry != nullptr) ? entry : nullptr;
+    }
+    auto it = mSparse.find(bufId);
+    return (it != mSparse.end()) ? &it->second : nullptr;
+}
+
+buffer_handle_t* CameraDeviceSession::CirculatingBuffers::insert(
+        uint64_t bufId, buffer_handle_t buf) {
+    if (bufId < kMaxDenseId) {
+        size_t block = bufId / kBlockSize;
+        if (block >= mBlocks.size()) {
+            mBlocks.resize(block + 1);
+        }
+        if (mBlocks[block] == nullptr) {
+            mBlocks[block].reset(new buffer_handle_t[kBlockSize]());
+        }
+        buffer_handle_t* entry = &mBlocks[block][bufId % kBlockSize];
+        *entry = buf;
+        return entry;
+    }
+    buffer_handle_t& entry = mSparse[bufId];
+    entry = buf;
+    return &entry;
+}
+
+buffer_handle_t CameraDeviceSession::CirculatingBuffers::remove(uint64_t bufId) {
+    if (bufId < kMaxDenseId) {
+        buffer_handle_t* entry = find(bufId);
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        buffer_handle_t buf = *entry;
+        *entry = nullptr;
+        return buf;
+    }
+    auto it = mSparse.find(bufId);
+    if (it == mSparse.end()) {
+        return nullptr;
+    }
+    buffer_handle_t buf = it->second;
+    mSparse.erase(it);
+    return buf;
+}
+
+void CameraDeviceSession::CirculatingBuffers::clear() {
+    mBlocks.clear();
+    mSparse.clear();
+}
+
 CameraDeviceSession::CameraDeviceSession(
     camera3_device_t* device,
     const camera_metadata_t* deviceInfo,
@@ -59,6 +295,7 @@ CameraDeviceSession::CameraDeviceSession(
         mIsAELockAvailable(false),
         mDerivePostRawSensKey(false),
         mNumPartialResults(1),
+        mInflightFrames(getInflightFramesCapacity(deviceInfo)),
         mResultBatcher(callback) {
     mDeviceInfo = deviceInfo;
     camera_metadata_entry partialResultsCount =
@@ -148,6 +385,12 @@ bool CameraDeviceSession::initialize() {
     }
     mResultBatcher.setResultMetadataQueue(mResultMetadataQueue);
 
+    mResultMetadataDelta = property_get_bool("ro.vendor.camera.res.fmq.delta", false);
+    if (mResultMetadataDelta) {
+        ALOGI("%s: result metadata FMQ is delta encoded", __FUNCTION__);
+    }
+    mResultBatcher.setResultMetadataDelta(mResultMetadataDelta);
+
     return false;
 }
 
@@ -284,7 +527,8 @@ Status CameraDeviceSession::importBuffer(int32_t streamId,
 
     Mutex::Autolock _l(mInflightLock);
     CirculatingBuffers& cbs = mCirculatingBuffers[streamId];
-    if (cbs.count(bufId) == 0) {
+    buffer_handle_t* cachedBuf = cbs.find(bufId);
+    if (cachedBuf == nullptr) {
         // Register a newly seen buffer
         buffer_handle_t importedBuf = buf;
         sHandleImporter.importBuffer(importedBuf);
@@ -292,10 +536,10 @@ Status CameraDeviceSession::importBuffer(int32_t streamId,
             ALOGE("%s: output buffer for stream %d is invalid!", __FUNCTION__, streamId);
             return Status::INTERNAL_ERROR;
         } else {
-            cbs[bufId] = importedBuf;
+            cachedBuf = cbs.insert(bufId, importedBuf);
         }
     }
-    *outBufPtr = &cbs[bufId];
+    *outBufPtr = cachedBuf;
     return Status::OK;
 }
 
@@ -413,6 +657,33 @@ void CameraDeviceSession::ResultBatcher::setResultMetadataQueue(
     mResultMetadataQueue = q;
 }
 
+void CameraDeviceSession::ResultBatcher::setResultMetadataDelta(bool enable) {
+    Mutex::Autolock _l(mProcessCaptureResultLock);
+    if (enable) {
+        mMetadataDeltaEncoder = std::make_unique<MetadataDeltaEncoder>();
+    } else {
+        mMetadataDeltaEncoder.reset();
+    }
+}
+
+size_t CameraDeviceSession::ResultBatcher::writeResultMetadataLocked(
+        const hidl_vec<uint8_t>& metadata, uint32_t partialResult) {
+    if (mMetadataDeltaEncoder == nullptr) {
+        return mResultMetadataQueue->write(metadata.data(), metadata.size()) ?
+                metadata.size() : 0;
+    }
+
+    const camera_metadata_t* md = reinterpret_cast<const camera_metadata_t*>(metadata.data());
+    uint32_t channel = MetadataDeltaEncoder::getChannel(md, partialResult);
+    if (mMetadataDeltaEncoder->encode(channel, md, &mMetadataDeltaBlob) != OK ||
+            !mResultMetadataQueue->write(mMetadataDeltaBlob.data(), mMetadataDeltaBlob.size())) {
+        // The full metadata goes over hwbinder and the channel keeps its base
+        return 0;
+    }
+    mMetadataDeltaEncoder->commit();
+    return mMetadataDeltaBlob.size();
+}
+
 void CameraDeviceSession::ResultBatcher::registerBatch(uint32_t frameNumber, uint32_t batchSize) {
     auto batch = std::make_shared<InflightBatch>();
     batch->mFirstFrame = frameNumber;
@@ -729,8 +1000,9 @@ void CameraDeviceSession::ResultBatcher::invokeProcessCaptureResultCallback(
     if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
         for (CaptureResult &result : results) {
             if (result.result.size() > 0) {
-                if (mResultMetadataQueue->write(result.result.data(), result.result.size())) {
-                    result.fmqResultSize = result.result.size();
+                size_t written = writeResultMetadataLocked(result.result, result.partialResult);
+                if (written > 0) {
+                    result.fmqResultSize = written;
                     result.result.resize(0);
                 } else {
                     ALOGW("%s: couldn't utilize fmq, fall back to hwbinder, result size: %zu,"
@@ -1034,25 +1306,25 @@ Return<void> CameraDeviceSession::configureStreams(
     // hold the inflight lock for entire configureStreams scope since there must not be any
     // inflight request/results during stream configuration.
     Mutex::Autolock _l(mInflightLock);
-    if (!mInflightBuffers.empty()) {
+    if (mInflightFrames.numBuffers() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight buffers!",
-                __FUNCTION__, mInflightBuffers.size());
+                __FUNCTION__, mInflightFrames.numBuffers());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
 
-    if (!mInflightAETriggerOverrides.empty()) {
+    if (mInflightFrames.numAETriggerOverrides() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " trigger overrides!", __FUNCTION__,
-                mInflightAETriggerOverrides.size());
+                mInflightFrames.numAETriggerOverrides());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
 
-    if (!mInflightRawBoostPresent.empty()) {
+    if (mInflightFrames.numRawBoosts() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " boost overrides!", __FUNCTION__,
-                mInflightRawBoostPresent.size());
+                mInflightFrames.numRawBoosts());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
@@ -1096,9 +1368,9 @@ Return<void> CameraDeviceSession::configureStreams(
 
 // Needs to get called after acquiring 'mInflightLock'
 void CameraDeviceSession::cleanupBuffersLocked(int id) {
-    for (auto& pair : mCirculatingBuffers.at(id)) {
-        sHandleImporter.freeBuffer(pair.second);
-    }
+    mCirculatingBuffers.at(id).forEach([](buffer_handle_t buf) {
+        sHandleImporter.freeBuffer(buf);
+    });
     mCirculatingBuffers[id].clear();
     mCirculatingBuffers.erase(id);
 }
@@ -1112,10 +1384,9 @@ void CameraDeviceSession::updateBufferCaches(const hidl_vec<BufferCache>& caches
             continue;
         }
         CirculatingBuffers& cbs = cbsIt->second;
-        auto it = cbs.find(cache.bufferId);
-        if (it != cbs.end()) {
-            sHandleImporter.freeBuffer(it->second);
-            cbs.erase(it);
+        buffer_handle_t buf = cbs.remove(cache.bufferId);
+        if (buf != nullptr) {
+            sHandleImporter.freeBuffer(buf);
         } else {
             ALOGE("%s: stream %d buffer %" PRIu64 " is not cached",
                     __FUNCTION__, cache.streamId, cache.bufferId);
@@ -1220,26 +1491,25 @@ Status CameraDeviceSession::processOneCaptureRequest(const CaptureRequest& reque
     {
         Mutex::Autolock _l(mInflightLock);
         if (hasInputBuf) {
-            auto key = std::make_pair(request.inputBuffer.streamId, request.frameNumber);
-            auto& bufCache = mInflightBuffers[key] = camera3_stream_buffer_t{};
+            camera3_stream_buffer_t* bufCache = mInflightFrames.addInputBuffer(
+                    request.frameNumber, request.inputBuffer.streamId);
             convertFromHidl(
                     allBufPtrs[numOutputBufs], request.inputBuffer.status,
                     &mStreamMap[request.inputBuffer.streamId], allFences[numOutputBufs],
-                    &bufCache);
-            halRequest.input_buffer = &bufCache;
+                    bufCache);
+            halRequest.input_buffer = bufCache;
         } else {
             halRequest.input_buffer = nullptr;
         }
 
         halRequest.num_output_buffers = numOutputBufs;
         for (size_t i = 0; i < numOutputBufs; i++) {
-            auto key = std::make_pair(request.outputBuffers[i].streamId, request.frameNumber);
-            auto& bufCache = mInflightBuffers[key] = camera3_stream_buffer_t{};
+            mInflightFrames.addOutputBuffer(
+                    request.frameNumber, request.outputBuffers[i].streamId);
             convertFromHidl(
                     allBufPtrs[i], request.outputBuffers[i].status,
                     &mStreamMap[request.outputBuffers[i].streamId], allFences[i],
-                    &bufCache);
-            outHalBufs[i] = bufCache;
+                    &outHalBufs[i]);
         }
         halRequest.output_buffers = outHalBufs.data();
 
@@ -1247,8 +1517,7 @@ Status CameraDeviceSession::processOneCaptureRequest(const CaptureRequest& reque
         aeCancelTriggerNeeded = handleAePrecaptureCancelRequestLocked(
                 halRequest, &settingsOverride /*out*/, &triggerOverride/*out*/);
         if (aeCancelTriggerNeeded) {
-            mInflightAETriggerOverrides[halRequest.frame_number] =
-                    triggerOverride;
+            mInflightFrames.setAETriggerOverride(halRequest.frame_number, triggerOverride);
             halRequest.settings = settingsOverride.getAndLock();
         }
     }
@@ -1266,16 +1535,9 @@ Status CameraDeviceSession::processOneCaptureRequest(const CaptureRequest& reque
         ALOGE("%s: HAL process_capture_request call failed!", __FUNCTION__);
 
         cleanupInflightFences(allFences, numBufs);
-        if (hasInputBuf) {
-            auto key = std::make_pair(request.inputBuffer.streamId, request.frameNumber);
-            mInflightBuffers.erase(key);
-        }
-        for (size_t i = 0; i < numOutputBufs; i++) {
-            auto key = std::make_pair(request.outputBuffers[i].streamId, request.frameNumber);
-            mInflightBuffers.erase(key);
-        }
+        mInflightFrames.removeAllBuffers(request.frameNumber);
         if (aeCancelTriggerNeeded) {
-            mInflightAETriggerOverrides.erase(request.frameNumber);
+            mInflightFrames.removeOverrides(request.frameNumber);
         }
         return Status::INTERNAL_ERROR;
     }
@@ -1301,19 +1563,19 @@ Return<void> CameraDeviceSession::close()  {
     if (!mClosed) {
         {
             Mutex::Autolock _l(mInflightLock);
-            if (!mInflightBuffers.empty()) {
+            if (mInflightFrames.numBuffers() != 0) {
                 ALOGE("%s: trying to close while there are still %zu inflight buffers!",
-                        __FUNCTION__, mInflightBuffers.size());
+                        __FUNCTION__, mInflightFrames.numBuffers());
             }
-            if (!mInflightAETriggerOverrides.empty()) {
+            if (mInflightFrames.numAETriggerOverrides() != 0) {
                 ALOGE("%s: trying to close while there are still %zu inflight "
                         "trigger overrides!", __FUNCTION__,
-                        mInflightAETriggerOverrides.size());
+                        mInflightFrames.numAETriggerOverrides());
             }
-            if (!mInflightRawBoostPresent.empty()) {
+            if (mInflightFrames.numRawBoosts() != 0) {
                 ALOGE("%s: trying to close while there are still %zu inflight "
                         " RAW boost overrides!", __FUNCTION__,
-                        mInflightRawBoostPresent.size());
+                        mInflightFrames.numRawBoosts());
             }
 
         }
@@ -1326,9 +1588,9 @@ Return<void> CameraDeviceSession::close()  {
         Mutex::Autolock _l(mInflightLock);
         for(auto& pair : mCirculatingBuffers) {
             CirculatingBuffers& buffers = pair.second;
-            for (auto& p2 : buffers) {
-                sHandleImporter.freeBuffer(p2.second);
-            }
+            buffers.forEach([](buffer_handle_t buf) {
+                sHandleImporter.freeBuffer(buf);
+            });
             buffers.clear();
         }
         mCirculatingBuffers.clear();
@@ -1350,12 +1612,10 @@ status_t CameraDeviceSession::constructCaptureResult(CaptureResult& result,
     size_t numOutputBufs = hal_result->num_output_buffers;
     size_t numBufs = numOutputBufs + (hasInputBuf ? 1 : 0);
     if (numBufs > 0) {
-        Mutex::Autolock _l(mInflightLock);
         if (hasInputBuf) {
             int streamId = static_cast<Camera3Stream*>(hal_result->input_buffer->stream)->mId;
             // validate if buffer is inflight
-            auto key = std::make_pair(streamId, frameNumber);
-            if (mInflightBuffers.count(key) != 1) {
+            if (!mInflightFrames.hasBuffer(frameNumber, streamId)) {
                 ALOGE("%s: input buffer for stream %d frame %d is not inflight!",
                         __FUNCTION__, streamId, frameNumber);
                 return -EINVAL;
@@ -1365,8 +1625,7 @@ status_t CameraDeviceSession::constructCaptureResult(CaptureResult& result,
         for (size_t i = 0; i < numOutputBufs; i++) {
             int streamId = static_cast<Camera3Stream*>(hal_result->output_buffers[i].stream)->mId;
             // validate if buffer is inflight
-            auto key = std::make_pair(streamId, frameNumber);
-            if (mInflightBuffers.count(key) != 1) {
+            if (!mInflightFrames.hasBuffer(frameNumber, streamId)) {
                 ALOGE("%s: output buffer for stream %d frame %d is not inflight!",
                         __FUNCTION__, streamId, frameNumber);
                 return -EINVAL;
@@ -1380,58 +1639,48 @@ status_t CameraDeviceSession::constructCaptureResult(CaptureResult& result,
     result.partialResult = hal_result->partial_result;
     convertToHidl(hal_result->result, &result.result);
     if (nullptr != hal_result->result) {
+        // The overridden result is referenced by result.result until the result has been
+        // sent to camera service. HAL callback threads each keep their own copy, which is
+        // reset rather than reallocated between results.
+        static thread_local ::android::hardware::camera::common::V1_0::helper::CameraMetadata
+                sOverridenResult;
         bool resultOverriden = false;
-        Mutex::Autolock _l(mInflightLock);
+        bool finalResult = (hal_result->partial_result == mNumPartialResults);
 
         // Derive some new keys for backward compatibility
         if (mDerivePostRawSensKey) {
             camera_metadata_ro_entry entry;
-            if (find_camera_metadata_ro_entry(hal_result->result,
-                    ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST, &entry) == 0) {
-                mInflightRawBoostPresent[frameNumber] = true;
-            } else {
-                auto entry = mInflightRawBoostPresent.find(frameNumber);
-                if (mInflightRawBoostPresent.end() == entry) {
-                    mInflightRawBoostPresent[frameNumber] = false;
-                }
-            }
-
-            if ((hal_result->partial_result == mNumPartialResults)) {
-                if (!mInflightRawBoostPresent[frameNumber]) {
-                    if (!resultOverriden) {
-                        mOverridenResult.clear();
-                        mOverridenResult.append(hal_result->result);
-                        resultOverriden = true;
-                    }
-                    int32_t defaultBoost[1] = {100};
-                    mOverridenResult.update(
-                            ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
-                            defaultBoost, 1);
+            bool present = find_camera_metadata_ro_entry(hal_result->result,
+                    ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST, &entry) == 0;
+            if (mInflightFrames.updateRawBoost(frameNumber, present, finalResult)) {
+                if (!resultOverriden) {
+                    sOverridenResult.reset();
+                    sOverridenResult.append(hal_result->result);
+                    resultOverriden = true;
                 }
-
-                mInflightRawBoostPresent.erase(frameNumber);
+                int32_t defaultBoost[1] = {100};
+                sOverridenResult.update(
+                        ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
+                        defaultBoost, 1);
             }
         }
 
-        auto entry = mInflightAETriggerOverrides.find(frameNumber);
-        if (mInflightAETriggerOverrides.end() != entry) {
+        AETriggerCancelOverride aeTriggerOverride;
+        if (mInflightFrames.getAETriggerOverride(frameNumber, finalResult, &aeTriggerOverride)) {
             if (!resultOverriden) {
-                mOverridenResult.clear();
-                mOverridenResult.append(hal_result->result);
+                sOverridenResult.reset();
+                sOverridenResult.append(hal_result->result);
                 resultOverriden = true;
             }
-            overrideResultForPrecaptureCancelLocked(entry->second,
-                    &mOverridenResult);
-            if (hal_result->partial_result == mNumPartialResults) {
-                mInflightAETriggerOverrides.erase(frameNumber);
-            }
+            overrideResultForPrecaptureCancelLocked(aeTriggerOverride,
+                    &sOverridenResult);
         }
 
         if (resultOverriden) {
             const camera_metadata_t *metaBuffer =
-                    mOverridenResult.getAndLock();
+                    sOverridenResult.getAndLock();
             convertToHidl(metaBuffer, &result.result);
-            mOverridenResult.unlock(metaBuffer);
+            sOverridenResult.unlock(metaBuffer);
         }
     }
     if (hasInputBuf) {
@@ -1480,20 +1729,17 @@ status_t CameraDeviceSession::constructCaptureResult(CaptureResult& result,
     // configure_streams right after the processCaptureResult call so we need to finish
     // updating inflight queues first
     if (numBufs > 0) {
-        Mutex::Autolock _l(mInflightLock);
         if (hasInputBuf) {
             int streamId = static_cast<Camera3Stream*>(hal_result->input_buffer->stream)->mId;
-            auto key = std::make_pair(streamId, frameNumber);
-            mInflightBuffers.erase(key);
+            mInflightFrames.removeBuffer(frameNumber, streamId);
         }
 
         for (size_t i = 0; i < numOutputBufs; i++) {
             int streamId = static_cast<Camera3Stream*>(hal_result->output_buffers[i].stream)->mId;
-            auto key = std::make_pair(streamId, frameNumber);
-            mInflightBuffers.erase(key);
+            mInflightFrames.removeBuffer(frameNumber, streamId);
         }
 
-        if (mInflightBuffers.empty()) {
+        if (mInflightFrames.numBuffers() == 0) {
             ALOGV("%s: inflight buffer queue is now empty!", __FUNCTION__);
         }
     }
@@ -1601,23 +1847,8 @@ void CameraDeviceSession::sNotify(
         switch (hidlMsg.msg.error.errorCode) {
             case ErrorCode::ERROR_DEVICE:
             case ErrorCode::ERROR_REQUEST:
-            case ErrorCode::ERROR_RESULT: {
-                Mutex::Autolock _l(d->mInflightLock);
-                auto entry = d->mInflightAETriggerOverrides.find(
-                        hidlMsg.msg.error.frameNumber);
-                if (d->mInflightAETriggerOverrides.end() != entry) {
-                    d->mInflightAETriggerOverrides.erase(
-                            hidlMsg.msg.error.frameNumber);
-                }
-
-                auto boostEntry = d->mInflightRawBoostPresent.find(
-                        hidlMsg.msg.error.frameNumber);
-                if (d->mInflightRawBoostPresent.end() != boostEntry) {
-                    d->mInflightRawBoostPresent.erase(
-                            hidlMsg.msg.error.frameNumber);
-                }
-
-            }
+            case ErrorCode::ERROR_RESULT:
+                d->mInflightFrames.removeOverrides(hidlMsg.msg.error.frameNumber);
                 break;
             case ErrorCode::ERROR_BUFFER:
             default:
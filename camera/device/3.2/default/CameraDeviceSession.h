@@ -23,11 +23,15 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <include/convert.h>
+#include <atomic>
 #include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include "CameraMetadata.h"
 #include "HandleImporter.h"
+#include "MetadataDelta.h"
 #include "hardware/camera3.h"
 #include "hardware/camera_common.h"
 #include "utils/Mutex.h"
@@ -45,6 +49,7 @@ using ::android::hardware::camera::device::V3_2::StreamConfiguration;
 using ::android::hardware::camera::device::V3_2::ICameraDeviceSession;
 using ::android::hardware::camera::common::V1_0::Status;
 using ::android::hardware::camera::common::V1_0::helper::HandleImporter;
+using ::android::hardware::camera::common::V1_0::helper::MetadataDeltaEncoder;
 using ::android::hardware::kSynchronizedReadWrite;
 using ::android::hardware::MessageQueue;
 using ::android::hardware::MQDescriptorSync;
@@ -151,14 +156,78 @@ protected:
     // Stream ID -> Camera3Stream cache
     std::map<int, Camera3Stream> mStreamMap;
 
-    mutable Mutex mInflightLock; // protecting mInflightBuffers and mCirculatingBuffers
-    // (streamID, frameNumber) -> inflight buffer cache
-    std::map<std::pair<int, uint32_t>, camera3_stream_buffer_t>  mInflightBuffers;
+    // Bookkeeping of requests sent to the HAL that have not been completed yet: the
+    // buffers in flight, AE precapture trigger overrides and whether the result carried
+    // ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST.
+    // Frames live in a fixed ring indexed by frameNumber modulo its capacity, each slot
+    // with its own lock, so the result path never waits on mInflightLock. A frame whose
+    // slot is still held by an older frame is kept in an overflow map instead.
+    class InflightFrames {
+    public:
+        explicit InflightFrames(size_t capacity);
+
+        // The returned buffer is passed to the HAL as the request input buffer. It
+        // stays valid until the frame's buffers are removed.
+        camera3_stream_buffer_t* addInputBuffer(uint32_t frameNumber, int streamId);
+        void addOutputBuffer(uint32_t frameNumber, int streamId);
+        bool hasBuffer(uint32_t frameNumber, int streamId);
+        void removeBuffer(uint32_t frameNumber, int streamId);
+        void removeAllBuffers(uint32_t frameNumber);
+
+        void setAETriggerOverride(uint32_t frameNumber, const AETriggerCancelOverride& o);
+        // Returns false if the frame has no override. The override is dropped once the
+        // final partial result is seen.
+        bool getAETriggerOverride(uint32_t frameNumber, bool finalResult,
+                AETriggerCancelOverride* out);
+        // Record whether a partial result carried the RAW sensitivity boost. Returns
+        // true if the final result needs the default boost added.
+        bool updateRawBoost(uint32_t frameNumber, bool present, bool finalResult);
+        // Drop the metadata overrides of a frame that ended with an error
+        void removeOverrides(uint32_t frameNumber);
+
+        size_t numBuffers() const { return mNumBuffers; }
+        size_t numAETriggerOverrides() const { return mNumAETriggerOverrides; }
+        size_t numRawBoosts() const { return mNumRawBoosts; }
+
+    private:
+        struct Frame {
+            uint32_t frameNumber = 0;
+            int inputStreamId = -1;
+            camera3_stream_buffer_t inputBuffer {};
+            std::vector<int> outputStreamIds;
+            bool hasAETriggerOverride = false;
+            AETriggerCancelOverride aeTriggerOverride {};
+            bool hasRawBoost = false;
+            bool rawBoostPresent = false;
+
+            bool inUse() const {
+                return inputStreamId != -1 || !outputStreamIds.empty() ||
+                        hasAETriggerOverride || hasRawBoost;
+            }
+        };
+        struct Slot {
+            std::mutex lock;
+            Frame frame;
+        };
+
+        // Runs f on the frame record, with its slot locked. If create is false and the
+        // frame is not tracked, f is not called and false is returned.
+        template <typename F>
+        bool withFrame(uint32_t frameNumber, bool create, F f);
+
+        const size_t mCapacity;
+        std::unique_ptr<Slot[]> mSlots;
+        std::mutex mOverflowLock; // Lock after a slot lock, never before
+        std::map<uint32_t, Frame> mOverflow;
+        std::atomic<size_t> mOverflowSize {0};
+        std::atomic<size_t> mNumBuffers {0};
+        std::atomic<size_t> mNumAETriggerOverrides {0};
+        std::atomic<size_t> mNumRawBoosts {0};
+    };
+
+    mutable Mutex mInflightLock; // protecting mCirculatingBuffers and request-side stream state
+    InflightFrames mInflightFrames;
 
-    // (frameNumber, AETriggerOverride) -> inflight request AETriggerOverrides
-    std::map<uint32_t, AETriggerCancelOverride> mInflightAETriggerOverrides;
-    ::android::hardware::camera::common::V1_0::helper::CameraMetadata mOverridenResult;
-    std::map<uint32_t, bool> mInflightRawBoostPresent;
     ::android::hardware::camera::common::V1_0::helper::CameraMetadata mOverridenRequest;
 
     static const uint64_t BUFFER_ID_NO_BUFFER = 0;
@@ -167,7 +236,37 @@ protected:
     // value: imported buffer_handle_t
     // Buffer will be imported during process_capture_request and will be freed
     // when the its stream is deleted or camera device session is closed
-    typedef std::unordered_map<uint64_t, buffer_handle_t> CirculatingBuffers;
+    // The camera service hands out small, increasing buffer ids, so they index straight
+    // into fixed-size blocks; ids past kMaxDenseId go to a hash map. Entries never move
+    // since their addresses are passed to the HAL.
+    class CirculatingBuffers {
+    public:
+        // Returns nullptr if bufId is not cached
+        buffer_handle_t* find(uint64_t bufId);
+        buffer_handle_t* insert(uint64_t bufId, buffer_handle_t buf);
+        // Returns the removed handle, or nullptr if bufId is not cached
+        buffer_handle_t remove(uint64_t bufId);
+        template <typename F>
+        void forEach(F f) {
+            for (auto& block : mBlocks) {
+                for (size_t i = 0; block != nullptr && i < kBlockSize; i++) {
+                    if (block[i] != nullptr) {
+                        f(block[i]);
+                    }
+                }
+            }
+            for (auto& pair : mSparse) {
+                f(pair.second);
+            }
+        }
+        void clear();
+
+    private:
+        static constexpr size_t kBlockSize = 64;
+        static constexpr uint64_t kMaxDenseId = 64 * kBlockSize;
+        std::vector<std::unique_ptr<buffer_handle_t[]>> mBlocks;
+        std::unordered_map<uint64_t, buffer_handle_t> mSparse;
+    };
     // Stream ID -> circulating buffers map
     std::map<int, CirculatingBuffers> mCirculatingBuffers;
 
@@ -183,6 +282,9 @@ protected:
     std::unique_ptr<RequestMetadataQueue> mRequestMetadataQueue;
     using ResultMetadataQueue = MessageQueue<uint8_t, kSynchronizedReadWrite>;
     std::shared_ptr<ResultMetadataQueue> mResultMetadataQueue;
+    // Delta encode result metadata written to the result FMQ. Only for clients that
+    // decode it with MetadataDeltaDecoder, see ro.vendor.camera.res.fmq.delta.
+    bool mResultMetadataDelta = false;
 
     class ResultBatcher {
     public:
@@ -190,6 +292,7 @@ protected:
         void setNumPartialResults(uint32_t n);
         void setBatchedStreams(const std::vector<int>& streamsToBatch);
         void setResultMetadataQueue(std::shared_ptr<ResultMetadataQueue> q);
+        void setResultMetadataDelta(bool enable);
 
         void registerBatch(uint32_t frameNumber, uint32_t batchSize);
         void notify(NotifyMsg& msg);
@@ -278,6 +381,11 @@ protected:
         void notifySingleMsg(NotifyMsg& msg);
         void processOneCaptureResult(CaptureResult& result);
         void invokeProcessCaptureResultCallback(hidl_vec<CaptureResult> &results, bool tryWriteFmq);
+        // Write result metadata to the result FMQ, delta encoded if enabled. Returns the
+        // number of bytes written, or 0 if the metadata has to be sent over hwbinder.
+        // Must be called with mProcessCaptureResultLock held.
+        size_t writeResultMetadataLocked(const hidl_vec<uint8_t>& metadata,
+                uint32_t partialResult);
 
         // Protect access to mInflightBatches, mNumPartialResults and mStreamsToBatch
         // processCaptureRequest, processCaptureResult, notify will compete for this lock
@@ -292,6 +400,10 @@ protected:
         // Protect against invokeProcessCaptureResultCallback()
         Mutex mProcessCaptureResultLock;
 
+        // Guarded by mProcessCaptureResultLock
+        std::unique_ptr<MetadataDeltaEncoder> mMetadataDeltaEncoder;
+        std::vector<uint8_t> mMetadataDeltaBlob;
+
     } mResultBatcher;
 
     std::vector<int> mVideoStreamIds;
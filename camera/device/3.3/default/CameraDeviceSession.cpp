@@ -49,25 +49,25 @@ Return<void> CameraDeviceSession::configureStreams_3_3(
     // hold the inflight lock for entire configureStreams scope since there must not be any
     // inflight request/results during stream configuration.
     Mutex::Autolock _l(mInflightLock);
-    if (!mInflightBuffers.empty()) {
+    if (mInflightFrames.numBuffers() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight buffers!",
-                __FUNCTION__, mInflightBuffers.size());
+                __FUNCTION__, mInflightFrames.numBuffers());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
 
-    if (!mInflightAETriggerOverrides.empty()) {
+    if (mInflightFrames.numAETriggerOverrides() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " trigger overrides!", __FUNCTION__,
-                mInflightAETriggerOverrides.size());
+                mInflightFrames.numAETriggerOverrides());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
 
-    if (!mInflightRawBoostPresent.empty()) {
+    if (mInflightFrames.numRawBoosts() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " boost overrides!", __FUNCTION__,
-                mInflightRawBoostPresent.size());
+                mInflightFrames.numRawBoosts());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return Void();
     }
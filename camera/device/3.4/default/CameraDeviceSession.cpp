@@ -51,6 +51,7 @@ CameraDeviceSession::CameraDeviceSession(
             mHasCallback_3_4 = true;
             if (!mInitFail) {
                 mResultBatcher_3_4.setResultMetadataQueue(mResultMetadataQueue);
+                mResultBatcher_3_4.setResultMetadataDelta(mResultMetadataDelta);
             }
         }
     }
@@ -94,25 +95,25 @@ void CameraDeviceSession::configureStreams_3_4_Impl(
     // hold the inflight lock for entire configureStreams scope since there must not be any
     // inflight request/results during stream configuration.
     Mutex::Autolock _l(mInflightLock);
-    if (!mInflightBuffers.empty()) {
+    if (mInflightFrames.numBuffers() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight buffers!",
-                __FUNCTION__, mInflightBuffers.size());
+                __FUNCTION__, mInflightFrames.numBuffers());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return;
     }
 
-    if (!mInflightAETriggerOverrides.empty()) {
+    if (mInflightFrames.numAETriggerOverrides() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " trigger overrides!", __FUNCTION__,
-                mInflightAETriggerOverrides.size());
+                mInflightFrames.numAETriggerOverrides());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return;
     }
 
-    if (!mInflightRawBoostPresent.empty()) {
+    if (mInflightFrames.numRawBoosts() != 0) {
         ALOGE("%s: trying to configureStreams while there are still %zu inflight"
                 " boost overrides!", __FUNCTION__,
-                mInflightRawBoostPresent.size());
+                mInflightFrames.numRawBoosts());
         _hidl_cb(Status::INTERNAL_ERROR, outStreams);
         return;
     }
@@ -400,14 +401,14 @@ Status CameraDeviceSession::processOneCaptureRequest_3_4(const V3_4::CaptureRequ
         Mutex::Autolock _l(mInflightLock);
         if (hasInputBuf) {
             auto streamId = request.v3_2.inputBuffer.streamId;
-            auto key = std::make_pair(request.v3_2.inputBuffer.streamId, request.v3_2.frameNumber);
-            auto& bufCache = mInflightBuffers[key] = camera3_stream_buffer_t{};
+            camera3_stream_buffer_t* bufCache = mInflightFrames.addInputBuffer(
+                    request.v3_2.frameNumber, streamId);
             convertFromHidl(
                     allBufPtrs[numOutputBufs], request.v3_2.inputBuffer.status,
                     &mStreamMap[request.v3_2.inputBuffer.streamId], allFences[numOutputBufs],
-                    &bufCache);
-            bufCache.stream->physical_camera_id = mPhysicalCameraIdMap[streamId].c_str();
-            halRequest.input_buffer = &bufCache;
+                    bufCache);
+            bufCache->stream->physical_camera_id = mPhysicalCameraIdMap[streamId].c_str();
+            halRequest.input_buffer = bufCache;
         } else {
             halRequest.input_buffer = nullptr;
         }
@@ -415,14 +416,13 @@ Status CameraDeviceSession::processOneCaptureRequest_3_4(const V3_4::CaptureRequ
         halRequest.num_output_buffers = numOutputBufs;
         for (size_t i = 0; i < numOutputBufs; i++) {
             auto streamId = request.v3_2.outputBuffers[i].streamId;
-            auto key = std::make_pair(streamId, request.v3_2.frameNumber);
-            auto& bufCache = mInflightBuffers[key] = camera3_stream_buffer_t{};
+            mInflightFrames.addOutputBuffer(request.v3_2.frameNumber, streamId);
+            camera3_stream_buffer_t& bufCache = outHalBufs[i];
             convertFromHidl(
                     allBufPtrs[i], request.v3_2.outputBuffers[i].status,
                     &mStreamMap[streamId], allFences[i],
                     &bufCache);
             bufCache.stream->physical_camera_id = mPhysicalCameraIdMap[streamId].c_str();
-            outHalBufs[i] = bufCache;
         }
         halRequest.output_buffers = outHalBufs.data();
 
@@ -430,8 +430,7 @@ Status CameraDeviceSession::processOneCaptureRequest_3_4(const V3_4::CaptureRequ
         aeCancelTriggerNeeded = handleAePrecaptureCancelRequestLocked(
                 halRequest, &settingsOverride /*out*/, &triggerOverride/*out*/);
         if (aeCancelTriggerNeeded) {
-            mInflightAETriggerOverrides[halRequest.frame_number] =
-                    triggerOverride;
+            mInflightFrames.setAETriggerOverride(halRequest.frame_number, triggerOverride);
             halRequest.settings = settingsOverride.getAndLock();
         }
     }
@@ -495,17 +494,9 @@ Status CameraDeviceSession::processOneCaptureRequest_3_4(const V3_4::CaptureRequ
         ALOGE("%s: HAL process_capture_request call failed!", __FUNCTION__);
 
         cleanupInflightFences(allFences, numBufs);
-        if (hasInputBuf) {
-            auto key = std::make_pair(request.v3_2.inputBuffer.streamId, request.v3_2.frameNumber);
-            mInflightBuffers.erase(key);
-        }
-        for (size_t i = 0; i < numOutputBufs; i++) {
-            auto key = std::make_pair(request.v3_2.outputBuffers[i].streamId,
-                    request.v3_2.frameNumber);
-            mInflightBuffers.erase(key);
-        }
+        mInflightFrames.removeAllBuffers(request.v3_2.frameNumber);
         if (aeCancelTriggerNeeded) {
-            mInflightAETriggerOverrides.erase(request.v3_2.frameNumber);
+            mInflightFrames.removeOverrides(request.v3_2.frameNumber);
         }
 
         if (ret == BAD_VALUE) {
@@ -588,23 +579,8 @@ void CameraDeviceSession::sNotify_3_4(
         switch (hidlMsg.msg.error.errorCode) {
             case V3_2::ErrorCode::ERROR_DEVICE:
             case V3_2::ErrorCode::ERROR_REQUEST:
-            case V3_2::ErrorCode::ERROR_RESULT: {
-                Mutex::Autolock _l(d->mInflightLock);
-                auto entry = d->mInflightAETriggerOverrides.find(
-                        hidlMsg.msg.error.frameNumber);
-                if (d->mInflightAETriggerOverrides.end() != entry) {
-                    d->mInflightAETriggerOverrides.erase(
-                            hidlMsg.msg.error.frameNumber);
-                }
-
-                auto boostEntry = d->mInflightRawBoostPresent.find(
-                        hidlMsg.msg.error.frameNumber);
-                if (d->mInflightRawBoostPresent.end() != boostEntry) {
-                    d->mInflightRawBoostPresent.erase(
-                            hidlMsg.msg.error.frameNumber);
-                }
-
-            }
+            case V3_2::ErrorCode::ERROR_RESULT:
+                d->mInflightFrames.removeOverrides(hidlMsg.msg.error.frameNumber);
                 break;
             case V3_2::ErrorCode::ERROR_BUFFER:
             default:
@@ -719,9 +695,10 @@ void CameraDeviceSession::ResultBatcher_3_4::invokeProcessCaptureResultCallback_
     if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
         for (CaptureResult &result : results) {
             if (result.v3_2.result.size() > 0) {
-                if (mResultMetadataQueue->write(result.v3_2.result.data(),
-                        result.v3_2.result.size())) {
-                    result.v3_2.fmqResultSize = result.v3_2.result.size();
+                size_t written = writeResultMetadataLocked(result.v3_2.result,
+                        result.v3_2.partialResult);
+                if (written > 0) {
+                    result.v3_2.fmqResultSize = written;
                     result.v3_2.result.resize(0);
                 } else {
                     ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
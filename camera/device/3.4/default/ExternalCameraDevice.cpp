@@ -26,6 +26,7 @@
 #include "CameraMetadata.h"
 #include "../../3.2/default/include/convert.h"
 #include "ExternalCameraDevice_3_4.h"
+#include "ExternalCameraProfileCache.h"
 
 namespace android {
 namespace hardware {
@@ -35,12 +36,51 @@ namespace V3_4 {
 namespace implementation {
 
 namespace {
-// Only support MJPEG for now as it seems to be the one supports higher fps
+// MJPEG usually supports the highest fps. YUYV/NV12 are used for sizes MJPEG does not
+// support, or where they run at least as fast as MJPEG, since YUV outputs of the same
+// size can then be copied without decoding.
 // Other formats to consider in the future:
 // * V4L2_PIX_FMT_YVU420 (== YV12)
 // * V4L2_PIX_FMT_YVYU (YVYU: can be converted to YV12 or other YUV420_888 formats)
-const std::array<uint32_t, /*size*/ 2> kSupportedFourCCs{
-    {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_Z16}};  // double braces required in C++11
+const std::array<uint32_t, /*size*/ 4> kSupportedFourCCs{
+    {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_Z16,
+     V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV}};  // double braces required in C++11
+
+double getMaxFps(const SupportedV4L2Format& fmt) {
+    double maxFps = 0.0;
+    for (const auto& fr : fmt.frameRates) {
+        maxFps = std::max(maxFps, fr.getDouble());
+    }
+    return maxFps;
+}
+
+// Keep one color format per size: MJPEG unless a YUV format is at least as fast,
+// NV12 over YUYV. Depth formats are left untouched.
+void dedupeColorFormats(std::vector<SupportedV4L2Format>* fmts) {
+    auto rank = [](const SupportedV4L2Format& fmt) {
+        double fps = getMaxFps(fmt);
+        int fourccRank = (fmt.fourcc == V4L2_PIX_FMT_NV12) ? 2 :
+                (fmt.fourcc == V4L2_PIX_FMT_YUYV) ? 1 : 0;
+        return std::make_pair(fps, fourccRank);
+    };
+    std::vector<SupportedV4L2Format> out;
+    for (const auto& fmt : *fmts) {
+        if (fmt.fourcc == V4L2_PIX_FMT_Z16) {
+            out.push_back(fmt);
+            continue;
+        }
+        auto it = std::find_if(out.begin(), out.end(), [&fmt](const SupportedV4L2Format& o) {
+            return o.fourcc != V4L2_PIX_FMT_Z16 &&
+                    o.width == fmt.width && o.height == fmt.height;
+        });
+        if (it == out.end()) {
+            out.push_back(fmt);
+        } else if (rank(fmt) > rank(*it)) {
+            *it = fmt;
+        }
+    }
+    *fmts = std::move(out);
+}
 
 constexpr int MAX_RETRY = 5; // Allow retry v4l2 open failures a few times.
 constexpr int OPEN_RETRY_SLEEP_US = 100000; // 100ms * MAX_RETRY = 0.5 seconds
@@ -274,7 +314,9 @@ status_t ExternalCameraDevice::initAvailableCapabilities(
     for (const auto& fmt : mSupportedFormats) {
         switch (fmt.fourcc) {
             case V4L2_PIX_FMT_Z16: hasDepth = true; break;
-            case V4L2_PIX_FMT_MJPEG: hasColor = true; break;
+            case V4L2_PIX_FMT_MJPEG:
+            case V4L2_PIX_FMT_NV12:
+            case V4L2_PIX_FMT_YUYV: hasColor = true; break;
             default: ALOGW("%s: Unsupported format found", __FUNCTION__);
         }
     }
@@ -602,7 +644,7 @@ status_t ExternalCameraDevice::initOutputCharskeysByFormat(
     std::vector<int64_t> stallDurations;
 
     for (const auto& supportedFormat : mSupportedFormats) {
-        if (supportedFormat.fourcc != fourcc) {
+        if ((supportedFormat.fourcc == V4L2_PIX_FMT_Z16) != (fourcc == V4L2_PIX_FMT_Z16)) {
             // Skip 4CCs not meant for the halFormats
             continue;
         }
@@ -700,7 +742,7 @@ status_t ExternalCameraDevice::initOutputCharsKeys(
 
     // For V4L2_PIX_FMT_Z16
     std::array<int, /*size*/ 1> halDepthFormats{{HAL_PIXEL_FORMAT_Y16}};
-    // For V4L2_PIX_FMT_MJPEG
+    // For V4L2_PIX_FMT_MJPEG/NV12/YUYV
     std::array<int, /*size*/ 3> halFormats{{HAL_PIXEL_FORMAT_BLOB, HAL_PIXEL_FORMAT_YCbCr_420_888,
                                             HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED}};
 
@@ -710,6 +752,8 @@ status_t ExternalCameraDevice::initOutputCharsKeys(
                 hasDepth = true;
                 break;
             case V4L2_PIX_FMT_MJPEG:
+            case V4L2_PIX_FMT_NV12:
+            case V4L2_PIX_FMT_YUYV:
                 hasColor = true;
                 break;
             default:
@@ -919,6 +963,7 @@ std::vector<SupportedV4L2Format> ExternalCameraDevice::getCandidateSupportedForm
         }
         fmtdesc.index++;
     }
+    dedupeColorFormats(&outFmts);
     trimSupportedFormats(cropType, &outFmts);
     return outFmts;
 }
@@ -952,6 +997,21 @@ void ExternalCameraDevice::updateFpsBounds(
 }
 
 void ExternalCameraDevice::initSupportedFormatsLocked(int fd) {
+    auto& profileCache = ExternalCameraProfileCache::getInstance();
+    std::string profileKey = ExternalCameraProfileCache::getDeviceKey(mDevicePath);
+    if (profileCache.lookup(profileKey, fd, mCfg, &mSupportedFormats, &mCroppingType)) {
+        ALOGV("%s: %s uses cached profile %s", __FUNCTION__, mDevicePath.c_str(),
+                profileKey.c_str());
+        return;
+    }
+
+    probeSupportedFormatsLocked(fd);
+    if (!mSupportedFormats.empty()) {
+        profileCache.store(profileKey, mCfg, mSupportedFormats, mCroppingType);
+    }
+}
+
+void ExternalCameraDevice::probeSupportedFormatsLocked(int fd) {
     std::vector<SupportedV4L2Format> horizontalFmts = getCandidateSupportedFormatsLocked(
         fd, HORIZONTAL, mCfg.fpsLimits, mCfg.depthFpsLimits, mCfg.minStreamSize, mCfg.depthEnabled);
     std::vector<SupportedV4L2Format> verticalFmts = getCandidateSupportedFormatsLocked(
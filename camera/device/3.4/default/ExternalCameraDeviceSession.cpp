@@ -18,6 +18,7 @@
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include <log/log.h>
 
+#include <algorithm>
 #include <inttypes.h>
 #include "ExternalCameraDeviceSession.h"
 
@@ -25,6 +26,7 @@
 #include <utils/Timers.h>
 #include <utils/Trace.h>
 #include <linux/videodev2.h>
+#include <poll.h>
 #include <sync/sync.h>
 
 #define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
@@ -51,6 +53,13 @@ constexpr int MAX_RETRY = 15; // Allow retry some ioctl failures a few times to
                              // webcam showing temporarily ioctl failures.
 constexpr int IOCTL_RETRY_SLEEP_US = 33000; // 33ms * MAX_RETRY = 0.5 seconds
 
+// Stream outputs favor speed. Thumbnails are heavily downscaled, where nearest neighbor
+// sampling aliases badly, and are small enough for a box filter to be cheap.
+const common::V1_0::helper::ScaleFilter kStreamScaleFilter =
+        common::V1_0::helper::ScaleFilter::NEAREST;
+const common::V1_0::helper::ScaleFilter kThumbnailScaleFilter =
+        common::V1_0::helper::ScaleFilter::BOX;
+
 // Constants for tryLock during dumpstate
 static constexpr int kDumpLockRetries = 50;
 static constexpr int kDumpLockSleep = 60000;
@@ -168,6 +177,8 @@ bool ExternalCameraDeviceSession::initialize() {
 
     // TODO: check is PRIORITY_DISPLAY enough?
     mOutputThread->run("ExtCamOut", PRIORITY_DISPLAY);
+    mCaptureThread = new CaptureThread(this);
+    mCaptureThread->run("ExtCamCapture", PRIORITY_DISPLAY);
     return false;
 }
 
@@ -278,12 +289,18 @@ void ExternalCameraDeviceSession::dumpState(const native_handle_t* handle) {
                 mV4l2StreamingFps);
 
         size_t numDequeuedV4l2Buffers = 0;
+        uint64_t numCapturedFrames = 0;
+        uint64_t numStaleFrames = 0;
         {
             std::lock_guard<std::mutex> lk(mV4l2BufferLock);
             numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
+            numCapturedFrames = mNumCapturedFrames;
+            numStaleFrames = mNumStaleFrames;
         }
         dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n",
                 v4L2BufferCount, numDequeuedV4l2Buffers);
+        dprintf(fd, "V4L2 frames captured %" PRIu64 ", dropped as stale %" PRIu64 "\n",
+                numCapturedFrames, numStaleFrames);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -480,6 +497,7 @@ Return<void> ExternalCameraDeviceSession::close(bool callerIsDtor) {
         } else {
             closeOutputThread();
         }
+        closeCaptureThread();
 
         Mutex::Autolock _l(mLock);
         // free all buffers
@@ -687,6 +705,7 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         }
 
         if (requestFpsMax != mV4l2StreamingFps) {
+            pauseCaptureLocked();
             {
                 std::unique_lock<std::mutex> lk(mV4l2BufferLock);
                 while (mNumDequeuedV4l2Buffers != 0) {
@@ -694,6 +713,8 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
                     int waitRet = waitForV4L2BufferReturnLocked(lk);
                     if (waitRet != 0) {
                         ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+                        lk.unlock();
+                        resumeCaptureLocked();
                         return Status::INTERNAL_ERROR;
                     }
                 }
@@ -708,7 +729,7 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
     }
 
     nsecs_t shutterTs = 0;
-    sp<V4L2Frame> frameIn = dequeueV4l2FrameLocked(&shutterTs);
+    sp<V4L2Frame> frameIn = takeLatestV4l2FrameLocked(&shutterTs);
     if ( frameIn == nullptr) {
         ALOGE("%s: V4L2 deque frame failed!", __FUNCTION__);
         return Status::INTERNAL_ERROR;
@@ -827,20 +848,23 @@ Status ExternalCameraDeviceSession::processCaptureRequestError(
 
 Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequest>& req) {
     ATRACE_CALL();
-    // Return V4L2 buffer to V4L2 buffer queue
-    sp<V3_4::implementation::V4L2Frame> v4l2Frame =
-            static_cast<V3_4::implementation::V4L2Frame*>(req->frameIn.get());
-    enqueueV4l2Frame(v4l2Frame);
+    if (!req->buffersOnly) {
+        // Return V4L2 buffer to V4L2 buffer queue
+        sp<V3_4::implementation::V4L2Frame> v4l2Frame =
+                static_cast<V3_4::implementation::V4L2Frame*>(req->frameIn.get());
+        enqueueV4l2Frame(v4l2Frame);
 
-    // NotifyShutter
-    notifyShutter(req->frameNumber, req->shutterTs);
+        // NotifyShutter
+        notifyShutter(req->frameNumber, req->shutterTs);
+    }
 
     // Fill output buffers
     hidl_vec<CaptureResult> results;
     results.resize(1);
     CaptureResult& result = results[0];
     result.frameNumber = req->frameNumber;
-    result.partialResult = 1;
+    // Metadata is only sent with the first part of a split request
+    result.partialResult = req->buffersOnly ? 0 : 1;
     result.inputBuffer.streamId = -1;
     result.outputBuffers.resize(req->buffers.size());
     for (size_t i = 0; i < req->buffers.size(); i++) {
@@ -866,13 +890,15 @@ Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequ
     }
 
     // Fill capture result metadata
-    fillCaptureResult(req->setting, req->shutterTs);
-    const camera_metadata_t *rawResult = req->setting.getAndLock();
-    V3_2::implementation::convertToHidl(rawResult, &result.result);
-    req->setting.unlock(rawResult);
+    if (!req->buffersOnly) {
+        fillCaptureResult(req->setting, req->shutterTs);
+        const camera_metadata_t *rawResult = req->setting.getAndLock();
+        V3_2::implementation::convertToHidl(rawResult, &result.result);
+        req->setting.unlock(rawResult);
+    }
 
     // update inflight records
-    {
+    if (!req->hasDeferredBuffers) {
         std::lock_guard<std::mutex> lk(mInflightFramesLock);
         mInflightFrames.erase(req->frameNumber);
     }
@@ -923,16 +949,41 @@ ExternalCameraDeviceSession::OutputThread::OutputThread(
         const common::V1_0::helper::CameraMetadata& chars) :
         mParent(parent), mCroppingType(ct), mCameraCharacteristics(chars) {}
 
-ExternalCameraDeviceSession::OutputThread::~OutputThread() {}
+ExternalCameraDeviceSession::OutputThread::~OutputThread() {
+    stopWorkers();
+}
 
 void ExternalCameraDeviceSession::OutputThread::setExifMakeModel(
         const std::string& make, const std::string& model) {
     mExifMake = make;
     mExifModel = model;
+    std::lock_guard<std::mutex> lk(mExifLock);
+    mExifUtils.reset();
 }
 
 int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         sp<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+    sp<AllocatedFrame> scaledYu12Buf;
+    auto it = mScaledYu12Frames.find(outSz);
+    if (it != mScaledYu12Frames.end()) {
+        scaledYu12Buf = it->second;
+    } else {
+        it = mIntermediateBuffers.find(outSz);
+        if (it != mIntermediateBuffers.end()) {
+            scaledYu12Buf = it->second;
+        }
+    }
+
+    int ret = cropAndScale(in, outSz, scaledYu12Buf, out);
+    if (ret == 0 && scaledYu12Buf != nullptr) {
+        mScaledYu12Frames.insert({outSz, scaledYu12Buf});
+    }
+    return ret;
+}
+
+int ExternalCameraDeviceSession::OutputThread::cropAndScale(
+        sp<AllocatedFrame>& in, const Size& outSz,
+        const sp<AllocatedFrame>& scaledYu12Buf, YCbCrLayout* out) {
     Size inSz = {in->mWidth, in->mHeight};
 
     int ret;
@@ -969,18 +1020,10 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return 0;
     }
 
-    auto it = mScaledYu12Frames.find(outSz);
-    sp<AllocatedFrame> scaledYu12Buf;
-    if (it != mScaledYu12Frames.end()) {
-        scaledYu12Buf = it->second;
-    } else {
-        it = mIntermediateBuffers.find(outSz);
-        if (it == mIntermediateBuffers.end()) {
-            ALOGE("%s: failed to find intermediate buffer size %dx%d",
-                    __FUNCTION__, outSz.width, outSz.height);
-            return -1;
-        }
-        scaledYu12Buf = it->second;
+    if (scaledYu12Buf == nullptr) {
+        ALOGE("%s: failed to find intermediate buffer size %dx%d",
+                __FUNCTION__, outSz.width, outSz.height);
+        return -1;
     }
     // Scale
     YCbCrLayout outLayout;
@@ -990,25 +1033,9 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return ret;
     }
 
-    ret = libyuv::I420Scale(
-            static_cast<uint8_t*>(croppedLayout.y),
-            croppedLayout.yStride,
-            static_cast<uint8_t*>(croppedLayout.cb),
-            croppedLayout.cStride,
-            static_cast<uint8_t*>(croppedLayout.cr),
-            croppedLayout.cStride,
-            inputCrop.width,
-            inputCrop.height,
-            static_cast<uint8_t*>(outLayout.y),
-            outLayout.yStride,
-            static_cast<uint8_t*>(outLayout.cb),
-            outLayout.cStride,
-            static_cast<uint8_t*>(outLayout.cr),
-            outLayout.cStride,
-            outSz.width,
-            outSz.height,
-            // TODO: b/72261744 see if we can use better filter without losing too much perf
-            libyuv::FilterMode::kFilterNone);
+    ret = common::V1_0::helper::cropScaleConvert(
+            toYuvPlanes(croppedLayout), /*left*/0, /*top*/0, inputCrop.width, inputCrop.height,
+            toYuvPlanes(outLayout), outSz.width, outSz.height, kStreamScaleFilter);
 
     if (ret != 0) {
         ALOGE("%s: failed to scale buffer from %dx%d to %dx%d. Ret %d",
@@ -1018,20 +1045,25 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
     }
 
     *out = outLayout;
-    mScaledYu12Frames.insert({outSz, scaledYu12Buf});
     return 0;
 }
 
 
 int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
         sp<AllocatedFrame>& in, const Size &outSz, YCbCrLayout* out) {
+    return cropAndScaleThumb(in, outSz, mYu12ThumbFrame, out);
+}
+
+int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumb(
+        sp<AllocatedFrame>& in, const Size &outSz,
+        const sp<AllocatedFrame>& thumb, YCbCrLayout* out) {
     Size inSz  {in->mWidth, in->mHeight};
 
     if ((outSz.width * outSz.height) >
-        (mYu12ThumbFrame->mWidth * mYu12ThumbFrame->mHeight)) {
+        (thumb->mWidth * thumb->mHeight)) {
         ALOGE("%s: Requested thumbnail size too big (%d,%d) > (%d,%d)",
               __FUNCTION__, outSz.width, outSz.height,
-              mYu12ThumbFrame->mWidth, mYu12ThumbFrame->mHeight);
+              thumb->mWidth, thumb->mHeight);
         return -1;
     }
 
@@ -1131,31 +1163,16 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
     // Scale
     YCbCrLayout outFullLayout;
 
-    ret = mYu12ThumbFrame->getLayout(&outFullLayout);
+    ret = thumb->getLayout(&outFullLayout);
     if (ret != 0) {
         ALOGE("%s: failed to get output buffer layout", __FUNCTION__);
         return ret;
     }
 
 
-    ret = libyuv::I420Scale(
-            static_cast<uint8_t*>(inputLayout.y),
-            inputLayout.yStride,
-            static_cast<uint8_t*>(inputLayout.cb),
-            inputLayout.cStride,
-            static_cast<uint8_t*>(inputLayout.cr),
-            inputLayout.cStride,
-            inputCrop.width,
-            inputCrop.height,
-            static_cast<uint8_t*>(outFullLayout.y),
-            outFullLayout.yStride,
-            static_cast<uint8_t*>(outFullLayout.cb),
-            outFullLayout.cStride,
-            static_cast<uint8_t*>(outFullLayout.cr),
-            outFullLayout.cStride,
-            outSz.width,
-            outSz.height,
-            libyuv::FilterMode::kFilterNone);
+    ret = common::V1_0::helper::cropScaleConvert(
+            toYuvPlanes(inputLayout), /*left*/0, /*top*/0, inputCrop.width, inputCrop.height,
+            toYuvPlanes(outFullLayout), outSz.width, outSz.height, kThumbnailScaleFilter);
 
     if (ret != 0) {
         ALOGE("%s: failed to scale buffer from %dx%d to %dx%d. Ret %d",
@@ -1236,6 +1253,24 @@ ssize_t ExternalCameraDeviceSession::getJpegBufferSize(
 int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         HalStreamBuffer &halBuf,
         const common::V1_0::helper::CameraMetadata& setting)
+{
+    ATRACE_CALL();
+    /* Scale and crop main jpeg */
+    YCbCrLayout yu12Main;
+    int ret = cropAndScaleLocked(mYu12Frame, Size { halBuf.width, halBuf.height }, &yu12Main);
+    if (ret != 0) {
+        ALOGE("%s: crop and scale main failed!", __FUNCTION__);
+        return 1;
+    }
+
+    return encodeJpeg(mYu12Frame, yu12Main, mYu12ThumbFrame, halBuf, setting, mJpegScratch);
+}
+
+int ExternalCameraDeviceSession::OutputThread::encodeJpeg(
+        sp<AllocatedFrame>& in, const YCbCrLayout& yu12Main,
+        const sp<AllocatedFrame>& thumb, HalStreamBuffer &halBuf,
+        const common::V1_0::helper::CameraMetadata& setting,
+        JpegScratch& scratch)
 {
     ATRACE_CALL();
     int ret;
@@ -1258,7 +1293,7 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
           halBuf.bufPtr);
     ALOGV("%s: YV12 buffer %d x %d",
           __FUNCTION__,
-          mYu12Frame->mWidth, mYu12Frame->mHeight);
+          in->mWidth, in->mHeight);
 
     int jpegQuality, thumbQuality;
     Size thumbSize;
@@ -1296,8 +1331,6 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
             "%s: ANDROID_JPEG_THUMBNAIL_SIZE not set", __FUNCTION__);
     }
 
-    /* Cropped and scaled YU12 buffer for main and thumbnail */
-    YCbCrLayout yu12Main;
     Size jpegSize { halBuf.width, halBuf.height };
 
     /* Compute temporary buffer sizes accounting for the following:
@@ -1318,61 +1351,57 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
 
     /* Hold actual thumbnail and main image code sizes */
     size_t thumbCodeSize = 0, jpegCodeSize = 0;
-    /* Temporary thumbnail code buffer */
-    std::vector<uint8_t> thumbCode(outputThumbnail ? maxThumbCodeSize : 0);
 
-    YCbCrLayout yu12Thumb;
+    /* Crop, scale and encode the thumbnail while the main image is encoded */
+    std::mutex thumbLock;
+    std::condition_variable thumbCond;
+    bool thumbDone = !outputThumbnail;
+    int thumbRet = 0;
     if (outputThumbnail) {
-        ret = cropAndScaleThumbLocked(mYu12Frame, thumbSize, &yu12Thumb);
-
-        if (ret != 0) {
-            return lfail(
-                "%s: crop and scale thumbnail failed!", __FUNCTION__);
-        }
+        scratch.thumbCode.resize(maxThumbCodeSize);
+        mJpegPartQueue.push([&]() {
+            ATRACE_NAME("encodeJpegThumbnail");
+            YCbCrLayout yu12Thumb;
+            int r = cropAndScaleThumb(in, thumbSize, thumb, &yu12Thumb);
+            if (r != 0) {
+                ALOGE("%s: crop and scale thumbnail failed!", __FUNCTION__);
+            } else {
+                r = encodeJpegYU12(thumbSize, yu12Thumb,
+                        thumbQuality, 0, 0,
+                        scratch.thumbCode.data(), maxThumbCodeSize, thumbCodeSize);
+                if (r != 0) {
+                    ALOGE("%s: thumbnail encodeJpegYU12 failed with %d", __FUNCTION__, r);
+                }
+            }
+            std::lock_guard<std::mutex> lk(thumbLock);
+            thumbRet = r;
+            thumbDone = true;
+            thumbCond.notify_one();
+        });
+    }
+
+    /* Encode the main jpeg image, in strips on the part threads if it is large.
+     * The APP1 segment is inserted afterwards, once the thumbnail is ready. */
+    uint32_t numStrips =
+            (jpegSize.width * jpegSize.height >= kJpegStripMinPixels) ? kNumJpegPartThreads + 1 : 1;
+    scratch.mainCode.resize(maxJpegCodeSize);
+    ret = encodeJpegYU12Strips(jpegSize, yu12Main, jpegQuality, numStrips,
+            [this](std::function<void()>&& task) { mJpegPartQueue.push(std::move(task)); },
+            scratch.mainCode.data(), scratch.mainCode.size(), jpegCodeSize);
+
+    /* The thumbnail task references this frame, always wait for it */
+    {
+        std::unique_lock<std::mutex> lk(thumbLock);
+        thumbCond.wait(lk, [&]() { return thumbDone; });
     }
 
-    /* Scale and crop main jpeg */
-    ret = cropAndScaleLocked(mYu12Frame, jpegSize, &yu12Main);
-
     if (ret != 0) {
-        return lfail("%s: crop and scale main failed!", __FUNCTION__);
+        return lfail("%s: encodeJpegYU12Strips failed with %d", __FUNCTION__, ret);
     }
-
-    /* Encode the thumbnail image */
-    if (outputThumbnail) {
-        ret = encodeJpegYU12(thumbSize, yu12Thumb,
-                thumbQuality, 0, 0,
-                &thumbCode[0], maxThumbCodeSize, thumbCodeSize);
-
-        if (ret != 0) {
-            return lfail("%s: thumbnail encodeJpegYU12 failed with %d",__FUNCTION__, ret);
-        }
+    if (thumbRet != 0) {
+        return lfail("%s: thumbnail encoding failed with %d", __FUNCTION__, thumbRet);
     }
 
-    /* Combine camera characteristics with request settings to form EXIF
-     * metadata */
-    common::V1_0::helper::CameraMetadata meta(mCameraCharacteristics);
-    meta.append(setting);
-
-    /* Generate EXIF object */
-    std::unique_ptr<ExifUtils> utils(ExifUtils::create());
-    /* Make sure it's initialized */
-    utils->initialize();
-
-    utils->setFromMetadata(meta, jpegSize.width, jpegSize.height);
-    utils->setMake(mExifMake);
-    utils->setModel(mExifModel);
-
-    ret = utils->generateApp1(outputThumbnail ? &thumbCode[0] : 0, thumbCodeSize);
-
-    if (!ret) {
-        return lfail("%s: generating APP1 failed", __FUNCTION__);
-    }
-
-    /* Get internal buffer */
-    size_t exifDataSize = utils->getApp1Length();
-    const uint8_t* exifData = utils->getApp1Buffer();
-
     /* Lock the HAL jpeg code buffer */
     void *bufPtr = sHandleImporter.lock(
             *(halBuf.bufPtr), halBuf.usage, maxJpegCodeSize);
@@ -1381,10 +1410,21 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         return lfail("%s: could not lock %zu bytes", __FUNCTION__, maxJpegCodeSize);
     }
 
-    /* Encode the main jpeg image */
-    ret = encodeJpegYU12(jpegSize, yu12Main,
-            jpegQuality, exifData, exifDataSize,
-            bufPtr, maxJpegCodeSize, jpegCodeSize);
+    {
+        std::lock_guard<std::mutex> lk(mExifLock);
+        if (!updateExifLocked(setting, jpegSize) ||
+                !mExifUtils->generateApp1(outputThumbnail ? scratch.thumbCode.data() : 0,
+                        thumbCodeSize)) {
+            ALOGE("%s: generating APP1 failed", __FUNCTION__);
+            ret = -1;
+        } else {
+            /* Copy the main image to the HAL buffer with the EXIF data in front */
+            size_t mainCodeSize = jpegCodeSize;
+            ret = insertJpegApp1(scratch.mainCode.data(), mainCodeSize,
+                    mExifUtils->getApp1Buffer(), mExifUtils->getApp1Length(),
+                    bufPtr, maxJpegCodeSize - sizeof(CameraBlob), jpegCodeSize);
+        }
+    }
 
     /* TODO: Not sure this belongs here, maybe better to pass jpegCodeSize out
      * and do this when returning buffer to parent */
@@ -1404,15 +1444,386 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
     /* Check if our JPEG actually succeeded */
     if (ret != 0) {
         return lfail(
-            "%s: encodeJpegYU12 failed with %d",__FUNCTION__, ret);
+            "%s: writing JPEG with APP1 failed with %d",__FUNCTION__, ret);
+    }
+
+    ALOGV("%s: encoded JPEG (ret:%d) with Q:%d in %u strips, max size: %zu",
+          __FUNCTION__, ret, jpegQuality, numStrips, maxJpegCodeSize);
+
+    return 0;
+}
+
+// Request settings that feed into EXIF tags other than date/time and orientation
+static const uint32_t kExifSettingTags[] = {
+    ANDROID_LENS_FOCAL_LENGTH,
+    ANDROID_LENS_APERTURE,
+    ANDROID_SENSOR_EXPOSURE_TIME,
+    ANDROID_CONTROL_AWB_MODE,
+    ANDROID_FLASH_MODE,
+    ANDROID_JPEG_GPS_COORDINATES,
+    ANDROID_JPEG_GPS_PROCESSING_METHOD,
+    ANDROID_JPEG_GPS_TIMESTAMP,
+};
+
+bool ExternalCameraDeviceSession::OutputThread::updateExifLocked(
+        const common::V1_0::helper::CameraMetadata& setting, const Size& jpegSize) {
+    std::vector<uint8_t> key;
+    for (uint32_t tag : kExifSettingTags) {
+        camera_metadata_ro_entry entry = setting.find(tag);
+        const uint8_t* tagBytes = reinterpret_cast<const uint8_t*>(&tag);
+        key.insert(key.end(), tagBytes, tagBytes + sizeof(tag));
+        const uint8_t* countBytes = reinterpret_cast<const uint8_t*>(&entry.count);
+        key.insert(key.end(), countBytes, countBytes + sizeof(entry.count));
+        if (entry.count > 0) {
+            key.insert(key.end(), entry.data.u8,
+                    entry.data.u8 + entry.count * camera_metadata_type_size[entry.type]);
+        }
+    }
+
+    camera_metadata_ro_entry orientation = setting.find(ANDROID_JPEG_ORIENTATION);
+    if (mExifUtils != nullptr && orientation.count > 0 && key == mExifKey &&
+            jpegSize == mExifJpegSize) {
+        /* Only the capture time and orientation differ from the last capture */
+        struct timespec ts;
+        struct tm now;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (localtime_r(&ts.tv_sec, &now) != nullptr && mExifUtils->setDateTime(now)) {
+            char subsec[8];
+            snprintf(subsec, sizeof(subsec), "%03ld", ts.tv_nsec / 1000000);
+            if (mExifUtils->setSubsecTime(subsec) &&
+                    mExifUtils->setOrientation(orientation.data.i32[0])) {
+                mExifReuses++;
+                return true;
+            }
+        }
+        ALOGW("%s: updating EXIF template failed, rebuilding", __FUNCTION__);
+    }
+
+    /* Combine camera characteristics with request settings to form EXIF
+     * metadata */
+    common::V1_0::helper::CameraMetadata meta(mCameraCharacteristics);
+    meta.append(setting);
+
+    if (mExifUtils == nullptr) {
+        mExifUtils.reset(ExifUtils::create());
+    }
+    /* Make sure it's initialized */
+    if (!mExifUtils->initialize()) {
+        mExifUtils.reset();
+        return false;
+    }
+
+    mExifUtils->setFromMetadata(meta, jpegSize.width, jpegSize.height);
+    mExifUtils->setMake(mExifMake);
+    mExifUtils->setModel(mExifModel);
+    mExifKey = std::move(key);
+    mExifJpegSize = jpegSize;
+    mExifRebuilds++;
+    return true;
+}
+
+int ExternalCameraDeviceSession::OutputThread::convertYuvOutputs(
+        const std::vector<HalStreamBuffer*>& halBufs) {
+    if (halBufs.empty()) {
+        return 0;
+    }
+
+    Size sz {halBufs[0]->width, halBufs[0]->height};
+    if (halBufs.size() == 1 && !(sz == Size {mYu12Frame->mWidth, mYu12Frame->mHeight})) {
+        return cropScaleConvertOutput(halBufs[0]);
+    }
+
+    // All buffers have the same size, so crop and scale only once
+    auto it = mIntermediateBuffers.find(sz);
+    sp<AllocatedFrame> scaledYu12Buf = (it != mIntermediateBuffers.end()) ? it->second : nullptr;
+
+    YCbCrLayout cropAndScaled;
+    ATRACE_BEGIN("cropAndScale");
+    int ret = cropAndScale(mYu12Frame, sz, scaledYu12Buf, &cropAndScaled);
+    ATRACE_END();
+    if (ret != 0) {
+        ALOGE("%s: crop and scale failed!", __FUNCTION__);
+        return ret;
+    }
+
+    for (auto halBuf : halBufs) {
+        IMapper::Rect outRect {0, 0,
+                static_cast<int32_t>(halBuf->width),
+                static_cast<int32_t>(halBuf->height)};
+        YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+                *(halBuf->bufPtr), halBuf->usage, outRect);
+        ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
+                __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
+                outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
+
+        // Convert to output buffer size/format
+        uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+        ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
+                outputFourcc & 0xFF,
+                (outputFourcc >> 8) & 0xFF,
+                (outputFourcc >> 16) & 0xFF,
+                (outputFourcc >> 24) & 0xFF);
+
+        ATRACE_BEGIN("formatConvert");
+        ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
+        ATRACE_END();
+        int relFence = sHandleImporter.unlock(*(halBuf->bufPtr));
+        if (relFence >= 0) {
+            halBuf->acquireFence = relFence;
+        }
+        if (ret != 0) {
+            ALOGE("%s: format coversion failed!", __FUNCTION__);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int ExternalCameraDeviceSession::OutputThread::cropScaleConvertOutput(HalStreamBuffer* halBuf) {
+    Size inSz {mYu12Frame->mWidth, mYu12Frame->mHeight};
+    Size outSz {halBuf->width, halBuf->height};
+    IMapper::Rect inputCrop;
+    int ret = getCropRect(mCroppingType, inSz, outSz, &inputCrop);
+    if (ret != 0) {
+        ALOGE("%s: failed to compute crop rect for output size %dx%d",
+                __FUNCTION__, outSz.width, outSz.height);
+        return ret;
     }
 
-    ALOGV("%s: encoded JPEG (ret:%d) with Q:%d max size: %zu",
-          __FUNCTION__, ret, jpegQuality, maxJpegCodeSize);
+    IMapper::Rect outRect {0, 0,
+            static_cast<int32_t>(halBuf->width),
+            static_cast<int32_t>(halBuf->height)};
+    YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+            *(halBuf->bufPtr), halBuf->usage, outRect);
+    uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+    if (outputFourcc == FLEX_YUV_GENERIC) {
+        ret = -1;
+        ALOGE("%s: unsupported flexible yuv layout"
+                " y %p cb %p cr %p y_str %d c_str %d c_step %d",
+                __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
+                outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
+    } else {
+        ATRACE_BEGIN("cropScaleConvert");
+        ret = common::V1_0::helper::cropScaleConvert(
+                toYuvPlanes(mYu12FrameLayout), inputCrop.left, inputCrop.top,
+                inputCrop.width, inputCrop.height,
+                toYuvPlanes(outLayout), outSz.width, outSz.height, kStreamScaleFilter);
+        ATRACE_END();
+    }
+    int relFence = sHandleImporter.unlock(*(halBuf->bufPtr));
+    if (relFence >= 0) {
+        halBuf->acquireFence = relFence;
+    }
+    if (ret != 0) {
+        ALOGE("%s: crop/scale/convert to %dx%d failed!", __FUNCTION__,
+                outSz.width, outSz.height);
+    }
+    return ret;
+}
 
+int ExternalCameraDeviceSession::OutputThread::copyYuvOutputs(
+        uint32_t inFourcc, const uint8_t* inData, size_t inDataSize, uint32_t inStride,
+        const std::vector<HalStreamBuffer*>& halBufs) {
+    for (auto halBuf : halBufs) {
+        Size sz {halBuf->width, halBuf->height};
+        IMapper::Rect outRect {0, 0,
+                static_cast<int32_t>(halBuf->width),
+                static_cast<int32_t>(halBuf->height)};
+        YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+                *(halBuf->bufPtr), halBuf->usage, outRect);
+        uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+
+        ATRACE_BEGIN("passThroughConvert");
+        int ret = passThroughConvert(inFourcc, inData, inDataSize, inStride, outLayout, sz,
+                outputFourcc);
+        ATRACE_END();
+        int relFence = sHandleImporter.unlock(*(halBuf->bufPtr));
+        if (relFence >= 0) {
+            halBuf->acquireFence = relFence;
+        }
+        if (ret != 0) {
+            ALOGE("%s: pass through conversion failed!", __FUNCTION__);
+            return ret;
+        }
+    }
     return 0;
 }
 
+ExternalCameraDeviceSession::OutputThread::JpegJob*
+ExternalCameraDeviceSession::OutputThread::acquireJpegJobLocked() {
+    JpegJob* job = nullptr;
+    {
+        std::unique_lock<std::mutex> lk(mJpegLock);
+        if (mFreeJpegJobs.empty()) {
+            // Too many captures queued up, wait for the oldest one to finish
+            mJpegStalls++;
+            ATRACE_NAME("Wait for JPEG job");
+            mJpegDoneCond.wait(lk, [this] { return !mFreeJpegJobs.empty(); });
+        }
+        job = mFreeJpegJobs.back();
+        mFreeJpegJobs.pop_back();
+    }
+
+    // Hand the decoded frame over to the job and decode the next request into the
+    // buffer the job is done with.
+    std::swap(job->yu12Frame, mYu12Frame);
+    std::swap(job->yu12FrameLayout, mYu12FrameLayout);
+    return job;
+}
+
+void ExternalCameraDeviceSession::OutputThread::processJpeg(
+        JpegJob* job, std::shared_ptr<HalRequest> req) {
+    ATRACE_CALL();
+    nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (auto& halBuf : req->buffers) {
+        Size jpegSize {halBuf.width, halBuf.height};
+        auto it = job->scaledFrames.find(jpegSize);
+        sp<AllocatedFrame> scaled = (it != job->scaledFrames.end()) ? it->second : nullptr;
+
+        YCbCrLayout yu12Main;
+        int ret = cropAndScale(job->yu12Frame, jpegSize, scaled, &yu12Main);
+        if (ret == 0) {
+            ret = encodeJpeg(job->yu12Frame, yu12Main, job->thumbFrame, halBuf, req->setting,
+                    job->scratch);
+        }
+        if (ret != 0) {
+            // The rest of the request has already been returned, so only this
+            // buffer is reported as failed.
+            ALOGE("%s: JPEG encode for frame %d failed with %d",
+                    __FUNCTION__, req->frameNumber, ret);
+            halBuf.fenceTimeout = true;
+        }
+    }
+    nsecs_t durationNs = systemTime(SYSTEM_TIME_MONOTONIC) - startTs;
+
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+        ALOGE("%s: session has been disconnected!", __FUNCTION__);
+    } else if (parent->processCaptureResult(req) != Status::OK) {
+        ALOGE("%s: failed to process capture result of frame %d!",
+                __FUNCTION__, req->frameNumber);
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mJpegLock);
+        mJpegStats.add(durationNs);
+        mFreeJpegJobs.push_back(job);
+    }
+    mJpegDoneCond.notify_all();
+}
+
+void ExternalCameraDeviceSession::OutputThread::waitForJpegDone() {
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    std::chrono::seconds timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+    bool done = mJpegDoneCond.wait_for(lk, timeout, [this] {
+        return mFreeJpegJobs.size() == mJpegJobs.size();
+    });
+    if (!done) {
+        ALOGE("%s: wait for inflight JPEG encode finish timeout!", __FUNCTION__);
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::startWorkers() {
+    if (mWorkersStarted) {
+        return;
+    }
+    for (int i = 0; i < kNumConvertThreads; i++) {
+        sp<TaskThread> thread = new TaskThread(mConvertQueue);
+        thread->run("ExtCamConvert", PRIORITY_DISPLAY);
+        mConvertThreads.push_back(thread);
+    }
+    mJpegThread = new TaskThread(mJpegQueue);
+    mJpegThread->run("ExtCamJpeg", PRIORITY_DISPLAY);
+    for (int i = 0; i < kNumJpegPartThreads; i++) {
+        sp<TaskThread> thread = new TaskThread(mJpegPartQueue);
+        thread->run("ExtCamJpegPart", PRIORITY_DISPLAY);
+        mJpegPartThreads.push_back(thread);
+    }
+    mWorkersStarted = true;
+}
+
+void ExternalCameraDeviceSession::OutputThread::stopWorkers() {
+    for (TaskQueue* queue : {&mConvertQueue, &mJpegQueue, &mJpegPartQueue}) {
+        std::lock_guard<std::mutex> lk(queue->lock);
+        queue->exiting = true;
+        queue->cond.notify_all();
+    }
+    for (auto& thread : mConvertThreads) {
+        thread->requestExit();
+        thread->join();
+    }
+    mConvertThreads.clear();
+    if (mJpegThread != nullptr) {
+        mJpegThread->requestExit();
+        mJpegThread->join();
+        mJpegThread.clear();
+    }
+    // Tasks pushed by the JPEG thread after this queue stopped ran inline
+    for (auto& thread : mJpegPartThreads) {
+        thread->requestExit();
+        thread->join();
+    }
+    mJpegPartThreads.clear();
+}
+
+void ExternalCameraDeviceSession::OutputThread::requestExit() {
+    Thread::requestExit();
+    stopWorkers();
+}
+
+void ExternalCameraDeviceSession::OutputThread::TaskQueue::push(
+        std::function<void()>&& task) {
+    std::unique_lock<std::mutex> lk(lock);
+    if (exiting) {
+        lk.unlock();
+        task();
+        return;
+    }
+    tasks.push_back(std::move(task));
+    lk.unlock();
+    cond.notify_one();
+}
+
+bool ExternalCameraDeviceSession::OutputThread::TaskQueue::pop(
+        std::function<void()>* out) {
+    std::unique_lock<std::mutex> lk(lock);
+    cond.wait(lk, [this] { return exiting || !tasks.empty(); });
+    if (tasks.empty()) {
+        return false;
+    }
+    *out = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+}
+
+size_t ExternalCameraDeviceSession::OutputThread::TaskQueue::size() {
+    std::lock_guard<std::mutex> lk(lock);
+    return tasks.size();
+}
+
+bool ExternalCameraDeviceSession::OutputThread::TaskThread::threadLoop() {
+    std::function<void()> task;
+    if (!mQueue.pop(&task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ExternalCameraDeviceSession::OutputThread::StageStats::add(nsecs_t durationNs) {
+    count++;
+    lastNs = durationNs;
+    maxNs = std::max(maxNs, durationNs);
+    totalNs += durationNs;
+}
+
+void ExternalCameraDeviceSession::OutputThread::StageStats::dump(
+        int fd, const char* name) const {
+    dprintf(fd, "OutputThread %s: %" PRIu64 " frames, last %" PRId64 "us, avg %" PRId64
+            "us, max %" PRId64 "us\n", name, count, ns2us(lastNs),
+            count == 0 ? 0 : ns2us(totalNs / static_cast<nsecs_t>(count)), ns2us(maxNs));
+}
+
 bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     std::shared_ptr<HalRequest> req;
     auto parent = mParent.promote();
@@ -1421,9 +1832,8 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
        return false;
     }
 
-    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
-    //       regularly to prevent v4l buffer queue filled with stale buffers
-    //       when app doesn't program a preveiw request
+    startWorkers();
+
     waitForNextRequest(&req);
     if (req == nullptr) {
         // No new request, wait again
@@ -1438,7 +1848,9 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return false;
     };
 
-    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+    const uint32_t inFourcc = req->frameIn->mFourcc;
+    if (inFourcc != V4L2_PIX_FMT_MJPEG && inFourcc != V4L2_PIX_FMT_Z16 &&
+            !isPassThroughFourcc(inFourcc)) {
         return onDeviceError("%s: do not support V4L2 format %c%c%c%c", __FUNCTION__,
                 req->frameIn->mFourcc & 0xFF,
                 (req->frameIn->mFourcc >> 8) & 0xFF,
@@ -1453,8 +1865,6 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     }
 
     std::unique_lock<std::mutex> lk(mBufferLock);
-    // Convert input V4L2 frame to YU12 of the same size
-    // TODO: see if we can save some computation by converting to YV12 here
     uint8_t* inData;
     size_t inDataSize;
     if (req->frameIn->getData(&inData, &inDataSize) != 0) {
@@ -1486,9 +1896,30 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         }
     }
 
-    // TODO: in some special case maybe we can decode jpg directly to gralloc output?
-    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
-        ATRACE_BEGIN("MJPGtoI420");
+    // YUYV/NV12 frames are copied straight into YUV outputs of the V4L2 frame size.
+    // The intermediate YU12 frame is only needed for the other outputs.
+    const Size inSize {req->frameIn->mWidth, req->frameIn->mHeight};
+    const bool passThrough = isPassThroughFourcc(inFourcc) && !mCameraMuted;
+    auto isPassThroughBuffer = [&](const HalStreamBuffer& halBuf) {
+        return passThrough &&
+                (halBuf.format == PixelFormat::YCBCR_420_888 ||
+                 halBuf.format == PixelFormat::YV12) &&
+                halBuf.width == inSize.width && halBuf.height == inSize.height;
+    };
+    bool needYu12Frame = false;
+    if (inFourcc != V4L2_PIX_FMT_Z16) {
+        for (const auto& halBuf : req->buffers) {
+            if (!isPassThroughBuffer(halBuf)) {
+                needYu12Frame = true;
+                break;
+            }
+        }
+    }
+
+    // Convert input V4L2 frame to YU12 of the same size
+    if (needYu12Frame) {
+        nsecs_t decodeStartTs = systemTime(SYSTEM_TIME_MONOTONIC);
+        ATRACE_BEGIN("V4L2FrameToYU12");
         int res = 0;
         if (mCameraMuted) {
             res = libyuv::ConvertToI420(
@@ -1499,14 +1930,14 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                     mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth,
                     mYu12Frame->mHeight, libyuv::kRotate0, libyuv::FOURCC_RAW);
         } else {
-            res = libyuv::MJPGToI420(
-                    inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y),
-                    mYu12FrameLayout.yStride, static_cast<uint8_t*>(mYu12FrameLayout.cb),
-                    mYu12FrameLayout.cStride, static_cast<uint8_t*>(mYu12FrameLayout.cr),
-                    mYu12FrameLayout.cStride, mYu12Frame->mWidth, mYu12Frame->mHeight,
-                    mYu12Frame->mWidth, mYu12Frame->mHeight);
+            res = convertV4l2FrameToYU12(inFourcc, inData, inDataSize, req->frameIn->mStride,
+                    Size {mYu12Frame->mWidth, mYu12Frame->mHeight}, mYu12FrameLayout);
         }
         ATRACE_END();
+        {
+            std::lock_guard<std::mutex> jpegLk(mJpegLock);
+            mDecodeStats.add(systemTime(SYSTEM_TIME_MONOTONIC) - decodeStartTs);
+        }
 
         if (res != 0) {
             // For some webcam, the first few V4L2 frames might be malformed...
@@ -1533,6 +1964,13 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
 
     ALOGV("%s processing new request", __FUNCTION__);
     const int kSyncWaitTimeoutMs = 500;
+    std::vector<HalStreamBuffer> blobBufs;
+    std::shared_ptr<HalRequest> jpegReq;
+    JpegJob* jpegJob = nullptr;
+    // YUV output buffers grouped by size
+    std::vector<std::vector<HalStreamBuffer*>> yuvBufs;
+    // YUV output buffers filled directly from the V4L2 frame
+    std::vector<HalStreamBuffer*> passThroughBufs;
     for (auto& halBuf : req->buffers) {
         if (*(halBuf.bufPtr) == nullptr) {
             ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
@@ -1554,12 +1992,16 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         // Gralloc lockYCbCr the buffer
         switch (halBuf.format) {
             case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req->setting);
-
-                if(ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: createJpegLocked failed with %d",
-                          __FUNCTION__, ret);
+                if (mJpegJobs.empty()) {
+                    // No JPEG job configured, encode inline
+                    int ret = createJpegLocked(halBuf, req->setting);
+                    if(ret != 0) {
+                        lk.unlock();
+                        return onDeviceError("%s: createJpegLocked failed with %d",
+                              __FUNCTION__, ret);
+                    }
+                } else {
+                    blobBufs.push_back(halBuf);
                 }
             } break;
             case PixelFormat::Y16: {
@@ -1574,46 +2016,19 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
             } break;
             case PixelFormat::YCBCR_420_888:
             case PixelFormat::YV12: {
-                IMapper::Rect outRect {0, 0,
-                        static_cast<int32_t>(halBuf.width),
-                        static_cast<int32_t>(halBuf.height)};
-                YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
-                        *(halBuf.bufPtr), halBuf.usage, outRect);
-                ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
-                        __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
-                        outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
-
-                // Convert to output buffer size/format
-                uint32_t outputFourcc = getFourCcFromLayout(outLayout);
-                ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
-                        outputFourcc & 0xFF,
-                        (outputFourcc >> 8) & 0xFF,
-                        (outputFourcc >> 16) & 0xFF,
-                        (outputFourcc >> 24) & 0xFF);
-
-                YCbCrLayout cropAndScaled;
-                ATRACE_BEGIN("cropAndScaleLocked");
-                int ret = cropAndScaleLocked(
-                        mYu12Frame,
-                        Size { halBuf.width, halBuf.height },
-                        &cropAndScaled);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
-                }
-
-                Size sz {halBuf.width, halBuf.height};
-                ATRACE_BEGIN("formatConvert");
-                ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: format coversion failed!", __FUNCTION__);
+                if (isPassThroughBuffer(halBuf)) {
+                    passThroughBufs.push_back(&halBuf);
+                    break;
                 }
-                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                if (relFence >= 0) {
-                    halBuf.acquireFence = relFence;
+                auto group = std::find_if(yuvBufs.begin(), yuvBufs.end(),
+                        [&halBuf](const std::vector<HalStreamBuffer*>& bufs) {
+                            return bufs[0]->width == halBuf.width &&
+                                    bufs[0]->height == halBuf.height;
+                        });
+                if (group == yuvBufs.end()) {
+                    yuvBufs.push_back({&halBuf});
+                } else {
+                    group->push_back(&halBuf);
                 }
             } break;
             default:
@@ -1621,11 +2036,81 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                 return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
         }
     } // for each buffer
+
+    // Fan out the YUV outputs by size: each size has its own intermediate buffer, so
+    // the conversions are independent. The pass-through outputs and the last size are
+    // converted on this thread.
+    if (!yuvBufs.empty() || !passThroughBufs.empty()) {
+        nsecs_t convertStartTs = systemTime(SYSTEM_TIME_MONOTONIC);
+        std::mutex convertLock;
+        std::condition_variable convertDoneCond;
+        size_t numPending = yuvBufs.empty() ? 0 : yuvBufs.size() - 1;
+        int convertRet = 0;
+        for (size_t i = 0; i < numPending; i++) {
+            const std::vector<HalStreamBuffer*>& halBufs = yuvBufs[i];
+            mConvertQueue.push([&, halBufs]() {
+                int ret = convertYuvOutputs(halBufs);
+                std::lock_guard<std::mutex> convertLk(convertLock);
+                if (ret != 0) {
+                    convertRet = ret;
+                }
+                if (--numPending == 0) {
+                    convertDoneCond.notify_one();
+                }
+            });
+        }
+        int ret = copyYuvOutputs(inFourcc, inData, inDataSize, req->frameIn->mStride,
+                passThroughBufs);
+        if (ret == 0 && !yuvBufs.empty()) {
+            ret = convertYuvOutputs(yuvBufs.back());
+        }
+        {
+            std::unique_lock<std::mutex> convertLk(convertLock);
+            convertDoneCond.wait(convertLk, [&] { return numPending == 0; });
+            if (ret != 0) {
+                convertRet = ret;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> jpegLk(mJpegLock);
+            mConvertStats.add(systemTime(SYSTEM_TIME_MONOTONIC) - convertStartTs);
+        }
+        if (convertRet != 0) {
+            lk.unlock();
+            return onDeviceError("%s: crop/scale/convert failed with %d!",
+                    __FUNCTION__, convertRet);
+        }
+    }
     mScaledYu12Frames.clear();
 
+    // JPEG is encoded off this thread so the next request does not wait for it. The
+    // BLOB buffers are returned separately once encoded.
+    if (!blobBufs.empty()) {
+        std::vector<HalStreamBuffer> remainingBufs;
+        for (const auto& halBuf : req->buffers) {
+            if (halBuf.format != PixelFormat::BLOB || halBuf.fenceTimeout) {
+                remainingBufs.push_back(halBuf);
+            }
+        }
+        req->buffers = std::move(remainingBufs);
+        req->hasDeferredBuffers = true;
+
+        jpegReq = std::make_shared<HalRequest>();
+        jpegReq->frameNumber = req->frameNumber;
+        jpegReq->setting = req->setting;
+        jpegReq->shutterTs = req->shutterTs;
+        jpegReq->buffers = std::move(blobBufs);
+        jpegReq->buffersOnly = true;
+        jpegJob = acquireJpegJobLocked();
+    }
+
     // Don't hold the lock while calling back to parent
     lk.unlock();
     Status st = parent->processCaptureResult(req);
+    if (jpegJob != nullptr) {
+        // Only queued now so the BLOB buffers are returned after the shutter
+        mJpegQueue.push([this, jpegJob, jpegReq]() { processJpeg(jpegJob, jpegReq); });
+    }
     if (st != Status::OK) {
         return onDeviceError("%s: failed to process capture result!", __FUNCTION__);
     }
@@ -1706,6 +2191,54 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         }
     }
 
+    // Allocating JPEG jobs, each with its own copy of the decode and scale buffers
+    {
+        std::lock_guard<std::mutex> jpegLk(mJpegLock);
+        if (mFreeJpegJobs.size() != mJpegJobs.size()) {
+            ALOGE("%s: %zu JPEG captures still inflight! (expect 0)",
+                    __FUNCTION__, mJpegJobs.size() - mFreeJpegJobs.size());
+            return Status::INTERNAL_ERROR;
+        }
+    }
+    std::vector<Size> blobSizes;
+    for (const auto& stream : streams) {
+        if (stream.format == PixelFormat::BLOB) {
+            blobSizes.push_back({stream.width, stream.height});
+        }
+    }
+    std::vector<std::unique_ptr<JpegJob>> jpegJobs;
+    for (int i = 0; !blobSizes.empty() && i < kMaxPendingJpegs; i++) {
+        std::unique_ptr<JpegJob> job = std::make_unique<JpegJob>();
+        job->yu12Frame = new AllocatedFrame(v4lSize.width, v4lSize.height);
+        job->thumbFrame = new AllocatedFrame(thumbSize.width, thumbSize.height);
+        if (job->yu12Frame->allocate(&job->yu12FrameLayout) != 0 ||
+                job->thumbFrame->allocate() != 0) {
+            ALOGE("%s: allocating JPEG job frames failed!", __FUNCTION__);
+            return Status::INTERNAL_ERROR;
+        }
+        for (const auto& sz : blobSizes) {
+            if (sz == v4lSize) {
+                continue;
+            }
+            sp<AllocatedFrame> buf = new AllocatedFrame(sz.width, sz.height);
+            if (buf->allocate() != 0) {
+                ALOGE("%s: allocating JPEG YU12 frame %dx%d failed!",
+                        __FUNCTION__, sz.width, sz.height);
+                return Status::INTERNAL_ERROR;
+            }
+            job->scaledFrames[sz] = buf;
+        }
+        jpegJobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> jpegLk(mJpegLock);
+        mJpegJobs = std::move(jpegJobs);
+        mFreeJpegJobs.clear();
+        for (auto& job : mJpegJobs) {
+            mFreeJpegJobs.push_back(job.get());
+        }
+    }
+
     // Allocate mute test pattern frame
     mMuteTestPatternFrame.resize(mYu12Frame->mWidth * mYu12Frame->mHeight * 3);
 
@@ -1720,6 +2253,9 @@ void ExternalCameraDeviceSession::OutputThread::clearIntermediateBuffers() {
     mIntermediateBuffers.clear();
     mMuteTestPatternFrame.clear();
     mBlobBufferSize = 0;
+    std::lock_guard<std::mutex> jpegLk(mJpegLock);
+    mJpegJobs.clear();
+    mFreeJpegJobs.clear();
 }
 
 Status ExternalCameraDeviceSession::OutputThread::submitRequest(
@@ -1752,6 +2288,7 @@ void ExternalCameraDeviceSession::OutputThread::flush() {
 
     ALOGV("%s: flusing inflight requests", __FUNCTION__);
     lk.unlock();
+    waitForJpegDone();
     for (const auto& req : reqs) {
         parent->processCaptureRequestError(req);
     }
@@ -1778,6 +2315,8 @@ ExternalCameraDeviceSession::OutputThread::switchToOffline() {
         }
     }
     lk.unlock();
+    // Captures already handed to the JPEG thread are finished here
+    waitForJpegDone();
     clearIntermediateBuffers();
     ALOGV("%s: returning %zu request for offline processing", __FUNCTION__, reqs.size());
     return reqs;
@@ -1833,6 +2372,22 @@ void ExternalCameraDeviceSession::OutputThread::dump(int fd) {
         dprintf(fd, "%d, ", req->frameNumber);
     }
     dprintf(fd, "\n");
+
+    std::lock_guard<std::mutex> jpegLk(mJpegLock);
+    mDecodeStats.dump(fd, "decode");
+    mConvertStats.dump(fd, "convert");
+    mJpegStats.dump(fd, "jpeg");
+    dprintf(fd, "OutputThread YUV kernels: %s\n", common::V1_0::helper::getYuvKernelIsa());
+    dprintf(fd, "OutputThread convert queue %zu, jpeg queue %zu, jpeg in flight %zu/%zu,"
+            " stalled on jpeg %" PRIu64 " times\n",
+            mConvertQueue.size(), mJpegQueue.size(),
+            mJpegJobs.size() - mFreeJpegJobs.size(), mJpegJobs.size(), mJpegStalls);
+    dprintf(fd, "OutputThread jpeg part queue %zu\n", mJpegPartQueue.size());
+    {
+        std::lock_guard<std::mutex> lk(mExifLock);
+        dprintf(fd, "OutputThread EXIF template reused %" PRIu64 " times, rebuilt %" PRIu64
+                " times\n", mExifReuses, mExifRebuilds);
+    }
 }
 
 void ExternalCameraDeviceSession::cleanupBuffersLocked(int id) {
@@ -1927,6 +2482,8 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
         return OK;
     }
 
+    pauseCaptureLocked();
+
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         if (mNumDequeuedV4l2Buffers != 0)  {
@@ -2044,9 +2601,26 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
                 fmt.fmt.pix.width, fmt.fmt.pix.height);
         return -EINVAL;
     }
+
+    // YUYV/NV12 lines may be padded by the driver; the conversions read with this stride
+    uint32_t stride = 0;
+    uint32_t expectedMaxBufferSize = kMaxBytesPerPixel * fmt.fmt.pix.width * fmt.fmt.pix.height;
+    if (isPassThroughFourcc(v4l2Fmt.fourcc)) {
+        uint32_t minBytesPerLine = (v4l2Fmt.fourcc == V4L2_PIX_FMT_YUYV) ?
+                v4l2Fmt.width * 2 : v4l2Fmt.width;
+        if (fmt.fmt.pix.bytesperline != 0 && fmt.fmt.pix.bytesperline < minBytesPerLine) {
+            ALOGE("%s: invalid V4L2 line stride %u, expect at least %u", __FUNCTION__,
+                    fmt.fmt.pix.bytesperline, minBytesPerLine);
+            return -EINVAL;
+        }
+        stride = fmt.fmt.pix.bytesperline;
+        // a padded NV12 frame is stride * 3/2 bytes per line, a padded YUYV one stride bytes
+        expectedMaxBufferSize = std::max(expectedMaxBufferSize,
+                stride * fmt.fmt.pix.height * 3 / 2);
+    }
+
     uint32_t bufferSize = fmt.fmt.pix.sizeimage;
     ALOGI("%s: V4L2 buffer size is %d", __FUNCTION__, bufferSize);
-    uint32_t expectedMaxBufferSize = kMaxBytesPerPixel * fmt.fmt.pix.width * fmt.fmt.pix.height;
     if ((bufferSize == 0) || (bufferSize > expectedMaxBufferSize)) {
         ALOGE("%s: V4L2 buffer size: %u looks invalid. Expected maximum size: %u", __FUNCTION__,
                 bufferSize, expectedMaxBufferSize);
@@ -2157,27 +2731,150 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
     ALOGI("%s: start V4L2 streaming %dx%d@%ffps",
                 __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, fps);
     mV4l2StreamingFmt = v4l2Fmt;
+    mV4l2StreamingStride = stride;
     mV4l2Streaming = true;
+    resumeCaptureLocked();
     return OK;
 }
 
-sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs) {
+sp<V4L2Frame> ExternalCameraDeviceSession::takeLatestV4l2FrameLocked(/*out*/nsecs_t* shutterTs) {
     ATRACE_CALL();
-    sp<V4L2Frame> ret = nullptr;
-
     if (shutterTs == nullptr) {
         ALOGE("%s: shutterTs must not be null!", __FUNCTION__);
-        return ret;
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+    if (mLatestFrame == nullptr) {
+        // The previous request took the latest frame, wait for the next one. mLock is
+        // kept since mCaptureThread does not need it.
+        std::chrono::seconds timeout = std::chrono::seconds(kBufferWaitTimeoutSec);
+        bool captured = mLatestFrameCond.wait_for(lk, timeout, [this] {
+            return mLatestFrame != nullptr;
+        });
+        if (!captured) {
+            ALOGE("%s: wait for V4L2 frame timeout!", __FUNCTION__);
+            return nullptr;
+        }
+    }
+    sp<V4L2Frame> ret = mLatestFrame;
+    *shutterTs = mLatestFrameTs;
+    mLatestFrame.clear();
+    return ret;
+}
+
+bool ExternalCameraDeviceSession::CaptureThread::threadLoop() {
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+        ALOGE("%s: session has been disconnected!", __FUNCTION__);
+        return false;
     }
+    parent->captureV4l2Frame();
+    return true;
+}
 
+void ExternalCameraDeviceSession::captureV4l2Frame() {
     {
         std::unique_lock<std::mutex> lk(mV4l2BufferLock);
-        if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
-            int waitRet = waitForV4L2BufferReturnLocked(lk);
-            if (waitRet != 0) {
-                return ret;
+        // A free buffer is needed to dequeue into: the frame in mLatestFrame is only
+        // re-queued once a newer one replaces it.
+        auto canCapture = [this] {
+            return !mCapturePaused && mNumDequeuedV4l2Buffers < mV4L2BufferCount;
+        };
+        if (!canCapture()) {
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(kCapturePollTimeoutMs);
+            if (!mV4L2BufferReturned.wait_for(lk, timeout, canCapture)) {
+                // Return to threadLoop so a pending exit is noticed
+                return;
+            }
+        }
+        mCaptureActive = true;
+    }
+
+    auto captureDone = [this](const sp<V4L2Frame>& frame, nsecs_t shutterTs) {
+        sp<V4L2Frame> staleFrame;
+        {
+            std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+            mCaptureActive = false;
+            if (frame != nullptr) {
+                staleFrame = mLatestFrame;
+                mLatestFrame = frame;
+                mLatestFrameTs = shutterTs;
+                mNumCapturedFrames++;
+                if (staleFrame != nullptr) {
+                    mNumStaleFrames++;
+                }
             }
         }
+        mV4L2BufferReturned.notify_all();
+        if (frame != nullptr) {
+            mLatestFrameCond.notify_one();
+        }
+        if (staleFrame != nullptr) {
+            // No request took this one, give it back to the driver right away
+            enqueueV4l2Frame(staleFrame);
+        }
+    };
+
+    // Wait with a timeout so the thread can be paused or stopped while the camera
+    // is not producing frames
+    struct pollfd pfd = {mV4l2Fd.get(), POLLIN, 0};
+    int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, kCapturePollTimeoutMs));
+    if (ret <= 0 || !(pfd.revents & POLLIN)) {
+        if (ret < 0 || (pfd.revents & POLLERR)) {
+            ALOGE("%s: poll on V4L2 FD failed: %s (revents 0x%x)", __FUNCTION__,
+                    ret < 0 ? strerror(errno) : "error event", pfd.revents);
+            usleep(IOCTL_RETRY_SLEEP_US);
+        }
+        captureDone(nullptr, 0);
+        return;
+    }
+
+    nsecs_t shutterTs = 0;
+    sp<V4L2Frame> frame = dequeueV4l2Frame(&shutterTs);
+    captureDone(frame, shutterTs);
+}
+
+void ExternalCameraDeviceSession::pauseCaptureLocked() {
+    sp<V4L2Frame> latestFrame;
+    {
+        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+        mCapturePaused = true;
+        mV4L2BufferReturned.notify_all();
+        // Bounded by kCapturePollTimeoutMs
+        mV4L2BufferReturned.wait(lk, [this] { return !mCaptureActive; });
+        latestFrame = mLatestFrame;
+        mLatestFrame.clear();
+    }
+    if (latestFrame != nullptr) {
+        enqueueV4l2Frame(latestFrame);
+    }
+}
+
+void ExternalCameraDeviceSession::resumeCaptureLocked() {
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mCapturePaused = false;
+    }
+    mV4L2BufferReturned.notify_all();
+}
+
+void ExternalCameraDeviceSession::closeCaptureThread() {
+    if (mCaptureThread) {
+        mCaptureThread->requestExit();
+        mV4L2BufferReturned.notify_all();
+        mCaptureThread->join();
+        mCaptureThread.clear();
+    }
+}
+
+sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2Frame(/*out*/nsecs_t* shutterTs) {
+    ATRACE_CALL();
+    sp<V4L2Frame> ret = nullptr;
+
+    if (shutterTs == nullptr) {
+        ALOGE("%s: shutterTs must not be null!", __FUNCTION__);
+        return ret;
     }
 
     ATRACE_BEGIN("VIDIOC_DQBUF");
@@ -2221,7 +2918,7 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
     }
     return new V4L2Frame(
             mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
-            buffer.index, mV4l2Fd.get(), buffer.bytesused, buffer.m.offset);
+            mV4l2StreamingStride, buffer.index, mV4l2Fd.get(), buffer.bytesused, buffer.m.offset);
 }
 
 void ExternalCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
@@ -2243,7 +2940,7 @@ void ExternalCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         mNumDequeuedV4l2Buffers--;
     }
-    mV4L2BufferReturned.notify_one();
+    mV4L2BufferReturned.notify_all();
 }
 
 Status ExternalCameraDeviceSession::isStreamCombinationSupported(
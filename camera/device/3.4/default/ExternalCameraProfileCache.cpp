@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ExtCamProfile@3.4"
+//#define LOG_NDEBUG 0
+#include <log/log.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <linux/videodev2.h>
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include "ExternalCameraProfileCache.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace V3_4 {
+namespace implementation {
+
+namespace {
+
+const char* kProfileCacheProperty = "ro.vendor.camera.external.profile_cache";
+// Bump when the file layout or the probing logic changes
+const char* kProfileCacheHeader = "extcam-profiles 1";
+constexpr uint32_t kMaxEnumFormats = 64;
+
+std::string readSysfsAttr(const std::string& dir, const char* attr) {
+    std::string value;
+    if (!base::ReadFileToString(dir + "/" + attr, &value)) {
+        return "";
+    }
+    value = base::Trim(value);
+    // Keys are stored space separated, so keep them to a safe character set
+    std::replace_if(value.begin(), value.end(), [](char c) {
+            return !isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-';
+        }, '_');
+    return value;
+}
+
+void hashBytes(uint64_t* hash, const void* data, size_t size) {
+    // FNV-1a, stable across builds unlike std::hash
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        *hash ^= bytes[i];
+        *hash *= 0x100000001b3ULL;
+    }
+}
+
+void hashFpsLimits(uint64_t* hash,
+        const std::vector<ExternalCameraConfig::FpsLimitation>& limits) {
+    for (const auto& limit : limits) {
+        hashBytes(hash, &limit.size.width, sizeof(limit.size.width));
+        hashBytes(hash, &limit.size.height, sizeof(limit.size.height));
+        hashBytes(hash, &limit.fpsUpperBound, sizeof(limit.fpsUpperBound));
+    }
+    uint32_t count = limits.size();
+    hashBytes(hash, &count, sizeof(count));
+}
+
+} // anonymous namespace
+
+ExternalCameraProfileCache& ExternalCameraProfileCache::getInstance() {
+    static ExternalCameraProfileCache sInstance;
+    return sInstance;
+}
+
+ExternalCameraProfileCache::ExternalCameraProfileCache() :
+        mPath(base::GetProperty(kProfileCacheProperty, "")) {}
+
+std::string ExternalCameraProfileCache::getDeviceKey(const std::string& devicePath) {
+    size_t pos = devicePath.rfind('/');
+    std::string nodeName = (pos == std::string::npos) ? devicePath : devicePath.substr(pos + 1);
+
+    // The device link of a UVC node points to its USB interface; the USB device is the
+    // interface's parent
+    std::string sysfsPath = "/sys/class/video4linux/" + nodeName + "/device";
+    char realPath[PATH_MAX];
+    if (realpath(sysfsPath.c_str(), realPath) == nullptr) {
+        return "";
+    }
+    std::string usbDir(realPath);
+    pos = usbDir.rfind('/');
+    if (pos == std::string::npos) {
+        return "";
+    }
+    usbDir.resize(pos);
+
+    std::string vid = readSysfsAttr(usbDir, "idVendor");
+    std::string pid = readSysfsAttr(usbDir, "idProduct");
+    std::string bcd = readSysfsAttr(usbDir, "bcdDevice");
+    if (vid.empty() || pid.empty() || bcd.empty()) {
+        ALOGV("%s: %s is not a USB device", __FUNCTION__, devicePath.c_str());
+        return "";
+    }
+    // Serial numbers are optional; cameras without one share the profile of their model
+    std::string serial = readSysfsAttr(usbDir, "serial");
+    if (serial.empty()) {
+        serial = "-";
+    }
+    return base::StringPrintf("%s:%s:%s:%s", vid.c_str(), pid.c_str(), serial.c_str(),
+            bcd.c_str());
+}
+
+uint64_t ExternalCameraProfileCache::getConfigHash(const ExternalCameraConfig& cfg) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint8_t depthEnabled = cfg.depthEnabled ? 1 : 0;
+    hashBytes(&hash, &depthEnabled, sizeof(depthEnabled));
+    hashBytes(&hash, &cfg.minStreamSize.width, sizeof(cfg.minStreamSize.width));
+    hashBytes(&hash, &cfg.minStreamSize.height, sizeof(cfg.minStreamSize.height));
+    hashFpsLimits(&hash, cfg.fpsLimits);
+    hashFpsLimits(&hash, cfg.depthFpsLimits);
+    return hash;
+}
+
+bool ExternalCameraProfileCache::validate(int fd, const Profile& profile) {
+    if (profile.fmts.empty()) {
+        return false;
+    }
+
+    // Format and size enumeration is answered from the descriptors the driver already
+    // parsed, unlike the frame interval queries that dominate a full probe
+    std::vector<uint32_t> fourccs;
+    v4l2_fmtdesc fmtdesc {
+        .index = 0,
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE};
+    for (; fmtdesc.index < kMaxEnumFormats &&
+            TEMP_FAILURE_RETRY(ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc)) == 0; fmtdesc.index++) {
+        fourccs.push_back(fmtdesc.pixelformat);
+    }
+    for (const auto& fmt : profile.fmts) {
+        if (std::find(fourccs.begin(), fourccs.end(), fmt.fourcc) == fourccs.end()) {
+            ALOGI("%s: cached format %c%c%c%c is no longer reported", __FUNCTION__,
+                    fmt.fourcc & 0xFF, (fmt.fourcc >> 8) & 0xFF,
+                    (fmt.fourcc >> 16) & 0xFF, (fmt.fourcc >> 24) & 0xFF);
+            return false;
+        }
+    }
+
+    // Formats are sorted by size, so the last one is the largest
+    const auto& maxFmt = profile.fmts.back();
+    v4l2_frmsizeenum frameSize {
+        .index = 0,
+        .pixel_format = maxFmt.fourcc};
+    for (; TEMP_FAILURE_RETRY(ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frameSize)) == 0;
+            frameSize.index++) {
+        if (frameSize.type == V4L2_FRMSIZE_TYPE_DISCRETE &&
+                frameSize.discrete.width == maxFmt.width &&
+                frameSize.discrete.height == maxFmt.height) {
+            return true;
+        }
+    }
+    ALOGI("%s: cached size %ux%u is no longer reported", __FUNCTION__,
+            maxFmt.width, maxFmt.height);
+    return false;
+}
+
+bool ExternalCameraProfileCache::lookup(const std::string& key, int fd,
+        const ExternalCameraConfig& cfg,
+        std::vector<SupportedV4L2Format>* fmts, CroppingType* croppingType) {
+    if (key.empty()) {
+        return false;
+    }
+
+    Profile profile;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        loadLocked();
+        auto it = mProfiles.find(key);
+        if (it == mProfiles.end()) {
+            return false;
+        }
+        if (it->second.cfgHash != getConfigHash(cfg)) {
+            ALOGI("%s: external camera config changed, dropping profile of %s",
+                    __FUNCTION__, key.c_str());
+            mProfiles.erase(it);
+            return false;
+        }
+        profile = it->second;
+    }
+
+    // Validate outside of the lock so several devices can be checked concurrently
+    if (!validate(fd, profile)) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mProfiles.erase(key);
+        return false;
+    }
+
+    ALOGV("%s: using cached profile of %s, %zu formats", __FUNCTION__, key.c_str(),
+            profile.fmts.size());
+    if (croppingType != nullptr) {
+        *croppingType = profile.croppingType;
+    }
+    if (fmts != nullptr) {
+        *fmts = std::move(profile.fmts);
+    }
+    return true;
+}
+
+void ExternalCameraProfileCache::store(const std::string& key, const ExternalCameraConfig& cfg,
+        const std::vector<SupportedV4L2Format>& fmts, CroppingType croppingType) {
+    if (key.empty() || fmts.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(mLock);
+    loadLocked();
+    mProfiles[key] = Profile{getConfigHash(cfg), croppingType, fmts};
+    saveLocked();
+}
+
+void ExternalCameraProfileCache::loadLocked() {
+    if (mLoaded) {
+        return;
+    }
+    mLoaded = true;
+    if (mPath.empty()) {
+        return;
+    }
+
+    std::string content;
+    if (!base::ReadFileToString(mPath, &content)) {
+        ALOGV("%s: no profile cache at %s", __FUNCTION__, mPath.c_str());
+        return;
+    }
+
+    std::vector<std::string> lines = base::Split(content, "\n");
+    if (lines.empty() || lines[0] != kProfileCacheHeader) {
+        ALOGI("%s: ignoring profile cache %s of another version", __FUNCTION__, mPath.c_str());
+        return;
+    }
+
+    // Each profile is a "profile <key> <cfgHash> <croppingType> <numFormats>" line followed
+    // by numFormats "<fourcc> <width> <height> <num>/<den>..." lines
+    size_t i = 1;
+    while (i < lines.size()) {
+        std::vector<std::string> fields = base::Split(lines[i++], " ");
+        if (fields.size() == 1 && fields[0].empty()) {
+            continue;
+        }
+
+        Profile profile;
+        uint32_t cropping;
+        size_t numFmts;
+        if (fields.size() != 5 || fields[0] != "profile" ||
+                !base::ParseUint(fields[2], &profile.cfgHash) ||
+                !base::ParseUint(fields[3], &cropping) || cropping > VERTICAL ||
+                !base::ParseUint(fields[4], &numFmts) || numFmts > lines.size() - i) {
+            ALOGE("%s: corrupt profile cache %s at line %zu", __FUNCTION__, mPath.c_str(), i);
+            mProfiles.clear();
+            return;
+        }
+        profile.croppingType = static_cast<CroppingType>(cropping);
+
+        for (size_t f = 0; f < numFmts; f++) {
+            std::vector<std::string> fmtFields = base::Split(lines[i++], " ");
+            SupportedV4L2Format fmt;
+            if (fmtFields.size() < 4 || !base::ParseUint(fmtFields[0], &fmt.fourcc) ||
+                    !base::ParseUint(fmtFields[1], &fmt.width) ||
+                    !base::ParseUint(fmtFields[2], &fmt.height)) {
+                ALOGE("%s: corrupt profile cache %s at line %zu", __FUNCTION__, mPath.c_str(), i);
+                mProfiles.clear();
+                return;
+            }
+            for (size_t r = 3; r < fmtFields.size(); r++) {
+                std::vector<std::string> fraction = base::Split(fmtFields[r], "/");
+                SupportedV4L2Format::FrameRate fr;
+                if (fraction.size() != 2 || !base::ParseUint(fraction[0], &fr.durationNumerator) ||
+                        !base::ParseUint(fraction[1], &fr.durationDenominator) ||
+                        fr.durationNumerator == 0) {
+                    ALOGE("%s: corrupt profile cache %s at line %zu", __FUNCTION__,
+                            mPath.c_str(), i);
+                    mProfiles.clear();
+                    return;
+                }
+                fmt.frameRates.push_back(fr);
+            }
+            profile.fmts.push_back(std::move(fmt));
+        }
+        mProfiles[fields[1]] = std::move(profile);
+    }
+    ALOGI("%s: loaded %zu external camera profiles", __FUNCTION__, mProfiles.size());
+}
+
+void ExternalCameraProfileCache::saveLocked() {
+    if (mPath.empty()) {
+        return;
+    }
+
+    std::string content = kProfileCacheHeader;
+    content += "\n";
+    for (const auto& pair : mProfiles) {
+        const Profile& profile = pair.second;
+        content += base::StringPrintf("profile %s %" PRIu64 " %d %zu\n", pair.first.c_str(),
+                profile.cfgHash, profile.croppingType, profile.fmts.size());
+        for (const auto& fmt : profile.fmts) {
+            content += base::StringPrintf("%u %u %u", fmt.fourcc, fmt.width, fmt.height);
+            for (const auto& fr : fmt.frameRates) {
+                content += base::StringPrintf(" %u/%u", fr.durationNumerator,
+                        fr.durationDenominator);
+            }
+            content += "\n";
+        }
+    }
+
+    // Write a temporary file and rename it so a crash never leaves a truncated cache
+    std::string tmpPath = mPath + ".tmp";
+    if (!base::WriteStringToFile(content, tmpPath)) {
+        ALOGW("%s: cannot write profile cache %s: %s", __FUNCTION__, tmpPath.c_str(),
+                strerror(errno));
+        return;
+    }
+    if (rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+        ALOGW("%s: cannot rename profile cache to %s: %s", __FUNCTION__, mPath.c_str(),
+                strerror(errno));
+        unlink(tmpPath.c_str());
+    }
+}
+
+}  // namespace implementation
+}  // namespace V3_4
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
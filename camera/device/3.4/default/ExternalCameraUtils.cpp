@@ -18,7 +18,9 @@
 #include <log/log.h>
 
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
+#include <setjmp.h>
 #include <sys/mman.h>
 #include <linux/videodev2.h>
 
@@ -42,13 +44,13 @@ namespace device {
 namespace V3_4 {
 namespace implementation {
 
-Frame::Frame(uint32_t width, uint32_t height, uint32_t fourcc) :
-        mWidth(width), mHeight(height), mFourcc(fourcc) {}
+Frame::Frame(uint32_t width, uint32_t height, uint32_t fourcc, uint32_t stride) :
+        mWidth(width), mHeight(height), mFourcc(fourcc), mStride(stride) {}
 
 V4L2Frame::V4L2Frame(
-        uint32_t w, uint32_t h, uint32_t fourcc,
+        uint32_t w, uint32_t h, uint32_t fourcc, uint32_t stride,
         int bufIdx, int fd, uint32_t dataSize, uint64_t offset) :
-        Frame(w, h, fourcc),
+        Frame(w, h, fourcc, stride),
         mBufferIndex(bufIdx), mFd(fd), mDataSize(dataSize), mOffset(offset) {}
 
 int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
@@ -300,73 +302,24 @@ int getCropRect(
     return 0;
 }
 
+common::V1_0::helper::YuvPlanes toYuvPlanes(const YCbCrLayout& layout) {
+    common::V1_0::helper::YuvPlanes planes;
+    planes.y = static_cast<uint8_t*>(layout.y);
+    planes.cb = static_cast<uint8_t*>(layout.cb);
+    planes.cr = static_cast<uint8_t*>(layout.cr);
+    planes.yStride = static_cast<int>(layout.yStride);
+    planes.cStride = static_cast<int>(layout.cStride);
+    planes.chromaStep = static_cast<int>(layout.chromaStep);
+    return planes;
+}
+
 int formatConvert(
         const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32_t format) {
-    int ret = 0;
     switch (format) {
         case V4L2_PIX_FMT_NV21:
-            ret = libyuv::I420ToNV21(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cr),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: convert to NV21 buffer failed! ret %d",
-                            __FUNCTION__, ret);
-                return ret;
-            }
-            break;
         case V4L2_PIX_FMT_NV12:
-            ret = libyuv::I420ToNV12(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cb),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: convert to NV12 buffer failed! ret %d",
-                            __FUNCTION__, ret);
-                return ret;
-            }
-            break;
         case V4L2_PIX_FMT_YVU420: // YV12
         case V4L2_PIX_FMT_YUV420: // YU12
-            // TODO: maybe we can speed up here by somehow save this copy?
-            ret = libyuv::I420Copy(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cb),
-                    out.cStride,
-                    static_cast<uint8_t*>(out.cr),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: copy to YV12 or YU12 buffer failed! ret %d",
-                            __FUNCTION__, ret);
-                return ret;
-            }
             break;
         case FLEX_YUV_GENERIC:
             // TODO: b/72261744 write to arbitrary flexible YUV layout. Slow.
@@ -379,81 +332,252 @@ int formatConvert(
             ALOGE("%s: unknown YUV format 0x%x!", __FUNCTION__, format);
             return -1;
     }
+
+    // The kernels interleave the chroma planes for NV12/NV21 and copy them for YU12/YV12
+    int ret = common::V1_0::helper::convertFromYu12(
+            toYuvPlanes(in), toYuvPlanes(out), sz.width, sz.height);
+    if (ret != 0) {
+        ALOGE("%s: convert to format 0x%x failed! ret %d", __FUNCTION__, format, ret);
+        return ret;
+    }
     return 0;
 }
 
-int encodeJpegYU12(
-        const Size & inSz, const YCbCrLayout& inLayout,
-        int jpegQuality, const void *app1Buffer, size_t app1Size,
-        void *out, const size_t maxOutSize, size_t &actualCodeSize)
-{
+bool isPassThroughFourcc(uint32_t fourcc) {
+    return fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_NV12;
+}
+
+namespace {
+
+// Bytes per line of the Y (NV12) or packed YUYV plane; the NV12 UV plane uses the same stride
+uint32_t getPassThroughStride(uint32_t fourcc, uint32_t stride, Size sz) {
+    if (stride != 0) {
+        return stride;
+    }
+    return (fourcc == V4L2_PIX_FMT_YUYV) ? sz.width * 2 : sz.width;
+}
+
+size_t getPassThroughFrameSize(uint32_t fourcc, uint32_t stride, Size sz) {
+    size_t planeSize = static_cast<size_t>(stride) * sz.height;
+    return (fourcc == V4L2_PIX_FMT_YUYV) ? planeSize : planeSize * 3 / 2;
+}
+
+} // anonymous namespace
+
+int convertV4l2FrameToYU12(uint32_t fourcc, const uint8_t* in, size_t inSize, uint32_t inStride,
+        Size sz, const YCbCrLayout& out) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_MJPEG:
+            return libyuv::MJPGToI420(
+                    in, inSize,
+                    static_cast<uint8_t*>(out.y), out.yStride,
+                    static_cast<uint8_t*>(out.cb), out.cStride,
+                    static_cast<uint8_t*>(out.cr), out.cStride,
+                    sz.width, sz.height, sz.width, sz.height);
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_NV12:
+            break;
+        default:
+            ALOGE("%s: unsupported V4L2 format 0x%x", __FUNCTION__, fourcc);
+            return -1;
+    }
+
+    const uint32_t stride = getPassThroughStride(fourcc, inStride, sz);
+    if (inSize < getPassThroughFrameSize(fourcc, stride, sz)) {
+        ALOGE("%s: V4L2 frame size %zu too small for %ux%u, stride %u", __FUNCTION__,
+                inSize, sz.width, sz.height, stride);
+        return -1;
+    }
+    if (fourcc == V4L2_PIX_FMT_YUYV) {
+        return libyuv::YUY2ToI420(
+                in, stride,
+                static_cast<uint8_t*>(out.y), out.yStride,
+                static_cast<uint8_t*>(out.cb), out.cStride,
+                static_cast<uint8_t*>(out.cr), out.cStride,
+                sz.width, sz.height);
+    }
+    return libyuv::NV12ToI420(
+            in, stride, in + static_cast<size_t>(stride) * sz.height, stride,
+            static_cast<uint8_t*>(out.y), out.yStride,
+            static_cast<uint8_t*>(out.cb), out.cStride,
+            static_cast<uint8_t*>(out.cr), out.cStride,
+            sz.width, sz.height);
+}
+
+int passThroughConvert(uint32_t fourcc, const uint8_t* in, size_t inSize, uint32_t inStride,
+        const YCbCrLayout& out, Size sz, uint32_t format) {
+    if (!isPassThroughFourcc(fourcc)) {
+        ALOGE("%s: V4L2 format 0x%x cannot be passed through", __FUNCTION__, fourcc);
+        return -1;
+    }
+    const int stride = getPassThroughStride(fourcc, inStride, sz);
+    if (inSize < getPassThroughFrameSize(fourcc, stride, sz)) {
+        ALOGE("%s: V4L2 frame size %zu too small for %ux%u, stride %d", __FUNCTION__,
+                inSize, sz.width, sz.height, stride);
+        return -1;
+    }
+
+    const int width = sz.width;
+    const int height = sz.height;
+    uint8_t* outY = static_cast<uint8_t*>(out.y);
+    uint8_t* outCb = static_cast<uint8_t*>(out.cb);
+    uint8_t* outCr = static_cast<uint8_t*>(out.cr);
+    int ret = 0;
+    if (fourcc == V4L2_PIX_FMT_NV12) {
+        const uint8_t* inUV = in + static_cast<size_t>(stride) * height;
+        switch (format) {
+            case V4L2_PIX_FMT_NV12:
+                libyuv::CopyPlane(in, stride, outY, out.yStride, width, height);
+                libyuv::CopyPlane(inUV, stride, outCb, out.cStride, width, height / 2);
+                break;
+            case V4L2_PIX_FMT_NV21:
+                libyuv::CopyPlane(in, stride, outY, out.yStride, width, height);
+                common::V1_0::helper::swapUvPlane(inUV, stride, outCr, out.cStride,
+                        width / 2, height / 2);
+                break;
+            case V4L2_PIX_FMT_YVU420: // YV12
+            case V4L2_PIX_FMT_YUV420: // YU12
+                ret = libyuv::NV12ToI420(in, stride, inUV, stride,
+                        outY, out.yStride, outCb, out.cStride, outCr, out.cStride,
+                        width, height);
+                break;
+            default:
+                ALOGE("%s: unsupported output format 0x%x!", __FUNCTION__, format);
+                return -1;
+        }
+    } else { // V4L2_PIX_FMT_YUYV
+        switch (format) {
+            case V4L2_PIX_FMT_NV12:
+                ret = libyuv::YUY2ToNV12(in, stride,
+                        outY, out.yStride, outCb, out.cStride, width, height);
+                break;
+            case V4L2_PIX_FMT_NV21:
+                ret = libyuv::YUY2ToNV12(in, stride,
+                        outY, out.yStride, outCr, out.cStride, width, height);
+                if (ret == 0) {
+                    common::V1_0::helper::swapUvPlane(outCr, out.cStride, outCr, out.cStride,
+                            width / 2, height / 2);
+                }
+                break;
+            case V4L2_PIX_FMT_YVU420: // YV12
+            case V4L2_PIX_FMT_YUV420: // YU12
+                ret = libyuv::YUY2ToI420(in, stride,
+                        outY, out.yStride, outCb, out.cStride, outCr, out.cStride,
+                        width, height);
+                break;
+            default:
+                ALOGE("%s: unsupported output format 0x%x!", __FUNCTION__, format);
+                return -1;
+        }
+    }
+    if (ret != 0) {
+        ALOGE("%s: pass through conversion to 0x%x failed! ret %d", __FUNCTION__, format, ret);
+    }
+    return ret;
+}
+
+namespace {
+
+// A libjpeg compressor reused across encodes. Creating one allocates libjpeg's memory
+// pools, so idle compressors are kept around by acquireJpegCompressor/releaseJpegCompressor.
+struct JpegCompressor {
     /* libjpeg is a C library so we use C-style "inheritance" by
      * putting libjpeg's jpeg_destination_mgr first in our custom
      * struct. This allows us to cast jpeg_destination_mgr* to
-     * CustomJpegDestMgr* when we get it passed to us in a callback */
-    struct CustomJpegDestMgr {
+     * DestMgr* when we get it passed to us in a callback */
+    struct DestMgr {
         struct jpeg_destination_mgr mgr;
         JOCTET *mBuffer;
         size_t mBufferSize;
         size_t mEncodedSize;
-        bool mSuccess;
-    } dmgr;
+    } mDest;
 
-    jpeg_compress_struct cinfo = {};
-    jpeg_error_mgr jerr;
+    /* Same for the error manager, so error_exit can jump back to encode() */
+    struct ErrorMgr {
+        struct jpeg_error_mgr mgr;
+        jmp_buf mJmp;
+    } mErr;
 
+    jpeg_compress_struct mCinfo = {};
+
+    /* Row pointers and strip output, kept to avoid reallocating for every frame */
+    std::vector<JSAMPROW> mYLines;
+    std::vector<JSAMPROW> mCbLines;
+    std::vector<JSAMPROW> mCrLines;
+    std::vector<uint8_t> mCode;
+
+    JpegCompressor();
+    ~JpegCompressor();
+
+    int encode(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+            const void *app1Buffer, size_t app1Size, unsigned int restartInterval,
+            void *out, size_t maxOutSize, size_t &actualCodeSize);
+};
+
+JpegCompressor::JpegCompressor() {
     /* Initialize error handling with standard callbacks, but
      * then override output_message (to print to ALOG) and
-     * error_exit to set a flag and print a message instead
+     * error_exit to jump back out of libjpeg instead
      * of killing the whole process */
-    cinfo.err = jpeg_std_error(&jerr);
+    mCinfo.err = jpeg_std_error(&mErr.mgr);
 
-    cinfo.err->output_message = [](j_common_ptr cinfo) {
+    mCinfo.err->output_message = [](j_common_ptr cinfo) {
         char buffer[JMSG_LENGTH_MAX];
 
         /* Create the message */
         (*cinfo->err->format_message)(cinfo, buffer);
         ALOGE("libjpeg error: %s", buffer);
     };
-    cinfo.err->error_exit = [](j_common_ptr cinfo) {
+    mCinfo.err->error_exit = [](j_common_ptr cinfo) {
         (*cinfo->err->output_message)(cinfo);
-        if(cinfo->client_data) {
-            auto & dmgr =
-                *reinterpret_cast<CustomJpegDestMgr*>(cinfo->client_data);
-            dmgr.mSuccess = false;
-        }
+        auto & err = reinterpret_cast<ErrorMgr&>(*cinfo->err);
+        longjmp(err.mJmp, 1);
     };
     /* Now that we initialized some callbacks, let's create our compressor */
-    jpeg_create_compress(&cinfo);
-
-    /* Initialize our destination manager */
-    dmgr.mBuffer = static_cast<JOCTET*>(out);
-    dmgr.mBufferSize = maxOutSize;
-    dmgr.mEncodedSize = 0;
-    dmgr.mSuccess = true;
-    cinfo.client_data = static_cast<void*>(&dmgr);
+    jpeg_create_compress(&mCinfo);
 
     /* These lambdas become C-style function pointers and as per C++11 spec
      * may not capture anything */
-    dmgr.mgr.init_destination = [](j_compress_ptr cinfo) {
-        auto & dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+    mDest.mgr.init_destination = [](j_compress_ptr cinfo) {
+        auto & dmgr = reinterpret_cast<DestMgr&>(*cinfo->dest);
         dmgr.mgr.next_output_byte = dmgr.mBuffer;
         dmgr.mgr.free_in_buffer = dmgr.mBufferSize;
         ALOGV("%s:%d jpeg start: %p [%zu]",
               __FUNCTION__, __LINE__, dmgr.mBuffer, dmgr.mBufferSize);
     };
 
-    dmgr.mgr.empty_output_buffer = [](j_compress_ptr cinfo __unused) {
+    mDest.mgr.empty_output_buffer = [](j_compress_ptr cinfo __unused) {
         ALOGV("%s:%d Out of buffer", __FUNCTION__, __LINE__);
         return 0;
     };
 
-    dmgr.mgr.term_destination = [](j_compress_ptr cinfo) {
-        auto & dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+    mDest.mgr.term_destination = [](j_compress_ptr cinfo) {
+        auto & dmgr = reinterpret_cast<DestMgr&>(*cinfo->dest);
         dmgr.mEncodedSize = dmgr.mBufferSize - dmgr.mgr.free_in_buffer;
         ALOGV("%s:%d Done with jpeg: %zu", __FUNCTION__, __LINE__, dmgr.mEncodedSize);
     };
-    cinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&dmgr);
+    mCinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&mDest);
+}
+
+JpegCompressor::~JpegCompressor() {
+    jpeg_destroy_compress(&mCinfo);
+}
+
+int JpegCompressor::encode(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+        const void *app1Buffer, size_t app1Size, unsigned int restartInterval,
+        void *out, size_t maxOutSize, size_t &actualCodeSize) {
+    jpeg_compress_struct& cinfo = mCinfo;
+
+    if (setjmp(mErr.mJmp)) {
+        /* libjpeg reported an error, reset the compressor so it can be reused */
+        jpeg_abort_compress(&cinfo);
+        return -1;
+    }
+
+    /* Initialize our destination manager */
+    mDest.mBuffer = static_cast<JOCTET*>(out);
+    mDest.mBufferSize = maxOutSize;
+    mDest.mEncodedSize = 0;
 
     /* We are going to be using JPEG in raw data mode, so we are passing
      * straight subsampled planar YCbCr and it will not touch our pixel
@@ -470,6 +594,9 @@ int encodeJpegYU12(
     jpeg_set_colorspace(&cinfo, JCS_YCbCr);
     cinfo.raw_data_in = 1;
     cinfo.dct_method = JDCT_IFAST;
+    /* Strips are joined after the fact, so they must all use the standard tables */
+    cinfo.optimize_coding = FALSE;
+    cinfo.restart_interval = restartInterval;
 
     /* Configure sampling factors. The sampling factor is JPEG subsampling 420
      * because the source format is YUV420. Note that libjpeg sampling factors
@@ -503,9 +630,9 @@ int encodeJpegYU12(
 
     /* libjpeg uses arrays of row pointers, which makes it really easy to pad
      * data vertically (unfortunately doesn't help horizontally) */
-    std::vector<JSAMPROW> yLines (paddedHeight);
-    std::vector<JSAMPROW> cbLines(paddedHeight/cVSubSampling);
-    std::vector<JSAMPROW> crLines(paddedHeight/cVSubSampling);
+    mYLines.resize(paddedHeight);
+    mCbLines.resize(paddedHeight/cVSubSampling);
+    mCrLines.resize(paddedHeight/cVSubSampling);
 
     uint8_t *py = static_cast<uint8_t*>(inLayout.y);
     uint8_t *pcr = static_cast<uint8_t*>(inLayout.cr);
@@ -516,12 +643,12 @@ int encodeJpegYU12(
         /* Once we are in the padding territory we still point to the last line
          * effectively replicating it several times ~ CLAMP_TO_EDGE */
         int li = std::min(i, inSz.height - 1);
-        yLines[i]  = static_cast<JSAMPROW>(py + li * inLayout.yStride);
+        mYLines[i]  = static_cast<JSAMPROW>(py + li * inLayout.yStride);
         if(i < paddedHeight / cVSubSampling)
         {
             li = std::min(i, (inSz.height - 1) / cVSubSampling);
-            crLines[i] = static_cast<JSAMPROW>(pcr + li * inLayout.cStride);
-            cbLines[i] = static_cast<JSAMPROW>(pcb + li * inLayout.cStride);
+            mCrLines[i] = static_cast<JSAMPROW>(pcr + li * inLayout.cStride);
+            mCbLines[i] = static_cast<JSAMPROW>(pcb + li * inLayout.cStride);
         }
     }
 
@@ -537,9 +664,9 @@ int encodeJpegYU12(
     while (cinfo.next_scanline < cinfo.image_height) {
         const uint32_t batchSize = DCTSIZE * maxVSampFactor;
         const uint32_t nl = cinfo.next_scanline;
-        JSAMPARRAY planes[3]{ &yLines[nl],
-                              &cbLines[nl/cVSubSampling],
-                              &crLines[nl/cVSubSampling] };
+        JSAMPARRAY planes[3]{ &mYLines[nl],
+                              &mCbLines[nl/cVSubSampling],
+                              &mCrLines[nl/cVSubSampling] };
 
         uint32_t done = jpeg_write_raw_data(&cinfo, planes, batchSize);
 
@@ -547,6 +674,7 @@ int encodeJpegYU12(
             ALOGE("%s: compressed %u lines, expected %u (total %u/%u)",
               __FUNCTION__, done, batchSize, cinfo.next_scanline,
               cinfo.image_height);
+            jpeg_abort_compress(&cinfo);
             return -1;
         }
     }
@@ -555,8 +683,224 @@ int encodeJpegYU12(
     jpeg_finish_compress(&cinfo);
 
     /* Grab the actual code size and set it */
-    actualCodeSize = dmgr.mEncodedSize;
+    actualCodeSize = mDest.mEncodedSize;
+
+    return 0;
+}
+
+const size_t kMaxIdleJpegCompressors = 4;
+std::mutex sJpegCompressorLock;
+std::vector<std::unique_ptr<JpegCompressor>> sIdleJpegCompressors;
+
+std::unique_ptr<JpegCompressor> acquireJpegCompressor() {
+    {
+        std::lock_guard<std::mutex> lk(sJpegCompressorLock);
+        if (!sIdleJpegCompressors.empty()) {
+            std::unique_ptr<JpegCompressor> compressor = std::move(sIdleJpegCompressors.back());
+            sIdleJpegCompressors.pop_back();
+            return compressor;
+        }
+    }
+    return std::make_unique<JpegCompressor>();
+}
+
+void releaseJpegCompressor(std::unique_ptr<JpegCompressor> compressor) {
+    std::lock_guard<std::mutex> lk(sJpegCompressorLock);
+    if (sIdleJpegCompressors.size() < kMaxIdleJpegCompressors) {
+        sIdleJpegCompressors.push_back(std::move(compressor));
+    }
+}
+
+const uint8_t kJpegMarkerPrefix = 0xFF;
+const uint8_t kJpegSOF0 = 0xC0;
+const uint8_t kJpegRST0 = 0xD0;
+const uint8_t kJpegEOI = 0xD9;
+const uint8_t kJpegSOS = 0xDA;
+const uint8_t kJpegAPP0 = 0xE0;
+const size_t kJpegMarkerSize = 2;
+
+// Walk the marker segments of the JPEG header in code, starting after SOI. Returns the
+// offset of the first segment with the given marker, or 0 if it is not found before
+// the scan data.
+size_t findJpegSegment(const uint8_t* code, size_t codeSize, uint8_t marker) {
+    size_t pos = kJpegMarkerSize;
+    while (pos + 4 <= codeSize && code[pos] == kJpegMarkerPrefix) {
+        uint8_t m = code[pos + 1];
+        if (m == marker) {
+            return pos;
+        }
+        if (m == kJpegSOS) {
+            break;
+        }
+        pos += kJpegMarkerSize + ((code[pos + 2] << 8) | code[pos + 3]);
+    }
+    return 0;
+}
+
+// Offset of the entropy coded data following the SOS header, or 0 if not found
+size_t getJpegScanOffset(const uint8_t* code, size_t codeSize) {
+    size_t sos = findJpegSegment(code, codeSize, kJpegSOS);
+    if (sos == 0) {
+        return 0;
+    }
+    return sos + kJpegMarkerSize + ((code[sos + 2] << 8) | code[sos + 3]);
+}
+
+} // anonymous namespace
+
+int encodeJpegYU12(
+        const Size & inSz, const YCbCrLayout& inLayout,
+        int jpegQuality, const void *app1Buffer, size_t app1Size,
+        void *out, const size_t maxOutSize, size_t &actualCodeSize)
+{
+    std::unique_ptr<JpegCompressor> compressor = acquireJpegCompressor();
+    int ret = compressor->encode(inSz, inLayout, jpegQuality, app1Buffer, app1Size,
+            /*restartInterval*/0, out, maxOutSize, actualCodeSize);
+    releaseJpegCompressor(std::move(compressor));
+    return ret;
+}
+
+int encodeJpegYU12Strips(
+        const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality, uint32_t numStrips,
+        const std::function<void(std::function<void()>&&)>& runAsync,
+        void* out, size_t maxOutSize, size_t& actualCodeSize) {
+    /* One MCU is 16x16 luma pixels for YUV420 */
+    const uint32_t kMcuSize = 2 * DCTSIZE;
+    const uint32_t kMaxRestartInterval = 0xFFFF;
+    const uint32_t mcusPerRow = (inSz.width + kMcuSize - 1) / kMcuSize;
+    const uint32_t mcuRows = (inSz.height + kMcuSize - 1) / kMcuSize;
+
+    uint32_t mcuRowsPerStrip = (mcuRows + numStrips - 1) / std::max(numStrips, 1u);
+    mcuRowsPerStrip = std::min(mcuRowsPerStrip, kMaxRestartInterval / mcusPerRow);
+    if (numStrips <= 1 || mcuRowsPerStrip == 0 || mcuRowsPerStrip >= mcuRows) {
+        return encodeJpegYU12(inSz, inLayout, jpegQuality, nullptr, 0,
+                out, maxOutSize, actualCodeSize);
+    }
+    numStrips = (mcuRows + mcuRowsPerStrip - 1) / mcuRowsPerStrip;
+    const uint32_t stripHeight = mcuRowsPerStrip * kMcuSize;
+
+    auto getStripLayout = [&](uint32_t strip, Size* stripSz, YCbCrLayout* stripLayout) {
+        uint32_t top = strip * stripHeight;
+        *stripSz = Size {inSz.width, std::min(stripHeight, inSz.height - top)};
+        *stripLayout = inLayout;
+        stripLayout->y = static_cast<uint8_t*>(inLayout.y) + top * inLayout.yStride;
+        stripLayout->cb = static_cast<uint8_t*>(inLayout.cb) + top / 2 * inLayout.cStride;
+        stripLayout->cr = static_cast<uint8_t*>(inLayout.cr) + top / 2 * inLayout.cStride;
+    };
+
+    /* Strips 1..n-1 are encoded into the compressors' own buffers */
+    std::vector<std::unique_ptr<JpegCompressor>> compressors(numStrips);
+    std::vector<size_t> stripCodeSizes(numStrips, 0);
+    std::mutex doneLock;
+    std::condition_variable doneCond;
+    uint32_t numPending = numStrips - 1;
+    int stripRet = 0;
+    for (uint32_t i = 1; i < numStrips; i++) {
+        compressors[i] = acquireJpegCompressor();
+        runAsync([&, i]() {
+            Size stripSz;
+            YCbCrLayout stripLayout;
+            getStripLayout(i, &stripSz, &stripLayout);
+            JpegCompressor& compressor = *compressors[i];
+            compressor.mCode.resize(stripSz.width * stripSz.height * 3 / 2 + 64 * 1024);
+            int ret = compressor.encode(stripSz, stripLayout, jpegQuality, nullptr, 0,
+                    /*restartInterval*/0, compressor.mCode.data(), compressor.mCode.size(),
+                    stripCodeSizes[i]);
+            std::lock_guard<std::mutex> lk(doneLock);
+            if (ret != 0) {
+                stripRet = ret;
+            }
+            if (--numPending == 0) {
+                doneCond.notify_one();
+            }
+        });
+    }
+
+    /* Strip 0 carries the headers, including the restart interval, and is written
+     * straight into out */
+    Size stripSz;
+    YCbCrLayout stripLayout;
+    getStripLayout(0, &stripSz, &stripLayout);
+    compressors[0] = acquireJpegCompressor();
+    size_t codeSize = 0;
+    int ret = compressors[0]->encode(stripSz, stripLayout, jpegQuality, nullptr, 0,
+            mcuRowsPerStrip * mcusPerRow, out, maxOutSize, codeSize);
+    {
+        std::unique_lock<std::mutex> lk(doneLock);
+        doneCond.wait(lk, [&] { return numPending == 0; });
+        if (ret == 0) {
+            ret = stripRet;
+        }
+    }
+
+    uint8_t* code = static_cast<uint8_t*>(out);
+    size_t sof = (ret == 0) ? findJpegSegment(code, codeSize, kJpegSOF0) : 0;
+    if (ret == 0 && sof == 0) {
+        ALOGE("%s: SOF0 not found in the first strip", __FUNCTION__);
+        ret = -1;
+    }
+    if (ret == 0) {
+        /* Patch the frame height to the full image and join the scans, replacing each
+         * strip's EOI with a restart marker */
+        code[sof + 5] = (inSz.height >> 8) & 0xFF;
+        code[sof + 6] = inSz.height & 0xFF;
+        codeSize -= kJpegMarkerSize;
+        for (uint32_t i = 1; i < numStrips && ret == 0; i++) {
+            const uint8_t* stripCode = compressors[i]->mCode.data();
+            size_t scan = getJpegScanOffset(stripCode, stripCodeSizes[i]);
+            size_t scanSize = stripCodeSizes[i] - kJpegMarkerSize - scan;
+            if (scan == 0 || scan + kJpegMarkerSize > stripCodeSizes[i]) {
+                ALOGE("%s: scan data not found in strip %u", __FUNCTION__, i);
+                ret = -1;
+            } else if (codeSize + kJpegMarkerSize + scanSize + kJpegMarkerSize > maxOutSize) {
+                ALOGE("%s: out of buffer joining strip %u", __FUNCTION__, i);
+                ret = -1;
+            } else {
+                code[codeSize++] = kJpegMarkerPrefix;
+                code[codeSize++] = kJpegRST0 + ((i - 1) & 0x7);
+                memcpy(code + codeSize, stripCode + scan, scanSize);
+                codeSize += scanSize;
+            }
+        }
+        code[codeSize++] = kJpegMarkerPrefix;
+        code[codeSize++] = kJpegEOI;
+    }
+
+    for (auto& compressor : compressors) {
+        releaseJpegCompressor(std::move(compressor));
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    actualCodeSize = codeSize;
+    return 0;
+}
+
+int insertJpegApp1(const uint8_t* code, size_t codeSize, const void* app1Buffer,
+        size_t app1Size, void* out, size_t maxOutSize, size_t& actualCodeSize) {
+    /* Keep SOI and the JFIF APP0 segment first, as libjpeg writes them */
+    size_t headerSize = kJpegMarkerSize;
+    if (codeSize >= kJpegMarkerSize + 4 && code[headerSize] == kJpegMarkerPrefix &&
+            code[headerSize + 1] == kJpegAPP0) {
+        headerSize += kJpegMarkerSize + ((code[headerSize + 2] << 8) | code[headerSize + 3]);
+    }
+    const size_t app1SegmentSize = kJpegMarkerSize + 2 + app1Size;
+    if (headerSize > codeSize || codeSize + app1SegmentSize > maxOutSize) {
+        ALOGE("%s: JPEG with APP1 does not fit in %zu bytes", __FUNCTION__, maxOutSize);
+        return -1;
+    }
 
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    memcpy(dst, code, headerSize);
+    dst += headerSize;
+    *dst++ = kJpegMarkerPrefix;
+    *dst++ = JPEG_APP0 + 1;
+    *dst++ = ((app1Size + 2) >> 8) & 0xFF;
+    *dst++ = (app1Size + 2) & 0xFF;
+    memcpy(dst, app1Buffer, app1Size);
+    dst += app1Size;
+    memcpy(dst, code + headerSize, codeSize - headerSize);
+    actualCodeSize = codeSize + app1SegmentSize;
     return 0;
 }
 
@@ -669,7 +1013,7 @@ namespace V3_6 {
 namespace implementation {
 
 AllocatedV4L2Frame::AllocatedV4L2Frame(sp<V3_4::implementation::V4L2Frame> frameIn) :
-        Frame(frameIn->mWidth, frameIn->mHeight, frameIn->mFourcc) {
+        Frame(frameIn->mWidth, frameIn->mHeight, frameIn->mFourcc, frameIn->mStride) {
     uint8_t* dataIn;
     size_t dataSize;
     if (frameIn->getData(&dataIn, &dataSize) != 0) {
@@ -25,6 +25,7 @@
 #include <include/convert.h>
 #include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <list>
 #include <unordered_map>
 #include <unordered_set>
@@ -125,6 +126,8 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         void flush();
         void dump(int fd);
         virtual bool threadLoop() override;
+        // Also stops the conversion and JPEG worker threads
+        virtual void requestExit() override;
 
         void setExifMakeModel(const std::string& make, const std::string& model);
 
@@ -142,6 +145,20 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         static const int kReqWaitTimeoutMs = 33;   // 33ms
         static const int kReqWaitTimesMax = 90;    // 33ms * 90 ~= 3 sec
 
+        // Number of threads converting the decoded frame to the YUV output streams.
+        // The OutputThread itself converts one output size, so this is one less
+        // than the number of processed streams.
+        static const int kNumConvertThreads = kMaxProcessedStream - 1;
+        // Number of JPEG captures that can be encoding or waiting to be encoded
+        // while the OutputThread moves on to the next request
+        static const int kMaxPendingJpegs = 2;
+        // Number of threads encoding thumbnails and main image strips alongside the
+        // JPEG thread
+        static const int kNumJpegPartThreads = 2;
+        // JPEGs of at least this many pixels are encoded in kNumJpegPartThreads + 1
+        // restart-interval strips
+        static const uint32_t kJpegStripMinPixels = 2048 * 1536;
+
         void waitForNextRequest(std::shared_ptr<HalRequest>* out);
         void signalRequestDone();
 
@@ -156,8 +173,105 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         int createJpegLocked(HalStreamBuffer &halBuf,
                 const common::V1_0::helper::CameraMetadata& settings);
 
+        // Thread safe versions of the above, writing into the given scratch frames
+        // instead of the shared intermediate buffers.
+        // scaled can be null if no scaling is needed for outSize.
+        int cropAndScale(
+                sp<AllocatedFrame>& in, const Size& outSize,
+                const sp<AllocatedFrame>& scaled, YCbCrLayout* out);
+
+        int cropAndScaleThumb(
+                sp<AllocatedFrame>& in, const Size& outSize,
+                const sp<AllocatedFrame>& thumb, YCbCrLayout* out);
+
+        // Compressed main image and thumbnail of one JPEG capture, before they are
+        // combined into the output buffer
+        struct JpegScratch {
+            std::vector<uint8_t> mainCode;
+            std::vector<uint8_t> thumbCode;
+        };
+
+        // Encode yu12Main, already cropped and scaled to halBuf size, into halBuf.
+        // The thumbnail is generated from the full frame in, in parallel with the
+        // main image.
+        int encodeJpeg(sp<AllocatedFrame>& in, const YCbCrLayout& yu12Main,
+                const sp<AllocatedFrame>& thumb, HalStreamBuffer &halBuf,
+                const common::V1_0::helper::CameraMetadata& settings,
+                JpegScratch& scratch);
+
+        // Bring mExifUtils up to date for a capture with the given settings. The EXIF
+        // block is only rebuilt when the settings it is derived from change; otherwise
+        // just the capture time and orientation are updated.
+        bool updateExifLocked(const common::V1_0::helper::CameraMetadata& settings,
+                const Size& jpegSize);
+
+        // Crop/scale mYu12Frame to the size of halBufs and format convert into each
+        // of them. All buffers must have the same size.
+        int convertYuvOutputs(const std::vector<HalStreamBuffer*>& halBufs);
+
+        // Crop, scale and convert mYu12Frame straight into halBuf in one pass
+        int cropScaleConvertOutput(HalStreamBuffer* halBuf);
+
+        // Copy a YUYV/NV12 V4L2 frame into halBufs of the same size, skipping mYu12Frame
+        int copyYuvOutputs(uint32_t inFourcc, const uint8_t* inData, size_t inDataSize,
+                uint32_t inStride, const std::vector<HalStreamBuffer*>& halBufs);
+
         void clearIntermediateBuffers();
 
+        // Timing of one pipeline stage, reported in dump()
+        struct StageStats {
+            uint64_t count = 0;
+            nsecs_t lastNs = 0;
+            nsecs_t maxNs = 0;
+            nsecs_t totalNs = 0;
+
+            void add(nsecs_t durationNs);
+            void dump(int fd, const char* name) const;
+        };
+
+        // FIFO of tasks shared by one or more TaskThreads
+        struct TaskQueue {
+            std::mutex lock;
+            std::condition_variable cond;
+            std::list<std::function<void()>> tasks;
+            bool exiting = false;
+
+            // Runs the task inline if the queue is already stopped
+            void push(std::function<void()>&& task);
+            // Blocks until a task is available. Returns false once the queue is
+            // stopped and drained.
+            bool pop(std::function<void()>* out);
+            size_t size();
+        };
+
+        class TaskThread : public android::Thread {
+        public:
+            explicit TaskThread(TaskQueue& queue) : mQueue(queue) {}
+            virtual bool threadLoop() override;
+        private:
+            TaskQueue& mQueue;
+        };
+
+        // Scratch frames owned by one in-flight JPEG capture. yu12Frame is swapped
+        // with mYu12Frame after the YUV outputs are done, so the JPEG encode reads
+        // the decoded frame while the next request is decoded into another buffer.
+        struct JpegJob {
+            sp<AllocatedFrame> yu12Frame;
+            YCbCrLayout yu12FrameLayout;
+            // One per configured BLOB size that differs from the V4L2 size
+            std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> scaledFrames;
+            sp<AllocatedFrame> thumbFrame;
+            JpegScratch scratch;
+        };
+
+        void startWorkers();
+        void stopWorkers();
+        // Takes a free JPEG job, waiting if all are in flight, and hands mYu12Frame
+        // over to it
+        JpegJob* acquireJpegJobLocked();
+        void processJpeg(JpegJob* job, std::shared_ptr<HalRequest> req);
+        void waitForJpegDone();
+
         const wp<OutputThreadInterface> mParent;
         const CroppingType mCroppingType;
         const common::V1_0::helper::CameraMetadata mCameraCharacteristics;
@@ -188,6 +302,43 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
 
         std::string mExifMake;
         std::string mExifModel;
+
+        // Conversion and JPEG stages. Started by the first threadLoop.
+        bool mWorkersStarted = false;
+        TaskQueue mConvertQueue;
+        std::vector<sp<TaskThread>> mConvertThreads;
+        TaskQueue mJpegQueue;
+        sp<TaskThread> mJpegThread;
+        TaskQueue mJpegPartQueue;
+        std::vector<sp<TaskThread>> mJpegPartThreads;
+        JpegScratch mJpegScratch; // Used by createJpegLocked
+
+        std::mutex mExifLock; // Protect the EXIF template below
+        std::unique_ptr<ExifUtils> mExifUtils;
+        Size mExifJpegSize {0, 0};
+        std::vector<uint8_t> mExifKey; // Settings the EXIF block was built from
+        uint64_t mExifReuses = 0;
+        uint64_t mExifRebuilds = 0;
+
+        mutable std::mutex mJpegLock; // Protect mFreeJpegJobs and the stats below
+        std::condition_variable mJpegDoneCond; // signaled when a JPEG job is freed
+        std::vector<std::unique_ptr<JpegJob>> mJpegJobs; // Protected by mBufferLock
+        std::vector<JpegJob*> mFreeJpegJobs;
+        uint64_t mJpegStalls = 0; // times the OutputThread waited for a free JPEG job
+        StageStats mDecodeStats;
+        StageStats mConvertStats;
+        StageStats mJpegStats;
+    };
+
+    // Keeps dequeuing V4L2 frames while streaming so the driver queue never fills up
+    // with stale frames. Only the latest frame is kept for the next request; older
+    // ones are re-queued right away.
+    class CaptureThread : public android::Thread {
+    public:
+        explicit CaptureThread(wp<ExternalCameraDeviceSession> parent) : mParent(parent) {}
+        virtual bool threadLoop() override;
+    private:
+        const wp<ExternalCameraDeviceSession> mParent;
     };
 
 protected:
@@ -273,9 +424,19 @@ protected:
             const ExternalCameraConfig& devCfg);
 
     // TODO: change to unique_ptr for better tracking
-    sp<V4L2Frame> dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs); // Called with mLock hold
+    sp<V4L2Frame> dequeueV4l2Frame(/*out*/nsecs_t* shutterTs);
     void enqueueV4l2Frame(const sp<V4L2Frame>&);
 
+    // Takes the latest frame captured by mCaptureThread, waiting for one if needed
+    sp<V4L2Frame> takeLatestV4l2FrameLocked(/*out*/nsecs_t* shutterTs); // Called with mLock hold
+    // Called by mCaptureThread: dequeues one frame into mLatestFrame
+    void captureV4l2Frame();
+    // Stop/restart mCaptureThread around V4L2 stream reconfiguration. Pausing
+    // re-queues the latest frame if no request took it.
+    void pauseCaptureLocked();
+    void resumeCaptureLocked();
+    void closeCaptureThread();
+
     // Check if input Stream is one of supported stream setting on this device
     static bool isSupported(const Stream& stream,
             const std::vector<SupportedV4L2Format>& supportedFormats,
@@ -342,15 +503,26 @@ protected:
 
     bool mV4l2Streaming = false;
     SupportedV4L2Format mV4l2StreamingFmt;
+    uint32_t mV4l2StreamingStride = 0; // V4L2 bytesperline of YUYV/NV12 streams
     double mV4l2StreamingFps = 0.0;
     size_t mV4L2BufferCount = 0;
 
     static const int kBufferWaitTimeoutSec = 3; // TODO: handle long exposure (or not allowing)
-    std::mutex mV4l2BufferLock; // protect the buffer count and condition below
-    std::condition_variable mV4L2BufferReturned;
+    static const int kCapturePollTimeoutMs = 100;
+    std::mutex mV4l2BufferLock; // protect the buffer count, capture state and conditions below
+    std::condition_variable mV4L2BufferReturned; // also signaled on capture state changes
     size_t mNumDequeuedV4l2Buffers = 0;
     uint32_t mMaxV4L2BufferSize = 0;
 
+    sp<CaptureThread> mCaptureThread;
+    std::condition_variable mLatestFrameCond; // signaled when mLatestFrame is updated
+    sp<V4L2Frame> mLatestFrame; // counted in mNumDequeuedV4l2Buffers
+    nsecs_t mLatestFrameTs = 0;
+    bool mCapturePaused = true;  // mCaptureThread must not dequeue
+    bool mCaptureActive = false; // mCaptureThread is waiting on/dequeuing a V4L2 frame
+    uint64_t mNumCapturedFrames = 0;
+    uint64_t mNumStaleFrames = 0; // frames re-queued without being used by a request
+
     // Not protected by mLock (but might be used when mLock is locked)
     sp<OutputThread> mOutputThread;
 
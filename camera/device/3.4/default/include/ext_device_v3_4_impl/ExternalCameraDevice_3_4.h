@@ -99,8 +99,11 @@ protected:
             const std::string& cameraId,
             unique_fd v4l2Fd);
 
-    // Init supported w/h/format/fps in mSupportedFormats. Caller still owns fd
+    // Init supported w/h/format/fps in mSupportedFormats, from the profile cache when the
+    // device was probed before. Caller still owns fd
     void initSupportedFormatsLocked(int fd);
+    // Enumerate supported w/h/format/fps from the device. Caller still owns fd
+    void probeSupportedFormatsLocked(int fd);
 
     // Calls into virtual member function. Do not use it in constructor
     status_t initCameraCharacteristics();
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_CAMERA_DEVICE_V3_4_EXTCAMPROFILECACHE_H
+#define ANDROID_HARDWARE_CAMERA_DEVICE_V3_4_EXTCAMPROFILECACHE_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ExternalCameraUtils.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace V3_4 {
+namespace implementation {
+
+using ::android::hardware::camera::external::common::ExternalCameraConfig;
+
+/*
+ * Persistent cache of the formats probed from external cameras.
+ *
+ * Enumerating every format, size and frame interval of a UVC camera takes hundreds of ms.
+ * The result only depends on the device model, its firmware and the fps limits of the HAL
+ * config, so it is stored on disk keyed by USB vendor/product id, serial number and
+ * bcdDevice, and reused when the same camera is attached again. The cache is opt-in: the
+ * file location is read from ro.vendor.camera.external.profile_cache, and the cache is
+ * disabled when the property is unset or empty. The device sepolicy must allow the camera
+ * HAL to create and write that file.
+ */
+class ExternalCameraProfileCache {
+public:
+    static ExternalCameraProfileCache& getInstance();
+
+    // Key of the USB device behind a V4L2 node such as "/dev/video2". Empty for devices
+    // that are not on USB, which are never cached.
+    static std::string getDeviceKey(const std::string& devicePath);
+
+    // Find the profile of a device and check it against what the opened V4L2 node fd still
+    // reports. fmts and croppingType may be null to only validate the profile.
+    bool lookup(const std::string& key, int fd, const ExternalCameraConfig& cfg,
+            /*out*/std::vector<SupportedV4L2Format>* fmts, /*out*/CroppingType* croppingType);
+
+    void store(const std::string& key, const ExternalCameraConfig& cfg,
+            const std::vector<SupportedV4L2Format>& fmts, CroppingType croppingType);
+
+private:
+    struct Profile {
+        uint64_t cfgHash;
+        CroppingType croppingType;
+        std::vector<SupportedV4L2Format> fmts;
+    };
+
+    ExternalCameraProfileCache();
+
+    // Hash of the config fields that affect the probed format list
+    static uint64_t getConfigHash(const ExternalCameraConfig& cfg);
+    static bool validate(int fd, const Profile& profile);
+
+    void loadLocked();
+    void saveLocked();
+
+    std::mutex mLock;
+    const std::string mPath;
+    bool mLoaded = false;
+    std::unordered_map<std::string, Profile> mProfiles; // device key -> profile
+};
+
+}  // namespace implementation
+}  // namespace V3_4
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_CAMERA_DEVICE_V3_4_EXTCAMPROFILECACHE_H
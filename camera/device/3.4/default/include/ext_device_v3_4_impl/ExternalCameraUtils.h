@@ -21,6 +21,7 @@
 #include <android/hardware/camera/device/3.2/types.h>
 #include <android/hardware/graphics/common/1.0/types.h>
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
+#include <functional>
 #include <inttypes.h>
 #include <mutex>
 #include <unordered_map>
@@ -31,6 +32,7 @@
 #include "utils/Timers.h"
 #include <CameraMetadata.h>
 #include <HandleImporter.h>
+#include <YuvKernels.h>
 
 
 using ::android::hardware::graphics::mapper::V2_0::IMapper;
@@ -130,10 +132,12 @@ struct SupportedV4L2Format {
 // A Base class with basic information about a frame
 struct Frame : public VirtualLightRefBase {
 public:
-    Frame(uint32_t width, uint32_t height, uint32_t fourcc);
+    Frame(uint32_t width, uint32_t height, uint32_t fourcc, uint32_t stride = 0);
     const uint32_t mWidth;
     const uint32_t mHeight;
     const uint32_t mFourcc;
+    // Bytes per line of the first plane as reported by the driver, 0 if tightly packed
+    const uint32_t mStride;
 
     // getData might involve map/allocation
     virtual int getData(uint8_t** outData, size_t* dataSize) = 0;
@@ -143,7 +147,7 @@ public:
 // Also contains necessary information to enqueue the buffer back to V4L2 buffer queue
 class V4L2Frame : public Frame {
 public:
-    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int fd,
+    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, uint32_t stride, int bufIdx, int fd,
               uint32_t dataSize, uint64_t offset);
     ~V4L2Frame() override;
 
@@ -209,6 +213,12 @@ struct HalRequest {
     sp<Frame> frameIn;
     nsecs_t shutterTs;
     std::vector<HalStreamBuffer> buffers;
+    // A request can be returned in two parts so that slow outputs (JPEG) do not
+    // hold back the others. The first part carries the shutter, metadata and
+    // fast buffers and has hasDeferredBuffers set; the second part only returns
+    // its buffers and has buffersOnly set.
+    bool hasDeferredBuffers = false;
+    bool buffersOnly = false;
 };
 
 static const uint64_t BUFFER_ID_NO_BUFFER = 0;
@@ -242,12 +252,42 @@ int getCropRect(CroppingType ct, const Size& inSize,
 
 int formatConvert(const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32_t format);
 
+// Describe a gralloc YUV layout to the shared YUV kernels
+common::V1_0::helper::YuvPlanes toYuvPlanes(const YCbCrLayout& layout);
+
+// YUYV and NV12 V4L2 frames can be copied straight into YUV output buffers of the
+// same size, without going through the intermediate YU12 frame
+bool isPassThroughFourcc(uint32_t fourcc);
+
+// Decode/convert a MJPEG, YUYV or NV12 V4L2 frame into a YU12 frame of the same size.
+// inStride is the V4L2 bytesperline (0 if tightly packed) and is ignored for MJPEG.
+int convertV4l2FrameToYU12(uint32_t fourcc, const uint8_t* in, size_t inSize, uint32_t inStride,
+        Size sz, const YCbCrLayout& out);
+
+// Convert a YUYV or NV12 V4L2 frame into an output buffer of the same size.
+// format is the output layout as returned by getFourCcFromLayout.
+int passThroughConvert(uint32_t fourcc, const uint8_t* in, size_t inSize, uint32_t inStride,
+        const YCbCrLayout& out, Size sz, uint32_t format);
+
 int encodeJpegYU12(const Size &inSz,
         const YCbCrLayout& inLayout, int jpegQuality,
         const void *app1Buffer, size_t app1Size,
         void *out, size_t maxOutSize,
         size_t &actualCodeSize);
 
+// Encode a YU12 frame as numStrips horizontal strips, compressed independently and joined
+// with restart markers. Strips 1..numStrips-1 are handed to runAsync, which must run each
+// exactly once; strip 0 is encoded on the calling thread. No APP1 segment is written, see
+// insertJpegApp1.
+int encodeJpegYU12Strips(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+        uint32_t numStrips, const std::function<void(std::function<void()>&&)>& runAsync,
+        void* out, size_t maxOutSize, size_t& actualCodeSize);
+
+// Copy the JPEG code to out with the APP1 segment in app1Buffer inserted after the
+// SOI and JFIF headers
+int insertJpegApp1(const uint8_t* code, size_t codeSize, const void* app1Buffer,
+        size_t app1Size, void* out, size_t maxOutSize, size_t& actualCodeSize);
+
 Size getMaxThumbnailResolution(const common::V1_0::helper::CameraMetadata&);
 
 void freeReleaseFences(hidl_vec<V3_2::CaptureResult>&);
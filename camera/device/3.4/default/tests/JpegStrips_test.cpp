@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <jpeglib.h>
+#include <libexif/exif-data.h>
+
+#include "Exif.h"
+#include "ExternalCameraUtils.h"
+
+namespace {
+
+using ::android::hardware::camera::common::V1_0::helper::ExifUtils;
+using ::android::hardware::camera::device::V3_4::implementation::encodeJpegYU12;
+using ::android::hardware::camera::device::V3_4::implementation::encodeJpegYU12Strips;
+using ::android::hardware::camera::device::V3_4::implementation::insertJpegApp1;
+using ::android::hardware::camera::external::common::Size;
+using ::android::hardware::graphics::mapper::V2_0::YCbCrLayout;
+
+constexpr int kJpegQuality = 90;
+
+// A tightly packed YU12 image with gradients and some texture, so every MCU has AC content
+class Yu12Image {
+  public:
+    Yu12Image(uint32_t width, uint32_t height) : mSize{width, height} {
+        const uint32_t chromaWidth = (width + 1) / 2;
+        const uint32_t chromaHeight = (height + 1) / 2;
+        mData.resize(width * height + 2 * chromaWidth * chromaHeight);
+        uint8_t* y = mData.data();
+        uint8_t* cb = y + width * height;
+        uint8_t* cr = cb + chromaWidth * chromaHeight;
+        for (uint32_t row = 0; row < height; row++) {
+            for (uint32_t i = 0; i < width; i++) {
+                y[row * width + i] = static_cast<uint8_t>((i * 3 + row * 2) ^ (i * row >> 4));
+            }
+        }
+        for (uint32_t row = 0; row < chromaHeight; row++) {
+            for (uint32_t i = 0; i < chromaWidth; i++) {
+                cb[row * chromaWidth + i] = static_cast<uint8_t>(64 + i + row / 2);
+                cr[row * chromaWidth + i] = static_cast<uint8_t>(192 - row - i / 3);
+            }
+        }
+        mLayout.y = y;
+        mLayout.cb = cb;
+        mLayout.cr = cr;
+        mLayout.yStride = width;
+        mLayout.cStride = chromaWidth;
+        mLayout.chromaStep = 1;
+    }
+
+    const Size& size() const { return mSize; }
+    const YCbCrLayout& layout() const { return mLayout; }
+    size_t maxCodeSize() const { return mData.size() + 64 * 1024; }
+
+  private:
+    Size mSize;
+    std::vector<uint8_t> mData;
+    YCbCrLayout mLayout;
+};
+
+struct DecodedJpeg {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;  // RGB
+    std::vector<uint8_t> app1;
+};
+
+bool decodeJpeg(const uint8_t* code, size_t codeSize, DecodedJpeg* out) {
+    jpeg_decompress_struct dinfo = {};
+    jpeg_error_mgr jerr;
+    dinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, code, codeSize);
+    jpeg_save_markers(&dinfo, JPEG_APP0 + 1, 0xFFFF);
+    if (jpeg_read_header(&dinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+    for (jpeg_saved_marker_ptr m = dinfo.marker_list; m != nullptr; m = m->next) {
+        if (m->marker == JPEG_APP0 + 1) {
+            out->app1.assign(m->data, m->data + m->data_length);
+        }
+    }
+    dinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&dinfo);
+    out->width = dinfo.output_width;
+    out->height = dinfo.output_height;
+    const size_t rowSize = dinfo.output_width * dinfo.output_components;
+    out->pixels.resize(rowSize * dinfo.output_height);
+    while (dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW row = out->pixels.data() + dinfo.output_scanline * rowSize;
+        jpeg_read_scanlines(&dinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+    return true;
+}
+
+// Runs every strip on its own thread
+class StripRunner {
+  public:
+    ~StripRunner() {
+        for (auto& t : mThreads) {
+            t.join();
+        }
+    }
+
+    void operator()(std::function<void()>&& task) { mThreads.emplace_back(std::move(task)); }
+
+  private:
+    std::vector<std::thread> mThreads;
+};
+
+class JpegStripsTest : public ::testing::TestWithParam<uint32_t /*numStrips*/> {};
+
+TEST_P(JpegStripsTest, stripsWithApp1MatchSinglePass) {
+    // neither dimension is a multiple of the 16 pixel MCU, so the last strip is partial
+    Yu12Image image(328, 250);
+    const Size& sz = image.size();
+
+    std::vector<uint8_t> singleCode(image.maxCodeSize());
+    size_t singleSize = 0;
+    ASSERT_EQ(0, encodeJpegYU12(sz, image.layout(), kJpegQuality, nullptr, 0, singleCode.data(),
+                                singleCode.size(), singleSize));
+
+    std::vector<uint8_t> stripCode(image.maxCodeSize());
+    size_t stripSize = 0;
+    {
+        StripRunner runner;
+        ASSERT_EQ(0, encodeJpegYU12Strips(
+                             sz, image.layout(), kJpegQuality, GetParam(),
+                             [&runner](std::function<void()>&& task) { runner(std::move(task)); },
+                             stripCode.data(), stripCode.size(), stripSize));
+    }
+
+    std::unique_ptr<ExifUtils> exif(ExifUtils::create());
+    ASSERT_TRUE(exif->initialize());
+    ASSERT_TRUE(exif->setImageWidth(sz.width));
+    ASSERT_TRUE(exif->setImageHeight(sz.height));
+    ASSERT_TRUE(exif->setMake("JpegStripsTest"));
+    ASSERT_TRUE(exif->generateApp1(nullptr, 0));
+    const uint8_t* app1 = exif->getApp1Buffer();
+    const size_t app1Size = exif->getApp1Length();
+    ASSERT_NE(nullptr, app1);
+    ASSERT_GT(app1Size, 0u);
+
+    std::vector<uint8_t> code(stripSize + app1Size + 4);
+    size_t codeSize = 0;
+    ASSERT_EQ(0, insertJpegApp1(stripCode.data(), stripSize, app1, app1Size, code.data(),
+                                code.size(), codeSize));
+    // marker, length and payload of the APP1 segment
+    EXPECT_EQ(stripSize + 4 + app1Size, codeSize);
+    EXPECT_EQ(0xFF, code[codeSize - 2]);
+    EXPECT_EQ(0xD9, code[codeSize - 1]);
+
+    DecodedJpeg single;
+    DecodedJpeg joined;
+    ASSERT_TRUE(decodeJpeg(singleCode.data(), singleSize, &single));
+    ASSERT_TRUE(decodeJpeg(code.data(), codeSize, &joined));
+    EXPECT_EQ(sz.width, joined.width);
+    EXPECT_EQ(sz.height, joined.height);
+    // Strips start on MCU rows and use the same tables, so the decoded pixels are identical
+    ASSERT_EQ(single.pixels.size(), joined.pixels.size());
+    EXPECT_TRUE(single.pixels == joined.pixels);
+
+    ASSERT_EQ(app1Size, joined.app1.size());
+    std::unique_ptr<ExifData, decltype(&exif_data_unref)> exifData(
+            exif_data_new_from_data(joined.app1.data(), joined.app1.size()), exif_data_unref);
+    ASSERT_NE(nullptr, exifData);
+    ExifEntry* widthEntry =
+            exif_content_get_entry(exifData->ifd[EXIF_IFD_EXIF], EXIF_TAG_PIXEL_X_DIMENSION);
+    ExifEntry* heightEntry =
+            exif_content_get_entry(exifData->ifd[EXIF_IFD_EXIF], EXIF_TAG_PIXEL_Y_DIMENSION);
+    ExifEntry* makeEntry = exif_content_get_entry(exifData->ifd[EXIF_IFD_0], EXIF_TAG_MAKE);
+    ASSERT_NE(nullptr, widthEntry);
+    ASSERT_NE(nullptr, heightEntry);
+    ASSERT_NE(nullptr, makeEntry);
+    const ExifByteOrder order = exif_data_get_byte_order(exifData.get());
+    EXPECT_EQ(sz.width, exif_get_long(widthEntry->data, order));
+    EXPECT_EQ(sz.height, exif_get_long(heightEntry->data, order));
+    char make[32];
+    EXPECT_STREQ("JpegStripsTest", exif_entry_get_value(makeEntry, make, sizeof(make)));
+}
+
+INSTANTIATE_TEST_SUITE_P(NumStrips, JpegStripsTest, ::testing::Values(1u, 2u, 3u, 5u));
+
+TEST(JpegApp1Test, rejectsSmallBuffer) {
+    Yu12Image image(64, 48);
+    std::vector<uint8_t> code(image.maxCodeSize());
+    size_t codeSize = 0;
+    ASSERT_EQ(0, encodeJpegYU12(image.size(), image.layout(), kJpegQuality, nullptr, 0,
+                                code.data(), code.size(), codeSize));
+    const uint8_t app1[16] = {'E', 'x', 'i', 'f', 0, 0};
+    std::vector<uint8_t> out(codeSize + sizeof(app1) + 3);
+    size_t outSize = 0;
+    EXPECT_NE(0, insertJpegApp1(code.data(), codeSize, app1, sizeof(app1), out.data(),
+                                out.size(), outSize));
+}
+
+}  // namespace
@@ -106,6 +106,9 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
        return false;
     }
 
+    // Thumbnails and large JPEG strips are encoded on the worker threads
+    startWorkers();
+
     if (mOfflineReqs.empty()) {
         ALOGI("%s: all offline requests are processed. Stopping.", __FUNCTION__);
         return false;
@@ -122,7 +125,8 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
         return false;
     };
 
-    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16 &&
+            !V3_4::implementation::isPassThroughFourcc(req->frameIn->mFourcc)) {
         return onDeviceError("%s: do not support V4L2 format %c%c%c%c", __FUNCTION__,
                 req->frameIn->mFourcc & 0xFF,
                 (req->frameIn->mFourcc >> 8) & 0xFF,
@@ -138,7 +142,6 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
 
     std::unique_lock<std::mutex> lk(mBufferLock);
     // Convert input V4L2 frame to YU12 of the same size
-    // TODO: see if we can save some computation by converting to YV12 here
     uint8_t* inData;
     size_t inDataSize;
     if (req->frameIn->getData(&inData, &inDataSize) != 0) {
@@ -146,14 +149,11 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
         return onDeviceError("%s: V4L2 buffer map failed", __FUNCTION__);
     }
 
-    // TODO: in some special case maybe we can decode jpg directly to gralloc output?
-    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
-        ATRACE_BEGIN("MJPGtoI420");
-        int res = libyuv::MJPGToI420(
-            inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
-            mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth, mYu12Frame->mHeight);
+    if (req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+        ATRACE_BEGIN("V4L2FrameToYU12");
+        int res = V3_4::implementation::convertV4l2FrameToYU12(
+                req->frameIn->mFourcc, inData, inDataSize, req->frameIn->mStride,
+                Size {mYu12Frame->mWidth, mYu12Frame->mHeight}, mYu12FrameLayout);
         ATRACE_END();
 
         if (res != 0) {
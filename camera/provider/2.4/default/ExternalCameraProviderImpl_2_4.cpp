@@ -18,7 +18,10 @@
 //#define LOG_NDEBUG 0
 #include <log/log.h>
 
+#include <algorithm>
+#include <atomic>
 #include <regex>
+#include <thread>
 #include <sys/inotify.h>
 #include <errno.h>
 #include <linux/videodev2.h>
@@ -30,6 +33,7 @@
 #include "ExternalCameraDevice_3_4.h"
 #include "ExternalCameraDevice_3_5.h"
 #include "ExternalCameraDevice_3_6.h"
+#include "ExternalCameraProfileCache.h"
 
 namespace android {
 namespace hardware {
@@ -50,6 +54,8 @@ const char* kDevicePath = "/dev/";
 constexpr char kPrefix[] = "video";
 constexpr int kPrefixLen = sizeof(kPrefix) - 1;
 constexpr int kDevicePrefixLen = sizeof(kDevicePath) + kPrefixLen + 1;
+// Cameras attached together (e.g. at boot) are probed on up to this many threads
+constexpr size_t kMaxProbeThreads = 4;
 
 bool matchDeviceName(int cameraIdOffset,
                      const hidl_string& deviceName, std::string* deviceVersion,
@@ -108,6 +114,7 @@ Return<Status> ExternalCameraProviderImpl_2_4::setCallback(
     }
     // Send a callback for all devices to initialize
     {
+        Mutex::Autolock _l(mLock);
         for (const auto& pair : mCameraStatusMap) {
             mCallbacks->cameraDeviceStatusChange(pair.first, pair.second);
         }
@@ -161,10 +168,13 @@ Return<void> ExternalCameraProviderImpl_2_4::getCameraDeviceInterface_V3_x(
         return Void();
     }
 
-    if (mCameraStatusMap.count(cameraDeviceName) == 0 ||
-            mCameraStatusMap[cameraDeviceName] != CameraDeviceStatus::PRESENT) {
-        _hidl_cb(Status::ILLEGAL_ARGUMENT, nullptr);
-        return Void();
+    {
+        Mutex::Autolock _l(mLock);
+        auto it = mCameraStatusMap.find(cameraDeviceName);
+        if (it == mCameraStatusMap.end() || it->second != CameraDeviceStatus::PRESENT) {
+            _hidl_cb(Status::ILLEGAL_ARGUMENT, nullptr);
+            return Void();
+        }
     }
 
     sp<device::V3_4::implementation::ExternalCameraDevice> deviceImpl;
@@ -252,6 +262,18 @@ void ExternalCameraProviderImpl_2_4::deviceAdded(const char* devName) {
             ALOGW("%s device %s does not support VIDEO_CAPTURE", __FUNCTION__, devName);
             return;
         }
+
+        // A camera probed before is advertised right away; its characteristics are built
+        // from the cached profile when the camera service asks for them
+        std::string profileKey =
+                device::V3_4::implementation::ExternalCameraProfileCache::getDeviceKey(devName);
+        if (device::V3_4::implementation::ExternalCameraProfileCache::getInstance().lookup(
+                profileKey, fd.get(), mCfg, /*fmts*/nullptr, /*croppingType*/nullptr)) {
+            ALOGI("%s: %s matches cached profile %s", __FUNCTION__, devName, profileKey.c_str());
+            fd.reset();
+            addExternalCamera(devName);
+            return;
+        }
     }
     // See if we can initialize ExternalCameraDevice correctly
     sp<device::V3_4::implementation::ExternalCameraDevice> deviceImpl =
@@ -353,6 +375,7 @@ bool ExternalCameraProviderImpl_2_4::HotplugThread::threadLoop() {
         return false;
     }
 
+    std::vector<std::string> addedDevices;
     struct dirent* de;
     while ((de = readdir(devdir)) != 0) {
         // Find external v4l devices that's existing before we start watching and add them
@@ -362,17 +385,12 @@ bool ExternalCameraProviderImpl_2_4::HotplugThread::threadLoop() {
             std::string deviceId(de->d_name + kPrefixLen);
             if (mInternalDevices.count(deviceId) == 0) {
                 ALOGV("Non-internal v4l device %s found", de->d_name);
-                char v4l2DevicePath[kMaxDevicePathLen];
-                char mCamDevice[kMaxDevicePathLen];
-                snprintf(v4l2DevicePath, kMaxDevicePathLen,
-                        "%s%s", kDevicePath, de->d_name);
-                sprintf(mCamDevice, "/sys/class/video4linux/%s/name", de->d_name);
-                if(mParent->isExternalDevice(v4l2DevicePath, mCamDevice, NULL))
-                    mParent->deviceAdded(v4l2DevicePath);
+                addedDevices.push_back(de->d_name);
             }
         }
     }
     closedir(devdir);
+    probeDevices(addedDevices);
 
     // Watch new video devices
     mINotifyFD = inotify_init();
@@ -394,6 +412,7 @@ bool ExternalCameraProviderImpl_2_4::HotplugThread::threadLoop() {
     char mHdmiRxNode[kMaxDevicePathLen];
     while (!done) {
         int offset = 0;
+        addedDevices.clear();
         int ret = read(mINotifyFD, eventBuf, sizeof(eventBuf));
         if (ret >= (int)sizeof(struct inotify_event)) {
             while (offset < ret) {
@@ -404,18 +423,20 @@ bool ExternalCameraProviderImpl_2_4::HotplugThread::threadLoop() {
                         std::string deviceId(event->name + kPrefixLen);
                         if (mInternalDevices.count(deviceId) == 0) {
                             char v4l2DevicePath[kMaxDevicePathLen];
-                            char mCamDevice[kMaxDevicePathLen];
                             snprintf(v4l2DevicePath, kMaxDevicePathLen,
                                     "%s%s", kDevicePath, event->name);
-                            sprintf(mCamDevice, "/sys/class/video4linux/%s/name", event->name);
                             if (event->mask & IN_CREATE) {
-                                // usb camera is not ready until 100ms.
-                                usleep(100000);
-                                if(mParent->isExternalDevice(v4l2DevicePath, mCamDevice, NULL))
-                                    mParent->deviceAdded(v4l2DevicePath);
+                                // Probed together once the whole batch of events is read
+                                addedDevices.push_back(event->name);
                             }
                             if (event->mask & IN_DELETE) {
-                                mParent->deviceRemoved(v4l2DevicePath);
+                                auto it = std::find(addedDevices.begin(), addedDevices.end(),
+                                        event->name);
+                                if (it != addedDevices.end()) {
+                                    addedDevices.erase(it);
+                                } else {
+                                    mParent->deviceRemoved(v4l2DevicePath);
+                                }
                             }
                         }
                     } else if (!strncmp("cec", event->name, 3)) {
@@ -454,11 +475,52 @@ bool ExternalCameraProviderImpl_2_4::HotplugThread::threadLoop() {
                 offset += sizeof(struct inotify_event) + event->len;
             }
         }
+        if (!addedDevices.empty()) {
+            // usb camera is not ready until 100ms.
+            usleep(100000);
+            probeDevices(addedDevices);
+        }
     }
 
     return true;
 }
 
+void ExternalCameraProviderImpl_2_4::HotplugThread::probeDevices(
+        const std::vector<std::string>& nodeNames) {
+    auto probe = [this](const std::string& nodeName) {
+        std::string v4l2DevicePath = kDevicePath + nodeName;
+        std::string sysClassName = "/sys/class/video4linux/" + nodeName + "/name";
+        if (mParent->isExternalDevice(v4l2DevicePath.c_str(), sysClassName.c_str(), NULL)) {
+            mParent->deviceAdded(v4l2DevicePath.c_str());
+        }
+    };
+
+    size_t numThreads = std::min(nodeNames.size(), kMaxProbeThreads);
+    if (numThreads <= 1) {
+        for (const auto& nodeName : nodeNames) {
+            probe(nodeName);
+        }
+        return;
+    }
+
+    // Each probe mostly waits on the device, so cameras attached together are probed in
+    // parallel instead of one after another
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < nodeNames.size(); i = next++) {
+            probe(nodeNames[i]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 }  // namespace implementation
 }  // namespace V2_4
 }  // namespace provider
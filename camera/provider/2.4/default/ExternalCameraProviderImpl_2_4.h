@@ -93,6 +93,9 @@ private:
         virtual bool threadLoop() override;
 
     private:
+        // Probe and add the given /dev/video* nodes, concurrently when there are several
+        void probeDevices(const std::vector<std::string>& nodeNames);
+
         ExternalCameraProviderImpl_2_4* mParent = nullptr;
         const std::unordered_set<std::string> mInternalDevices;
 
@@ -62,6 +62,10 @@ class CommandWriterBase {
     virtual ~CommandWriterBase() { reset(); }
 
     void reset() {
+        // fold this frame into the rolling high-water mark before it is discarded; it decays by
+        // 1/16 per frame so a single spike does not pin the sizing forever
+        mHighWaterMark = std::max(mDataWritten, mHighWaterMark - mHighWaterMark / 16);
+
         mDataWritten = 0;
         mCommandEnd = 0;
 
@@ -117,12 +121,20 @@ class CommandWriterBase {
 
             *outQueueChanged = false;
         } else {
+            // Size the new queue with headroom over the recent high-water mark so that the
+            // frames following a layer-count spike do not each force another queue change.
+            uint32_t queueSize = std::max(mDataMaxSize, headroomSize(mDataWritten));
+            reserve(queueSize);
+
             auto newQueue = std::make_unique<CommandQueueType>(mDataMaxSize);
             if (!newQueue->isValid() || !newQueue->write(mData.get(), mDataWritten)) {
                 ALOGE("failed to prepare a new message queue ");
                 return false;
             }
 
+            if (mQueue) {
+                mQueueRegrowCount++;
+            }
             mQueue = std::move(newQueue);
             *outQueueChanged = true;
         }
@@ -138,6 +150,22 @@ class CommandWriterBase {
         return (mQueue) ? mQueue->getDesc() : nullptr;
     }
 
+    // Makes sure at least size words can be written without regrowing the command buffer.
+    void reserve(uint32_t size) {
+        if (size > mDataMaxSize) {
+            resizeData(size);
+        }
+    }
+
+    // Number of times the command buffer had to be regrown while commands were written.
+    uint32_t getDataRegrowCount() const { return mDataRegrowCount; }
+
+    // Number of times the message queue had to be replaced by a larger one.
+    uint32_t getQueueRegrowCount() const { return mQueueRegrowCount; }
+
+    // Rolling maximum of the number of words written per frame.
+    uint32_t getHighWaterMark() const { return std::max(mHighWaterMark, mDataWritten); }
+
     static constexpr uint16_t kSelectDisplayLength = 2;
     void selectDisplay(Display display) {
         beginCommand(IComposerClient::Command::SELECT_DISPLAY, kSelectDisplayLength);
@@ -540,7 +568,7 @@ class CommandWriterBase {
     static constexpr uint16_t kMaxLength = std::numeric_limits<uint16_t>::max();
 
     std::unique_ptr<uint32_t[]> mData;
-    uint32_t mDataWritten;
+    uint32_t mDataWritten = 0;
 
    private:
     void growData(uint32_t grow) {
@@ -554,18 +582,31 @@ class CommandWriterBase {
             return;
         }
 
-        uint32_t newMaxSize = mDataMaxSize << 1;
-        if (newMaxSize < newWritten) {
-            newMaxSize = newWritten;
-        }
+        uint32_t newMaxSize = std::max(mDataMaxSize << 1, headroomSize(newWritten));
 
+        mDataRegrowCount++;
+        resizeData(newMaxSize);
+    }
+
+    void resizeData(uint32_t newMaxSize) {
         auto newData = std::make_unique<uint32_t[]>(newMaxSize);
         std::copy_n(mData.get(), mDataWritten, newData.get());
         mDataMaxSize = newMaxSize;
         mData = std::move(newData);
     }
 
+    // Returns a size that fits both size and twice the rolling high-water mark, saturating at
+    // the largest representable size.
+    uint32_t headroomSize(uint32_t size) const {
+        uint64_t headroom = static_cast<uint64_t>(std::max(size, mHighWaterMark)) * 2;
+        return static_cast<uint32_t>(
+                std::min<uint64_t>(headroom, std::numeric_limits<uint32_t>::max()));
+    }
+
     uint32_t mDataMaxSize;
+    uint32_t mHighWaterMark = 0;
+    uint32_t mDataRegrowCount = 0;
+    uint32_t mQueueRegrowCount = 0;
     // end offset of the current command
     uint32_t mCommandEnd;
 
@@ -602,6 +643,9 @@ class CommandReaderBase {
             mData = std::make_unique<uint32_t[]>(mDataMaxSize);
         }
 
+        // The commands are always copied out of the message queue before they are parsed: the
+        // client can still write to the queue memory, so lengths and handle indices validated in
+        // place could change before they are used.
         if (commandLength > mDataMaxSize || !mQueue->read(mData.get(), commandLength)) {
             ALOGE("failed to read commands from message queue");
             return false;
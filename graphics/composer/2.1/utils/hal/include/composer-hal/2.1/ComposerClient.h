@@ -20,6 +20,9 @@
 #warning "ComposerClient.h included without LOG_TAG"
 #endif
 
+#include <inttypes.h>
+#include <stdio.h>
+
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -321,6 +324,32 @@ class ComposerClientImpl : public Interface {
         return Void();
     }
 
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /*options*/) override {
+        if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+            return Void();
+        }
+
+        const ComposerResources::Stats stats = mResources->getStats();
+        dprintf(fd->data[0],
+                "Composer client:\n"
+                "  buffers imported %" PRIu64 ", freed %" PRIu64 "\n"
+                "  streams imported %" PRIu64 ", freed %" PRIu64 "\n"
+                "  cache lookups %" PRIu64 " (%" PRIu64 " failed), updates %" PRIu64 "\n",
+                stats.importer.bufferImports, stats.importer.bufferFrees,
+                stats.importer.streamImports, stats.importer.streamFrees, stats.cacheLookups,
+                stats.cacheLookupFailures, stats.cacheUpdates);
+
+        std::lock_guard<std::mutex> lock(mCommandEngineMutex);
+        const CommandWriterBase& writer = mCommandEngine->getWriter();
+        dprintf(fd->data[0],
+                "  output commands: high-water mark %u words, buffer regrown %u times, "
+                "queue regrown %u times\n",
+                writer.getHighWaterMark(), writer.getDataRegrowCount(),
+                writer.getQueueRegrowCount());
+
+        return Void();
+    }
+
    protected:
     virtual std::unique_ptr<ComposerResources> createResources() {
         return ComposerResources::create();
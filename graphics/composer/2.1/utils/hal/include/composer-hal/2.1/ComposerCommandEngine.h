@@ -63,6 +63,12 @@ class ComposerCommandEngine : protected CommandReaderBase {
                 break;
             }
 
+            // Per-layer state changes are collected and applied to the HAL together; any other
+            // command first flushes them so that the HAL observes commands in stream order.
+            if (!isLayerStateCommand(command)) {
+                flushLayerStates();
+            }
+
             bool parsed = executeCommand(command, length);
             endCommand();
 
@@ -72,6 +78,8 @@ class ComposerCommandEngine : protected CommandReaderBase {
             }
         }
 
+        flushLayerStates();
+
         if (!isEmpty()) {
             return Error::BAD_PARAMETER;
         }
@@ -83,12 +91,69 @@ class ComposerCommandEngine : protected CommandReaderBase {
 
     const MQDescriptorSync<uint32_t>* getOutputMQDescriptor() { return mWriter->getMQDescriptor(); }
 
+    // for dumping the sizing of the output command buffer
+    const CommandWriterBase& getWriter() const { return *mWriter; }
+
     void reset() {
         CommandReaderBase::reset();
         mWriter->reset();
+        mLayerStates.clear();
+        mLayerStateLocs.clear();
     }
 
    protected:
+    static bool isLayerStateCommand(IComposerClient::Command command) {
+        switch (command) {
+            case IComposerClient::Command::SELECT_LAYER:
+            case IComposerClient::Command::SET_LAYER_CURSOR_POSITION:
+            case IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE:
+            case IComposerClient::Command::SET_LAYER_BLEND_MODE:
+            case IComposerClient::Command::SET_LAYER_COLOR:
+            case IComposerClient::Command::SET_LAYER_COMPOSITION_TYPE:
+            case IComposerClient::Command::SET_LAYER_DATASPACE:
+            case IComposerClient::Command::SET_LAYER_DISPLAY_FRAME:
+            case IComposerClient::Command::SET_LAYER_PLANE_ALPHA:
+            case IComposerClient::Command::SET_LAYER_SOURCE_CROP:
+            case IComposerClient::Command::SET_LAYER_TRANSFORM:
+            case IComposerClient::Command::SET_LAYER_VISIBLE_REGION:
+            case IComposerClient::Command::SET_LAYER_Z_ORDER:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Queues a per-layer state change for the current layer. It is applied by the next
+    // flushLayerStates().
+    LayerStateChange& queueLayerState(IComposerClient::Command command) {
+        mLayerStateLocs.push_back(getCommandLoc());
+        LayerStateChange& change = mLayerStates.emplace_back();
+        change.command = command;
+        change.layer = mCurrentLayer;
+        return change;
+    }
+
+    // Applies all queued per-layer state changes in one HAL call. Region data in the queued
+    // changes points into the command buffer, so this must run before the next readQueue.
+    void flushLayerStates() {
+        if (mLayerStates.empty()) {
+            return;
+        }
+
+        mLayerStateErrors.resize(mLayerStates.size());
+        mHal->setLayerStates(mCurrentDisplay, mLayerStates.data(), mLayerStates.size(),
+                             mLayerStateErrors.data());
+        for (size_t i = 0; i < mLayerStates.size(); i++) {
+            if (mLayerStateErrors[i] != Error::NONE) {
+                mWriter->setError(mLayerStateLocs[i], mLayerStateErrors[i]);
+            }
+        }
+
+        // clear() keeps the capacity, so the frame description is not reallocated every frame
+        mLayerStates.clear();
+        mLayerStateLocs.clear();
+    }
+
     virtual bool executeCommand(IComposerClient::Command command, uint16_t length) {
         switch (command) {
             case IComposerClient::Command::SELECT_DISPLAY:
@@ -345,11 +410,9 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerCursorPosition(mCurrentDisplay, mCurrentLayer, readSigned(),
-                                                readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        auto& change = queueLayerState(IComposerClient::Command::SET_LAYER_CURSOR_POSITION);
+        change.cursorPosition.x = readSigned();
+        change.cursorPosition.y = readSigned();
 
         return true;
     }
@@ -391,11 +454,8 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto damage = readRegion(length / 4);
-        auto err = mHal->setLayerSurfaceDamage(mCurrentDisplay, mCurrentLayer, damage);
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        auto& change = queueLayerState(IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE);
+        change.region = readRegionInPlace(length / 4);
 
         return true;
     }
@@ -405,10 +465,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerBlendMode(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_BLEND_MODE).value = readSigned();
 
         return true;
     }
@@ -418,10 +475,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerColor(mCurrentDisplay, mCurrentLayer, readColor());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_COLOR).color = readColor();
 
         return true;
     }
@@ -431,10 +485,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerCompositionType(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_COMPOSITION_TYPE).value = readSigned();
 
         return true;
     }
@@ -444,10 +495,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerDataspace(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_DATASPACE).value = readSigned();
 
         return true;
     }
@@ -457,10 +505,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerDisplayFrame(mCurrentDisplay, mCurrentLayer, readRect());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_DISPLAY_FRAME).frame = readRect();
 
         return true;
     }
@@ -470,10 +515,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerPlaneAlpha(mCurrentDisplay, mCurrentLayer, readFloat());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_PLANE_ALPHA).alpha = readFloat();
 
         return true;
     }
@@ -504,10 +546,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerSourceCrop(mCurrentDisplay, mCurrentLayer, readFRect());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_SOURCE_CROP).crop = readFRect();
 
         return true;
     }
@@ -517,10 +556,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerTransform(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_TRANSFORM).value = readSigned();
 
         return true;
     }
@@ -531,11 +567,8 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto region = readRegion(length / 4);
-        auto err = mHal->setLayerVisibleRegion(mCurrentDisplay, mCurrentLayer, region);
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        auto& change = queueLayerState(IComposerClient::Command::SET_LAYER_VISIBLE_REGION);
+        change.region = readRegionInPlace(length / 4);
 
         return true;
     }
@@ -545,10 +578,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerZOrder(mCurrentDisplay, mCurrentLayer, read());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        queueLayerState(IComposerClient::Command::SET_LAYER_Z_ORDER).z = read();
 
         return true;
     }
@@ -570,6 +600,15 @@ class ComposerCommandEngine : protected CommandReaderBase {
         return region;
     }
 
+    // Returns the next count rectangles as a region that points into the command buffer rather
+    // than copying them. The region is valid until the next readQueue.
+    hwc_region_t readRegionInPlace(size_t count) {
+        static_assert(sizeof(hwc_rect_t) == 4 * sizeof(uint32_t));
+        hwc_region_t region{count, reinterpret_cast<const hwc_rect_t*>(&mData[mDataRead])};
+        mDataRead += count * 4;
+        return region;
+    }
+
     hwc_frect_t readFRect() {
         return hwc_frect_t{
             readFloat(), readFloat(), readFloat(), readFloat(),
@@ -585,6 +624,11 @@ class ComposerCommandEngine : protected CommandReaderBase {
 
     Display mCurrentDisplay = 0;
     Layer mCurrentLayer = 0;
+
+    // per-layer state changes of the current display that have not been applied yet
+    std::vector<LayerStateChange> mLayerStates;
+    std::vector<uint32_t> mLayerStateLocs;
+    std::vector<Error> mLayerStateErrors;
 };
 
 }  // namespace hal
@@ -43,6 +43,28 @@ using common::V1_0::Hdr;
 using common::V1_0::PixelFormat;
 using common::V1_0::Transform;
 
+// A single per-layer state change decoded from the command stream.
+//
+// Region data points into the command reader's buffer and is only valid until the change has
+// been applied.
+struct LayerStateChange {
+    IComposerClient::Command command;
+    Layer layer;
+    IComposerClient::Color color;
+    union {
+        struct {
+            int32_t x;
+            int32_t y;
+        } cursorPosition;
+        int32_t value;  // blend mode, composition type, dataspace or transform
+        uint32_t z;
+        float alpha;
+        hwc_rect_t frame;
+        hwc_frect_t crop;
+        hwc_region_t region;  // surface damage or visible region
+    };
+};
+
 class ComposerHal {
    public:
     virtual ~ComposerHal() = default;
@@ -127,6 +149,57 @@ class ComposerHal {
     virtual Error setLayerVisibleRegion(Display display, Layer layer,
                                         const std::vector<hwc_rect_t>& visible) = 0;
     virtual Error setLayerZOrder(Display display, Layer layer, uint32_t z) = 0;
+
+    // Applies a single per-layer state change. Backends that can consume hwc_region_t directly
+    // should override this to avoid copying region data into a vector.
+    virtual Error setLayerState(Display display, const LayerStateChange& change) {
+        using Command = IComposerClient::Command;
+        switch (change.command) {
+            case Command::SET_LAYER_CURSOR_POSITION:
+                return setLayerCursorPosition(display, change.layer, change.cursorPosition.x,
+                                              change.cursorPosition.y);
+            case Command::SET_LAYER_SURFACE_DAMAGE:
+                return setLayerSurfaceDamage(
+                        display, change.layer,
+                        std::vector<hwc_rect_t>(change.region.rects,
+                                                change.region.rects + change.region.numRects));
+            case Command::SET_LAYER_BLEND_MODE:
+                return setLayerBlendMode(display, change.layer, change.value);
+            case Command::SET_LAYER_COLOR:
+                return setLayerColor(display, change.layer, change.color);
+            case Command::SET_LAYER_COMPOSITION_TYPE:
+                return setLayerCompositionType(display, change.layer, change.value);
+            case Command::SET_LAYER_DATASPACE:
+                return setLayerDataspace(display, change.layer, change.value);
+            case Command::SET_LAYER_DISPLAY_FRAME:
+                return setLayerDisplayFrame(display, change.layer, change.frame);
+            case Command::SET_LAYER_PLANE_ALPHA:
+                return setLayerPlaneAlpha(display, change.layer, change.alpha);
+            case Command::SET_LAYER_SOURCE_CROP:
+                return setLayerSourceCrop(display, change.layer, change.crop);
+            case Command::SET_LAYER_TRANSFORM:
+                return setLayerTransform(display, change.layer, change.value);
+            case Command::SET_LAYER_VISIBLE_REGION:
+                return setLayerVisibleRegion(
+                        display, change.layer,
+                        std::vector<hwc_rect_t>(change.region.rects,
+                                                change.region.rects + change.region.numRects));
+            case Command::SET_LAYER_Z_ORDER:
+                return setLayerZOrder(display, change.layer, change.z);
+            default:
+                return Error::UNSUPPORTED;
+        }
+    }
+
+    // Applies all per-layer state changes collected for a display in one call. outErrors must
+    // have room for count entries. Backends with a native batched entry point should override
+    // this; the default applies the changes one at a time.
+    virtual void setLayerStates(Display display, const LayerStateChange* changes, size_t count,
+                                Error* outErrors) {
+        for (size_t i = 0; i < count; i++) {
+            outErrors[i] = setLayerState(display, changes[i]);
+        }
+    }
 };
 
 }  // namespace hal
@@ -25,6 +25,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <sstream>
@@ -106,8 +107,14 @@ HWC2On1Adapter::HWC2On1Adapter(hwc_composer_device_1_t* hwc1Device)
     mPendingVsyncs(),
     mPendingHotplugs(),
     mDisplays(),
-    mHwc1DisplayMap()
+    mHwc1DisplayMap(),
+    mVsyncCallback(nullptr),
+    mVsyncReaders(0)
 {
+    for (auto& displayId : mHwc1DisplayIds) {
+        displayId.store(kInvalidDisplayId, std::memory_order_relaxed);
+    }
+
     common.close = closeHook;
     getCapabilities = getCapabilitiesHook;
     getFunction = getFunctionHook;
@@ -327,7 +334,7 @@ Error HWC2On1Adapter::createVirtualDisplay(uint32_t width,
             HWC2::DisplayType::Virtual);
     mHwc1VirtualDisplay->populateConfigs(width, height);
     const auto displayId = mHwc1VirtualDisplay->getId();
-    mHwc1DisplayMap[HWC_DISPLAY_VIRTUAL] = displayId;
+    setHwc1DisplayMapping(HWC_DISPLAY_VIRTUAL, displayId);
     mHwc1VirtualDisplay->setHwc1Id(HWC_DISPLAY_VIRTUAL);
     mDisplays.emplace(displayId, mHwc1VirtualDisplay);
     *outDisplay = displayId;
@@ -343,7 +350,7 @@ Error HWC2On1Adapter::destroyVirtualDisplay(hwc2_display_t displayId) {
     }
 
     mHwc1VirtualDisplay.reset();
-    mHwc1DisplayMap.erase(HWC_DISPLAY_VIRTUAL);
+    clearHwc1DisplayMapping(HWC_DISPLAY_VIRTUAL);
     mDisplays.erase(displayId);
 
     return Error::None;
@@ -378,6 +385,9 @@ void HWC2On1Adapter::dump(uint32_t* outSize, char* outBuffer) {
         }
     }
 
+    output << "HWC1 prepare: " << mHwc1PrepareTiming.dump() << '\n';
+    output << "HWC1 set: " << mHwc1SetTiming.dump() << '\n';
+
     output << "Displays:\n";
     for (const auto& element : mDisplays) {
         const auto& display = element.second;
@@ -424,6 +434,11 @@ Error HWC2On1Adapter::registerCallback(Callback descriptor,
     ALOGV("registerCallback(%s, %p, %p)", to_string(descriptor).c_str(),
             callbackData, pointer);
 
+    if (descriptor == Callback::Vsync) {
+        registerVsyncCallback(callbackData, pointer);
+        return Error::None;
+    }
+
     std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
 
     if (pointer != nullptr) {
@@ -436,7 +451,6 @@ Error HWC2On1Adapter::registerCallback(Callback descriptor,
 
     bool hasPendingInvalidate = false;
     std::vector<hwc2_display_t> displayIds;
-    std::vector<std::pair<hwc2_display_t, int64_t>> pendingVsyncs;
     std::vector<std::pair<hwc2_display_t, int>> pendingHotplugs;
 
     if (descriptor == Callback::Refresh) {
@@ -447,19 +461,6 @@ Error HWC2On1Adapter::registerCallback(Callback descriptor,
             }
         }
         mHasPendingInvalidate = false;
-    } else if (descriptor == Callback::Vsync) {
-        for (auto pending : mPendingVsyncs) {
-            auto hwc1DisplayId = pending.first;
-            if (mHwc1DisplayMap.count(hwc1DisplayId) == 0) {
-                ALOGE("hwc1Vsync: Couldn't find display for HWC1 id %d",
-                        hwc1DisplayId);
-                continue;
-            }
-            auto displayId = mHwc1DisplayMap[hwc1DisplayId];
-            auto timestamp = pending.second;
-            pendingVsyncs.emplace_back(displayId, timestamp);
-        }
-        mPendingVsyncs.clear();
     } else if (descriptor == Callback::Hotplug) {
         // Hotplug the primary display
         pendingHotplugs.emplace_back(mHwc1DisplayMap[HWC_DISPLAY_PRIMARY],
@@ -487,12 +488,6 @@ Error HWC2On1Adapter::registerCallback(Callback descriptor,
             refresh(callbackData, displayId);
         }
     }
-    if (!pendingVsyncs.empty()) {
-        auto vsync = reinterpret_cast<HWC2_PFN_VSYNC>(pointer);
-        for (auto& pendingVsync : pendingVsyncs) {
-            vsync(callbackData, pendingVsync.first, pendingVsync.second);
-        }
-    }
     if (!pendingHotplugs.empty()) {
         auto hotplug = reinterpret_cast<HWC2_PFN_HOTPLUG>(pointer);
         for (auto& pendingHotplug : pendingHotplugs) {
@@ -525,7 +520,7 @@ HWC2On1Adapter::Display::Display(HWC2On1Adapter& device, HWC2::DisplayType type)
     mOutputBuffer(),
     mHasColorTransform(false),
     mLayers(),
-    mHwc1LayerMap(),
+    mHwc1Layers(),
     mNumAvailableRects(0),
     mNextAvailableRect(nullptr),
     mGeometryChanged(false)
@@ -562,7 +557,8 @@ Error HWC2On1Adapter::Display::acceptChanges() {
 Error HWC2On1Adapter::Display::createLayer(hwc2_layer_t* outLayerId) {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
 
-    auto layer = *mLayers.emplace(std::make_shared<Layer>(*this));
+    auto layer = std::make_shared<Layer>(*this);
+    insertLayerByZ(layer);
     mDevice.mLayers.emplace(std::make_pair(layer->getId(), layer));
     *outLayerId = layer->getId();
     ALOGV("[%" PRIu64 "] created layer %" PRIu64, mId, *outLayerId);
@@ -581,12 +577,9 @@ Error HWC2On1Adapter::Display::destroyLayer(hwc2_layer_t layerId) {
     }
     const auto layer = mapLayer->second;
     mDevice.mLayers.erase(mapLayer);
-    const auto zRange = mLayers.equal_range(layer);
-    for (auto current = zRange.first; current != zRange.second; ++current) {
-        if (**current == *layer) {
-            current = mLayers.erase(current);
-            break;
-        }
+    const auto current = std::find(mLayers.begin(), mLayers.end(), layer);
+    if (current != mLayers.end()) {
+        mLayers.erase(current);
     }
     ALOGV("[%" PRIu64 "] destroyed layer %" PRIu64, mId, layerId);
     markGeometryChanged();
@@ -1001,28 +994,21 @@ Error HWC2On1Adapter::Display::updateLayerZ(hwc2_layer_t layerId, uint32_t z) {
     }
 
     const auto layer = mapLayer->second;
-    const auto zRange = mLayers.equal_range(layer);
-    bool layerOnDisplay = false;
-    for (auto current = zRange.first; current != zRange.second; ++current) {
-        if (**current == *layer) {
-            if ((*current)->getZ() == z) {
-                // Don't change anything if the Z hasn't changed
-                return Error::None;
-            }
-            current = mLayers.erase(current);
-            layerOnDisplay = true;
-            break;
-        }
-    }
-
-    if (!layerOnDisplay) {
+    const auto current = std::find(mLayers.begin(), mLayers.end(), layer);
+    if (current == mLayers.end()) {
         ALOGE("[%" PRIu64 "] updateLayerZ failed to find layer on display",
                 mId);
         return Error::BadLayer;
     }
 
+    if (layer->getZ() == z) {
+        // Don't change anything if the Z hasn't changed
+        return Error::None;
+    }
+
+    mLayers.erase(current);
     layer->setZ(z);
-    mLayers.emplace(std::move(layer));
+    insertLayerByZ(layer);
     markGeometryChanged();
 
     return Error::None;
@@ -1201,6 +1187,7 @@ void HWC2On1Adapter::Display::populateConfigs(uint32_t width, uint32_t height) {
 
 bool HWC2On1Adapter::Display::prepare() {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
+    const auto start = std::chrono::steady_clock::now();
 
     // Only prepare display contents for displays HWC1 knows about
     if (mHwc1Id == -1) {
@@ -1239,6 +1226,7 @@ bool HWC2On1Adapter::Display::prepare() {
 
     resetGeometryMarker();
 
+    mPrepareTiming.add(std::chrono::steady_clock::now() - start);
     return true;
 }
 
@@ -1250,7 +1238,7 @@ void HWC2On1Adapter::Display::generateChanges() {
     size_t numLayers = mHwc1RequestedContents->numHwLayers;
     for (size_t hwc1Id = 0; hwc1Id < numLayers; ++hwc1Id) {
         const auto& receivedLayer = mHwc1RequestedContents->hwLayers[hwc1Id];
-        if (mHwc1LayerMap.count(hwc1Id) == 0) {
+        if (hwc1Id >= mHwc1Layers.size()) {
             ALOGE_IF(receivedLayer.compositionType != HWC_FRAMEBUFFER_TARGET,
                     "generateChanges: HWC1 layer %zd doesn't have a"
                     " matching HWC2 layer, and isn't the framebuffer target",
@@ -1258,7 +1246,7 @@ void HWC2On1Adapter::Display::generateChanges() {
             continue;
         }
 
-        Layer& layer = *mHwc1LayerMap[hwc1Id];
+        Layer& layer = *mHwc1Layers[hwc1Id];
         updateTypeChanges(receivedLayer, layer);
         updateLayerRequests(receivedLayer, layer);
     }
@@ -1271,6 +1259,7 @@ bool HWC2On1Adapter::Display::hasChanges() const {
 
 Error HWC2On1Adapter::Display::set(hwc_display_contents_1& hwcContents) {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
+    const auto start = std::chrono::steady_clock::now();
 
     if (!mChanges || (mChanges->getNumTypes() > 0)) {
         ALOGE("[%" PRIu64 "] set failed: not validated", mId);
@@ -1302,6 +1291,7 @@ Error HWC2On1Adapter::Display::set(hwc_display_contents_1& hwcContents) {
 
     mChanges.reset();
 
+    mSetTiming.add(std::chrono::steady_clock::now() - start);
     return Error::None;
 }
 
@@ -1317,7 +1307,7 @@ void HWC2On1Adapter::Display::addReleaseFences(
     size_t numLayers = hwcContents.numHwLayers;
     for (size_t hwc1Id = 0; hwc1Id < numLayers; ++hwc1Id) {
         const auto& receivedLayer = hwcContents.hwLayers[hwc1Id];
-        if (mHwc1LayerMap.count(hwc1Id) == 0) {
+        if (hwc1Id >= mHwc1Layers.size()) {
             if (receivedLayer.compositionType != HWC_FRAMEBUFFER_TARGET) {
                 ALOGE("addReleaseFences: HWC1 layer %zd doesn't have a"
                         " matching HWC2 layer, and isn't the framebuffer"
@@ -1331,7 +1321,7 @@ void HWC2On1Adapter::Display::addReleaseFences(
             continue;
         }
 
-        Layer& layer = *mHwc1LayerMap[hwc1Id];
+        Layer& layer = *mHwc1Layers[hwc1Id];
         ALOGV("Adding release fence %d to layer %" PRIu64,
                 receivedLayer.releaseFenceFd, layer.getId());
         layer.addReleaseFence(receivedLayer.releaseFenceFd);
@@ -1538,6 +1528,9 @@ std::string HWC2On1Adapter::Display::dump() const {
         output << config->toString(true) << '\n';
     }
 
+    output << "    Prepare: " << mPrepareTiming.dump() << '\n';
+    output << "    Set: " << mSetTiming.dump() << '\n';
+
     output << "    " << mLayers.size() << " Layer" <<
             (mLayers.size() == 1 ? "" : "s") << '\n';
     for (const auto& layer : mLayers) {
@@ -1814,14 +1807,20 @@ void HWC2On1Adapter::Display::allocateRequestedContents() {
 }
 
 void HWC2On1Adapter::Display::assignHwc1LayerIds() {
-    mHwc1LayerMap.clear();
+    // mLayers is already in Z order, so HWC1 ids are just positions in it
+    mHwc1Layers = mLayers;
     size_t nextHwc1Id = 0;
-    for (auto& layer : mLayers) {
-        mHwc1LayerMap[nextHwc1Id] = layer;
+    for (auto& layer : mHwc1Layers) {
         layer->setHwc1Id(nextHwc1Id++);
     }
 }
 
+void HWC2On1Adapter::Display::insertLayerByZ(std::shared_ptr<Layer> layer) {
+    auto position = std::upper_bound(mLayers.begin(), mLayers.end(), layer,
+            SortLayersByZ());
+    mLayers.insert(position, std::move(layer));
+}
+
 void HWC2On1Adapter::Display::updateTypeChanges(const hwc_layer_1_t& hwc1Layer,
         const Layer& layer) {
     auto layerId = layer.getId();
@@ -1926,6 +1925,26 @@ bool HWC2On1Adapter::SortLayersByZ::operator()(const std::shared_ptr<Layer>& lhs
     return lhs->getZ() < rhs->getZ();
 }
 
+void HWC2On1Adapter::StageTiming::add(std::chrono::nanoseconds duration) {
+    mLast = duration;
+    mMax = std::max(mMax, duration);
+    mTotal += duration;
+    ++mCount;
+}
+
+std::string HWC2On1Adapter::StageTiming::dump() const {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::stringstream output;
+    output << "last " << duration_cast<microseconds>(mLast).count() << "us";
+    output << ", avg " << (mCount == 0 ? 0 :
+            duration_cast<microseconds>(mTotal).count() / mCount) << "us";
+    output << ", max " << duration_cast<microseconds>(mMax).count() << "us";
+    output << " (" << mCount << " frames)";
+    return output.str();
+}
+
 Error HWC2On1Adapter::Layer::setBuffer(buffer_handle_t buffer,
         int32_t acquireFence) {
     ALOGV("Setting acquireFence to %d for layer %" PRIu64, acquireFence, mId);
@@ -2305,7 +2324,7 @@ void HWC2On1Adapter::populatePrimary() {
     std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
 
     auto display = std::make_shared<Display>(*this, HWC2::DisplayType::Physical);
-    mHwc1DisplayMap[HWC_DISPLAY_PRIMARY] = display->getId();
+    setHwc1DisplayMapping(HWC_DISPLAY_PRIMARY, display->getId());
     display->setHwc1Id(HWC_DISPLAY_PRIMARY);
     display->populateConfigs();
     mDisplays.emplace(display->getId(), std::move(display));
@@ -2373,8 +2392,10 @@ bool HWC2On1Adapter::prepareAllDisplays() {
     ALOGV("Calling HWC1 prepare");
     {
         ATRACE_NAME("HWC1 prepare");
+        const auto start = std::chrono::steady_clock::now();
         mHwc1Device->prepare(mHwc1Device, mHwc1Contents.size(),
                 mHwc1Contents.data());
+        mHwc1PrepareTiming.add(std::chrono::steady_clock::now() - start);
     }
 
     for (size_t c = 0; c < mHwc1Contents.size(); ++c) {
@@ -2504,8 +2525,10 @@ Error HWC2On1Adapter::setAllDisplays() {
     {
         ATRACE_NAME("HWC1 set");
         //dumpHWC1Message(mHwc1Device, mHwc1Contents.size(), mHwc1Contents.data());
+        const auto start = std::chrono::steady_clock::now();
         mHwc1Device->set(mHwc1Device, mHwc1Contents.size(),
                 mHwc1Contents.data());
+        mHwc1SetTiming.add(std::chrono::steady_clock::now() - start);
     }
 
     // Add retire and release fences
@@ -2556,28 +2579,109 @@ void HWC2On1Adapter::hwc1Invalidate() {
 void HWC2On1Adapter::hwc1Vsync(int hwc1DisplayId, int64_t timestamp) {
     ALOGV("Received hwc1Vsync(%d, %" PRId64 ")", hwc1DisplayId, timestamp);
 
-    std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
+    // This path does not take mStateMutex, so that a prepare or set in
+    // progress never delays vsync delivery. It counts itself as a reader of
+    // mVsyncCallback until it is done with the callback, so that
+    // registerVsyncCallback knows when replaced callbacks can be freed.
+    struct VsyncReader {
+        explicit VsyncReader(std::atomic<int>& readers) : mReaders(readers) {
+            mReaders.fetch_add(1);
+        }
+        ~VsyncReader() { mReaders.fetch_sub(1); }
+        std::atomic<int>& mReaders;
+    } reader(mVsyncReaders);
+
+    auto callbackInfo = mVsyncCallback.load();
+    if (callbackInfo == nullptr) {
+        std::lock_guard<std::mutex> lock(mVsyncMutex);
+
+        // registerVsyncCallback publishes the callback while holding the lock,
+        // so check again before buffering.
+        callbackInfo = mVsyncCallback.load();
+        if (callbackInfo == nullptr) {
+            // If the HWC2-side callback hasn't been registered yet, buffer this
+            // until it is registered.
+            mPendingVsyncs.emplace_back(hwc1DisplayId, timestamp);
+            return;
+        }
+    }
 
-    // If the HWC2-side callback hasn't been registered yet, buffer this until
-    // it is registered.
-    if (mCallbacks.count(Callback::Vsync) == 0) {
-        mPendingVsyncs.emplace_back(hwc1DisplayId, timestamp);
+    auto displayId = getHwc2DisplayId(hwc1DisplayId);
+    if (displayId == kInvalidDisplayId) {
+        ALOGE("hwc1Vsync: Couldn't find display for HWC1 id %d", hwc1DisplayId);
         return;
     }
 
-    if (mHwc1DisplayMap.count(hwc1DisplayId) == 0) {
-        ALOGE("hwc1Vsync: Couldn't find display for HWC1 id %d", hwc1DisplayId);
+    auto vsync = reinterpret_cast<HWC2_PFN_VSYNC>(callbackInfo->pointer);
+    vsync(callbackInfo->data, displayId, timestamp);
+}
+
+void HWC2On1Adapter::registerVsyncCallback(hwc2_callback_data_t callbackData,
+        hwc2_function_pointer_t pointer) {
+    std::lock_guard<std::mutex> lock(mVsyncMutex);
+
+    if (pointer == nullptr) {
+        ALOGI("unregisterCallback(%s)", to_string(Callback::Vsync).c_str());
+        mVsyncCallback.store(nullptr);
+        reclaimVsyncCallbacksLocked();
         return;
     }
 
-    const auto& callbackInfo = mCallbacks[Callback::Vsync];
-    auto displayId = mHwc1DisplayMap[hwc1DisplayId];
+    // Deliver buffered vsyncs before publishing the callback, so that they
+    // are not overtaken by new ones.
+    auto vsync = reinterpret_cast<HWC2_PFN_VSYNC>(pointer);
+    for (auto pending : mPendingVsyncs) {
+        auto hwc1DisplayId = pending.first;
+        auto displayId = getHwc2DisplayId(hwc1DisplayId);
+        if (displayId == kInvalidDisplayId) {
+            ALOGE("hwc1Vsync: Couldn't find display for HWC1 id %d",
+                    hwc1DisplayId);
+            continue;
+        }
+        vsync(callbackData, displayId, pending.second);
+    }
+    mPendingVsyncs.clear();
+
+    mVsyncCallbacks.push_back(std::make_unique<CallbackInfo>(
+            CallbackInfo{callbackData, pointer}));
+    mVsyncCallback.store(mVsyncCallbacks.back().get());
+    reclaimVsyncCallbacksLocked();
+}
 
-    // Call back without the state lock held.
-    lock.unlock();
+void HWC2On1Adapter::reclaimVsyncCallbacksLocked() {
+    // mVsyncCallback no longer points to the replaced callbacks. A vsync that
+    // starts reading after this check sees the new value, so without readers
+    // in progress nothing can still be using them. Otherwise they are kept
+    // until the next registration.
+    if (mVsyncReaders.load() != 0) {
+        return;
+    }
+    const CallbackInfo* current = mVsyncCallback.load();
+    mVsyncCallbacks.erase(std::remove_if(mVsyncCallbacks.begin(),
+            mVsyncCallbacks.end(),
+            [current](const std::unique_ptr<CallbackInfo>& callbackInfo) {
+                return callbackInfo.get() != current;
+            }), mVsyncCallbacks.end());
+}
+
+void HWC2On1Adapter::setHwc1DisplayMapping(int hwc1DisplayId,
+        hwc2_display_t displayId) {
+    mHwc1DisplayMap[hwc1DisplayId] = displayId;
+    mHwc1DisplayIds[hwc1DisplayId].store(displayId, std::memory_order_release);
+}
+
+void HWC2On1Adapter::clearHwc1DisplayMapping(int hwc1DisplayId) {
+    mHwc1DisplayMap.erase(hwc1DisplayId);
+    mHwc1DisplayIds[hwc1DisplayId].store(kInvalidDisplayId,
+            std::memory_order_release);
+}
 
-    auto vsync = reinterpret_cast<HWC2_PFN_VSYNC>(callbackInfo.pointer);
-    vsync(callbackInfo.data, displayId, timestamp);
+hwc2_display_t HWC2On1Adapter::getHwc2DisplayId(int hwc1DisplayId) const {
+    if (hwc1DisplayId < 0 ||
+            static_cast<size_t>(hwc1DisplayId) >= mHwc1DisplayIds.size()) {
+        return kInvalidDisplayId;
+    }
+    return mHwc1DisplayIds[hwc1DisplayId].load(std::memory_order_acquire);
 }
 
 void HWC2On1Adapter::hwc1Hotplug(int hwc1DisplayId, int connected) {
@@ -2603,7 +2707,7 @@ void HWC2On1Adapter::hwc1Hotplug(int hwc1DisplayId, int connected) {
         display->setHwc1Id(HWC_DISPLAY_EXTERNAL);
         display->populateConfigs();
         displayId = display->getId();
-        mHwc1DisplayMap[HWC_DISPLAY_EXTERNAL] = displayId;
+        setHwc1DisplayMapping(HWC_DISPLAY_EXTERNAL, displayId);
         mDisplays.emplace(displayId, std::move(display));
     } else {
         if (connected != 0) {
@@ -2614,7 +2718,7 @@ void HWC2On1Adapter::hwc1Hotplug(int hwc1DisplayId, int connected) {
 
         // Disconnect an existing display
         displayId = mHwc1DisplayMap[hwc1DisplayId];
-        mHwc1DisplayMap.erase(HWC_DISPLAY_EXTERNAL);
+        clearHwc1DisplayMapping(HWC_DISPLAY_EXTERNAL);
         mDisplays.erase(displayId);
     }
 
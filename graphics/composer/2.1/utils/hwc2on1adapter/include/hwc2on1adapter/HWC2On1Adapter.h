@@ -25,7 +25,9 @@
 
 #include "MiniFence.h"
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <mutex>
 #include <queue>
@@ -134,6 +136,20 @@ private:
                          const std::shared_ptr<Layer>& rhs) const;
     };
 
+    // Running duration statistics for one stage of the prepare/set path,
+    // reported in dump().
+    class StageTiming {
+        public:
+            void add(std::chrono::nanoseconds duration);
+            std::string dump() const;
+
+        private:
+            std::chrono::nanoseconds mLast{0};
+            std::chrono::nanoseconds mMax{0};
+            std::chrono::nanoseconds mTotal{0};
+            uint64_t mCount = 0;
+    };
+
     // The semantics of the fences returned by the device differ between
     // hwc1.set() and hwc2.present(). Read hwcomposer.h and hwcomposer2.h
     // for more information.
@@ -373,7 +389,7 @@ private:
 
             // Creates a bi-directional mapping between index in HWC1
             // prepare/set array and Layer object. Stores mapping in
-            // mHwc1LayerMap and also updates Layer's attribute mHwc1Id.
+            // mHwc1Layers and also updates Layer's attribute mHwc1Id.
             void assignHwc1LayerIds();
 
             // Called after a response to prepare() has been received:
@@ -442,12 +458,22 @@ private:
 
             bool mHasColorTransform;
 
-            // All layers this Display is aware of.
-            std::multiset<std::shared_ptr<Layer>, SortLayersByZ> mLayers;
+            // Inserts layer into mLayers after any layers with the same Z.
+            void insertLayerByZ(std::shared_ptr<Layer> layer);
+
+            // All layers this Display is aware of, kept sorted by Z. Layers
+            // with equal Z stay in insertion order. The ordering is only
+            // updated when a layer is added or its Z changes, not per frame.
+            std::vector<std::shared_ptr<Layer>> mLayers;
 
-            // Mapping between layer index in array of hwc_display_contents_1*
-            // passed to HWC1 during validate/set and Layer object.
-            std::unordered_map<size_t, std::shared_ptr<Layer>> mHwc1LayerMap;
+            // Layer objects indexed by their position in the array of
+            // hwc_display_contents_1* passed to HWC1 during validate/set.
+            std::vector<std::shared_ptr<Layer>> mHwc1Layers;
+
+            // Time spent preparing this display's HWC1 contents and ingesting
+            // the HWC1 response, and time spent in set() for it.
+            StageTiming mPrepareTiming;
+            StageTiming mSetTiming;
 
             // All communication with HWC1 via prepare/set is done with one
             // alloc. This pointer is pointing to a pool of hwc_rect_t.
@@ -700,7 +726,7 @@ private:
     // These are only accessed from the main SurfaceFlinger thread (not from
     // callbacks or dump
 
-    std::map<hwc2_layer_t, std::shared_ptr<Layer>> mLayers;
+    std::unordered_map<hwc2_layer_t, std::shared_ptr<Layer>> mLayers;
 
     // A HWC1 supports only one virtual display.
     std::shared_ptr<Display> mHwc1VirtualDisplay;
@@ -731,6 +757,43 @@ private:
     // Map HWC1 display type (HWC_DISPLAY_PRIMARY, HWC_DISPLAY_EXTERNAL,
     // HWC_DISPLAY_VIRTUAL) to Display IDs generated by HWC2on1Adapter objects.
     std::unordered_map<int, hwc2_display_t> mHwc1DisplayMap;
+
+    // Time spent in the HWC1 prepare() and set() calls, which cover all
+    // displays at once.
+    StageTiming mHwc1PrepareTiming;
+    StageTiming mHwc1SetTiming;
+
+    // Vsync delivery does not take mStateMutex, so that vsyncs are never held
+    // up behind a prepare/set in progress. The vsync callback and the HWC1 ->
+    // HWC2 display id mapping are mirrored below for it.
+
+    void registerVsyncCallback(hwc2_callback_data_t callbackData,
+            hwc2_function_pointer_t pointer);
+    // Frees the replaced vsync callbacks if no vsync is being delivered.
+    // mVsyncMutex must be held.
+    void reclaimVsyncCallbacksLocked();
+    void setHwc1DisplayMapping(int hwc1DisplayId, hwc2_display_t displayId);
+    void clearHwc1DisplayMapping(int hwc1DisplayId);
+    hwc2_display_t getHwc2DisplayId(int hwc1DisplayId) const;
+
+    static constexpr hwc2_display_t kInvalidDisplayId = UINT64_MAX;
+
+    // Indexed by HWC1 display type, kInvalidDisplayId when not connected.
+    std::array<std::atomic<hwc2_display_t>, HWC_NUM_DISPLAY_TYPES>
+            mHwc1DisplayIds;
+
+    // The registered vsync callback, or null. A replaced registration is only
+    // freed once no vsync is in progress, so a vsync racing with
+    // re-registration still reads a valid CallbackInfo.
+    std::atomic<const CallbackInfo*> mVsyncCallback;
+    // Number of vsyncs in progress that may be using a CallbackInfo.
+    std::atomic<int> mVsyncReaders;
+
+    // Guards mVsyncCallbacks and mPendingVsyncs. It is only contended while
+    // the vsync callback is being registered.
+    std::mutex mVsyncMutex;
+    // The current vsync callback, and the replaced ones still to be freed.
+    std::vector<std::unique_ptr<CallbackInfo>> mVsyncCallbacks;
 };
 
 } // namespace android
@@ -485,6 +485,24 @@ class HwcHalImpl : public Hal {
         return static_cast<Error>(err);
     }
 
+    Error setLayerState(Display display, const hal::LayerStateChange& change) override {
+        // hwc2 takes regions as hwc_region_t, so pass the command stream rects through as is
+        int32_t err;
+        switch (change.command) {
+            case IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE:
+                err = mDispatch.setLayerSurfaceDamage(mDevice, display, change.layer,
+                                                      change.region);
+                break;
+            case IComposerClient::Command::SET_LAYER_VISIBLE_REGION:
+                err = mDispatch.setLayerVisibleRegion(mDevice, display, change.layer,
+                                                      change.region);
+                break;
+            default:
+                return Hal::setLayerState(display, change);
+        }
+        return static_cast<Error>(err);
+    }
+
    protected:
     virtual void initCapabilities() {
         uint32_t count = 0;
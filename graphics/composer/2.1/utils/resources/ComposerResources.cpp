@@ -18,6 +18,8 @@
 
 #include "composer-resources/2.1/ComposerResources.h"
 
+#include <algorithm>
+
 namespace android {
 namespace hardware {
 namespace graphics {
@@ -83,12 +85,14 @@ Error ComposerHandleImporter::importBuffer(const native_handle_t* rawHandle,
         }
     }
 
+    mBufferImports.fetch_add(1, std::memory_order_relaxed);
     *outBufferHandle = bufferHandle;
     return Error::NONE;
 }
 
 void ComposerHandleImporter::freeBuffer(const native_handle_t* bufferHandle) {
     if (bufferHandle) {
+        mBufferFrees.fetch_add(1, std::memory_order_relaxed);
         if (mMapper2) {
             mMapper2->freeBuffer(static_cast<void*>(const_cast<native_handle_t*>(bufferHandle)));
         } else if (mMapper3) {
@@ -107,6 +111,7 @@ Error ComposerHandleImporter::importStream(const native_handle_t* rawHandle,
         if (!streamHandle) {
             return Error::NO_RESOURCES;
         }
+        mStreamImports.fetch_add(1, std::memory_order_relaxed);
     }
 
     *outStreamHandle = streamHandle;
@@ -115,14 +120,24 @@ Error ComposerHandleImporter::importStream(const native_handle_t* rawHandle,
 
 void ComposerHandleImporter::freeStream(const native_handle_t* streamHandle) {
     if (streamHandle) {
+        mStreamFrees.fetch_add(1, std::memory_order_relaxed);
         native_handle_close(streamHandle);
         native_handle_delete(const_cast<native_handle_t*>(streamHandle));
     }
 }
 
+ComposerHandleImporter::Stats ComposerHandleImporter::getStats() const {
+    return Stats{
+            mBufferImports.load(std::memory_order_relaxed),
+            mBufferFrees.load(std::memory_order_relaxed),
+            mStreamImports.load(std::memory_order_relaxed),
+            mStreamFrees.load(std::memory_order_relaxed),
+    };
+}
+
 ComposerHandleCache::ComposerHandleCache(ComposerHandleImporter& importer, HandleType type,
                                          uint32_t cacheSize)
-    : mImporter(importer), mHandleType(type), mHandles(cacheSize, nullptr) {}
+    : mImporter(importer), mHandleType(type), mSlots(cacheSize) {}
 
 // must be initialized later with initCache
 ComposerHandleCache::ComposerHandleCache(ComposerHandleImporter& importer) : mImporter(importer) {}
@@ -130,13 +145,13 @@ ComposerHandleCache::ComposerHandleCache(ComposerHandleImporter& importer) : mIm
 ComposerHandleCache::~ComposerHandleCache() {
     switch (mHandleType) {
         case HandleType::BUFFER:
-            for (auto handle : mHandles) {
-                mImporter.freeBuffer(handle);
+            for (const auto& slot : mSlots) {
+                mImporter.freeBuffer(slot.handle);
             }
             break;
         case HandleType::STREAM:
-            for (auto handle : mHandles) {
-                mImporter.freeStream(handle);
+            for (const auto& slot : mSlots) {
+                mImporter.freeStream(slot.handle);
             }
             break;
         default:
@@ -145,7 +160,7 @@ ComposerHandleCache::~ComposerHandleCache() {
 }
 
 size_t ComposerHandleCache::getCacheSize() const {
-    return mHandles.size();
+    return mSlots.size();
 }
 
 bool ComposerHandleCache::initCache(HandleType type, uint32_t cacheSize) {
@@ -155,26 +170,40 @@ bool ComposerHandleCache::initCache(HandleType type, uint32_t cacheSize) {
     }
 
     mHandleType = type;
-    mHandles.resize(cacheSize, nullptr);
+    mSlots.resize(cacheSize);
 
     return true;
 }
 
 Error ComposerHandleCache::lookupCache(uint32_t slot, const native_handle_t** outHandle) {
-    if (slot >= 0 && slot < mHandles.size()) {
-        *outHandle = mHandles[slot];
+    uint32_t generation;
+    return lookupCache(slot, outHandle, &generation);
+}
+
+Error ComposerHandleCache::lookupCache(uint32_t slot, const native_handle_t** outHandle,
+                                       uint32_t* outGeneration) {
+    if (slot < mSlots.size()) {
+        *outHandle = mSlots[slot].handle;
+        *outGeneration = mSlots[slot].generation;
         return Error::NONE;
     } else {
         return Error::BAD_PARAMETER;
     }
 }
 
+bool ComposerHandleCache::isCurrent(uint32_t slot, uint32_t generation) const {
+    return slot < mSlots.size() && mSlots[slot].generation == generation;
+}
+
 Error ComposerHandleCache::updateCache(uint32_t slot, const native_handle_t* handle,
                                        const native_handle** outReplacedHandle) {
-    if (slot >= 0 && slot < mHandles.size()) {
-        auto& cachedHandle = mHandles[slot];
-        *outReplacedHandle = cachedHandle;
-        cachedHandle = handle;
+    if (slot < mSlots.size()) {
+        auto& cachedSlot = mSlots[slot];
+        *outReplacedHandle = cachedSlot.handle;
+        cachedSlot.handle = handle;
+        if (++cachedSlot.generation == kEmptyGeneration) {
+            cachedSlot.generation++;
+        }
         return Error::NONE;
     } else {
         return Error::BAD_PARAMETER;
@@ -194,6 +223,16 @@ Error ComposerHandleCache::getHandle(uint32_t slot, bool fromCache, const native
     }
 }
 
+Error ComposerHandleCache::getWrittenHandle(uint32_t slot, bool fromCache,
+                                            const native_handle_t* inHandle,
+                                            const native_handle_t** outHandle,
+                                            const native_handle** outReplacedHandle) {
+    if (fromCache && isCurrent(slot, kEmptyGeneration)) {
+        return Error::BAD_PARAMETER;
+    }
+    return getHandle(slot, fromCache, inHandle, outHandle, outReplacedHandle);
+}
+
 ComposerLayerResource::ComposerLayerResource(ComposerHandleImporter& importer,
                                              uint32_t bufferCacheSize)
     : mBufferCache(importer, ComposerHandleCache::HandleType::BUFFER, bufferCacheSize),
@@ -203,7 +242,7 @@ Error ComposerLayerResource::getBuffer(uint32_t slot, bool fromCache,
                                        const native_handle_t* inHandle,
                                        const native_handle_t** outHandle,
                                        const native_handle** outReplacedHandle) {
-    return mBufferCache.getHandle(slot, fromCache, inHandle, outHandle, outReplacedHandle);
+    return mBufferCache.getWrittenHandle(slot, fromCache, inHandle, outHandle, outReplacedHandle);
 }
 
 Error ComposerLayerResource::getSidebandStream(uint32_t slot, bool fromCache,
@@ -247,22 +286,41 @@ Error ComposerDisplayResource::getOutputBuffer(uint32_t slot, bool fromCache,
                                                const native_handle_t* inHandle,
                                                const native_handle_t** outHandle,
                                                const native_handle** outReplacedHandle) {
-    return mOutputBufferCache.getHandle(slot, fromCache, inHandle, outHandle, outReplacedHandle);
+    return mOutputBufferCache.getWrittenHandle(slot, fromCache, inHandle, outHandle,
+                                               outReplacedHandle);
+}
+
+std::vector<ComposerDisplayResource::LayerEntry>::iterator ComposerDisplayResource::lowerBoundLayer(
+        Layer layer) {
+    return std::lower_bound(
+            mLayerResources.begin(), mLayerResources.end(), layer,
+            [](const LayerEntry& entry, Layer value) { return entry.first < value; });
 }
 
 bool ComposerDisplayResource::addLayer(Layer layer,
                                        std::unique_ptr<ComposerLayerResource> layerResource) {
-    auto result = mLayerResources.emplace(layer, std::move(layerResource));
-    return result.second;
+    auto layerIter = lowerBoundLayer(layer);
+    if (layerIter != mLayerResources.end() && layerIter->first == layer) {
+        return false;
+    }
+
+    mLayerResources.emplace(layerIter, layer, std::move(layerResource));
+    return true;
 }
 
 bool ComposerDisplayResource::removeLayer(Layer layer) {
-    return mLayerResources.erase(layer) > 0;
+    auto layerIter = lowerBoundLayer(layer);
+    if (layerIter == mLayerResources.end() || layerIter->first != layer) {
+        return false;
+    }
+
+    mLayerResources.erase(layerIter);
+    return true;
 }
 
 ComposerLayerResource* ComposerDisplayResource::findLayerResource(Layer layer) {
-    auto layerIter = mLayerResources.find(layer);
-    if (layerIter == mLayerResources.end()) {
+    auto layerIter = lowerBoundLayer(layer);
+    if (layerIter == mLayerResources.end() || layerIter->first != layer) {
         return nullptr;
     }
 
@@ -296,7 +354,7 @@ bool ComposerResources::init() {
 }
 
 void ComposerResources::clear(RemoveDisplay removeDisplay) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::unique_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     for (const auto& displayKey : mDisplayResources) {
         Display display = displayKey.first;
         const ComposerDisplayResource& displayResource = *displayKey.second;
@@ -306,13 +364,14 @@ void ComposerResources::clear(RemoveDisplay removeDisplay) {
 }
 
 bool ComposerResources::hasDisplay(Display display) {
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     return mDisplayResources.count(display) > 0;
 }
 
 Error ComposerResources::addPhysicalDisplay(Display display) {
     auto displayResource = createDisplayResource(ComposerDisplayResource::DisplayType::PHYSICAL, 0);
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::unique_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     auto result = mDisplayResources.emplace(display, std::move(displayResource));
     return result.second ? Error::NONE : Error::BAD_DISPLAY;
 }
@@ -321,44 +380,47 @@ Error ComposerResources::addVirtualDisplay(Display display, uint32_t outputBuffe
     auto displayResource = createDisplayResource(ComposerDisplayResource::DisplayType::VIRTUAL,
                                                  outputBufferCacheSize);
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::unique_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     auto result = mDisplayResources.emplace(display, std::move(displayResource));
     return result.second ? Error::NONE : Error::BAD_DISPLAY;
 }
 
 Error ComposerResources::removeDisplay(Display display) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::unique_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     return mDisplayResources.erase(display) > 0 ? Error::NONE : Error::BAD_DISPLAY;
 }
 
 Error ComposerResources::setDisplayClientTargetCacheSize(Display display,
                                                          uint32_t clientTargetCacheSize) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
+    std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
 
     return displayResource->initClientTargetCache(clientTargetCacheSize) ? Error::NONE
                                                                          : Error::BAD_PARAMETER;
 }
 
 Error ComposerResources::getDisplayClientTargetCacheSize(Display display, size_t* outCacheSize) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
+    std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
     *outCacheSize = displayResource->getClientTargetCacheSize();
     return Error::NONE;
 }
 
 Error ComposerResources::getDisplayOutputBufferCacheSize(Display display, size_t* outCacheSize) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
+    std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
     *outCacheSize = displayResource->getOutputBufferCacheSize();
     return Error::NONE;
 }
@@ -366,22 +428,24 @@ Error ComposerResources::getDisplayOutputBufferCacheSize(Display display, size_t
 Error ComposerResources::addLayer(Display display, Layer layer, uint32_t bufferCacheSize) {
     auto layerResource = createLayerResource(bufferCacheSize);
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
+    std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
 
     return displayResource->addLayer(layer, std::move(layerResource)) ? Error::NONE
                                                                       : Error::BAD_LAYER;
 }
 
 Error ComposerResources::removeLayer(Display display, Layer layer) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
+    std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
 
     return displayResource->removeLayer(layer) ? Error::NONE : Error::BAD_LAYER;
 }
@@ -419,22 +483,33 @@ Error ComposerResources::getLayerSidebandStream(Display display, Layer layer,
 }
 
 void ComposerResources::setDisplayMustValidateState(Display display, bool mustValidate) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     auto* displayResource = findDisplayResourceLocked(display);
     if (displayResource) {
+        std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
         displayResource->setMustValidateState(mustValidate);
     }
 }
 
 bool ComposerResources::mustValidateDisplay(Display display) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
     auto* displayResource = findDisplayResourceLocked(display);
     if (displayResource) {
+        std::lock_guard<std::mutex> displayLock(displayResource->getMutex());
         return displayResource->mustValidate();
     }
     return false;
 }
 
+ComposerResources::Stats ComposerResources::getStats() const {
+    return Stats{
+            mImporter.getStats(),
+            mCacheLookups.load(std::memory_order_relaxed),
+            mCacheUpdates.load(std::memory_order_relaxed),
+            mCacheLookupFailures.load(std::memory_order_relaxed),
+    };
+}
+
 std::unique_ptr<ComposerDisplayResource> ComposerResources::createDisplayResource(
         ComposerDisplayResource::DisplayType type, uint32_t outputBufferCacheSize) {
     return std::make_unique<ComposerDisplayResource>(type, mImporter, outputBufferCacheSize);
@@ -470,12 +545,22 @@ Error ComposerResources::getHandle(Display display, Layer layer, uint32_t slot,
         }
     }
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    if (fromCache) {
+        mCacheLookups.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        mCacheUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
 
     // find display/layer resource
     const bool needLayerResource = (cache == ComposerResources::Cache::LAYER_BUFFER ||
                                     cache == ComposerResources::Cache::LAYER_SIDEBAND_STREAM);
     ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+    std::unique_lock<std::mutex> displayLock;
+    if (displayResource) {
+        displayLock = std::unique_lock<std::mutex>(displayResource->getMutex());
+    }
     ComposerLayerResource* layerResource = (displayResource && needLayerResource)
                                                    ? displayResource->findLayerResource(layer)
                                                    : nullptr;
@@ -516,7 +601,9 @@ Error ComposerResources::getHandle(Display display, Layer layer, uint32_t slot,
 
     // clean up on errors
     if (error != Error::NONE) {
-        if (!fromCache) {
+        if (fromCache) {
+            mCacheLookupFailures.fetch_add(1, std::memory_order_relaxed);
+        } else {
             if (outReplacedHandle->isBuffer()) {
                 mImporter.freeBuffer(importedHandle);
             } else {
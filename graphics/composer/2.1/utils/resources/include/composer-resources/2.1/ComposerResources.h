@@ -20,9 +20,12 @@
 #warning "ComposerResources.h included without LOG_TAG"
 #endif
 
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <android/hardware/graphics/composer/2.1/types.h>
@@ -49,10 +52,24 @@ class ComposerHandleImporter {
     Error importStream(const native_handle_t* rawHandle, const native_handle_t** outStreamHandle);
     void freeStream(const native_handle_t* streamHandle);
 
+    // import/free churn since init
+    struct Stats {
+        uint64_t bufferImports;
+        uint64_t bufferFrees;
+        uint64_t streamImports;
+        uint64_t streamFrees;
+    };
+    Stats getStats() const;
+
   private:
     sp<mapper::V2_0::IMapper> mMapper2;
     sp<mapper::V3_0::IMapper> mMapper3;
     sp<mapper::V4_0::IMapper> mMapper4;
+
+    std::atomic<uint64_t> mBufferImports{0};
+    std::atomic<uint64_t> mBufferFrees{0};
+    std::atomic<uint64_t> mStreamImports{0};
+    std::atomic<uint64_t> mStreamFrees{0};
 };
 
 class ComposerHandleCache {
@@ -79,14 +96,32 @@ class ComposerHandleCache {
     Error updateCache(uint32_t slot, const native_handle_t* handle,
                       const native_handle** outReplacedHandle);
 
+    // Each slot carries a generation that is bumped whenever its handle is replaced, so a
+    // holder of (slot, generation) can tell whether its handle is stale without comparing
+    // handles.  A slot that was never written has kEmptyGeneration.
+    static constexpr uint32_t kEmptyGeneration = 0;
+    Error lookupCache(uint32_t slot, const native_handle_t** outHandle, uint32_t* outGeneration);
+    bool isCurrent(uint32_t slot, uint32_t generation) const;
+
     // when fromCache is true, look up in the cache; otherwise, update the cache
     Error getHandle(uint32_t slot, bool fromCache, const native_handle_t* inHandle,
                     const native_handle_t** outHandle, const native_handle** outReplacedHandle);
 
+    // like getHandle, but a cache lookup of a slot that was never written fails with
+    // BAD_PARAMETER: the client's view of the cache is stale
+    Error getWrittenHandle(uint32_t slot, bool fromCache, const native_handle_t* inHandle,
+                           const native_handle_t** outHandle,
+                           const native_handle** outReplacedHandle);
+
   private:
+    struct Slot {
+        const native_handle_t* handle = nullptr;
+        uint32_t generation = 0;
+    };
+
     ComposerHandleImporter& mImporter;
     HandleType mHandleType = HandleType::INVALID;
-    std::vector<const native_handle_t*> mHandles;
+    std::vector<Slot> mSlots;
 };
 
 // layer resource
@@ -142,13 +177,26 @@ class ComposerDisplayResource {
 
     bool mustValidate() const;
 
+    // Guards the caches and layers of this display. Displays are locked independently so that
+    // commands for different displays do not contend; callers must also hold
+    // ComposerResources::mDisplayResourcesMutex (shared is enough) while holding this lock.
+    std::mutex& getMutex() { return mMutex; }
+
   protected:
+    using LayerEntry = std::pair<Layer, std::unique_ptr<ComposerLayerResource>>;
+
+    // returns the first entry whose layer is not less than the given layer
+    std::vector<LayerEntry>::iterator lowerBoundLayer(Layer layer);
+
     const DisplayType mType;
     ComposerHandleCache mClientTargetCache;
     ComposerHandleCache mOutputBufferCache;
     bool mMustValidate;
 
-    std::unordered_map<Layer, std::unique_ptr<ComposerLayerResource>> mLayerResources;
+    std::mutex mMutex;
+    // sorted by layer; layers are looked up far more often than they are added or removed, and a
+    // few dozen contiguous keys are cheaper to search than a hash table
+    std::vector<LayerEntry> mLayerResources;
 };
 
 class ComposerResources {
@@ -232,6 +280,15 @@ class ComposerResources {
                                  const native_handle_t** outStreamHandle,
                                  ReplacedHandle* outReplacedStream);
 
+    struct Stats {
+        ComposerHandleImporter::Stats importer;
+        uint64_t cacheLookups;
+        uint64_t cacheUpdates;
+        // lookups of unknown or never written slots
+        uint64_t cacheLookupFailures;
+    };
+    Stats getStats() const;
+
   protected:
     virtual std::unique_ptr<ComposerDisplayResource> createDisplayResource(
             ComposerDisplayResource::DisplayType type, uint32_t outputBufferCacheSize);
@@ -242,9 +299,15 @@ class ComposerResources {
 
     ComposerHandleImporter mImporter;
 
-    std::mutex mDisplayResourcesMutex;
+    // Held exclusively to add or remove displays and shared for everything else; per-display
+    // state is guarded by ComposerDisplayResource::getMutex().
+    std::shared_mutex mDisplayResourcesMutex;
     std::unordered_map<Display, std::unique_ptr<ComposerDisplayResource>> mDisplayResources;
 
+    std::atomic<uint64_t> mCacheLookups{0};
+    std::atomic<uint64_t> mCacheUpdates{0};
+    std::atomic<uint64_t> mCacheLookupFailures{0};
+
   private:
     enum class Cache {
         CLIENT_TARGET,
@@ -54,7 +54,7 @@ Error ComposerResources::getDisplayReadbackBuffer(Display display, const native_
         return error;
     }
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
 
     auto iter = mDisplayResources.find(display);
     if (iter == mDisplayResources.end()) {
@@ -63,6 +63,7 @@ Error ComposerResources::getDisplayReadbackBuffer(Display display, const native_
     }
     ComposerDisplayResource& displayResource =
             *static_cast<ComposerDisplayResource*>(iter->second.get());
+    std::lock_guard<std::mutex> displayLock(displayResource.getMutex());
 
     // update cache
     const native_handle_t* replacedHandle;
@@ -70,7 +70,7 @@ class ComposerResources : public V2_1::hal::ComposerResources {
             return error;
         }
 
-        std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+        std::shared_lock<std::shared_mutex> lock(mDisplayResourcesMutex);
 
         auto iter = mDisplayResources.find(display);
         if (iter == mDisplayResources.end()) {
@@ -79,6 +79,7 @@ class ComposerResources : public V2_1::hal::ComposerResources {
         }
         ComposerDisplayResource& displayResource =
                 *static_cast<ComposerDisplayResource*>(iter->second.get());
+        std::lock_guard<std::mutex> displayLock(displayResource.getMutex());
 
         // update cache
         const native_handle_t* replacedHandle;
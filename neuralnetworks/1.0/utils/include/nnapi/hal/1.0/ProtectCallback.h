@@ -21,10 +21,13 @@
 #include <android-base/thread_annotations.h>
 #include <android/hidl/base/1.0/IBase.h>
 #include <hidl/HidlSupport.h>
+#include <nnapi/IPreparedModel.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
 
+#include <any>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -96,6 +99,30 @@ class DeathHandler final {
     sp<DeathRecipient> mDeathRecipient;
 };
 
+// Calls `onDeath` when `object` dies, for as long as the returned object is held.
+nn::GeneralResult<std::shared_ptr<void>> notifyOnDeath(sp<hidl::base::V1_0::IBase> object,
+                                                       std::function<void()> onDeath);
+
+// Calls `onDeath` when the HIDL prepared model under `preparedModel` dies, for as long as the
+// returned object is held. The underlying resource of `preparedModel` must be an sp<> of one of
+// `PreparedModels`, which are tried in order.
+template <typename... PreparedModels>
+nn::GeneralResult<std::shared_ptr<void>> notifyOnPreparedModelDeath(
+        const nn::SharedPreparedModel& preparedModel, std::function<void()> onDeath) {
+    const auto resource = preparedModel->getUnderlyingResource();
+    sp<hidl::base::V1_0::IBase> object;
+    const auto tryCast = [&object](const auto* held) {
+        if (object == nullptr && held != nullptr) {
+            object = *held;
+        }
+    };
+    (tryCast(std::any_cast<sp<PreparedModels>>(&resource)), ...);
+    if (object == nullptr) {
+        return NN_ERROR() << "prepared model does not hold a HIDL IPreparedModel";
+    }
+    return notifyOnDeath(std::move(object), std::move(onDeath));
+}
+
 }  // namespace android::hardware::neuralnetworks::utils
 
 #endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_1_0_UTILS_PROTECT_CALLBACK_H
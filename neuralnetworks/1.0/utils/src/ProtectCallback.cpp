@@ -27,10 +27,34 @@
 
 #include <algorithm>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <utility>
 #include <vector>
 
 namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+class DeathNotification final : public IProtectedCallback {
+  public:
+    explicit DeathNotification(std::function<void()> onDeath) : kOnDeath(std::move(onDeath)) {}
+
+    void notifyAsDeadObject() override { kOnDeath(); }
+
+  private:
+    const std::function<void()> kOnDeath;
+};
+
+struct DeathNotificationLink {
+    // `notification` must outlive `deathHandler` and `hold`, so it is declared first.
+    std::unique_ptr<DeathNotification> notification;
+    DeathHandler deathHandler;
+    // Removes `notification` from the death recipient on destruction, as the recipient can
+    // outlive the link.
+    DeathHandler::Hold hold;
+};
+
+}  // namespace
 
 void DeathRecipient::serviceDied(uint64_t /*cookie*/, const wp<hidl::base::V1_0::IBase>& /*who*/) {
     std::lock_guard guard(mMutex);
@@ -101,4 +125,13 @@ void DeathHandler::protectCallbackForLifetimeOfDeathHandler(IProtectedCallback*
     mDeathRecipient->add(killable);
 }
 
+nn::GeneralResult<std::shared_ptr<void>> notifyOnDeath(sp<hidl::base::V1_0::IBase> object,
+                                                       std::function<void()> onDeath) {
+    auto deathHandler = NN_TRY(DeathHandler::create(std::move(object)));
+    auto notification = std::make_unique<DeathNotification>(std::move(onDeath));
+    auto hold = deathHandler.protectCallback(notification.get());
+    return std::make_shared<DeathNotificationLink>(DeathNotificationLink{
+            std::move(notification), std::move(deathHandler), std::move(hold)});
+}
+
 }  // namespace android::hardware::neuralnetworks::utils
@@ -16,9 +16,11 @@
 
 #include "Service.h"
 
+#include <android/hardware/neuralnetworks/1.0/IPreparedModel.h>
 #include <nnapi/IDevice.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
+#include <nnapi/hal/1.0/ProtectCallback.h>
 #include <nnapi/hal/ResilientDevice.h>
 #include <string>
 #include "Device.h"
@@ -35,7 +37,8 @@ nn::GeneralResult<nn::SharedDevice> getDevice(const std::string& name) {
         return Device::create(name, std::move(service));
     };
 
-    return hal::utils::ResilientDevice::create(std::move(makeDevice));
+    return hal::utils::ResilientDevice::create(
+            std::move(makeDevice), hal::utils::notifyOnPreparedModelDeath<V1_0::IPreparedModel>);
 }
 
 }  // namespace android::hardware::neuralnetworks::V1_1::utils
@@ -25,6 +25,7 @@
 #include <nnapi/hal/CommonUtils.h>
 
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -95,6 +96,15 @@ class DeathHandler final {
     std::shared_ptr<DeathMonitor> kDeathMonitor;
 };
 
+// Calls `onDeath` when `object` dies, for as long as the returned object is held.
+nn::GeneralResult<std::shared_ptr<void>> notifyOnDeath(std::shared_ptr<ndk::ICInterface> object,
+                                                       std::function<void()> onDeath);
+
+// Calls `onDeath` when the AIDL prepared model under `preparedModel` dies, for as long as the
+// returned object is held.
+nn::GeneralResult<std::shared_ptr<void>> notifyOnPreparedModelDeath(
+        const nn::SharedPreparedModel& preparedModel, std::function<void()> onDeath);
+
 }  // namespace aidl::android::hardware::neuralnetworks::utils
 
 #endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_AIDL_UTILS_PROTECT_CALLBACK_H
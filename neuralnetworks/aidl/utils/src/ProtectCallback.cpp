@@ -23,15 +23,41 @@
 #include <android/binder_interface_utils.h>
 #include <nnapi/Result.h>
 
+#include <aidl/android/hardware/neuralnetworks/IPreparedModel.h>
+
 #include <algorithm>
+#include <any>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <utility>
 #include <vector>
 
 #include "Utils.h"
 
 namespace aidl::android::hardware::neuralnetworks::utils {
+namespace {
+
+class DeathNotification final : public IProtectedCallback {
+  public:
+    explicit DeathNotification(std::function<void()> onDeath) : kOnDeath(std::move(onDeath)) {}
+
+    void notifyAsDeadObject() override { kOnDeath(); }
+
+  private:
+    const std::function<void()> kOnDeath;
+};
+
+struct DeathNotificationLink {
+    // `notification` must outlive `deathHandler` and `hold`, so it is declared first.
+    std::unique_ptr<DeathNotification> notification;
+    DeathHandler deathHandler;
+    // Removes `notification` from the death monitor on destruction, as the monitor can outlive
+    // the link.
+    ::android::base::ScopeGuard<DeathHandler::Cleanup> hold;
+};
+
+}  // namespace
 
 void DeathMonitor::serviceDied() {
     std::lock_guard guard(mMutex);
@@ -108,4 +134,23 @@ DeathHandler::~DeathHandler() {
             [deathMonitor = kDeathMonitor, killable] { deathMonitor->remove(killable); });
 }
 
+nn::GeneralResult<std::shared_ptr<void>> notifyOnDeath(std::shared_ptr<ndk::ICInterface> object,
+                                                       std::function<void()> onDeath) {
+    auto deathHandler = NN_TRY(DeathHandler::create(std::move(object)));
+    auto notification = std::make_unique<DeathNotification>(std::move(onDeath));
+    auto hold = deathHandler.protectCallback(notification.get());
+    return std::make_shared<DeathNotificationLink>(DeathNotificationLink{
+            std::move(notification), std::move(deathHandler), std::move(hold)});
+}
+
+nn::GeneralResult<std::shared_ptr<void>> notifyOnPreparedModelDeath(
+        const nn::SharedPreparedModel& preparedModel, std::function<void()> onDeath) {
+    const auto resource = preparedModel->getUnderlyingResource();
+    const auto* object = std::any_cast<std::shared_ptr<aidl_hal::IPreparedModel>>(&resource);
+    if (object == nullptr || *object == nullptr) {
+        return NN_ERROR() << "prepared model does not hold an AIDL IPreparedModel";
+    }
+    return notifyOnDeath(*object, std::move(onDeath));
+}
+
 }  // namespace aidl::android::hardware::neuralnetworks::utils
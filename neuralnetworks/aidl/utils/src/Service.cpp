@@ -29,6 +29,7 @@
 #include <string>
 
 #include "Device.h"
+#include "ProtectCallback.h"
 #include "Utils.h"
 
 namespace aidl::android::hardware::neuralnetworks::utils {
@@ -85,7 +86,7 @@ nn::GeneralResult<nn::SharedDevice> getDevice(
         return Device::create(instanceName, std::move(service), featureLevel);
     };
 
-    return hal::utils::ResilientDevice::create(std::move(makeDevice));
+    return hal::utils::ResilientDevice::create(std::move(makeDevice), notifyOnPreparedModelDeath);
 }
 
 }  // namespace aidl::android::hardware::neuralnetworks::utils
@@ -23,6 +23,7 @@
 #include <nnapi/IPreparedModel.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
+#include <nnapi/hal/ResilientPreparedModel.h>
 
 #include <functional>
 #include <memory>
@@ -39,11 +40,19 @@ class ResilientDevice final : public nn::IDevice,
   public:
     using Factory = std::function<nn::GeneralResult<nn::SharedDevice>(bool blocking)>;
 
-    static nn::GeneralResult<std::shared_ptr<const ResilientDevice>> create(Factory makeDevice);
+    /**
+     * `notifyOnPreparedModelDeath` is passed on to the ResilientPreparedModel of each prepared
+     * model, so that the model is re-prepared in the background as soon as its driver dies.
+     */
+    static nn::GeneralResult<std::shared_ptr<const ResilientDevice>> create(
+            Factory makeDevice,
+            ResilientPreparedModel::DeathNotifier notifyOnPreparedModelDeath = nullptr);
 
-    explicit ResilientDevice(PrivateConstructorTag tag, Factory makeDevice, std::string name,
-                             std::string versionString, std::vector<nn::Extension> extensions,
-                             nn::Capabilities capabilities, nn::SharedDevice device);
+    explicit ResilientDevice(PrivateConstructorTag tag, Factory makeDevice,
+                             ResilientPreparedModel::DeathNotifier notifyOnPreparedModelDeath,
+                             std::string name, std::string versionString,
+                             std::vector<nn::Extension> extensions, nn::Capabilities capabilities,
+                             nn::SharedDevice device);
 
     nn::SharedDevice getDevice() const EXCLUDES(mMutex);
     nn::GeneralResult<nn::SharedDevice> recover(const nn::IDevice* failingDevice,
@@ -96,6 +105,7 @@ class ResilientDevice final : public nn::IDevice,
             const std::vector<nn::BufferRole>& outputRoles) const;
 
     const Factory kMakeDevice;
+    const ResilientPreparedModel::DeathNotifier kNotifyOnPreparedModelDeath;
     const std::string kName;
     const std::string kVersionString;
     const std::vector<nn::Extension> kExtensions;
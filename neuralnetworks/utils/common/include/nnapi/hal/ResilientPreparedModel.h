@@ -23,6 +23,7 @@
 #include <nnapi/Types.h>
 
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <utility>
@@ -37,16 +38,45 @@ class ResilientPreparedModel final : public nn::IPreparedModel,
   public:
     using Factory = std::function<nn::GeneralResult<nn::SharedPreparedModel>()>;
 
+    /**
+     * Arranges for `onDeath` to be called when the driver serving `preparedModel` dies.
+     *
+     * The notification stays registered for as long as the returned object is held. This is
+     * provided by the HAL-specific utils, which know how to link to the death of the underlying
+     * HIDL or AIDL object.
+     */
+    using DeathNotifier = std::function<nn::GeneralResult<std::shared_ptr<void>>(
+            const nn::SharedPreparedModel& preparedModel, std::function<void()> onDeath)>;
+
     static nn::GeneralResult<std::shared_ptr<const ResilientPreparedModel>> create(
-            Factory makePreparedModel);
+            Factory makePreparedModel, DeathNotifier notifyOnDeath = nullptr);
 
     explicit ResilientPreparedModel(PrivateConstructorTag tag, Factory makePreparedModel,
+                                    DeathNotifier notifyOnDeath,
                                     nn::SharedPreparedModel preparedModel);
 
     nn::SharedPreparedModel getPreparedModel() const;
+
+    /**
+     * Replaces `failingPreparedModel` with a newly prepared model.
+     *
+     * Only one recovery runs at a time. Concurrent callers that observe the same failing prepared
+     * model wait for the recovery already in flight and share its result instead of preparing the
+     * model again.
+     */
     nn::GeneralResult<nn::SharedPreparedModel> recover(
             const nn::IPreparedModel* failingPreparedModel) const;
 
+    /**
+     * Starts recovering `failingPreparedModel` on a background thread and returns immediately.
+     *
+     * This is called when the DeathNotifier reports that the driver died, so that the model is
+     * re-prepared (typically from the compilation cache) before the next call reaches it. Calls
+     * made while the recovery is in flight wait for it and then run on the recovered prepared
+     * model.
+     */
+    void recoverAsync(const nn::IPreparedModel* failingPreparedModel) const;
+
     nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> execute(
             const nn::Request& request, nn::MeasureTiming measure,
             const nn::OptionalTimePoint& deadline, const nn::OptionalDuration& loopTimeoutDuration,
@@ -71,7 +101,18 @@ class ResilientPreparedModel final : public nn::IPreparedModel,
 
     std::any getUnderlyingResource() const override;
 
+    // Returns the current prepared model, waiting for any recovery that is in flight.
+    nn::SharedPreparedModel getRecoveredPreparedModel() const;
+
   private:
+    using RecoveryResult = nn::GeneralResult<nn::SharedPreparedModel>;
+
+    static void recoverAsync(std::weak_ptr<const ResilientPreparedModel> resilientPreparedModel,
+                             const nn::IPreparedModel* failingPreparedModel);
+    // Returns the registration of the death notification of `preparedModel`, or nullptr if there
+    // is no DeathNotifier or it failed.
+    std::shared_ptr<void> notifyOnDeath(const nn::SharedPreparedModel& preparedModel) const;
+
     bool isValidInternal() const EXCLUDES(mMutex);
     nn::GeneralResult<nn::SharedExecution> createReusableExecutionInternal(
             const nn::Request& request, nn::MeasureTiming measure,
@@ -81,8 +122,11 @@ class ResilientPreparedModel final : public nn::IPreparedModel,
     nn::GeneralResult<nn::SharedBurst> configureExecutionBurstInternal() const;
 
     const Factory kMakePreparedModel;
+    const DeathNotifier kNotifyOnDeath;
     mutable std::mutex mMutex;
     mutable nn::SharedPreparedModel mPreparedModel GUARDED_BY(mMutex);
+    mutable std::shared_ptr<void> mDeathNotification GUARDED_BY(mMutex);
+    mutable std::shared_future<RecoveryResult> mRecovery GUARDED_BY(mMutex);
 };
 
 }  // namespace android::hardware::neuralnetworks::utils
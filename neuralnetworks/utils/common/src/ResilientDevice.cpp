@@ -66,7 +66,7 @@ auto protect(const ResilientDevice& resilientDevice, const FnType& fn, bool bloc
 }  // namespace
 
 nn::GeneralResult<std::shared_ptr<const ResilientDevice>> ResilientDevice::create(
-        Factory makeDevice) {
+        Factory makeDevice, ResilientPreparedModel::DeathNotifier notifyOnPreparedModelDeath) {
     if (makeDevice == nullptr) {
         return NN_ERROR(nn::ErrorStatus::INVALID_ARGUMENT)
                << "utils::ResilientDevice::create must have non-empty makeDevice";
@@ -79,17 +79,19 @@ nn::GeneralResult<std::shared_ptr<const ResilientDevice>> ResilientDevice::creat
     auto extensions = device->getSupportedExtensions();
     auto capabilities = device->getCapabilities();
 
-    return std::make_shared<ResilientDevice>(PrivateConstructorTag{}, std::move(makeDevice),
-                                             std::move(name), std::move(versionString),
-                                             std::move(extensions), std::move(capabilities),
-                                             std::move(device));
+    return std::make_shared<ResilientDevice>(
+            PrivateConstructorTag{}, std::move(makeDevice), std::move(notifyOnPreparedModelDeath),
+            std::move(name), std::move(versionString), std::move(extensions),
+            std::move(capabilities), std::move(device));
 }
 
 ResilientDevice::ResilientDevice(PrivateConstructorTag /*tag*/, Factory makeDevice,
+                                 ResilientPreparedModel::DeathNotifier notifyOnPreparedModelDeath,
                                  std::string name, std::string versionString,
                                  std::vector<nn::Extension> extensions,
                                  nn::Capabilities capabilities, nn::SharedDevice device)
     : kMakeDevice(std::move(makeDevice)),
+      kNotifyOnPreparedModelDeath(std::move(notifyOnPreparedModelDeath)),
       kName(std::move(name)),
       kVersionString(std::move(versionString)),
       kExtensions(std::move(extensions)),
@@ -182,7 +184,6 @@ nn::GeneralResult<nn::SharedPreparedModel> ResilientDevice::prepareModel(
         const std::vector<nn::SharedHandle>& dataCache, const nn::CacheToken& token,
         const std::vector<nn::TokenValuePair>& hints,
         const std::vector<nn::ExtensionNameAndPrefix>& extensionNameToPrefix) const {
-#if 0
     auto self = shared_from_this();
     ResilientPreparedModel::Factory makePreparedModel = [device = std::move(self), model,
                                                          preference, priority, deadline, modelCache,
@@ -190,26 +191,20 @@ nn::GeneralResult<nn::SharedPreparedModel> ResilientDevice::prepareModel(
         return device->prepareModelInternal(model, preference, priority, deadline, modelCache,
                                             dataCache, token, hints, extensionNameToPrefix);
     };
-    return ResilientPreparedModel::create(std::move(makePreparedModel));
-#else
-    return prepareModelInternal(model, preference, priority, deadline, modelCache, dataCache, token,
-                                hints, extensionNameToPrefix);
-#endif
+    return ResilientPreparedModel::create(std::move(makePreparedModel),
+                                          kNotifyOnPreparedModelDeath);
 }
 
 nn::GeneralResult<nn::SharedPreparedModel> ResilientDevice::prepareModelFromCache(
         nn::OptionalTimePoint deadline, const std::vector<nn::SharedHandle>& modelCache,
         const std::vector<nn::SharedHandle>& dataCache, const nn::CacheToken& token) const {
-#if 0
     auto self = shared_from_this();
     ResilientPreparedModel::Factory makePreparedModel = [device = std::move(self), deadline,
                                                          modelCache, dataCache, token] {
         return device->prepareModelFromCacheInternal(deadline, modelCache, dataCache, token);
     };
-    return ResilientPreparedModel::create(std::move(makePreparedModel));
-#else
-    return prepareModelFromCacheInternal(deadline, modelCache, dataCache, token);
-#endif
+    return ResilientPreparedModel::create(std::move(makePreparedModel),
+                                          kNotifyOnPreparedModelDeath);
 }
 
 nn::GeneralResult<nn::SharedBuffer> ResilientDevice::allocate(
@@ -29,9 +29,12 @@
 #include <nnapi/Types.h>
 
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -41,7 +44,9 @@ namespace {
 template <typename FnType>
 auto protect(const ResilientPreparedModel& resilientPreparedModel, const FnType& fn)
         -> decltype(fn(*resilientPreparedModel.getPreparedModel())) {
-    auto preparedModel = resilientPreparedModel.getPreparedModel();
+    // If the prepared model is already being recovered, queue behind the recovery rather than
+    // calling into a prepared model that is known to be dead.
+    auto preparedModel = resilientPreparedModel.getRecoveredPreparedModel();
     auto result = fn(*preparedModel);
 
     // Immediately return if prepared model is not dead.
@@ -66,21 +71,34 @@ auto protect(const ResilientPreparedModel& resilientPreparedModel, const FnType&
 }  // namespace
 
 nn::GeneralResult<std::shared_ptr<const ResilientPreparedModel>> ResilientPreparedModel::create(
-        Factory makePreparedModel) {
+        Factory makePreparedModel, DeathNotifier notifyOnDeath) {
     if (makePreparedModel == nullptr) {
         return NN_ERROR(nn::ErrorStatus::INVALID_ARGUMENT)
                << "utils::ResilientPreparedModel::create must have non-empty makePreparedModel";
     }
     auto preparedModel = NN_TRY(makePreparedModel());
     CHECK(preparedModel != nullptr);
-    return std::make_shared<ResilientPreparedModel>(
-            PrivateConstructorTag{}, std::move(makePreparedModel), std::move(preparedModel));
+    auto resilientPreparedModel = std::make_shared<ResilientPreparedModel>(
+            PrivateConstructorTag{}, std::move(makePreparedModel), std::move(notifyOnDeath),
+            preparedModel);
+
+    // The death notification refers back to the ResilientPreparedModel, so it can only be
+    // registered once the object is owned by a shared_ptr.
+    auto deathNotification = resilientPreparedModel->notifyOnDeath(preparedModel);
+    {
+        std::lock_guard guard(resilientPreparedModel->mMutex);
+        resilientPreparedModel->mDeathNotification = std::move(deathNotification);
+    }
+    return resilientPreparedModel;
 }
 
 ResilientPreparedModel::ResilientPreparedModel(PrivateConstructorTag /*tag*/,
                                                Factory makePreparedModel,
+                                               DeathNotifier notifyOnDeath,
                                                nn::SharedPreparedModel preparedModel)
-    : kMakePreparedModel(std::move(makePreparedModel)), mPreparedModel(std::move(preparedModel)) {
+    : kMakePreparedModel(std::move(makePreparedModel)),
+      kNotifyOnDeath(std::move(notifyOnDeath)),
+      mPreparedModel(std::move(preparedModel)) {
     CHECK(kMakePreparedModel != nullptr);
     CHECK(mPreparedModel != nullptr);
 }
@@ -90,17 +108,113 @@ nn::SharedPreparedModel ResilientPreparedModel::getPreparedModel() const {
     return mPreparedModel;
 }
 
+nn::SharedPreparedModel ResilientPreparedModel::getRecoveredPreparedModel() const {
+    std::shared_future<RecoveryResult> recovery;
+    {
+        std::lock_guard guard(mMutex);
+        if (!mRecovery.valid()) {
+            return mPreparedModel;
+        }
+        recovery = mRecovery;
+    }
+
+    // Wait for the in-flight recovery. If it fails, fall back to the current prepared model so
+    // that the caller's own call reports the error.
+    recovery.wait();
+    return getPreparedModel();
+}
+
 nn::GeneralResult<nn::SharedPreparedModel> ResilientPreparedModel::recover(
         const nn::IPreparedModel* failingPreparedModel) const {
-    std::lock_guard guard(mMutex);
+    std::shared_future<RecoveryResult> recovery;
+    std::optional<std::promise<RecoveryResult>> promise;
+    {
+        std::lock_guard guard(mMutex);
+
+        // Another caller updated the failing prepared model.
+        if (mPreparedModel.get() != failingPreparedModel) {
+            return mPreparedModel;
+        }
 
-    // Another caller updated the failing prepared model.
-    if (mPreparedModel.get() != failingPreparedModel) {
-        return mPreparedModel;
+        // Join the recovery already in flight, or become the caller that performs it.
+        if (!mRecovery.valid()) {
+            promise.emplace();
+            mRecovery = promise->get_future().share();
+        }
+        recovery = mRecovery;
     }
 
-    mPreparedModel = NN_TRY(kMakePreparedModel());
-    return mPreparedModel;
+    if (promise.has_value()) {
+        // The factory is called without holding mMutex so that getPreparedModel() never blocks
+        // behind a re-preparation.
+        auto result = kMakePreparedModel();
+        std::shared_ptr<void> deathNotification;
+        if (result.has_value()) {
+            CHECK(result.value() != nullptr);
+            deathNotification = notifyOnDeath(result.value());
+        }
+        {
+            std::lock_guard guard(mMutex);
+            if (result.has_value()) {
+                mPreparedModel = result.value();
+                // Swap so the registration for the dead prepared model is released below, outside
+                // of mMutex.
+                std::swap(mDeathNotification, deathNotification);
+            }
+            mRecovery = {};
+        }
+        deathNotification.reset();
+        promise->set_value(std::move(result));
+    }
+
+    return recovery.get();
+}
+
+void ResilientPreparedModel::recoverAsync(const nn::IPreparedModel* failingPreparedModel) const {
+    {
+        std::lock_guard guard(mMutex);
+        if (mPreparedModel.get() != failingPreparedModel || mRecovery.valid()) {
+            return;
+        }
+    }
+    recoverAsync(weak_from_this(), failingPreparedModel);
+}
+
+void ResilientPreparedModel::recoverAsync(
+        std::weak_ptr<const ResilientPreparedModel> resilientPreparedModel,
+        const nn::IPreparedModel* failingPreparedModel) {
+    // The thread only holds a weak reference until it runs, so a ResilientPreparedModel released
+    // by its users is not kept alive (or destroyed on the binder thread) by a death notification.
+    std::thread([resilientPreparedModel = std::move(resilientPreparedModel), failingPreparedModel] {
+        const auto self = resilientPreparedModel.lock();
+        if (self == nullptr) {
+            return;
+        }
+        const auto result = self->recover(failingPreparedModel);
+        if (!result.has_value()) {
+            LOG(ERROR) << "Background recovery of dead prepared model failed with error "
+                       << result.error().code << ": " << result.error().message;
+        }
+    }).detach();
+}
+
+std::shared_ptr<void> ResilientPreparedModel::notifyOnDeath(
+        const nn::SharedPreparedModel& preparedModel) const {
+    if (kNotifyOnDeath == nullptr) {
+        return nullptr;
+    }
+    auto onDeath = [resilientPreparedModel = weak_from_this(),
+                    failingPreparedModel = preparedModel.get()] {
+        recoverAsync(resilientPreparedModel, failingPreparedModel);
+    };
+    auto result = kNotifyOnDeath(preparedModel, std::move(onDeath));
+    if (!result.has_value()) {
+        // Not fatal: a call reaching the dead prepared model still recovers it on DEAD_OBJECT.
+        LOG(WARNING) << "Failed to register for the death of the prepared model with error "
+                     << result.error().code << ": " << result.error().message;
+        return nullptr;
+    }
+    return std::move(result).value();
 }
 
 nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>>
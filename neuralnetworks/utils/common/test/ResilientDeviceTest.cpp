@@ -18,8 +18,12 @@
 #include <nnapi/TypeUtils.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/ResilientDevice.h>
+#include <nnapi/hal/ResilientPreparedModel.h>
+#include <functional>
+#include <future>
 #include <tuple>
 #include <utility>
+#include <vector>
 #include "MockBuffer.h"
 #include "MockDevice.h"
 #include "MockPreparedModel.h"
@@ -28,6 +32,7 @@ namespace android::hardware::neuralnetworks::utils {
 namespace {
 
 using ::testing::_;
+using ::testing::InvokeWithoutArgs;
 using ::testing::Return;
 
 using SharedMockDevice = std::shared_ptr<const nn::MockDevice>;
@@ -101,6 +106,76 @@ constexpr auto makeError = [](nn::ErrorStatus status) {
 const auto kReturnGeneralFailure = makeError(nn::ErrorStatus::GENERAL_FAILURE);
 const auto kReturnDeadObject = makeError(nn::ErrorStatus::DEAD_OBJECT);
 
+struct FakeDeathLink {};
+
+// Records each prepared model linked to, and keeps the death callback of the last one.
+ResilientPreparedModel::DeathNotifier makeDeathNotifier(
+        std::vector<nn::SharedPreparedModel>* linkedPreparedModels,
+        std::function<void()>* onDeath) {
+    return [linkedPreparedModels, onDeath](const nn::SharedPreparedModel& preparedModel,
+                                           std::function<void()> callback)
+                   -> nn::GeneralResult<std::shared_ptr<void>> {
+        linkedPreparedModels->push_back(preparedModel);
+        *onDeath = std::move(callback);
+        return std::make_shared<FakeDeathLink>();
+    };
+}
+
+// Prepares a model with `prepare`, kills it together with its driver and checks that the death
+// notification re-prepares it on the recovered driver. `expectPrepare` sets up the prepare call
+// on a mock device.
+template <typename ExpectPrepare, typename Prepare>
+void testPreparedModelDeathRecovers(ExpectPrepare expectPrepare, Prepare prepare) {
+    // setup call
+    const auto mockDevice = createConfiguredMockDevice();
+    const auto recoveredMockDevice = createConfiguredMockDevice();
+    MockDeviceFactory mockDeviceFactory;
+    EXPECT_CALL(mockDeviceFactory, Call(true)).Times(1).WillOnce(Return(mockDevice));
+    EXPECT_CALL(mockDeviceFactory, Call(false)).Times(1).WillOnce(Return(recoveredMockDevice));
+    const auto mockPreparedModel = std::make_shared<const nn::MockPreparedModel>();
+    const auto recoveredMockPreparedModel = std::make_shared<const nn::MockPreparedModel>();
+    std::promise<void> recoveryEntered;
+    expectPrepare(*mockDevice)
+            .Times(2)
+            .WillOnce(Return(mockPreparedModel))
+            .WillOnce(kReturnDeadObject);
+    expectPrepare(*recoveredMockDevice)
+            .Times(1)
+            .WillOnce(InvokeWithoutArgs(
+                    [&recoveryEntered, &recoveredMockPreparedModel]()
+                            -> nn::GeneralResult<nn::SharedPreparedModel> {
+                        recoveryEntered.set_value();
+                        return recoveredMockPreparedModel;
+                    }));
+    std::vector<nn::SharedPreparedModel> linkedPreparedModels;
+    std::function<void()> onDeath;
+    const auto device = ResilientDevice::create(mockDeviceFactory.AsStdFunction(),
+                                                makeDeathNotifier(&linkedPreparedModels, &onDeath))
+                                .value();
+
+    // run test
+    const auto result = prepare(*device);
+    ASSERT_TRUE(result.has_value())
+            << "Failed with " << result.error().code << ": " << result.error().message;
+    const auto preparedModel =
+            std::dynamic_pointer_cast<const ResilientPreparedModel>(result.value());
+    ASSERT_NE(preparedModel, nullptr);
+    EXPECT_TRUE(preparedModel->getPreparedModel() == mockPreparedModel);
+    ASSERT_EQ(linkedPreparedModels.size(), 1u);
+    EXPECT_TRUE(linkedPreparedModels[0] == mockPreparedModel);
+
+    ASSERT_TRUE(onDeath != nullptr);
+    onDeath();
+    recoveryEntered.get_future().wait();
+    const auto recoveredPreparedModel = preparedModel->getRecoveredPreparedModel();
+
+    // verify result
+    EXPECT_TRUE(recoveredPreparedModel == recoveredMockPreparedModel);
+    EXPECT_TRUE(device->getDevice() == recoveredMockDevice);
+    ASSERT_EQ(linkedPreparedModels.size(), 2u);
+    EXPECT_TRUE(linkedPreparedModels[1] == recoveredMockPreparedModel);
+}
+
 }  // namespace
 
 TEST(ResilientDeviceTest, invalidDeviceFactory) {
@@ -373,6 +448,16 @@ TEST(ResilientDeviceTest, prepareModelDeadObjectSuccessfulRecovery) {
             << "Failed with " << result.error().code << ": " << result.error().message;
 }
 
+TEST(ResilientDeviceTest, prepareModelDeathNotificationRecovers) {
+    testPreparedModelDeathRecovers(
+            [](const nn::MockDevice& mockDevice) -> auto& {
+                return EXPECT_CALL(mockDevice, prepareModel(_, _, _, _, _, _, _, _, _));
+            },
+            [](const ResilientDevice& device) {
+                return device.prepareModel({}, {}, {}, {}, {}, {}, {}, {}, {});
+            });
+}
+
 TEST(ResilientDeviceTest, prepareModelFromCache) {
     // setup call
     const auto [mockDevice, mockDeviceFactory, device] = setup();
@@ -441,6 +526,16 @@ TEST(ResilientDeviceTest, prepareModelFromCacheDeadObjectSuccessfulRecovery) {
             << "Failed with " << result.error().code << ": " << result.error().message;
 }
 
+TEST(ResilientDeviceTest, prepareModelFromCacheDeathNotificationRecovers) {
+    testPreparedModelDeathRecovers(
+            [](const nn::MockDevice& mockDevice) -> auto& {
+                return EXPECT_CALL(mockDevice, prepareModelFromCache(_, _, _, _));
+            },
+            [](const ResilientDevice& device) {
+                return device.prepareModelFromCache({}, {}, {}, {});
+            });
+}
+
 TEST(ResilientDeviceTest, allocate) {
     // setup call
     const auto [mockDevice, mockDeviceFactory, device] = setup();
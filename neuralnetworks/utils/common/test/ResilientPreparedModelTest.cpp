@@ -18,7 +18,13 @@
 #include <nnapi/TypeUtils.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/ResilientPreparedModel.h>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <utility>
+#include <vector>
 #include "MockPreparedModel.h"
 
 namespace android::hardware::neuralnetworks::utils {
@@ -327,4 +333,122 @@ TEST(ResilientPreparedModelTest, someoneElseRecovered) {
     EXPECT_TRUE(result.value() == recoveredMockPreparedModel);
 }
 
+TEST(ResilientPreparedModelTest, concurrentRecoveryPreparesOnce) {
+    // setup call
+    const auto [mockPreparedModel, mockPreparedModelFactory, preparedModel] = setup();
+    const auto recoveredMockPreparedModel = createConfiguredMockPreparedModel();
+    constexpr size_t kNumCallers = 4;
+    std::mutex mutex;
+    std::condition_variable callerStarted;
+    size_t numCallersStarted = 0;
+    EXPECT_CALL(*mockPreparedModelFactory, Call())
+            .Times(1)
+            .WillOnce(InvokeWithoutArgs([&]() -> nn::GeneralResult<nn::SharedPreparedModel> {
+                // Hold the recovery until every caller is on its way to join it.
+                std::unique_lock lock(mutex);
+                callerStarted.wait(lock, [&] { return numCallersStarted == kNumCallers; });
+                return recoveredMockPreparedModel;
+            }));
+
+    // run test
+    std::vector<std::future<nn::GeneralResult<nn::SharedPreparedModel>>> callers;
+    for (size_t i = 0; i < kNumCallers; ++i) {
+        callers.push_back(std::async(std::launch::async, [&, &preparedModel = preparedModel,
+                                                          &mockPreparedModel = mockPreparedModel] {
+            {
+                std::lock_guard guard(mutex);
+                ++numCallersStarted;
+            }
+            callerStarted.notify_all();
+            return preparedModel->recover(mockPreparedModel.get());
+        }));
+    }
+
+    // verify result
+    for (auto& caller : callers) {
+        const auto result = caller.get();
+        ASSERT_TRUE(result.has_value())
+                << "Failed with " << result.error().code << ": " << result.error().message;
+        EXPECT_TRUE(result.value() == recoveredMockPreparedModel);
+    }
+}
+
+TEST(ResilientPreparedModelTest, recoverAsync) {
+    // setup call
+    const auto [mockPreparedModel, mockPreparedModelFactory, preparedModel] = setup();
+    const auto recoveredMockPreparedModel = createConfiguredMockPreparedModel();
+    EXPECT_CALL(*mockPreparedModel, execute(_, _, _, _, _, _)).Times(0);
+    EXPECT_CALL(*recoveredMockPreparedModel, execute(_, _, _, _, _, _))
+            .Times(1)
+            .WillOnce(Return(kNoExecutionError));
+    std::promise<void> releaseFactory;
+    auto releaseFuture = releaseFactory.get_future().share();
+    std::promise<void> factoryEntered;
+    EXPECT_CALL(*mockPreparedModelFactory, Call())
+            .Times(1)
+            .WillOnce(InvokeWithoutArgs([&factoryEntered, releaseFuture,
+                                         &recoveredMockPreparedModel]()
+                                                -> nn::GeneralResult<nn::SharedPreparedModel> {
+                factoryEntered.set_value();
+                releaseFuture.wait();
+                return recoveredMockPreparedModel;
+            }));
+
+    // run test
+    preparedModel->recoverAsync(mockPreparedModel.get());
+    factoryEntered.get_future().wait();
+    auto execution = std::async(std::launch::async, [&preparedModel = preparedModel] {
+        return preparedModel->execute({}, {}, {}, {}, {}, {});
+    });
+    releaseFactory.set_value();
+    const auto result = execution.get();
+
+    // verify result
+    ASSERT_TRUE(result.has_value())
+            << "Failed with " << result.error().code << ": " << result.error().message;
+    EXPECT_TRUE(preparedModel->getPreparedModel() == recoveredMockPreparedModel);
+}
+
+TEST(ResilientPreparedModelTest, deathNotificationRecovers) {
+    // setup call
+    const auto mockPreparedModel = createConfiguredMockPreparedModel();
+    const auto recoveredMockPreparedModel = createConfiguredMockPreparedModel();
+    std::promise<void> factoryEntered;
+    MockPreparedModelFactory mockPreparedModelFactory;
+    EXPECT_CALL(mockPreparedModelFactory, Call())
+            .Times(2)
+            .WillOnce(Return(mockPreparedModel))
+            .WillOnce(InvokeWithoutArgs(
+                    [&factoryEntered,
+                     &recoveredMockPreparedModel]() -> nn::GeneralResult<nn::SharedPreparedModel> {
+                        factoryEntered.set_value();
+                        return recoveredMockPreparedModel;
+                    }));
+    std::vector<nn::SharedPreparedModel> linkedPreparedModels;
+    std::function<void()> onDeath;
+    const auto notifyOnDeath = [&linkedPreparedModels, &onDeath](
+                                       const nn::SharedPreparedModel& preparedModel,
+                                       std::function<void()> callback)
+            -> nn::GeneralResult<std::shared_ptr<void>> {
+        linkedPreparedModels.push_back(preparedModel);
+        onDeath = std::move(callback);
+        return std::make_shared<FakeResource>();
+    };
+    const auto preparedModel =
+            ResilientPreparedModel::create(mockPreparedModelFactory.AsStdFunction(), notifyOnDeath)
+                    .value();
+    ASSERT_EQ(linkedPreparedModels.size(), 1u);
+    EXPECT_TRUE(linkedPreparedModels[0] == mockPreparedModel);
+
+    // run test
+    onDeath();
+    factoryEntered.get_future().wait();
+    const auto result = preparedModel->getRecoveredPreparedModel();
+
+    // verify result
+    EXPECT_TRUE(result == recoveredMockPreparedModel);
+    ASSERT_EQ(linkedPreparedModels.size(), 2u);
+    EXPECT_TRUE(linkedPreparedModels[1] == recoveredMockPreparedModel);
+}
+
 }  // namespace android::hardware::neuralnetworks::utils
@@ -15,6 +15,7 @@
  */
 
 #include "sensors-impl/Sensor.h"
+#include "sensors-impl/SensorScheduler.h"
 
 #include "utils/SystemClock.h"
 
@@ -32,19 +33,11 @@ static constexpr int32_t kDefaultMaxDelayUs = 10 * 1000 * 1000;
 Sensor::Sensor(ISensorsEventCallback* callback)
     : mIsEnabled(false),
       mSamplingPeriodNs(0),
-      mLastSampleTimeNs(0),
       mCallback(callback),
-      mMode(OperationMode::NORMAL) {
-    mRunThread = std::thread(startThread, this);
-}
+      mMode(OperationMode::NORMAL) {}
 
 Sensor::~Sensor() {
-    std::unique_lock<std::mutex> lock(mRunMutex);
-    mStopThread = true;
-    mIsEnabled = false;
-    mWaitCV.notify_all();
-    lock.release();
-    mRunThread.join();
+    SensorScheduler::getInstance().cancel(this);
 }
 
 const SensorInfo& Sensor::getSensorInfo() const {
@@ -60,16 +53,15 @@ void Sensor::batch(int64_t samplingPeriodNs) {
 
     if (mSamplingPeriodNs != samplingPeriodNs) {
         mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+        // The new period applies from the last sample, which may make the next one due now
+        updateSchedule();
     }
 }
 
 void Sensor::activate(bool enable) {
     if (mIsEnabled != enable) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
         mIsEnabled = enable;
-        mWaitCV.notify_all();
+        updateSchedule();
     }
 }
 
@@ -97,33 +89,14 @@ ScopedAStatus Sensor::flush() {
     return ScopedAStatus::ok();
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
-}
-
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
-
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_BOOTTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            }
-
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
-        }
+void Sensor::updateSchedule() {
+    if (mIsEnabled && mMode == OperationMode::NORMAL) {
+        // A sensor enabled before its first batch() samples at the slowest rate
+        int64_t samplingPeriodNs =
+                mSamplingPeriodNs > 0 ? mSamplingPeriodNs : kDefaultMaxDelayUs * 1000LL;
+        SensorScheduler::getInstance().schedule(this, samplingPeriodNs);
+    } else {
+        SensorScheduler::getInstance().cancel(this);
     }
 }
 
@@ -145,9 +118,8 @@ std::vector<Event> Sensor::readEvents() {
 
 void Sensor::setOperationMode(OperationMode mode) {
     if (mMode != mode) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
         mMode = mode;
-        mWaitCV.notify_all();
+        updateSchedule();
     }
 }
 
@@ -54,23 +54,19 @@ class Sensor {
     ndk::ScopedAStatus injectEvent(const Event& event);
 
   protected:
-    void run();
+    friend class SensorScheduler;
+
     virtual std::vector<Event> readEvents();
     virtual void readEventPayload(EventPayload&) = 0;
-    static void startThread(Sensor* sensor);
+    // Sample the sensor from the SensorScheduler while it is enabled in NORMAL mode
+    void updateSchedule();
 
     bool isWakeUpSensor();
 
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
-    int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
-    std::mutex mRunMutex;
-    std::thread mRunThread;
-
     ISensorsEventCallback* mCallback;
 
     OperationMode mMode;
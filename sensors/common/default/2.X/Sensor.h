@@ -20,10 +20,8 @@
 #include <android/hardware/sensors/1.0/types.h>
 #include <android/hardware/sensors/2.1/types.h>
 
-#include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 namespace android {
@@ -64,23 +62,19 @@ class Sensor {
     Result injectEvent(const Event& event);
 
   protected:
-    void run();
+    friend class SensorScheduler;
+
     virtual std::vector<Event> readEvents();
     virtual void readEventPayload(EventPayload&) {}
-    static void startThread(Sensor* sensor);
+    // Sample the sensor from the SensorScheduler while it is enabled in NORMAL mode
+    void updateSchedule();
 
     bool isWakeUpSensor();
 
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
-    int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
-    std::mutex mRunMutex;
-    std::thread mRunThread;
-
     ISensorsEventCallback* mCallback;
 
     OperationMode mMode;
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorScheduler"
+
+#include "SensorScheduler.h"
+
+#include "Sensor.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_X {
+namespace implementation {
+
+using ::android::hardware::sensors::V2_1::Event;
+
+SensorScheduler& SensorScheduler::getInstance() {
+    // Never destroyed, so sensors may be torn down in any order at exit
+    static SensorScheduler* scheduler = new SensorScheduler();
+    return *scheduler;
+}
+
+SensorScheduler::SensorScheduler() {
+    mTimerFd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(mTimerFd < 0, "Failed to create the sampling timer: %d", errno);
+    mWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(mWakeFd < 0, "Failed to create the wake eventfd: %d", errno);
+    mThread = std::thread(&SensorScheduler::threadLoop, this);
+}
+
+void SensorScheduler::schedule(Sensor* sensor, int64_t samplingPeriodNs) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        int64_t now = ::android::elapsedRealtimeNano();
+        int64_t deadlineNs = now;
+        int64_t lastSampleTimeNs = 0;
+        auto entry = mEntries.find(sensor);
+        if (entry != mEntries.end()) {
+            // A new rate applies from the last sample
+            mQueue.erase({entry->second.deadlineNs, sensor});
+            lastSampleTimeNs = entry->second.lastSampleTimeNs;
+            deadlineNs = std::max(now, lastSampleTimeNs + samplingPeriodNs);
+        }
+        mEntries[sensor] = {samplingPeriodNs, deadlineNs, lastSampleTimeNs};
+        mQueue.emplace(deadlineNs, sensor);
+    }
+    wake();
+}
+
+void SensorScheduler::cancel(Sensor* sensor) {
+    // Sensors are sampled with mLock held, so taking it waits for a pass in progress
+    std::lock_guard<std::mutex> lock(mLock);
+    auto entry = mEntries.find(sensor);
+    if (entry != mEntries.end()) {
+        mQueue.erase({entry->second.deadlineNs, sensor});
+        mEntries.erase(entry);
+    }
+}
+
+void SensorScheduler::threadLoop() {
+    pollfd fds[] = {{mTimerFd, POLLIN, 0}, {mWakeFd, POLLIN, 0}};
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            sampleDueSensorsLocked(::android::elapsedRealtimeNano());
+            armTimerLocked();
+        }
+
+        if (poll(fds, 2, -1 /* timeout */) < 0) {
+            if (errno != EINTR) {
+                ALOGE("Failed to wait for the sampling timer: %d", errno);
+            }
+            continue;
+        }
+        uint64_t count;
+        if (fds[0].revents & POLLIN) {
+            (void)read(mTimerFd, &count, sizeof(count));
+        }
+        if (fds[1].revents & POLLIN) {
+            (void)read(mWakeFd, &count, sizeof(count));
+        }
+    }
+}
+
+void SensorScheduler::sampleDueSensorsLocked(int64_t now) {
+    std::vector<Sensor*> dueSensors;
+    while (!mQueue.empty() && mQueue.begin()->first <= now + kSamplingToleranceNs) {
+        dueSensors.push_back(mQueue.begin()->second);
+        mQueue.erase(mQueue.begin());
+    }
+    if (dueSensors.empty()) {
+        return;
+    }
+
+    // Events of the pass, by callback and wake-up flag
+    std::map<std::pair<ISensorsEventCallback*, bool>, std::vector<Event>> batches;
+    for (Sensor* sensor : dueSensors) {
+        std::vector<Event> events = sensor->readEvents();
+        if (!events.empty()) {
+            std::vector<Event>& batch = batches[{sensor->mCallback, sensor->isWakeUpSensor()}];
+            batch.insert(batch.end(), events.begin(), events.end());
+        }
+
+        Entry& entry = mEntries[sensor];
+        entry.lastSampleTimeNs = now;
+        entry.deadlineNs += entry.samplingPeriodNs;
+        if (entry.deadlineNs <= now) {
+            // Skip the periods missed while the thread was late or the device suspended
+            entry.deadlineNs = now + entry.samplingPeriodNs;
+        }
+        mQueue.emplace(entry.deadlineNs, sensor);
+    }
+
+    for (const auto& [target, events] : batches) {
+        target.first->postEvents(events, target.second);
+    }
+}
+
+void SensorScheduler::armTimerLocked() {
+    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
+
+    // A zero it_value disarms the timer when no sensor is enabled
+    itimerspec spec = {};
+    if (!mQueue.empty()) {
+        int64_t deadlineNs = mQueue.begin()->first;
+        spec.it_value.tv_sec = deadlineNs / kNanosecondsInSeconds;
+        spec.it_value.tv_nsec = deadlineNs % kNanosecondsInSeconds;
+    }
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        ALOGE("Failed to arm the sampling timer: %d", errno);
+    }
+}
+
+void SensorScheduler::wake() {
+    uint64_t one = 1;
+    (void)write(mWakeFd, &one, sizeof(one));
+}
+
+}  // namespace implementation
+}  // namespace V2_X
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_X_SENSORSCHEDULER_H
+#define ANDROID_HARDWARE_SENSORS_V2_X_SENSORSCHEDULER_H
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_X {
+namespace implementation {
+
+class Sensor;
+
+/**
+ * Samples all the enabled sensors of the process from a single thread.
+ *
+ * Each sensor is queued with the absolute CLOCK_BOOTTIME deadline of its next sample, which
+ * advances by whole sampling periods so the rate does not drift with wake-up latency. The
+ * thread sleeps on one CLOCK_BOOTTIME timer armed for the earliest deadline, and the sensors
+ * due within kSamplingToleranceNs of it are sampled in the same pass, their events posted as
+ * one vector per callback.
+ */
+class SensorScheduler {
+  public:
+    static constexpr int64_t kSamplingToleranceNs = 1000 * 1000;
+
+    static SensorScheduler& getInstance();
+
+    /**
+     * Sample the sensor every samplingPeriodNs, replacing its previous schedule. A sensor that
+     * was not scheduled is sampled right away.
+     */
+    void schedule(Sensor* sensor, int64_t samplingPeriodNs);
+
+    // Stop sampling the sensor and wait for a pass sampling it to return
+    void cancel(Sensor* sensor);
+
+  private:
+    struct Entry {
+        int64_t samplingPeriodNs;
+        int64_t deadlineNs;
+        int64_t lastSampleTimeNs;
+    };
+
+    SensorScheduler();
+
+    void threadLoop();
+    void sampleDueSensorsLocked(int64_t now);
+    void armTimerLocked();
+    void wake();
+
+    std::mutex mLock;
+    std::set<std::pair<int64_t, Sensor*>> mQueue;
+    std::map<Sensor*, Entry> mEntries;
+
+    int mTimerFd;
+    // Signaled when the queue changes so the thread re-arms the timer
+    int mWakeFd;
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_X
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_X_SENSORSCHEDULER_H
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "android.hardware.tv.tuner-service.example-AvBufferPool"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <BufferAllocator/BufferAllocator.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+
+#include "AvBufferPool.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+namespace {
+
+class DmaBufAvBufferAllocator : public AvBufferAllocator {
+  public:
+    int allocate(size_t size) override {
+        // Created on the first allocation as most filters never carry media
+        if (mAllocator == nullptr) {
+            mAllocator = std::make_unique<BufferAllocator>();
+        }
+        return mAllocator->Alloc("system-uncached", size);
+    }
+
+  private:
+    std::unique_ptr<BufferAllocator> mAllocator;
+};
+
+}  // namespace
+
+AvBufferPool::AvBufferPool(std::unique_ptr<AvBufferAllocator> allocator)
+    : mAllocator(allocator != nullptr ? std::move(allocator)
+                                      : std::make_unique<DmaBufAvBufferAllocator>()) {
+    mBuffers.reserve(MAX_POOLED_BUFFERS);
+}
+
+AvBufferPool::~AvBufferPool() {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (Buffer& buffer : mBuffers) {
+        freeLocked(&buffer);
+    }
+    for (Buffer& buffer : mOverflowBuffers) {
+        freeLocked(&buffer);
+    }
+}
+
+void AvBufferPool::preallocate(size_t count, size_t size) {
+    std::lock_guard<std::mutex> lock(mLock);
+    count = std::min(count, MAX_POOLED_BUFFERS);
+    while (mBuffers.size() < count) {
+        Buffer buffer;
+        if (!allocateLocked(size, &buffer)) {
+            return;
+        }
+        mBuffers.push_back(buffer);
+    }
+}
+
+const native_handle_t* AvBufferPool::write(uint64_t dataId, const void* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Buffer* buffer = acquireLocked(size);
+    if (buffer == nullptr) {
+        Buffer overflow;
+        if (!allocateLocked(size, &overflow)) {
+            return nullptr;
+        }
+        mStats.overflowAllocations++;
+        mOverflowBuffers.push_back(overflow);
+        buffer = &mOverflowBuffers.back();
+    }
+
+    if (size > 0) {
+        memcpy(buffer->data, data, size);
+    }
+    buffer->dataId = dataId;
+    buffer->inUse = true;
+    mStats.buffersInUse++;
+    mStats.peakBuffersInUse = std::max(mStats.peakBuffersInUse, mStats.buffersInUse);
+    return buffer->handle;
+}
+
+bool AvBufferPool::release(uint64_t dataId) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (Buffer& buffer : mBuffers) {
+        if (buffer.inUse && buffer.dataId == dataId) {
+            buffer.inUse = false;
+            mStats.buffersInUse--;
+            return true;
+        }
+    }
+    for (auto it = mOverflowBuffers.begin(); it != mOverflowBuffers.end(); it++) {
+        if (it->dataId == dataId) {
+            freeLocked(&*it);
+            mOverflowBuffers.erase(it);
+            mStats.buffersInUse--;
+            return true;
+        }
+    }
+    return false;
+}
+
+AvBufferPool::Stats AvBufferPool::getStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    Stats stats = mStats;
+    stats.pooledBuffers = mBuffers.size();
+    stats.pooledBytes = 0;
+    for (const Buffer& buffer : mBuffers) {
+        stats.pooledBytes += buffer.size;
+    }
+    return stats;
+}
+
+AvBufferPool::Buffer* AvBufferPool::acquireLocked(size_t size) {
+    // Prefer the smallest free buffer that fits, then the largest one to grow
+    Buffer* fit = nullptr;
+    Buffer* largest = nullptr;
+    for (Buffer& buffer : mBuffers) {
+        if (buffer.inUse) {
+            continue;
+        }
+        if (buffer.size >= size && (fit == nullptr || buffer.size < fit->size)) {
+            fit = &buffer;
+        }
+        if (largest == nullptr || buffer.size > largest->size) {
+            largest = &buffer;
+        }
+    }
+    if (fit != nullptr) {
+        mStats.reuses++;
+        return fit;
+    }
+
+    if (mBuffers.size() < MAX_POOLED_BUFFERS) {
+        Buffer buffer;
+        if (!allocateLocked(size, &buffer)) {
+            return nullptr;
+        }
+        mBuffers.push_back(buffer);
+        return &mBuffers.back();
+    }
+
+    if (largest != nullptr) {
+        Buffer buffer;
+        if (!allocateLocked(size, &buffer)) {
+            return nullptr;
+        }
+        freeLocked(largest);
+        *largest = buffer;
+        mStats.reallocations++;
+        return largest;
+    }
+    return nullptr;
+}
+
+bool AvBufferPool::allocateLocked(size_t size, Buffer* buffer) {
+    size = std::max(size, MIN_BUFFER_SIZE);
+    int fd = mAllocator->allocate(size);
+    if (fd < 0) {
+        ALOGE("[AvBufferPool] Failed to allocate %zu bytes: %d", size, fd);
+        mStats.allocationFailures++;
+        return false;
+    }
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 /*offset*/);
+    if (data == MAP_FAILED) {
+        ALOGE("[AvBufferPool] Failed to map %zu bytes: %d", size, errno);
+        ::close(fd);
+        mStats.allocationFailures++;
+        return false;
+    }
+    native_handle_t* handle = native_handle_create(/*numFd*/ 1, 0);
+    if (handle == nullptr) {
+        ALOGE("[AvBufferPool] Failed to create native_handle %d", errno);
+        munmap(data, size);
+        ::close(fd);
+        mStats.allocationFailures++;
+        return false;
+    }
+    handle->data[0] = fd;
+
+    buffer->fd = fd;
+    buffer->data = static_cast<uint8_t*>(data);
+    buffer->size = size;
+    buffer->handle = handle;
+    buffer->inUse = false;
+    return true;
+}
+
+void AvBufferPool::freeLocked(Buffer* buffer) {
+    if (buffer->data != nullptr) {
+        munmap(buffer->data, buffer->size);
+    }
+    if (buffer->handle != nullptr) {
+        // Closes the buffer fd
+        native_handle_close(buffer->handle);
+        native_handle_delete(buffer->handle);
+    }
+    *buffer = Buffer();
+}
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
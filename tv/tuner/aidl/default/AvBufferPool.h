@@ -0,0 +1,112 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cutils/native_handle.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+// Allocates the buffers of an AvBufferPool
+class AvBufferAllocator {
+  public:
+    virtual ~AvBufferAllocator() = default;
+
+    // Return the fd of a new mappable buffer of size bytes, or a negative errno
+    virtual int allocate(size_t size) = 0;
+};
+
+/**
+ * DMA-BUFs handed to the client with the media events of a filter.
+ *
+ * Up to MAX_POOLED_BUFFERS buffers are kept allocated and mapped, each with the native handle
+ * sent to the client. A buffer goes back to the free list when the client releases its data
+ * id, so steady playback reuses the same buffers instead of allocating and mapping one per
+ * access unit. When the client holds every pooled buffer, one-off buffers are allocated and
+ * freed on release; their count tells how short the pool is.
+ */
+class AvBufferPool {
+  public:
+    static constexpr size_t MAX_POOLED_BUFFERS = 16;
+    static constexpr size_t MIN_BUFFER_SIZE = 1 << 20;
+
+    struct Stats {
+        size_t pooledBuffers = 0;
+        size_t pooledBytes = 0;
+        size_t buffersInUse = 0;
+        size_t peakBuffersInUse = 0;
+        uint64_t reuses = 0;
+        // Pooled buffers allocated again because they were too small
+        uint64_t reallocations = 0;
+        // One-off buffers allocated while every pooled buffer was in use
+        uint64_t overflowAllocations = 0;
+        uint64_t allocationFailures = 0;
+    };
+
+    // Allocate from the system DMA-BUF heap by default
+    explicit AvBufferPool(std::unique_ptr<AvBufferAllocator> allocator = nullptr);
+    ~AvBufferPool();
+
+    // Allocate and map buffers ahead of the first media event
+    void preallocate(size_t count, size_t size);
+
+    /**
+     * Copy size bytes of data into a free buffer held for dataId until release(dataId).
+     * Return the native handle of the buffer, owned by the pool, or nullptr if no buffer
+     * could be allocated.
+     */
+    const native_handle_t* write(uint64_t dataId, const void* data, size_t size);
+
+    // Return false if no buffer is held for dataId
+    bool release(uint64_t dataId);
+
+    Stats getStats();
+
+  private:
+    struct Buffer {
+        int fd = -1;
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        native_handle_t* handle = nullptr;
+        uint64_t dataId = 0;
+        bool inUse = false;
+    };
+
+    bool allocateLocked(size_t size, Buffer* buffer);
+    void freeLocked(Buffer* buffer);
+    // Find a free pooled buffer for size bytes, allocating one if the pool isn't full
+    Buffer* acquireLocked(size_t size);
+
+    std::mutex mLock;
+    std::unique_ptr<AvBufferAllocator> mAllocator;
+    std::vector<Buffer> mBuffers;
+    std::vector<Buffer> mOverflowBuffers;
+    Stats mStats;
+};
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
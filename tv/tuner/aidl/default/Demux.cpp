@@ -31,7 +31,8 @@ namespace tuner {
 
 #define WAIT_TIMEOUT 3000000000
 
-Demux::Demux(int32_t demuxId, std::shared_ptr<Tuner> tuner) {
+Demux::Demux(int32_t demuxId, std::shared_ptr<Tuner> tuner)
+    : mFilterEventDispatcher(std::make_shared<FilterEventDispatcher>()) {
     mDemuxId = demuxId;
     mTuner = tuner;
 }
@@ -83,6 +84,7 @@ Demux::~Demux() {
     }
 
     mFilters[filterId] = filter;
+    invalidatePidTable();
     if (filter->isPcrFilter()) {
         mPcrFilterIds.insert(filterId);
     }
@@ -179,6 +181,7 @@ Demux::~Demux() {
     mPlaybackFilterIds.clear();
     mRecordFilterIds.clear();
     mFilters.clear();
+    invalidatePidTable();
     mLastUsedFilterId = -1;
     mTuner->removeDemux(mDemuxId);
 
@@ -263,41 +266,71 @@ Demux::~Demux() {
     mPlaybackFilterIds.erase(filterId);
     mRecordFilterIds.erase(filterId);
     mFilters.erase(filterId);
+    invalidatePidTable();
 
     return ::ndk::ScopedAStatus::ok();
 }
 
-void Demux::startBroadcastTsFilter(vector<int8_t> data) {
-    set<int64_t>::iterator it;
-    uint16_t pid = ((data[1] & 0x1f) << 8) | ((data[2] & 0xff));
-    if (DEBUG_DEMUX) {
-        ALOGW("[Demux] start ts filter pid: %d", pid);
+void Demux::invalidatePidTable() {
+    mPidTableDirty = true;
+}
+
+void Demux::mayRebuildPidTablesLocked() {
+    if (!mPidTableDirty.exchange(false)) {
+        return;
     }
-    for (it = mPlaybackFilterIds.begin(); it != mPlaybackFilterIds.end(); it++) {
-        if (pid == mFilters[*it]->getTpid()) {
-            mFilters[*it]->updateFilterOutput(data);
+    vector<TsPidTable<Filter>::Entry> entries;
+    for (int64_t filterId : mPlaybackFilterIds) {
+        auto filter = mFilters.find(filterId);
+        if (filter != mFilters.end() && filter->second != nullptr) {
+            entries.emplace_back(filter->second->getTpid(), filter->second);
+        }
+    }
+    mPidTable.rebuild(entries);
+
+    entries.clear();
+    for (int64_t filterId : mRecordFilterIds) {
+        auto filter = mFilters.find(filterId);
+        if (filter != mFilters.end() && filter->second != nullptr) {
+            entries.emplace_back(filter->second->getTpid(), filter->second);
         }
     }
+    mRecordPidTable.rebuild(entries);
 }
 
-void Demux::sendFrontendInputToRecord(vector<int8_t> data) {
-    set<int64_t>::iterator it;
+void Demux::startBroadcastTsFilter(const int8_t* data, size_t size, size_t packetSize) {
+    lock_guard<mutex> lock(mPidTableLock);
+    mayRebuildPidTablesLocked();
+
+    if (DEBUG_DEMUX) {
+        ALOGW("[Demux] start ts filter on %zu bytes", size);
+    }
+    mPidTable.dispatch(data, size, packetSize,
+                       [](Filter& filter, const int8_t* packets, size_t packetsSize) {
+                           filter.updateFilterOutput(packets, packetsSize);
+                       });
+}
+
+void Demux::sendFrontendInputToRecord(const int8_t* data, size_t size, size_t packetSize) {
     if (DEBUG_DEMUX) {
         ALOGW("[Demux] update record filter output");
     }
-    for (it = mRecordFilterIds.begin(); it != mRecordFilterIds.end(); it++) {
-        mFilters[*it]->updateRecordOutput(data);
+    if (mDvrRecord == nullptr) {
+        return;
     }
+    lock_guard<mutex> lock(mPidTableLock);
+    mayRebuildPidTablesLocked();
+    mDvrRecord->writeRecordPackets(data, size, packetSize, mRecordPidTable);
 }
 
-void Demux::sendFrontendInputToRecord(vector<int8_t> data, uint16_t pid, uint64_t pts) {
-    sendFrontendInputToRecord(data);
-    set<int64_t>::iterator it;
-    for (it = mRecordFilterIds.begin(); it != mRecordFilterIds.end(); it++) {
-        if (pid == mFilters[*it]->getTpid()) {
-            mFilters[*it]->updatePts(pts);
-        }
+void Demux::sendFrontendInputToRecord(const vector<int8_t>& data, uint16_t pid, uint64_t pts) {
+    if (mDvrRecord == nullptr) {
+        return;
     }
+    lock_guard<mutex> lock(mPidTableLock);
+    mayRebuildPidTablesLocked();
+    mRecordPidTable.forEachFilter(pid, [&](Filter& filter) { filter.updatePts(pts); });
+    mDvrRecord->writeRecordFrame(data.data(), data.size(), pid, mRecordPidTable);
 }
 
 bool Demux::startBroadcastFilterDispatcher() {
@@ -313,16 +346,23 @@ bool Demux::startBroadcastFilterDispatcher() {
     return true;
 }
 
-bool Demux::startRecordFilterDispatcher() {
-    set<int64_t>::iterator it;
+std::shared_ptr<FilterEventDispatcher> Demux::getFilterEventDispatcher() {
+    return mFilterEventDispatcher;
+}
 
-    for (it = mRecordFilterIds.begin(); it != mRecordFilterIds.end(); it++) {
-        if (!mFilters[*it]->startRecordFilterHandler().isOk()) {
-            return false;
-        }
+void Demux::beginStopInput() {
+    ++mStoppingInputs;
+    for (auto& filter : mFilters) {
+        filter.second->wakeFilterWriter();
     }
+}
 
-    return true;
+void Demux::endStopInput() {
+    --mStoppingInputs;
+}
+
+bool Demux::isInputStopping() {
+    return mStoppingInputs > 0;
 }
 
 ::ndk::ScopedAStatus Demux::startFilterHandler(int64_t filterId) {
@@ -398,7 +438,9 @@ void Demux::stopFrontendInput() {
     mKeepFetchingDataFromFrontend = false;
     mFrontendInputThreadRunning = false;
     if (mFrontendInputThread.joinable()) {
+        beginStopInput();
         mFrontendInputThread.join();
+        endStopInput();
     }
 }
 
@@ -449,6 +491,7 @@ bool Demux::attachRecordFilter(int64_t filterId) {
 
     mRecordFilterIds.insert(filterId);
     mFilters[filterId]->attachFilterToRecord(mDvrRecord);
+    invalidatePidTable();
 
     return true;
 }
@@ -460,6 +503,7 @@ bool Demux::detachRecordFilter(int64_t filterId) {
 
     mRecordFilterIds.erase(filterId);
     mFilters[filterId]->detachFilterFromRecord();
+    invalidatePidTable();
 
     return true;
 }
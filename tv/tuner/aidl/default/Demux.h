@@ -28,6 +28,7 @@
 #include "Filter.h"
 #include "Frontend.h"
 #include "TimeFilter.h"
+#include "TsPidTable.h"
 #include "Tuner.h"
 
 using namespace std;
@@ -47,6 +48,7 @@ using FilterMQ = AidlMessageQueue<int8_t, SynchronizedReadWrite>;
 
 class Dvr;
 class Filter;
+class FilterEventDispatcher;
 class Frontend;
 class TimeFilter;
 class Tuner;
@@ -92,11 +94,25 @@ class Demux : public BnDemux {
      * Note that recording filters are not included.
      */
     bool startBroadcastFilterDispatcher();
-    void startBroadcastTsFilter(vector<int8_t> data);
-
-    void sendFrontendInputToRecord(vector<int8_t> data);
-    void sendFrontendInputToRecord(vector<int8_t> data, uint16_t pid, uint64_t pts);
-    bool startRecordFilterDispatcher();
+    // Hand the whole packets in data, read in place from the playback FMQ, to the playback
+    // filters on their PIDs.
+    void startBroadcastTsFilter(const int8_t* data, size_t size, size_t packetSize);
+    // Called when a filter is added or removed or its PID changes
+    void invalidatePidTable();
+
+    // Record the whole packets in data on the PIDs of the record filters
+    void sendFrontendInputToRecord(const int8_t* data, size_t size, size_t packetSize);
+    // Record an ES frame of the record filters on the PID
+    void sendFrontendInputToRecord(const vector<int8_t>& data, uint16_t pid, uint64_t pts);
+    // Sends the events of all the filters of the demux
+    std::shared_ptr<FilterEventDispatcher> getFilterEventDispatcher();
+    /**
+     * Bracket the join of a thread that feeds the filters. In between, the filters drop data
+     * instead of waiting for room in a filter FMQ the client may no longer read.
+     */
+    void beginStopInput();
+    void endStopInput();
+    bool isInputStopping();
 
   private:
     // Tuner service
@@ -123,6 +139,8 @@ class Demux : public BnDemux {
      */
     void deleteEventFlag();
     bool readDataFromMQ();
+    // mPidTableLock needs to be held to call this function
+    void mayRebuildPidTablesLocked();
 
     int32_t mDemuxId = -1;
     int32_t mCiCamId;
@@ -148,6 +166,20 @@ class Demux : public BnDemux {
      */
     std::map<int64_t, std::shared_ptr<Filter>> mFilters;
 
+    /**
+     * The playback and record filters by PID, rebuilt on the next dispatch after
+     * invalidatePidTable().
+     */
+    TsPidTable<Filter> mPidTable;
+    TsPidTable<Filter> mRecordPidTable;
+    std::atomic<bool> mPidTableDirty{true};
+    std::mutex mPidTableLock;
+
+    const std::shared_ptr<FilterEventDispatcher> mFilterEventDispatcher;
+
+    // Number of input threads being stopped
+    std::atomic<int> mStoppingInputs{0};
+
     /**
      * Local reference to the opened Timer Filter instance.
      */
@@ -116,6 +116,7 @@ Dvr::~Dvr() {
         mDvrThread = std::thread(&Dvr::playbackThreadLoop, this);
     } else if (mType == DvrType::RECORD) {
         mRecordStatus = RecordStatus::DATA_READY;
+        mRecordedBytes = 0;
         mDemux->setIsRecording(mType == DvrType::RECORD);
     }
 
@@ -129,7 +130,9 @@ Dvr::~Dvr() {
 
     mDvrThreadRunning = false;
     if (mDvrThread.joinable()) {
+        mDemux->beginStopInput();
         mDvrThread.join();
+        mDemux->endStopInput();
     }
     // thread should always be joinable if it is running,
     // so it should be safe to assume recording stopped.
@@ -258,28 +261,55 @@ PlaybackStatus Dvr::checkPlaybackStatusChange(uint32_t availableToWrite, uint32_
 }
 
 bool Dvr::readPlaybackFMQ(bool isVirtualFrontend, bool isRecording) {
-    // Read playback data from the input FMQ
-    size_t size = mDvrMQ->availableToRead();
-    int64_t playbackPacketSize = mDvrSettings.get<DvrSettings::Tag::playback>().packetSize;
-    vector<int8_t> dataOutputBuffer;
-    dataOutputBuffer.resize(playbackPacketSize);
-    // Dispatch the packet to the PID matching filter output buffer
-    for (int i = 0; i < size / playbackPacketSize; i++) {
-        if (!mDvrMQ->read(dataOutputBuffer.data(), playbackPacketSize)) {
-            return false;
-        }
-        if (isVirtualFrontend) {
-            if (isRecording) {
-                mDemux->sendFrontendInputToRecord(dataOutputBuffer);
-            } else {
-                mDemux->startBroadcastTsFilter(dataOutputBuffer);
-            }
-        } else {
-            startTpidFilter(dataOutputBuffer);
-        }
+    // Dispatch every whole packet in the playback FMQ straight from the queue memory
+    int64_t packetSize = mDvrSettings.get<DvrSettings::Tag::playback>().packetSize;
+    if (packetSize <= 0) {
+        ALOGE("[Dvr] invalid playback packet size %" PRId64, packetSize);
+        return false;
+    }
+    size_t size = mDvrMQ->availableToRead() / packetSize * packetSize;
+    if (size == 0) {
+        return true;
     }
 
-    return true;
+    DvrMQ::MemTransaction tx;
+    if (!mDvrMQ->beginRead(size, &tx)) {
+        return false;
+    }
+    const int8_t* first = tx.getFirstRegion().getAddress();
+    size_t firstSize = tx.getFirstRegion().getLength();
+    const int8_t* second = tx.getSecondRegion().getAddress();
+    size_t secondSize = tx.getSecondRegion().getLength();
+
+    // A packet split by the end of the ring is reassembled in mWrappedPacket
+    size_t wrappedHead = firstSize % packetSize;
+    dispatchPlaybackData(first, firstSize - wrappedHead, packetSize, isVirtualFrontend,
+                         isRecording);
+    if (wrappedHead > 0) {
+        size_t wrappedTail = packetSize - wrappedHead;
+        mWrappedPacket.resize(packetSize);
+        memcpy(mWrappedPacket.data(), first + firstSize - wrappedHead, wrappedHead);
+        memcpy(mWrappedPacket.data() + wrappedHead, second, wrappedTail);
+        dispatchPlaybackData(mWrappedPacket.data(), packetSize, packetSize, isVirtualFrontend,
+                             isRecording);
+        second += wrappedTail;
+        secondSize -= wrappedTail;
+    }
+    if (secondSize > 0) {
+        dispatchPlaybackData(second, secondSize, packetSize, isVirtualFrontend, isRecording);
+    }
+
+    return mDvrMQ->commitRead(size);
+}
+
+void Dvr::dispatchPlaybackData(const int8_t* data, size_t size, size_t packetSize,
+                               bool isVirtualFrontend, bool isRecording) {
+    if (isVirtualFrontend && isRecording) {
+        mDemux->sendFrontendInputToRecord(data, size, packetSize);
+    } else {
+        // Without a virtual frontend the playback filters of the DVR are the demux ones
+        mDemux->startBroadcastTsFilter(data, size, packetSize);
+    }
 }
 
 bool Dvr::processEsDataOnPlayback(bool isVirtualFrontend, bool isRecording) {
@@ -402,23 +432,11 @@ void Dvr::getMetaDataValue(int& index, int8_t* dataOutputBuffer, int& value) {
     }
 }
 
-void Dvr::startTpidFilter(vector<int8_t> data) {
-    map<int64_t, std::shared_ptr<IFilter>>::iterator it;
-    for (it = mFilters.begin(); it != mFilters.end(); it++) {
-        uint16_t pid = ((data[1] & 0x1f) << 8) | ((data[2] & 0xff));
-        if (DEBUG_DVR) {
-            ALOGW("[Dvr] start ts filter pid: %d", pid);
-        }
-        if (pid == mDemux->getFilterTpid(it->first)) {
-            mDemux->updateFilterOutput(it->first, data);
-        }
-    }
-}
-
 bool Dvr::startFilterDispatcher(bool isVirtualFrontend, bool isRecording) {
     if (isVirtualFrontend) {
         if (isRecording) {
-            return mDemux->startRecordFilterDispatcher();
+            // The record data is written into the record FMQ as it is demuxed
+            return true;
         } else {
             return mDemux->startBroadcastFilterDispatcher();
         }
@@ -435,20 +453,107 @@ bool Dvr::startFilterDispatcher(bool isVirtualFrontend, bool isRecording) {
     return true;
 }
 
-bool Dvr::writeRecordFMQ(const vector<int8_t>& data) {
+bool Dvr::writeRecordPackets(const int8_t* data, size_t size, size_t packetSize,
+                             const TsPidTable<Filter>& recordFilters) {
     lock_guard<mutex> lock(mWriteLock);
     if (mRecordStatus == RecordStatus::OVERFLOW) {
         ALOGW("[Dvr] stops writing and wait for the client side flushing.");
         return true;
     }
-    if (mDvrMQ->write(data.data(), data.size())) {
+    if (packetSize < TS_PACKET_SIZE) {
+        return false;
+    }
+
+    // Reserve the free space of the FMQ. Only what is written is committed.
+    size_t space = std::min(size, mDvrMQ->availableToWrite());
+    DvrMQ::MemTransaction tx;
+    if (space > 0 && !mDvrMQ->beginWrite(space, &tx)) {
+        return false;
+    }
+
+    // Consecutive recorded packets are copied in one run
+    size_t written = 0;
+    const int8_t* run = data;
+    size_t runSize = 0;
+    bool overflow = false;
+    const int8_t* end = data + size / packetSize * packetSize;
+    for (const int8_t* packet = data; packet < end; packet += packetSize) {
+        uint16_t pid = TsPidTable<Filter>::getPid(packet);
+        if (!recordFilters.hasFilters(pid)) {
+            continue;
+        }
+        if (written + runSize + packetSize > space) {
+            overflow = true;
+            break;
+        }
+        if (run + runSize != packet) {
+            if (runSize > 0 && !tx.copyTo(run, written, runSize)) {
+                return false;
+            }
+            written += runSize;
+            run = packet;
+            runSize = 0;
+        }
+        int64_t byteNumber = mRecordedBytes + written + runSize;
+        recordFilters.forEachFilter(
+                pid, [&](Filter& filter) { filter.indexRecordPacket(packet, byteNumber); });
+        runSize += packetSize;
+    }
+    if (runSize > 0 && !tx.copyTo(run, written, runSize)) {
+        return false;
+    }
+    written += runSize;
+
+    if (written > 0) {
+        if (!mDvrMQ->commitWrite(written)) {
+            return false;
+        }
+        mRecordedBytes += written;
         mDvrEventFlag->wake(static_cast<uint32_t>(DemuxQueueNotifyBits::DATA_READY));
-        maySendRecordStatusCallback();
+    }
+    recordFilters.forEachFilter([](Filter& filter) { filter.sendRecordEvents(); });
+
+    if (overflow) {
+        setRecordOverflowLocked();
+        return false;
+    }
+    maySendRecordStatusCallback();
+    return true;
+}
+
+bool Dvr::writeRecordFrame(const int8_t* data, size_t size, uint16_t pid,
+                           const TsPidTable<Filter>& recordFilters) {
+    lock_guard<mutex> lock(mWriteLock);
+    if (mRecordStatus == RecordStatus::OVERFLOW) {
+        ALOGW("[Dvr] stops writing and wait for the client side flushing.");
+        return true;
+    }
+    if (!recordFilters.hasFilters(pid)) {
         return true;
     }
+    if (!mDvrMQ->write(data, size)) {
+        setRecordOverflowLocked();
+        return false;
+    }
 
+    int64_t byteNumber = mRecordedBytes;
+    mRecordedBytes += size;
+    mDvrEventFlag->wake(static_cast<uint32_t>(DemuxQueueNotifyBits::DATA_READY));
+    recordFilters.forEachFilter(pid, [&](Filter& filter) {
+        filter.indexRecordFrame(byteNumber);
+        filter.sendRecordEvents();
+    });
     maySendRecordStatusCallback();
-    return false;
+    return true;
+}
+
+void Dvr::setRecordOverflowLocked() {
+    // Data was dropped, the client has to flush the FMQ before recording resumes
+    lock_guard<mutex> lock(mRecordStatusLock);
+    if (mRecordStatus != RecordStatus::OVERFLOW) {
+        mRecordStatus = RecordStatus::OVERFLOW;
+        mCallback->onRecordStatus(mRecordStatus);
+    }
 }
 
 void Dvr::maySendRecordStatusCallback() {
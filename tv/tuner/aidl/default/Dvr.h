@@ -26,6 +26,7 @@
 #include <thread>
 #include "Demux.h"
 #include "Frontend.h"
+#include "TsPidTable.h"
 #include "Tuner.h"
 
 using namespace std;
@@ -79,7 +80,17 @@ class Dvr : public BnDvr {
      * Return false is any of the above processes fails.
      */
     bool createDvrMQ();
-    bool writeRecordFMQ(const std::vector<int8_t>& data);
+    /**
+     * Copy the whole packets of data on the PIDs of the record filters into the record FMQ in
+     * one transaction, and send the index events of the filters for the packets written.
+     *
+     * Return false if the packets didn't all fit.
+     */
+    bool writeRecordPackets(const int8_t* data, size_t size, size_t packetSize,
+                            const TsPidTable<Filter>& recordFilters);
+    // Write an ES frame of the record filters on the PID into the record FMQ
+    bool writeRecordFrame(const int8_t* data, size_t size, uint16_t pid,
+                          const TsPidTable<Filter>& recordFilters);
     bool addPlaybackFilter(int64_t filterId, std::shared_ptr<IFilter> filter);
     bool removePlaybackFilter(int64_t filterId);
     bool readPlaybackFMQ(bool isVirtualFrontend, bool isRecording);
@@ -102,19 +113,21 @@ class Dvr : public BnDvr {
     void getMetaDataValue(int& index, int8_t* dataOutputBuffer, int& value);
     void maySendPlaybackStatusCallback();
     void maySendRecordStatusCallback();
+    // mWriteLock needs to be held to call this function
+    void setRecordOverflowLocked();
     PlaybackStatus checkPlaybackStatusChange(uint32_t availableToWrite, uint32_t availableToRead,
                                              int64_t highThreshold, int64_t lowThreshold);
     RecordStatus checkRecordStatusChange(uint32_t availableToWrite, uint32_t availableToRead,
                                          int64_t highThreshold, int64_t lowThreshold);
-    /**
-     * A dispatcher to read and dispatch input data to all the started filters.
-     * Each filter handler handles the data filtering/output writing/filterEvent updating.
-     */
-    void startTpidFilter(vector<int8_t> data);
+    void dispatchPlaybackData(const int8_t* data, size_t size, size_t packetSize,
+                              bool isVirtualFrontend, bool isRecording);
     void playbackThreadLoop();
 
     unique_ptr<DvrMQ> mDvrMQ;
     EventFlag* mDvrEventFlag;
+    vector<int8_t> mWrappedPacket;
+    // Bytes written into the record FMQ since start, the byte number of the next record event
+    int64_t mRecordedBytes = 0;
     /**
      * Demux callbacks used on filter events or IO buffer status
      */
@@ -20,6 +20,7 @@
 #include <BufferAllocator/BufferAllocator.h>
 #include <aidl/android/hardware/tv/tuner/DemuxFilterMonitorEventType.h>
 #include <aidl/android/hardware/tv/tuner/DemuxQueueNotifyBits.h>
+#include <aidl/android/hardware/tv/tuner/DemuxTsIndex.h>
 #include <aidl/android/hardware/tv/tuner/Result.h>
 #include <aidlcommonsupport/NativeHandle.h>
 #include <inttypes.h>
@@ -35,30 +36,26 @@ namespace tuner {
 
 #define WAIT_TIMEOUT 3000000000
 
-FilterCallbackScheduler::FilterCallbackScheduler(const std::shared_ptr<IFilterCallback>& cb)
+FilterCallbackScheduler::FilterCallbackScheduler(const std::shared_ptr<IFilterCallback>& cb,
+                                                 std::shared_ptr<FilterEventDispatcher> dispatcher)
     : mCallback(cb),
-      mIsConditionMet(false),
+      mDispatcher(dispatcher),
       mDataLength(0),
       mTimeDelayInMs(0),
-      mDataSizeDelayInBytes(0) {
-    start();
-}
+      mDataSizeDelayInBytes(0) {}
 
 FilterCallbackScheduler::~FilterCallbackScheduler() {
-    stop();
+    mDispatcher->cancel(this);
 }
 
 void FilterCallbackScheduler::onFilterEvent(DemuxFilterEvent&& event) {
-    std::unique_lock<std::mutex> lock(mLock);
-    mCallbackBuffer.push_back(std::move(event));
-    mDataLength += getDemuxFilterEventDataLength(event);
-
-    if (isDataSizeDelayConditionMetLocked()) {
-        mIsConditionMet = true;
-        // unlock, so thread is not immediately blocked when it is notified.
-        lock.unlock();
-        mCv.notify_all();
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mCallbackBuffer.empty()) {
+        mFirstEventTime = FilterEventDispatcher::Clock::now();
     }
+    mDataLength += getDemuxFilterEventDataLength(event);
+    mCallbackBuffer.push_back(std::move(event));
+    scheduleLocked();
 }
 
 void FilterCallbackScheduler::onFilterStatus(const DemuxFilterStatus& status) {
@@ -68,79 +65,61 @@ void FilterCallbackScheduler::onFilterStatus(const DemuxFilterStatus& status) {
 }
 
 void FilterCallbackScheduler::flushEvents() {
-    std::unique_lock<std::mutex> lock(mLock);
-    mCallbackBuffer.clear();
-    mDataLength = 0;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mCallbackBuffer.clear();
+        mDataLength = 0;
+    }
+    // The dispatcher takes mLock to send the events, so it can't be waited for under mLock
+    mDispatcher->cancel(this);
+}
+
+void FilterCallbackScheduler::dispatchEventsNow() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mCallbackBuffer.empty()) {
+        mDispatcher->schedule(this, FilterEventDispatcher::Clock::now());
+    }
 }
 
 void FilterCallbackScheduler::setTimeDelayHint(int timeDelay) {
-    std::unique_lock<std::mutex> lock(mLock);
+    std::lock_guard<std::mutex> lock(mLock);
     mTimeDelayInMs = timeDelay;
-    // always notify condition variable to update timeout
-    mIsConditionMet = true;
-    lock.unlock();
-    mCv.notify_all();
+    scheduleLocked();
 }
 
 void FilterCallbackScheduler::setDataSizeDelayHint(int dataSizeDelay) {
-    std::unique_lock<std::mutex> lock(mLock);
+    std::lock_guard<std::mutex> lock(mLock);
     mDataSizeDelayInBytes = dataSizeDelay;
-    if (isDataSizeDelayConditionMetLocked()) {
-        mIsConditionMet = true;
-        lock.unlock();
-        mCv.notify_all();
-    }
+    scheduleLocked();
 }
 
 bool FilterCallbackScheduler::hasCallbackRegistered() const {
     return mCallback != nullptr;
 }
 
-void FilterCallbackScheduler::start() {
-    mIsRunning = true;
-    mCallbackThread = std::thread(&FilterCallbackScheduler::threadLoop, this);
-}
-
-void FilterCallbackScheduler::stop() {
-    mIsRunning = false;
-    if (mCallbackThread.joinable()) {
-        {
-            std::lock_guard<std::mutex> lock(mLock);
-            mIsConditionMet = true;
-        }
-        mCv.notify_all();
-        mCallbackThread.join();
+void FilterCallbackScheduler::dispatchEvents() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mCallbackBuffer.empty()) {
+        return;
     }
-}
-
-void FilterCallbackScheduler::threadLoop() {
-    while (mIsRunning) {
-        threadLoopOnce();
+    if (mCallback) {
+        mCallback->onFilterEvent(mCallbackBuffer);
     }
+    mCallbackBuffer.clear();
+    mDataLength = 0;
 }
 
-void FilterCallbackScheduler::threadLoopOnce() {
-    std::unique_lock<std::mutex> lock(mLock);
-    if (mTimeDelayInMs > 0) {
-        // Note: predicate protects from lost and spurious wakeups
-        mCv.wait_for(lock, std::chrono::milliseconds(mTimeDelayInMs),
-                     [this] { return mIsConditionMet; });
-    } else {
-        // Note: predicate protects from lost and spurious wakeups
-        mCv.wait(lock, [this] { return mIsConditionMet; });
+// mLock needs to be held to call this function
+void FilterCallbackScheduler::scheduleLocked() {
+    if (mCallbackBuffer.empty()) {
+        return;
     }
-    mIsConditionMet = false;
-
-    // condition_variable wait locks mutex on timeout / notify
-    // Note: if stop() has been called in the meantime, do not send more filter
-    // events.
-    if (mIsRunning && !mCallbackBuffer.empty()) {
-        if (mCallback) {
-            mCallback->onFilterEvent(mCallbackBuffer);
-        }
-        mCallbackBuffer.clear();
-        mDataLength = 0;
+    if (isDataSizeDelayConditionMetLocked()) {
+        mDispatcher->schedule(this, FilterEventDispatcher::Clock::now());
+    } else if (mTimeDelayInMs > 0) {
+        mDispatcher->schedule(this, mFirstEventTime + std::chrono::milliseconds(mTimeDelayInMs));
     }
+    // Otherwise the events wait for enough data to meet the data size delay
 }
 
 // mLock needs to be held to call this function
@@ -190,7 +169,7 @@ int FilterCallbackScheduler::getDemuxFilterEventDataLength(const DemuxFilterEven
 Filter::Filter(DemuxFilterType type, int64_t filterId, uint32_t bufferSize,
                const std::shared_ptr<IFilterCallback>& cb, std::shared_ptr<Demux> demux)
     : mDemux(demux),
-      mCallbackScheduler(cb),
+      mCallbackScheduler(cb, demux->getFilterEventDispatcher()),
       mFilterId(filterId),
       mBufferSize(bufferSize),
       mType(type) {
@@ -305,8 +284,31 @@ Filter::~Filter() {
     switch (mType.mainType) {
         case DemuxFilterMainType::TS:
             mTpid = in_settings.get<DemuxFilterSettings::Tag::ts>().tpid;
+            mDemux->invalidatePidTable();
+            createTsAssembler();
+            if (mIsRecordFilter) {
+                const auto& filterSettings =
+                        in_settings.get<DemuxFilterSettings::Tag::ts>().filterSettings;
+                if (filterSettings.getTag() == DemuxTsFilterSettingsFilterSettings::Tag::record) {
+                    mRecordTsIndexMask =
+                            filterSettings.get<DemuxTsFilterSettingsFilterSettings::Tag::record>()
+                                    .tsIndexMask;
+                }
+            }
             break;
         case DemuxFilterMainType::MMTP:
+            mTpid = in_settings.get<DemuxFilterSettings::Tag::mmtp>().mmtpPid;
+            mDemux->invalidatePidTable();
+            if (mIsRecordFilter) {
+                const auto& filterSettings =
+                        in_settings.get<DemuxFilterSettings::Tag::mmtp>().filterSettings;
+                if (filterSettings.getTag() ==
+                    DemuxMmtpFilterSettingsFilterSettings::Tag::record) {
+                    mRecordTsIndexMask =
+                            filterSettings.get<DemuxMmtpFilterSettingsFilterSettings::Tag::record>()
+                                    .tsIndexMask;
+                }
+            }
             break;
         case DemuxFilterMainType::IP:
             break;
@@ -318,13 +320,19 @@ Filter::~Filter() {
             break;
     }
 
+    if (mIsMediaFilter) {
+        mAvBufferPool.preallocate(AV_BUFFER_PREALLOCATE_COUNT, AvBufferPool::MIN_BUFFER_SIZE);
+    }
+
     mConfigured = true;
     return ::ndk::ScopedAStatus::ok();
 }
 
 ::ndk::ScopedAStatus Filter::start() {
     ALOGV("%s", __FUNCTION__);
-    mFilterThreadRunning = true;
+    mFilterStarted = true;
+    mFirstEventPending = true;
+    mRecordFirstPacket = true;
     std::vector<DemuxFilterEvent> events;
     // All the filter event callbacks in start are for testing purpose.
     switch (mType.mainType) {
@@ -355,16 +363,14 @@ Filter::~Filter() {
         mCallbackScheduler.onFilterEvent(std::move(event));
     }
 
-    return startFilterLoop();
+    return ::ndk::ScopedAStatus::ok();
 }
 
 ::ndk::ScopedAStatus Filter::stop() {
     ALOGV("%s", __FUNCTION__);
 
-    mFilterThreadRunning = false;
-    if (mFilterThread.joinable()) {
-        mFilterThread.join();
-    }
+    mFilterStarted = false;
+    wakeFilterWriter();
 
     mCallbackScheduler.flushEvents();
 
@@ -393,12 +399,10 @@ Filter::~Filter() {
         return ::ndk::ScopedAStatus::ok();
     }
 
-    if (mDataId2Avfd.find(in_avDataId) == mDataId2Avfd.end()) {
+    if (!mAvBufferPool.release(static_cast<uint64_t>(in_avDataId))) {
         return ::ndk::ScopedAStatus::fromServiceSpecificError(
                 static_cast<int32_t>(Result::INVALID_ARGUMENT));
     }
-
-    ::close(mDataId2Avfd[in_avDataId]);
     return ::ndk::ScopedAStatus::ok();
 }
 
@@ -552,108 +556,35 @@ bool Filter::createFilterMQ() {
     return true;
 }
 
-::ndk::ScopedAStatus Filter::startFilterLoop() {
-    mFilterThread = std::thread(&Filter::filterThreadLoop, this);
-    return ::ndk::ScopedAStatus::ok();
-}
-
-void Filter::filterThreadLoop() {
-    if (!mFilterThreadRunning) {
+void Filter::sendFilterEvent(DemuxFilterEvent&& event) {
+    if (!mFilterStarted) {
         return;
     }
+    if (mConfigured.exchange(false)) {
+        auto startEvent = DemuxFilterEvent::make<DemuxFilterEvent::Tag::startId>(mStartId++);
+        mCallbackScheduler.onFilterEvent(std::move(startEvent));
+    }
+    mCallbackScheduler.onFilterEvent(std::move(event));
 
-    ALOGD("[Filter] filter %" PRIu64 " threadLoop start.", mFilterId);
-
-    // For the first time of filter output, implementation needs to send the filter
-    // Event Callback without waiting for the DATA_CONSUMED to init the process.
-    while (mFilterThreadRunning) {
-        std::unique_lock<std::mutex> lock(mFilterEventsLock);
-        if (mFilterEvents.size() == 0) {
-            lock.unlock();
-            if (DEBUG_FILTER) {
-                ALOGD("[Filter] wait for filter data output.");
-            }
-            usleep(1000 * 1000);
-            continue;
-        }
-
-        // After successfully write, send a callback and wait for the read to be done
-        if (mCallbackScheduler.hasCallbackRegistered()) {
-            if (mConfigured) {
-                auto startEvent =
-                        DemuxFilterEvent::make<DemuxFilterEvent::Tag::startId>(mStartId++);
-                mCallbackScheduler.onFilterEvent(std::move(startEvent));
-                mConfigured = false;
-            }
-
-            // lock is still being held
-            for (auto&& event : mFilterEvents) {
-                mCallbackScheduler.onFilterEvent(std::move(event));
-            }
-        } else {
-            ALOGD("[Filter] filter callback is not configured yet.");
-            mFilterThreadRunning = false;
-            return;
-        }
-
-        mFilterEvents.clear();
+    if (mFirstEventPending.exchange(false)) {
+        std::lock_guard<std::mutex> lock(mFilterStatusLock);
         mFilterStatus = DemuxFilterStatus::DATA_READY;
         mCallbackScheduler.onFilterStatus(mFilterStatus);
-        break;
     }
-
-    while (mFilterThreadRunning) {
-        uint32_t efState = 0;
-        // We do not wait for the last round of written data to be read to finish the thread
-        // because the VTS can verify the reading itself.
-        for (int i = 0; i < SECTION_WRITE_COUNT; i++) {
-            if (!mFilterThreadRunning) {
-                break;
-            }
-            while (mFilterThreadRunning && mIsUsingFMQ) {
-                ::android::status_t status = mFilterEventsFlag->wait(
-                        static_cast<uint32_t>(DemuxQueueNotifyBits::DATA_CONSUMED), &efState,
-                        WAIT_TIMEOUT, true /* retry on spurious wake */);
-                if (status != ::android::OK) {
-                    ALOGD("[Filter] wait for data consumed");
-                    continue;
-                }
-                break;
-            }
-
-            maySendFilterStatusCallback();
-
-            while (mFilterThreadRunning) {
-                std::lock_guard<std::mutex> lock(mFilterEventsLock);
-                if (mFilterEvents.size() == 0) {
-                    continue;
-                }
-                // After successfully write, send a callback and wait for the read to be done
-                for (auto&& event : mFilterEvents) {
-                    mCallbackScheduler.onFilterEvent(std::move(event));
-                }
-                mFilterEvents.clear();
-                break;
-            }
-            // We do not wait for the last read to be done
-            // VTS can verify the read result itself.
-            if (i == SECTION_WRITE_COUNT - 1) {
-                ALOGD("[Filter] filter %" PRIu64 " writing done. Ending thread", mFilterId);
-                break;
-            }
-        }
-        break;
-    }
-    ALOGD("[Filter] filter thread ended.");
 }
 
 void Filter::freeSharedAvHandle() {
     if (!mIsMediaFilter) {
         return;
     }
+    if (mSharedAvMemBuffer != nullptr) {
+        munmap(mSharedAvMemBuffer, BUFFER_SIZE_16M);
+        mSharedAvMemBuffer = nullptr;
+    }
     native_handle_close(mSharedAvMemHandle);
     native_handle_delete(mSharedAvMemHandle);
     mSharedAvMemHandle = nullptr;
+    mSharedAvMemOffset = 0;
 }
 
 binder_status_t Filter::dump(int fd, const char** /* args */, uint32_t /* numArgs */) {
@@ -663,7 +594,24 @@ binder_status_t Filter::dump(int fd, const char** /* args */, uint32_t /* numArg
     dprintf(fd, "      mIsPcrFilter: %d\n", mIsPcrFilter);
     dprintf(fd, "      mIsRecordFilter: %d\n", mIsRecordFilter);
     dprintf(fd, "      mIsUsingFMQ: %d\n", mIsUsingFMQ);
-    dprintf(fd, "      mFilterThreadRunning: %d\n", (bool)mFilterThreadRunning);
+    dprintf(fd, "      mFilterStarted: %d\n", (bool)mFilterStarted);
+    if (mTsAssembler != nullptr) {
+        const TsAssembler::Stats& stats = mTsAssembler->getStats();
+        dprintf(fd,
+                "      TS packets: %" PRIu64 ", units: %" PRIu64 ", dropped: %" PRIu64
+                ", continuity errors: %" PRIu64 ", CRC errors: %" PRIu64 "\n",
+                stats.packets, stats.units, stats.droppedUnits, stats.continuityErrors,
+                stats.crcErrors);
+    }
+    if (mIsMediaFilter) {
+        AvBufferPool::Stats stats = mAvBufferPool.getStats();
+        dprintf(fd,
+                "      AV buffers: %zu (%zu bytes), in use: %zu, peak: %zu, reuses: %" PRIu64
+                ", reallocations: %" PRIu64 ", overflows: %" PRIu64 ", failures: %" PRIu64 "\n",
+                stats.pooledBuffers, stats.pooledBytes, stats.buffersInUse,
+                stats.peakBuffersInUse, stats.reuses, stats.reallocations,
+                stats.overflowAllocations, stats.allocationFailures);
+    }
     return STATUS_OK;
 }
 
@@ -702,8 +650,12 @@ uint16_t Filter::getTpid() {
 }
 
 void Filter::updateFilterOutput(vector<int8_t>& data) {
+    updateFilterOutput(data.data(), data.size());
+}
+
+void Filter::updateFilterOutput(const int8_t* data, size_t size) {
     std::lock_guard<std::mutex> lock(mFilterOutputLock);
-    mFilterOutput.insert(mFilterOutput.end(), data.begin(), data.end());
+    mFilterOutput.insert(mFilterOutput.end(), data, data + size);
 }
 
 void Filter::updatePts(uint64_t pts) {
@@ -711,11 +663,6 @@ void Filter::updatePts(uint64_t pts) {
     mPts = pts;
 }
 
-void Filter::updateRecordOutput(vector<int8_t>& data) {
-    std::lock_guard<std::mutex> lock(mRecordFilterOutputLock);
-    mRecordFilterOutput.insert(mRecordFilterOutput.end(), data.begin(), data.end());
-}
-
 ::ndk::ScopedAStatus Filter::startFilterHandler() {
     std::lock_guard<std::mutex> lock(mFilterOutputLock);
     switch (mType.mainType) {
@@ -765,84 +712,31 @@ void Filter::updateRecordOutput(vector<int8_t>& data) {
 }
 
 ::ndk::ScopedAStatus Filter::startSectionFilterHandler() {
-    if (mFilterOutput.empty()) {
-        return ::ndk::ScopedAStatus::ok();
-    }
-    if (!writeSectionsAndCreateEvent(mFilterOutput)) {
-        ALOGD("[Filter] filter %" PRIu64 " fails to write into FMQ. Ending thread", mFilterId);
-        return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                static_cast<int32_t>(Result::UNKNOWN_ERROR));
-    }
-
-    mFilterOutput.clear();
-
-    return ::ndk::ScopedAStatus::ok();
+    return startTsAssemblerHandler();
 }
 
 ::ndk::ScopedAStatus Filter::startPesFilterHandler() {
+    return startTsAssemblerHandler();
+}
+
+::ndk::ScopedAStatus Filter::startTsAssemblerHandler() {
     if (mFilterOutput.empty()) {
         return ::ndk::ScopedAStatus::ok();
     }
-
-    for (int i = 0; i < mFilterOutput.size(); i += 188) {
-        if (mPesSizeLeft == 0) {
-            uint32_t prefix = (mFilterOutput[i + 4] << 16) | (mFilterOutput[i + 5] << 8) |
-                              mFilterOutput[i + 6];
-            if (DEBUG_FILTER) {
-                ALOGD("[Filter] prefix %d", prefix);
-            }
-            if (prefix == 0x000001) {
-                // TODO handle mulptiple Pes filters
-                mPesSizeLeft = (mFilterOutput[i + 8] << 8) | mFilterOutput[i + 9];
-                mPesSizeLeft += 6;
-                if (DEBUG_FILTER) {
-                    ALOGD("[Filter] pes data length %d", mPesSizeLeft);
-                }
-            } else {
-                continue;
-            }
-        }
-
-        int endPoint = min(184, mPesSizeLeft);
-        // append data and check size
-        vector<int8_t>::const_iterator first = mFilterOutput.begin() + i + 4;
-        vector<int8_t>::const_iterator last = mFilterOutput.begin() + i + 4 + endPoint;
-        mPesOutput.insert(mPesOutput.end(), first, last);
-        // size does not match then continue
-        mPesSizeLeft -= endPoint;
-        if (DEBUG_FILTER) {
-            ALOGD("[Filter] pes data left %d", mPesSizeLeft);
-        }
-        if (mPesSizeLeft > 0) {
-            continue;
-        }
-        // size match then create event
-        if (!writeDataToFilterMQ(mPesOutput)) {
-            ALOGD("[Filter] pes data write failed");
-            mFilterOutput.clear();
-            return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                    static_cast<int32_t>(Result::INVALID_ARGUMENT));
-        }
-        maySendFilterStatusCallback();
-        DemuxFilterPesEvent pesEvent;
-        pesEvent = {
-                // temp dump meta data
-                .streamId = static_cast<int32_t>(mPesOutput[3]),
-                .dataLength = static_cast<int32_t>(mPesOutput.size()),
-        };
-        if (DEBUG_FILTER) {
-            ALOGD("[Filter] assembled pes data length %d", pesEvent.dataLength);
-        }
-
-        {
-            std::lock_guard<std::mutex> lock(mFilterEventsLock);
-            mFilterEvents.push_back(DemuxFilterEvent::make<DemuxFilterEvent::Tag::pes>(pesEvent));
-        }
-
-        mPesOutput.clear();
+    if (mTsAssembler == nullptr) {
+        // Not configured yet
+        mFilterOutput.clear();
+        return ::ndk::ScopedAStatus::ok();
     }
 
+    mTsAssemblerWriteFailed = false;
+    mTsAssembler->push(mFilterOutput.data(), mFilterOutput.size());
     mFilterOutput.clear();
+    if (mTsAssemblerWriteFailed) {
+        ALOGD("[Filter] filter %" PRIu64 " fails to write into FMQ", mFilterId);
+        return ::ndk::ScopedAStatus::fromServiceSpecificError(
+                static_cast<int32_t>(Result::UNKNOWN_ERROR));
+    }
 
     return ::ndk::ScopedAStatus::ok();
 }
@@ -922,33 +816,104 @@ void Filter::updateRecordOutput(vector<int8_t>& data) {
     return createIndependentMediaEvents(output);
 }
 
-::ndk::ScopedAStatus Filter::startRecordFilterHandler() {
-    std::lock_guard<std::mutex> lock(mRecordFilterOutputLock);
-    if (mRecordFilterOutput.empty()) {
-        return ::ndk::ScopedAStatus::ok();
+void Filter::indexRecordPacket(const int8_t* packet, int64_t byteNumber) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(packet);
+    int32_t index = 0;
+    if (mRecordFirstPacket.exchange(false)) {
+        index |= static_cast<int32_t>(DemuxTsIndex::FIRST_PACKET);
+    }
+    bool unitStart = bytes[1] & 0x40;
+    if (unitStart) {
+        index |= static_cast<int32_t>(DemuxTsIndex::PAYLOAD_UNIT_START_INDICATOR);
     }
 
-    if (mDvr == nullptr || !mDvr->writeRecordFMQ(mRecordFilterOutput)) {
-        ALOGD("[Filter] dvr fails to write into record FMQ.");
-        return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                static_cast<int32_t>(Result::UNKNOWN_ERROR));
+    int scramblingControl = bytes[3] >> 6;
+    if (mRecordScramblingControl >= 0 && scramblingControl != mRecordScramblingControl) {
+        switch (scramblingControl) {
+            case 0:
+                index |= static_cast<int32_t>(DemuxTsIndex::CHANGE_TO_NOT_SCRAMBLED);
+                break;
+            case 2:
+                index |= static_cast<int32_t>(DemuxTsIndex::CHANGE_TO_EVEN_SCRAMBLED);
+                break;
+            case 3:
+                index |= static_cast<int32_t>(DemuxTsIndex::CHANGE_TO_ODD_SCRAMBLED);
+                break;
+            default:
+                break;
+        }
+    }
+    mRecordScramblingControl = scramblingControl;
+
+    size_t payloadOffset = 4;
+    if (bytes[3] & 0x20) {
+        // The adaptation field flags, from discontinuity_indicator down to
+        // adaptation_field_extension_flag, are the indexes from DISCONTINUITY_INDICATOR up
+        for (int bit = 0; bytes[4] > 0 && bit < 8; bit++) {
+            if (bytes[5] & (0x80 >> bit)) {
+                index |= static_cast<int32_t>(DemuxTsIndex::DISCONTINUITY_INDICATOR) << bit;
+            }
+        }
+        payloadOffset += 1 + bytes[4];
+    }
+
+    index &= mRecordTsIndexMask;
+    if (index == 0) {
+        return;
+    }
+
+    int64_t pts = mPts;
+    // The PTS of a PES header at the start of the packet payload
+    const uint8_t* pes = bytes + payloadOffset;
+    if (unitStart && payloadOffset + 14 <= TS_PACKET_SIZE && pes[0] == 0 && pes[1] == 0 &&
+        pes[2] == 1 && (pes[7] & 0x80)) {
+        pts = (static_cast<int64_t>(pes[9] & 0x0e) << 29) | (pes[10] << 22) |
+              ((pes[11] & 0xfe) << 14) | (pes[12] << 7) | (pes[13] >> 1);
+    }
+    queueRecordEvent(index, byteNumber, pts);
+}
+
+void Filter::indexRecordFrame(int64_t byteNumber) {
+    int32_t index = static_cast<int32_t>(DemuxTsIndex::PAYLOAD_UNIT_START_INDICATOR);
+    if (mRecordFirstPacket.exchange(false)) {
+        index |= static_cast<int32_t>(DemuxTsIndex::FIRST_PACKET);
+    }
+    index &= mRecordTsIndexMask;
+    if (index != 0) {
+        queueRecordEvent(index, byteNumber, mPts);
+    }
+}
+
+void Filter::queueRecordEvent(int32_t tsIndexMask, int64_t byteNumber, int64_t pts) {
+    if (mType.mainType == DemuxFilterMainType::MMTP) {
+        DemuxFilterMmtpRecordEvent recordEvent;
+        recordEvent = {
+                .byteNumber = byteNumber,
+                .pts = pts,
+                .firstMbInSlice = 0,  // random address
+                .tsIndexMask = tsIndexMask,
+        };
+        mRecordEvents.push_back(
+                DemuxFilterEvent::make<DemuxFilterEvent::Tag::mmtpRecord>(recordEvent));
+        return;
     }
 
     DemuxFilterTsRecordEvent recordEvent;
     recordEvent = {
-            .byteNumber = static_cast<int64_t>(mRecordFilterOutput.size()),
-            .pts = (mPts == 0) ? static_cast<int64_t>(time(NULL)) * 900000 : mPts,
+            .tsIndexMask = tsIndexMask,
+            .byteNumber = byteNumber,
+            .pts = pts,
             .firstMbInSlice = 0,  // random address
     };
+    recordEvent.pid.set<DemuxPid::Tag::tPid>(mTpid);
+    mRecordEvents.push_back(DemuxFilterEvent::make<DemuxFilterEvent::Tag::tsRecord>(recordEvent));
+}
 
-    {
-        std::lock_guard<std::mutex> lock(mFilterEventsLock);
-        mFilterEvents.push_back(
-                DemuxFilterEvent::make<DemuxFilterEvent::Tag::tsRecord>(recordEvent));
+void Filter::sendRecordEvents() {
+    for (auto&& event : mRecordEvents) {
+        sendFilterEvent(std::move(event));
     }
-
-    mRecordFilterOutput.clear();
-    return ::ndk::ScopedAStatus::ok();
+    mRecordEvents.clear();
 }
 
 ::ndk::ScopedAStatus Filter::startPcrFilterHandler() {
@@ -961,37 +926,127 @@ void Filter::updateRecordOutput(vector<int8_t>& data) {
     return ::ndk::ScopedAStatus::ok();
 }
 
-bool Filter::writeSectionsAndCreateEvent(vector<int8_t>& data) {
-    // TODO check how many sections has been read
-    ALOGD("[Filter] section handler");
-    if (!writeDataToFilterMQ(data)) {
-        return false;
+void Filter::createTsAssembler() {
+    mTsAssembler = nullptr;
+    const DemuxTsFilterSettings& settings = mFilterSettings.get<DemuxFilterSettings::Tag::ts>();
+    switch (mType.subType.get<DemuxFilterSubType::Tag::tsFilterType>()) {
+        case DemuxTsFilterType::SECTION: {
+            bool checkCrc = false;
+            if (settings.filterSettings.getTag() ==
+                DemuxTsFilterSettingsFilterSettings::Tag::section) {
+                checkCrc = settings.filterSettings
+                                   .get<DemuxTsFilterSettingsFilterSettings::Tag::section>()
+                                   .isCheckCrc;
+            }
+            mTsAssembler = std::make_unique<TsAssembler>(
+                    TsAssembler::Kind::SECTION, checkCrc,
+                    [this](const uint8_t* data, size_t size) {
+                        writeSectionAndCreateEvent(data, size);
+                    });
+            break;
+        }
+        case DemuxTsFilterType::PES:
+            mTsAssembler = std::make_unique<TsAssembler>(
+                    TsAssembler::Kind::PES, false /* checkCrc */,
+                    [this](const uint8_t* data, size_t size) { writePesAndCreateEvent(data, size); });
+            break;
+        default:
+            break;
+    }
+}
+
+void Filter::writeSectionAndCreateEvent(const uint8_t* data, size_t size) {
+    if (!writeDataToFilterMQ(data, size)) {
+        mTsAssemblerWriteFailed = true;
+        return;
     }
+    maySendFilterStatusCallback();
+
+    // version_number and section_number are only in sections with the long header
+    bool longHeader = (data[1] & 0x80) && size >= 8;
     DemuxFilterSectionEvent secEvent;
     secEvent = {
-            // temp dump meta data
-            .tableId = 0,
-            .version = 1,
-            .sectionNum = 1,
-            .dataLength = static_cast<int32_t>(data.size()),
+            .tableId = data[0],
+            .version = longHeader ? (data[5] >> 1) & 0x1f : 0,
+            .sectionNum = longHeader ? data[6] : 0,
+            .dataLength = static_cast<int64_t>(size),
     };
+    if (DEBUG_FILTER) {
+        ALOGD("[Filter] assembled section table id %d length %zu", secEvent.tableId, size);
+    }
 
-    {
-        std::lock_guard<std::mutex> lock(mFilterEventsLock);
-        mFilterEvents.push_back(DemuxFilterEvent::make<DemuxFilterEvent::Tag::section>(secEvent));
+    sendFilterEvent(DemuxFilterEvent::make<DemuxFilterEvent::Tag::section>(secEvent));
+}
+
+void Filter::writePesAndCreateEvent(const uint8_t* data, size_t size) {
+    if (!writeDataToFilterMQ(data, size)) {
+        mTsAssemblerWriteFailed = true;
+        return;
     }
+    maySendFilterStatusCallback();
 
-    return true;
+    DemuxFilterPesEvent pesEvent;
+    pesEvent = {
+            .streamId = data[3],
+            .dataLength = static_cast<int32_t>(size),
+    };
+    if (DEBUG_FILTER) {
+        ALOGD("[Filter] assembled pes data length %d", pesEvent.dataLength);
+    }
+
+    sendFilterEvent(DemuxFilterEvent::make<DemuxFilterEvent::Tag::pes>(pesEvent));
 }
 
-bool Filter::writeDataToFilterMQ(const std::vector<int8_t>& data) {
+bool Filter::writeDataToFilterMQ(const uint8_t* data, size_t size) {
+    if (!waitForFilterMQSpace(size)) {
+        return false;
+    }
     std::lock_guard<std::mutex> lock(mWriteLock);
-    if (mFilterMQ->write(data.data(), data.size())) {
+    if (mFilterMQ->write(reinterpret_cast<const int8_t*>(data), size)) {
         return true;
     }
     return false;
 }
 
+bool Filter::waitForFilterMQSpace(size_t size) {
+    size_t queueSize = mFilterMQ->getQuantumCount();
+    if (size > queueSize) {
+        return false;
+    }
+    size_t highThreshold = ceil(queueSize * 0.75);
+    // Nobody reads the FMQ before the client gets its descriptor
+    while (mFilterStarted && mIsUsingFMQ) {
+        size_t used = mFilterMQ->availableToRead();
+        // Data larger than the margin above the watermark goes into an empty queue
+        if (mFilterMQ->availableToWrite() >= size && (used == 0 || used + size <= highThreshold)) {
+            return true;
+        }
+        // Don't block the input thread that is being joined on a client that stopped reading
+        if (mDemux->isInputStopping()) {
+            ALOGW("[Filter] drop %zu bytes, the input is stopping", size);
+            return false;
+        }
+        maySendFilterStatusCallback();
+        // The client only reads the data it has events for
+        mCallbackScheduler.dispatchEventsNow();
+
+        uint32_t efState = 0;
+        ::android::status_t status = mFilterEventsFlag->wait(
+                static_cast<uint32_t>(DemuxQueueNotifyBits::DATA_CONSUMED), &efState,
+                WAIT_TIMEOUT, true /* retry on spurious wake */);
+        if (status != ::android::OK && DEBUG_FILTER) {
+            ALOGD("[Filter] wait for data consumed");
+        }
+    }
+    return mFilterStarted;
+}
+
+void Filter::wakeFilterWriter() {
+    if (mIsUsingFMQ) {
+        mFilterEventsFlag->wake(static_cast<uint32_t>(DemuxQueueNotifyBits::DATA_CONSUMED));
+    }
+}
+
 void Filter::attachFilterToRecord(const std::shared_ptr<Dvr> dvr) {
     mDvr = dvr;
 }
@@ -1045,29 +1100,15 @@ native_handle_t* Filter::createNativeHandle(int fd) {
 }
 
 ::ndk::ScopedAStatus Filter::createIndependentMediaEvents(vector<int8_t>& output) {
-    int av_fd = createAvIonFd(output.size());
-    if (av_fd == -1) {
-        return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                static_cast<int32_t>(Result::UNKNOWN_ERROR));
-    }
-    // copy the filtered data to the buffer
-    uint8_t* avBuffer = getIonBuffer(av_fd, output.size());
-    if (avBuffer == NULL) {
-        return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                static_cast<int32_t>(Result::UNKNOWN_ERROR));
-    }
-    memcpy(avBuffer, output.data(), output.size() * sizeof(uint8_t));
-
-    native_handle_t* nativeHandle = createNativeHandle(av_fd);
-    if (nativeHandle == NULL) {
+    // copy the filtered data to a pooled buffer held until the client releases the data id
+    uint64_t dataId = mLastUsedDataId++ /*createdUID*/;
+    const native_handle_t* nativeHandle =
+            mAvBufferPool.write(dataId, output.data(), output.size() * sizeof(uint8_t));
+    if (nativeHandle == nullptr) {
         return ::ndk::ScopedAStatus::fromServiceSpecificError(
                 static_cast<int32_t>(Result::UNKNOWN_ERROR));
     }
 
-    // Create a dataId and add a <dataId, av_fd> pair into the dataId2Avfd map
-    uint64_t dataId = mLastUsedDataId++ /*createdUID*/;
-    mDataId2Avfd[dataId] = dup(av_fd);
-
     // Create mediaEvent and send callback
     auto event = DemuxFilterEvent::make<DemuxFilterEvent::Tag::media>();
     auto& mediaEvent = event.get<DemuxFilterEvent::Tag::media>();
@@ -1079,14 +1120,9 @@ native_handle_t* Filter::createNativeHandle(int fd) {
         mPts = 0;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(mFilterEventsLock);
-        mFilterEvents.push_back(std::move(event));
-    }
+    sendFilterEvent(std::move(event));
 
     // Clear and log
-    native_handle_close(nativeHandle);
-    native_handle_delete(nativeHandle);
     output.clear();
     mAvBufferCopyCount = 0;
     if (DEBUG_FILTER) {
@@ -1096,14 +1132,26 @@ native_handle_t* Filter::createNativeHandle(int fd) {
 }
 
 ::ndk::ScopedAStatus Filter::createShareMemMediaEvents(vector<int8_t>& output) {
-    // copy the filtered data to the shared buffer
-    uint8_t* sharedAvBuffer =
-            getIonBuffer(mSharedAvMemHandle->data[0], output.size() + mSharedAvMemOffset);
-    if (sharedAvBuffer == NULL) {
+    if (output.size() > BUFFER_SIZE_16M) {
         return ::ndk::ScopedAStatus::fromServiceSpecificError(
-                static_cast<int32_t>(Result::UNKNOWN_ERROR));
+                static_cast<int32_t>(Result::OUT_OF_MEMORY));
+    }
+    // The shared buffer is mapped once and stays mapped until it is released
+    if (mSharedAvMemBuffer == nullptr) {
+        mSharedAvMemBuffer = getIonBuffer(mSharedAvMemHandle->data[0], BUFFER_SIZE_16M);
+        if (mSharedAvMemBuffer == NULL) {
+            return ::ndk::ScopedAStatus::fromServiceSpecificError(
+                    static_cast<int32_t>(Result::UNKNOWN_ERROR));
+        }
+    }
+    // Wrap around to the start of the buffer when the data doesn't fit at the end
+    if (mSharedAvMemOffset + output.size() > BUFFER_SIZE_16M) {
+        mSharedAvMemOffset = 0;
     }
-    memcpy(sharedAvBuffer + mSharedAvMemOffset, output.data(), output.size() * sizeof(uint8_t));
+
+    // copy the filtered data to the shared buffer
+    memcpy(mSharedAvMemBuffer + mSharedAvMemOffset, output.data(),
+           output.size() * sizeof(uint8_t));
 
     // Create a memory handle with numFds == 0
     native_handle_t* nativeHandle = createNativeHandle(-1);
@@ -1123,10 +1171,7 @@ native_handle_t* Filter::createNativeHandle(int fd) {
         mPts = 0;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(mFilterEventsLock);
-        mFilterEvents.push_back(std::move(event));
-    }
+    sendFilterEvent(std::move(event));
 
     mSharedAvMemOffset += output.size();
 
@@ -1168,29 +1213,17 @@ void Filter::createMediaEvent(vector<DemuxFilterEvent>& events) {
     mediaEvent.isPesPrivateData = true;
     mediaEvent.extraMetaData.set<DemuxFilterMediaEventExtraMetaData::Tag::audio>(audio);
 
-    int av_fd = createAvIonFd(BUFFER_SIZE_16M);
-    if (av_fd == -1) {
-        return;
-    }
-
-    native_handle_t* nativeHandle = createNativeHandle(av_fd);
+    // Hold a pooled buffer for the dataId until the client releases it
+    uint64_t dataId = mLastUsedDataId++ /*createdUID*/;
+    const native_handle_t* nativeHandle = mAvBufferPool.write(dataId, nullptr, 0);
     if (nativeHandle == nullptr) {
-        ::close(av_fd);
-        ALOGE("[Filter] Failed to create native_handle %d", errno);
         return;
     }
 
-    // Create a dataId and add a <dataId, av_fd> pair into the dataId2Avfd map
-    uint64_t dataId = mLastUsedDataId++ /*createdUID*/;
-    mDataId2Avfd[dataId] = dup(av_fd);
-
     mediaEvent.avDataId = static_cast<int64_t>(dataId);
     mediaEvent.avMemory = ::android::dupToAidl(nativeHandle);
 
     events.push_back(DemuxFilterEvent::make<DemuxFilterEvent::Tag::media>(std::move(mediaEvent)));
-
-    native_handle_close(nativeHandle);
-    native_handle_delete(nativeHandle);
 }
 
 void Filter::createTsRecordEvent(vector<DemuxFilterEvent>& events) {
@@ -31,9 +31,12 @@
 #include <set>
 #include <thread>
 
+#include "AvBufferPool.h"
 #include "Demux.h"
 #include "Dvr.h"
+#include "FilterEventDispatcher.h"
 #include "Frontend.h"
+#include "TsAssembler.h"
 
 using namespace std;
 
@@ -51,13 +54,16 @@ using ::android::hardware::EventFlag;
 
 using FilterMQ = AidlMessageQueue<int8_t, SynchronizedReadWrite>;
 const uint32_t BUFFER_SIZE_16M = 0x1000000;
+// Buffers allocated for a media filter when it is configured
+const size_t AV_BUFFER_PREALLOCATE_COUNT = 4;
 
 class Demux;
 class Dvr;
 
 class FilterCallbackScheduler final {
   public:
-    FilterCallbackScheduler(const std::shared_ptr<IFilterCallback>& cb);
+    FilterCallbackScheduler(const std::shared_ptr<IFilterCallback>& cb,
+                            std::shared_ptr<FilterEventDispatcher> dispatcher);
     ~FilterCallbackScheduler();
 
     void onFilterEvent(DemuxFilterEvent&& event);
@@ -69,13 +75,15 @@ class FilterCallbackScheduler final {
     bool hasCallbackRegistered() const;
 
     void flushEvents();
+    // Send the pending events now, regardless of the delay hints
+    void dispatchEventsNow();
 
-  private:
-    void start();
-    void stop();
+    // Called by the dispatcher to send the pending events in one batch
+    void dispatchEvents();
 
-    void threadLoop();
-    void threadLoopOnce();
+  private:
+    // Queue the pending events on the dispatcher by the deadline the delay hints give them
+    void scheduleLocked();
 
     // function needs to be called while holding mLock
     bool isDataSizeDelayConditionMetLocked();
@@ -84,15 +92,14 @@ class FilterCallbackScheduler final {
 
   private:
     std::shared_ptr<IFilterCallback> mCallback;
-    std::thread mCallbackThread;
-    std::atomic<bool> mIsRunning;
+    std::shared_ptr<FilterEventDispatcher> mDispatcher;
 
-    // mLock protects mCallbackBuffer, mIsConditionMet, mCv, mDataLength,
-    // mTimeDelayInMs, and mDataSizeDelayInBytes
+    // mLock protects mCallbackBuffer, mFirstEventTime, mDataLength, mTimeDelayInMs, and
+    // mDataSizeDelayInBytes
     std::mutex mLock;
     std::vector<DemuxFilterEvent> mCallbackBuffer;
-    bool mIsConditionMet;
-    std::condition_variable mCv;
+    // Time the oldest pending event was added, the time delay is counted from it
+    FilterEventDispatcher::Clock::time_point mFirstEventTime;
     int mDataLength;
     int mTimeDelayInMs;
     int mDataSizeDelayInBytes;
@@ -136,13 +143,23 @@ class Filter : public BnFilter {
     bool createFilterMQ();
     uint16_t getTpid();
     void updateFilterOutput(vector<int8_t>& data);
-    void updateRecordOutput(vector<int8_t>& data);
+    void updateFilterOutput(const int8_t* data, size_t size);
+    /**
+     * Queue the record event of a TS packet written at byteNumber of the record output if it
+     * has any of the indexes of the record settings.
+     */
+    void indexRecordPacket(const int8_t* packet, int64_t byteNumber);
+    // Queue the record event of an ES frame written at byteNumber of the record output
+    void indexRecordFrame(int64_t byteNumber);
+    // Send the record events queued since the last call
+    void sendRecordEvents();
     void updatePts(uint64_t pts);
     ::ndk::ScopedAStatus startFilterHandler();
-    ::ndk::ScopedAStatus startRecordFilterHandler();
     void attachFilterToRecord(const std::shared_ptr<Dvr> dvr);
     void detachFilterFromRecord();
     void freeSharedAvHandle();
+    // Release the input thread if it waits for the client to read the filter FMQ
+    void wakeFilterWriter();
     bool isMediaFilter() { return mIsMediaFilter; };
     bool isPcrFilter() { return mIsPcrFilter; };
     bool isRecordFilter() { return mIsRecordFilter; };
@@ -168,28 +185,24 @@ class Filter : public BnFilter {
     std::shared_ptr<IFilter> mDataSource;
     bool mIsDataSourceDemux = true;
     vector<int8_t> mFilterOutput;
-    vector<int8_t> mRecordFilterOutput;
+    // Record filter index state, only used from the thread writing the record FMQ
+    int32_t mRecordTsIndexMask = 0;
+    std::atomic<bool> mRecordFirstPacket{true};
+    int mRecordScramblingControl = -1;
+    vector<DemuxFilterEvent> mRecordEvents;
     int64_t mPts = 0;
     unique_ptr<FilterMQ> mFilterMQ;
     bool mIsUsingFMQ = false;
     EventFlag* mFilterEventsFlag;
-    vector<DemuxFilterEvent> mFilterEvents;
-
-    // Thread handlers
-    std::thread mFilterThread;
 
     // FMQ status local records
     DemuxFilterStatus mFilterStatus;
     /**
-     * If a specific filter's writing loop is still running
-     */
-    std::atomic<bool> mFilterThreadRunning;
-
-    /**
-     * How many times a filter should write
-     * TODO make this dynamic/random/can take as a parameter
+     * If the filter is started and its events are sent
      */
-    const uint16_t SECTION_WRITE_COUNT = 10;
+    std::atomic<bool> mFilterStarted{false};
+    // If the DATA_READY status is still to be sent after the first event since start
+    std::atomic<bool> mFirstEventPending{false};
 
     bool DEBUG_FILTER = false;
 
@@ -200,16 +213,29 @@ class Filter : public BnFilter {
      */
     ::ndk::ScopedAStatus startSectionFilterHandler();
     ::ndk::ScopedAStatus startPesFilterHandler();
+    // Reassemble the output of a section or PES filter into its FMQ
+    ::ndk::ScopedAStatus startTsAssemblerHandler();
     ::ndk::ScopedAStatus startTsFilterHandler();
     ::ndk::ScopedAStatus startMediaFilterHandler();
     ::ndk::ScopedAStatus startPcrFilterHandler();
     ::ndk::ScopedAStatus startTemiFilterHandler();
-    ::ndk::ScopedAStatus startFilterLoop();
 
     void deleteEventFlag();
-    bool writeDataToFilterMQ(const std::vector<int8_t>& data);
+    bool writeDataToFilterMQ(const uint8_t* data, size_t size);
+    /**
+     * Block until the client has read the FMQ down to its high watermark with room for size
+     * bytes, which holds back the demux instead of dropping the data.
+     *
+     * Return false if the filter is stopped or the data can never fit.
+     */
+    bool waitForFilterMQSpace(size_t size);
+    // Send an event produced by a filter handler once the filter is started
+    void sendFilterEvent(DemuxFilterEvent&& event);
     bool readDataFromMQ();
-    bool writeSectionsAndCreateEvent(vector<int8_t>& data);
+    void createTsAssembler();
+    void writeSectionAndCreateEvent(const uint8_t* data, size_t size);
+    void writePesAndCreateEvent(const uint8_t* data, size_t size);
+    void queueRecordEvent(int32_t tsIndexMask, int64_t byteNumber, int64_t pts);
     void maySendFilterStatusCallback();
     DemuxFilterStatus checkFilterStatusChange(uint32_t availableToWrite, uint32_t availableToRead,
                                               uint32_t highThreshold, uint32_t lowThreshold);
@@ -218,8 +244,6 @@ class Filter : public BnFilter {
      * Each filter handler handles the data filtering/output writing/filterEvent updating.
      */
     bool startFilterDispatcher();
-    static void* __threadLoopFilter(void* user);
-    void filterThreadLoop();
 
     int createAvIonFd(int size);
     uint8_t* getIonBuffer(int fd, int size);
@@ -244,30 +268,29 @@ class Filter : public BnFilter {
      * Lock to protect writes to the FMQs
      */
     std::mutex mWriteLock;
-    /**
-     * Lock to protect writes to the filter event
-     */
-    // TODO make each filter separate event lock
-    std::mutex mFilterEventsLock;
     /**
      * Lock to protect writes to the input status
      */
     std::mutex mFilterStatusLock;
     std::mutex mFilterOutputLock;
-    std::mutex mRecordFilterOutputLock;
 
-    // temp handle single PES filter
-    // TODO handle mulptiple Pes filters
+    // Reassembles the sections or PES packets of a section or PES filter
+    unique_ptr<TsAssembler> mTsAssembler;
+    // If a unit assembled from the current output failed to be written into the FMQ
+    bool mTsAssemblerWriteFailed = false;
+
+    // temp handle single PES for the media filters
     int mPesSizeLeft = 0;
     vector<int8_t> mPesOutput;
 
-    // A map from data id to ion handle
-    std::map<uint64_t, int> mDataId2Avfd;
+    // Buffers of the media events, reused once the client releases their data ids
+    AvBufferPool mAvBufferPool;
     uint64_t mLastUsedDataId = 1;
     int mAvBufferCopyCount = 0;
 
     // Shared A/V memory handle
     native_handle_t* mSharedAvMemHandle = nullptr;
+    uint8_t* mSharedAvMemBuffer = nullptr;
     bool mUsingSharedAvMem = false;
     int64_t mSharedAvMemOffset = 0;
 
@@ -277,7 +300,7 @@ class Filter : public BnFilter {
     // Scrambling status to be monitored
     uint32_t mStatuses = 0;
 
-    bool mConfigured = false;
+    std::atomic<bool> mConfigured{false};
     int mStartId = 0;
     uint8_t mScramblingStatusMonitored = 0;
     uint8_t mIpCidMonitored = 0;
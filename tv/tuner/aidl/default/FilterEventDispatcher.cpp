@@ -0,0 +1,110 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "android.hardware.tv.tuner-service.example-FilterEventDispatcher"
+
+#include <utils/Log.h>
+
+#include "Filter.h"
+#include "FilterEventDispatcher.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+FilterEventDispatcher::FilterEventDispatcher() {
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        mThreads.emplace_back(&FilterEventDispatcher::threadLoop, this);
+    }
+}
+
+FilterEventDispatcher::~FilterEventDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mIsRunning = false;
+    }
+    mCv.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void FilterEventDispatcher::schedule(FilterCallbackScheduler* scheduler,
+                                     Clock::time_point deadline) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto queued = mDeadlines.find(scheduler);
+        if (queued != mDeadlines.end()) {
+            if (queued->second <= deadline) {
+                return;
+            }
+            mQueue.erase({queued->second, scheduler});
+        }
+        mDeadlines[scheduler] = deadline;
+        mQueue.emplace(deadline, scheduler);
+    }
+    mCv.notify_all();
+}
+
+void FilterEventDispatcher::cancel(FilterCallbackScheduler* scheduler) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto queued = mDeadlines.find(scheduler);
+    if (queued != mDeadlines.end()) {
+        mQueue.erase({queued->second, scheduler});
+        mDeadlines.erase(queued);
+    }
+    mCv.wait(lock, [&] { return mDispatching.count(scheduler) == 0; });
+}
+
+void FilterEventDispatcher::threadLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (mIsRunning) {
+        // A scheduler being dispatched by another thread waits for its previous batch
+        auto next = mQueue.begin();
+        while (next != mQueue.end() && mDispatching.count(next->second) > 0) {
+            next++;
+        }
+        if (next == mQueue.end()) {
+            mCv.wait(lock);
+            continue;
+        }
+        if (next->first > Clock::now()) {
+            mCv.wait_until(lock, next->first);
+            continue;
+        }
+
+        FilterCallbackScheduler* scheduler = next->second;
+        mDeadlines.erase(scheduler);
+        mQueue.erase(next);
+        mDispatching.insert(scheduler);
+
+        lock.unlock();
+        scheduler->dispatchEvents();
+        lock.lock();
+
+        mDispatching.erase(scheduler);
+        mCv.notify_all();
+    }
+}
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+class FilterCallbackScheduler;
+
+/**
+ * Sends the filter events of all the filters of a demux from a small pool of threads.
+ *
+ * Each filter is queued at most once, with the deadline of its pending events, and is
+ * dispatched by a single thread at a time so its batches are delivered in order.
+ */
+class FilterEventDispatcher final {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static const int THREAD_COUNT = 2;
+
+    FilterEventDispatcher();
+    ~FilterEventDispatcher();
+
+    /**
+     * Call scheduler->dispatchEvents() at the deadline. A scheduler already queued keeps the
+     * earlier of its deadlines.
+     */
+    void schedule(FilterCallbackScheduler* scheduler, Clock::time_point deadline);
+
+    // Remove the scheduler from the queue and wait for its dispatch in progress to return
+    void cancel(FilterCallbackScheduler* scheduler);
+
+  private:
+    void threadLoop();
+
+    std::mutex mLock;
+    // Notified when the queue changes, a dispatch ends or the dispatcher stops
+    std::condition_variable mCv;
+    std::set<std::pair<Clock::time_point, FilterCallbackScheduler*>> mQueue;
+    std::map<FilterCallbackScheduler*, Clock::time_point> mDeadlines;
+    // Schedulers being dispatched
+    std::set<FilterCallbackScheduler*> mDispatching;
+    bool mIsRunning = true;
+
+    std::vector<std::thread> mThreads;
+};
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
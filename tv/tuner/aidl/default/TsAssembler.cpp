@@ -0,0 +1,291 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "android.hardware.tv.tuner-service.example-TsAssembler"
+
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "TsAssembler.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+namespace {
+
+const uint8_t TS_SYNC_BYTE = 0x47;
+const size_t TS_HEADER_SIZE = 4;
+const size_t PES_HEADER_SIZE = 6;
+const size_t SECTION_HEADER_SIZE = 3;
+
+std::array<uint32_t, 256> makeCrc32Table() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+const std::array<uint32_t, 256> kCrc32Table = makeCrc32Table();
+
+}  // namespace
+
+bool parseTsPacket(const int8_t* data, TsPacket* packet) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    if (bytes[0] != TS_SYNC_BYTE || (bytes[1] & 0x80)) {
+        return false;
+    }
+    packet->pid = ((bytes[1] & 0x1f) << 8) | bytes[2];
+    packet->unitStart = bytes[1] & 0x40;
+    packet->continuityCounter = bytes[3] & 0x0f;
+    packet->discontinuity = false;
+
+    uint8_t adaptationFieldControl = (bytes[3] >> 4) & 0x03;
+    if (adaptationFieldControl == 0) {
+        return false;
+    }
+    size_t offset = TS_HEADER_SIZE;
+    if (adaptationFieldControl & 0x02) {
+        size_t adaptationFieldLength = bytes[offset];
+        if (adaptationFieldLength > 0) {
+            packet->discontinuity = bytes[offset + 1] & 0x80;
+        }
+        offset += 1 + adaptationFieldLength;
+        if (offset > TS_PACKET_SIZE) {
+            return false;
+        }
+    }
+    if (adaptationFieldControl & 0x01) {
+        packet->payload = bytes + offset;
+        packet->payloadSize = TS_PACKET_SIZE - offset;
+    } else {
+        packet->payload = nullptr;
+        packet->payloadSize = 0;
+    }
+    return true;
+}
+
+uint32_t crc32Mpeg2(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ kCrc32Table[(crc >> 24) ^ data[i]];
+    }
+    return crc;
+}
+
+TsAssembler::TsAssembler(Kind kind, bool checkCrc, UnitCallback onUnit)
+    : mKind(kind),
+      mCheckCrc(checkCrc),
+      mOnUnit(std::move(onUnit)),
+      mBuffer(kind == Kind::PES ? MAX_PES_SIZE : MAX_SECTION_SIZE) {}
+
+void TsAssembler::reset() {
+    mSize = 0;
+    mExpectedSize = 0;
+    mInUnit = false;
+    mLastContinuityCounter = -1;
+    mDuplicateSeen = false;
+}
+
+void TsAssembler::push(const int8_t* data, size_t size) {
+    for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE) {
+        TsPacket packet;
+        if (!parseTsPacket(data + offset, &packet)) {
+            ALOGV("[TsAssembler] skipping a malformed packet");
+            continue;
+        }
+        mStats.packets++;
+        if (packet.payloadSize == 0 || !checkContinuity(packet)) {
+            continue;
+        }
+        if (mKind == Kind::PES) {
+            pushPes(packet);
+        } else {
+            pushSection(packet);
+        }
+    }
+}
+
+bool TsAssembler::checkContinuity(const TsPacket& packet) {
+    // Only packets with a payload increment the continuity counter
+    int last = mLastContinuityCounter;
+    mLastContinuityCounter = packet.continuityCounter;
+    if (last < 0 || packet.discontinuity) {
+        mDuplicateSeen = false;
+        return true;
+    }
+    if (packet.continuityCounter == last && !mDuplicateSeen) {
+        // A packet may be sent twice in a row
+        mDuplicateSeen = true;
+        return false;
+    }
+    mDuplicateSeen = false;
+    if (packet.continuityCounter != ((last + 1) & 0x0f)) {
+        ALOGV("[TsAssembler] pid %d continuity counter %d after %d", packet.pid,
+              packet.continuityCounter, last);
+        mStats.continuityErrors++;
+        if (mInUnit) {
+            dropUnit();
+        }
+    }
+    return true;
+}
+
+void TsAssembler::pushPes(const TsPacket& packet) {
+    if (packet.unitStart) {
+        if (mInUnit) {
+            // A PES packet of unbounded length ends where the next one starts
+            if (mExpectedSize == 0 && mSize >= PES_HEADER_SIZE) {
+                emitUnit();
+            } else {
+                dropUnit();
+            }
+        }
+        mInUnit = true;
+        mSize = 0;
+        mExpectedSize = 0;
+    } else if (!mInUnit) {
+        return;
+    }
+
+    size_t headerSize = mSize;
+    size_t size = std::min(packet.payloadSize, mBuffer.size() - mSize);
+    if (mExpectedSize > 0) {
+        size = std::min(size, mExpectedSize - mSize);
+    }
+    memcpy(mBuffer.data() + mSize, packet.payload, size);
+    mSize += size;
+
+    if (headerSize < PES_HEADER_SIZE && mSize >= PES_HEADER_SIZE) {
+        if (mBuffer[0] != 0 || mBuffer[1] != 0 || mBuffer[2] != 1) {
+            dropUnit();
+            return;
+        }
+        size_t length = (mBuffer[4] << 8) | mBuffer[5];
+        if (length > 0) {
+            mExpectedSize = PES_HEADER_SIZE + length;
+            if (mSize > mExpectedSize) {
+                // The rest of the payload is stuffing
+                mSize = mExpectedSize;
+            }
+        }
+    }
+
+    if (mExpectedSize > 0 && mSize == mExpectedSize) {
+        emitUnit();
+    } else if (mSize == mBuffer.size()) {
+        ALOGW("[TsAssembler] PES packet larger than %zu bytes dropped", mBuffer.size());
+        dropUnit();
+    }
+}
+
+void TsAssembler::pushSection(const TsPacket& packet) {
+    const uint8_t* data = packet.payload;
+    size_t size = packet.payloadSize;
+    if (!packet.unitStart) {
+        if (mInUnit) {
+            appendSections(data, size, false);
+        }
+        return;
+    }
+
+    // The pointer_field counts the bytes ending the previous section
+    size_t pointer = data[0];
+    if (1 + pointer > size) {
+        if (mInUnit) {
+            dropUnit();
+        }
+        return;
+    }
+    if (mInUnit) {
+        appendSections(data + 1, pointer, false);
+        if (mInUnit) {
+            dropUnit();
+        }
+    }
+    appendSections(data + 1 + pointer, size - 1 - pointer, true);
+}
+
+void TsAssembler::appendSections(const uint8_t* data, size_t size, bool startSections) {
+    while (size > 0) {
+        if (!mInUnit) {
+            // 0xff where a table_id is expected starts the stuffing up to the next packet
+            if (!startSections || data[0] == 0xff) {
+                return;
+            }
+            mInUnit = true;
+            mSize = 0;
+            mExpectedSize = 0;
+        }
+
+        size_t needed = mExpectedSize > 0 ? mExpectedSize - mSize : SECTION_HEADER_SIZE - mSize;
+        size_t chunk = std::min(size, needed);
+        memcpy(mBuffer.data() + mSize, data, chunk);
+        mSize += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (mExpectedSize == 0 && mSize == SECTION_HEADER_SIZE) {
+            mExpectedSize = SECTION_HEADER_SIZE + (((mBuffer[1] & 0x0f) << 8) | mBuffer[2]);
+            if (mExpectedSize > mBuffer.size()) {
+                dropUnit();
+                return;
+            }
+        }
+        if (mExpectedSize > 0 && mSize == mExpectedSize) {
+            // Only sections with section_syntax_indicator set end with a CRC_32
+            bool hasCrc = mBuffer[1] & 0x80;
+            if (mCheckCrc && hasCrc && crc32Mpeg2(mBuffer.data(), mSize) != 0) {
+                mStats.crcErrors++;
+                dropUnit();
+            } else {
+                emitUnit();
+            }
+        }
+    }
+}
+
+void TsAssembler::emitUnit() {
+    mStats.units++;
+    mOnUnit(mBuffer.data(), mSize);
+    mInUnit = false;
+    mSize = 0;
+    mExpectedSize = 0;
+}
+
+void TsAssembler::dropUnit() {
+    mStats.droppedUnits++;
+    mInUnit = false;
+    mSize = 0;
+    mExpectedSize = 0;
+}
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
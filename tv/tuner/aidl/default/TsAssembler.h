@@ -0,0 +1,118 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+const size_t TS_PACKET_SIZE = 188;
+
+struct TsPacket {
+    uint16_t pid;
+    bool unitStart;
+    // The discontinuity_indicator of the adaptation field
+    bool discontinuity;
+    uint8_t continuityCounter;
+    const uint8_t* payload;
+    size_t payloadSize;
+};
+
+/**
+ * Parse the header and adaptation field of a 188-byte TS packet.
+ *
+ * Return false for a packet without sync byte, with the transport error bit set or with a
+ * malformed adaptation field.
+ */
+bool parseTsPacket(const int8_t* data, TsPacket* packet);
+
+// CRC_32 of MPEG-2 sections. It is 0 over a whole section that ends with a valid CRC_32.
+uint32_t crc32Mpeg2(const uint8_t* data, size_t size);
+
+/**
+ * Reassembles the PES packets or the sections carried on one PID.
+ *
+ * All the memory is allocated when the assembler is created. Each unit is handed to the
+ * callback from the reassembly buffer once it is complete; it is only valid during the call.
+ * A gap in the continuity counters drops the unit in progress, and the assembler resumes at
+ * the next payload_unit_start_indicator.
+ */
+class TsAssembler {
+  public:
+    enum class Kind { PES, SECTION };
+
+    using UnitCallback = std::function<void(const uint8_t* data, size_t size)>;
+
+    struct Stats {
+        uint64_t packets = 0;
+        uint64_t units = 0;
+        uint64_t continuityErrors = 0;
+        uint64_t crcErrors = 0;
+        // Units lost to continuity errors, malformed headers or overflows
+        uint64_t droppedUnits = 0;
+    };
+
+    // PES packets with an unbounded length are limited to this size
+    static const size_t MAX_PES_SIZE = 1 << 20;
+    static const size_t MAX_SECTION_SIZE = 4096;
+
+    // Section CRCs are only checked with checkCrc
+    TsAssembler(Kind kind, bool checkCrc, UnitCallback onUnit);
+
+    // Feed TS packets of the assembled PID. A trailing partial packet is ignored.
+    void push(const int8_t* data, size_t size);
+    void reset();
+
+    const Stats& getStats() const { return mStats; }
+
+  private:
+    bool checkContinuity(const TsPacket& packet);
+    void pushPes(const TsPacket& packet);
+    void pushSection(const TsPacket& packet);
+    // Append section data, starting new sections if allowed. Stops at stuffing.
+    void appendSections(const uint8_t* data, size_t size, bool startSections);
+    void emitUnit();
+    void dropUnit();
+
+    const Kind mKind;
+    const bool mCheckCrc;
+    const UnitCallback mOnUnit;
+
+    std::vector<uint8_t> mBuffer;
+    size_t mSize = 0;
+    // Size of the unit in progress once its header is read, 0 before
+    size_t mExpectedSize = 0;
+    bool mInUnit = false;
+
+    int mLastContinuityCounter = -1;
+    bool mDuplicateSeen = false;
+
+    Stats mStats;
+};
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
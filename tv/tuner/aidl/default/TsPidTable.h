@@ -0,0 +1,131 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+
+/**
+ * Maps the 13-bit PID of a TS packet to the filters listening on it.
+ *
+ * The filters of all PIDs are kept in one array ordered by PID, and mStart[pid] is the index
+ * of the first filter of a PID, so a lookup is two loads instead of a scan of every filter.
+ * The table is rebuilt from scratch whenever the filters or their PIDs change.
+ */
+template <typename FilterT>
+class TsPidTable {
+  public:
+    static constexpr uint32_t kPidCount = 8192;
+
+    using Entry = std::pair<uint16_t, std::shared_ptr<FilterT>>;
+
+    TsPidTable() { mStart.fill(0); }
+
+    // Replace the table with the given (pid, filter) pairs. PIDs out of range are dropped.
+    void rebuild(const std::vector<Entry>& entries) {
+        std::array<uint32_t, kPidCount + 1> count{};
+        for (const auto& entry : entries) {
+            if (entry.first < kPidCount) {
+                count[entry.first + 1]++;
+            }
+        }
+        for (uint32_t pid = 0; pid < kPidCount; pid++) {
+            count[pid + 1] += count[pid];
+        }
+        mStart = count;
+
+        mFilters.assign(mStart[kPidCount], nullptr);
+        for (const auto& entry : entries) {
+            if (entry.first < kPidCount) {
+                mFilters[count[entry.first]++] = entry.second;
+            }
+        }
+    }
+
+    static uint16_t getPid(const int8_t* packet) {
+        return ((packet[1] & 0x1f) << 8) | (packet[2] & 0xff);
+    }
+
+    /**
+     * Call fn(FilterT&, const int8_t* packets, size_t size) for every filter on the PID of
+     * each run of consecutive packets sharing a PID. The packets are passed in place.
+     * A trailing partial packet is ignored.
+     */
+    template <typename Fn>
+    void dispatch(const int8_t* data, size_t size, size_t packetSize, Fn&& fn) const {
+        if (packetSize < 3) {
+            return;
+        }
+        const int8_t* end = data + size / packetSize * packetSize;
+        const int8_t* run = data;
+        uint16_t runPid = 0;
+        for (const int8_t* packet = data; packet < end; packet += packetSize) {
+            uint16_t pid = getPid(packet);
+            if (packet != run && pid != runPid) {
+                deliver(runPid, run, packet - run, fn);
+                run = packet;
+            }
+            runPid = pid;
+        }
+        if (run < end) {
+            deliver(runPid, run, end - run, fn);
+        }
+    }
+
+    bool hasFilters(uint16_t pid) const { return mStart[pid] != mStart[pid + 1]; }
+
+    // Call fn(FilterT&) for every filter on the PID
+    template <typename Fn>
+    void forEachFilter(uint16_t pid, Fn&& fn) const {
+        for (uint32_t i = mStart[pid]; i < mStart[pid + 1]; i++) {
+            fn(*mFilters[i]);
+        }
+    }
+
+    // Call fn(FilterT&) for every entry of the table
+    template <typename Fn>
+    void forEachFilter(Fn&& fn) const {
+        for (const auto& filter : mFilters) {
+            fn(*filter);
+        }
+    }
+
+  private:
+    template <typename Fn>
+    void deliver(uint16_t pid, const int8_t* packets, size_t size, Fn& fn) const {
+        forEachFilter(pid, [&](FilterT& filter) { fn(filter, packets, size); });
+    }
+
+    std::array<uint32_t, kPidCount + 1> mStart;
+    std::vector<std::shared_ptr<FilterT>> mFilters;
+};
+
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/benchmark.h"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "TsPidTable.h"
+
+using ::aidl::android::hardware::tv::tuner::TsPidTable;
+using ::benchmark::Counter;
+using ::benchmark::State;
+
+namespace {
+
+constexpr size_t kPacketSize = 188;
+// Enough packets for about 60 ms of a 100 Mbit/s stream
+constexpr size_t kPacketCount = 4096;
+
+// Stands in for a playback Filter, which appends the packets to its output buffer
+struct Sink {
+    uint16_t pid;
+    std::mutex lock;
+    std::vector<int8_t> output;
+
+    void update(const int8_t* data, size_t size) {
+        std::lock_guard<std::mutex> guard(lock);
+        output.insert(output.end(), data, data + size);
+    }
+};
+
+// A multiplex of several programs, each with video, audio, PMT and subtitle PIDs, plus the
+// PAT and null packets. Video carries most of the packets, as in a broadcast stream.
+class Multiplex {
+  public:
+    explicit Multiplex(int programs) : mData(kPacketCount * kPacketSize) {
+        std::vector<std::pair<uint16_t, int>> weights = {{0x0000, 1}, {0x1fff, 20}};
+        for (int i = 0; i < programs; i++) {
+            uint16_t base = 0x100 + i * 0x10;
+            weights.push_back({base, 2});       // PMT
+            weights.push_back({base + 1, 80});  // video
+            weights.push_back({base + 2, 10});  // audio
+            weights.push_back({base + 3, 2});   // subtitles
+            mPids.push_back(base);
+            mPids.push_back(base + 1);
+            mPids.push_back(base + 2);
+            mPids.push_back(base + 3);
+        }
+
+        std::vector<int> distribution;
+        for (const auto& weight : weights) {
+            distribution.push_back(weight.second);
+        }
+        std::mt19937 rng(42);
+        std::discrete_distribution<size_t> pick(distribution.begin(), distribution.end());
+        for (size_t i = 0; i < kPacketCount; i++) {
+            int8_t* packet = mData.data() + i * kPacketSize;
+            uint16_t pid = weights[pick(rng)].first;
+            packet[0] = 0x47;
+            packet[1] = (pid >> 8) & 0x1f;
+            packet[2] = pid & 0xff;
+            packet[3] = 0x10 | (i & 0x0f);
+        }
+    }
+
+    const std::vector<int8_t>& data() const { return mData; }
+    // The PIDs the filters listen on
+    const std::vector<uint16_t>& pids() const { return mPids; }
+
+  private:
+    std::vector<int8_t> mData;
+    std::vector<uint16_t> mPids;
+};
+
+void setCounters(State& state, size_t bytesPerIteration) {
+    state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+    state.counters["bits_per_second"] = Counter(state.iterations() * bytesPerIteration * 8,
+                                                Counter::kIsRate, Counter::OneK::kIs1000);
+}
+
+// The PID table dispatching whole FMQ spans in place
+void BM_PidTable(State& state) {
+    Multiplex multiplex(state.range(0) / 4);
+    std::vector<std::shared_ptr<Sink>> sinks;
+    std::vector<TsPidTable<Sink>::Entry> entries;
+    for (uint16_t pid : multiplex.pids()) {
+        sinks.push_back(std::make_shared<Sink>());
+        sinks.back()->pid = pid;
+        entries.emplace_back(pid, sinks.back());
+    }
+    TsPidTable<Sink> table;
+    table.rebuild(entries);
+
+    const std::vector<int8_t>& data = multiplex.data();
+    for (auto _ : state) {
+        table.dispatch(data.data(), data.size(), kPacketSize,
+                       [](Sink& sink, const int8_t* packets, size_t size) {
+                           sink.update(packets, size);
+                       });
+        for (auto& sink : sinks) {
+            sink->output.clear();
+        }
+    }
+    setCounters(state, data.size());
+}
+BENCHMARK(BM_PidTable)->Arg(8)->Arg(32)->Arg(64);
+
+// The previous dispatch: one packet copy and a scan of every filter per packet
+void BM_FilterScan(State& state) {
+    Multiplex multiplex(state.range(0) / 4);
+    std::map<int64_t, std::shared_ptr<Sink>> filters;
+    std::set<int64_t> filterIds;
+    for (uint16_t pid : multiplex.pids()) {
+        int64_t id = filters.size();
+        filters[id] = std::make_shared<Sink>();
+        filters[id]->pid = pid;
+        filterIds.insert(id);
+    }
+
+    const std::vector<int8_t>& data = multiplex.data();
+    std::vector<int8_t> packet(kPacketSize);
+    for (auto _ : state) {
+        for (size_t offset = 0; offset < data.size(); offset += kPacketSize) {
+            memcpy(packet.data(), data.data() + offset, kPacketSize);
+            std::vector<int8_t> copy = packet;
+            uint16_t pid = TsPidTable<Sink>::getPid(copy.data());
+            for (int64_t id : filterIds) {
+                if (pid == filters[id]->pid) {
+                    filters[id]->update(copy.data(), copy.size());
+                }
+            }
+        }
+        for (auto& filter : filters) {
+            filter.second->output.clear();
+        }
+    }
+    setCounters(state, data.size());
+}
+BENCHMARK(BM_FilterScan)->Arg(8)->Arg(32)->Arg(64);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "AvBufferPool.h"
+
+namespace {
+
+using ::aidl::android::hardware::tv::tuner::AvBufferAllocator;
+using ::aidl::android::hardware::tv::tuner::AvBufferPool;
+
+constexpr size_t kMinSize = AvBufferPool::MIN_BUFFER_SIZE;
+constexpr size_t kMaxBuffers = AvBufferPool::MAX_POOLED_BUFFERS;
+
+// What the fake allocator did, kept outside of it as the pool owns the allocator
+struct Allocations {
+    std::vector<size_t> sizes;
+    std::vector<int> fds;
+    bool fail = false;
+};
+
+// Allocates memfds instead of DMA-BUFs
+class FakeAllocator : public AvBufferAllocator {
+  public:
+    explicit FakeAllocator(Allocations* allocations) : mAllocations(allocations) {}
+
+    int allocate(size_t size) override {
+        if (mAllocations->fail) {
+            return -ENOMEM;
+        }
+        int fd = memfd_create("AvBufferPool_test", MFD_CLOEXEC);
+        if (fd < 0) {
+            return -errno;
+        }
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            return -errno;
+        }
+        mAllocations->sizes.push_back(size);
+        mAllocations->fds.push_back(fd);
+        return fd;
+    }
+
+  private:
+    Allocations* const mAllocations;
+};
+
+bool isOpen(int fd) {
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+class AvBufferPoolTest : public ::testing::Test {
+  protected:
+    const native_handle_t* write(uint64_t dataId, size_t size) {
+        std::vector<uint8_t> data(size, static_cast<uint8_t>(dataId));
+        return mPool.write(dataId, data.data(), data.size());
+    }
+
+    Allocations mAllocations;
+    AvBufferPool mPool{std::make_unique<FakeAllocator>(&mAllocations)};
+};
+
+TEST_F(AvBufferPoolTest, writeCopiesIntoSharedBuffer) {
+    const uint8_t data[] = {1, 2, 3, 4};
+    const native_handle_t* handle = mPool.write(7, data, sizeof(data));
+    ASSERT_NE(nullptr, handle);
+    ASSERT_EQ(1, handle->numFds);
+    // Buffers are never smaller than the minimum
+    EXPECT_EQ(std::vector<size_t>({kMinSize}), mAllocations.sizes);
+
+    void* mapped = mmap(nullptr, sizeof(data), PROT_READ, MAP_SHARED, handle->data[0], 0);
+    ASSERT_NE(MAP_FAILED, mapped);
+    EXPECT_EQ(0, memcmp(data, mapped, sizeof(data)));
+    munmap(mapped, sizeof(data));
+}
+
+TEST_F(AvBufferPoolTest, releasedBufferIsReused) {
+    const native_handle_t* first = write(1, 100);
+    ASSERT_NE(nullptr, first);
+    EXPECT_TRUE(mPool.release(1));
+    EXPECT_FALSE(mPool.release(1));
+
+    EXPECT_EQ(first, write(2, 200));
+    EXPECT_EQ(1u, mAllocations.sizes.size());
+    AvBufferPool::Stats stats = mPool.getStats();
+    EXPECT_EQ(1u, stats.reuses);
+    EXPECT_EQ(1u, stats.pooledBuffers);
+    EXPECT_EQ(kMinSize, stats.pooledBytes);
+    EXPECT_EQ(1u, stats.buffersInUse);
+}
+
+TEST_F(AvBufferPoolTest, smallestFreeBufferThatFits) {
+    const native_handle_t* small = write(1, kMinSize);
+    const native_handle_t* large = write(2, 3 * kMinSize);
+    const native_handle_t* medium = write(3, 2 * kMinSize);
+    ASSERT_NE(nullptr, small);
+    ASSERT_NE(nullptr, large);
+    ASSERT_NE(nullptr, medium);
+    EXPECT_TRUE(mPool.release(1));
+    EXPECT_TRUE(mPool.release(2));
+    EXPECT_TRUE(mPool.release(3));
+
+    EXPECT_EQ(medium, write(4, kMinSize + 1));
+    EXPECT_EQ(small, write(5, kMinSize));
+    EXPECT_EQ(large, write(6, 1));
+    EXPECT_EQ(3u, mAllocations.sizes.size());
+}
+
+TEST_F(AvBufferPoolTest, fullPoolReallocatesLargestFreeBuffer) {
+    mPool.preallocate(kMaxBuffers + 1, kMinSize);
+    ASSERT_EQ(kMaxBuffers, mAllocations.sizes.size());
+    // Nothing fits, the pool is full: one free buffer is grown
+    ASSERT_NE(nullptr, write(1, 2 * kMinSize));
+    EXPECT_TRUE(mPool.release(1));
+    // The grown buffer is the largest free one and is grown again
+    ASSERT_NE(nullptr, write(2, 3 * kMinSize));
+
+    AvBufferPool::Stats stats = mPool.getStats();
+    EXPECT_EQ(2u, stats.reallocations);
+    EXPECT_EQ(kMaxBuffers, stats.pooledBuffers);
+    EXPECT_EQ((kMaxBuffers - 1) * kMinSize + 3 * kMinSize, stats.pooledBytes);
+    EXPECT_EQ(0u, stats.overflowAllocations);
+    // The replaced buffers are freed
+    EXPECT_FALSE(isOpen(mAllocations.fds[kMaxBuffers]));
+    EXPECT_TRUE(isOpen(mAllocations.fds[kMaxBuffers + 1]));
+}
+
+TEST_F(AvBufferPoolTest, overflowBufferIsFreedOnRelease) {
+    for (uint64_t dataId = 0; dataId < kMaxBuffers; dataId++) {
+        ASSERT_NE(nullptr, write(dataId, 1));
+    }
+    const native_handle_t* overflow = write(kMaxBuffers, 1);
+    ASSERT_NE(nullptr, overflow);
+    const int overflowFd = mAllocations.fds.back();
+
+    AvBufferPool::Stats stats = mPool.getStats();
+    EXPECT_EQ(1u, stats.overflowAllocations);
+    EXPECT_EQ(kMaxBuffers, stats.pooledBuffers);
+    EXPECT_EQ(kMaxBuffers + 1, stats.buffersInUse);
+    EXPECT_EQ(kMaxBuffers + 1, stats.peakBuffersInUse);
+
+    EXPECT_TRUE(mPool.release(kMaxBuffers));
+    EXPECT_FALSE(isOpen(overflowFd));
+    stats = mPool.getStats();
+    EXPECT_EQ(kMaxBuffers, stats.buffersInUse);
+    EXPECT_EQ(kMaxBuffers + 1, stats.peakBuffersInUse);
+
+    // Pooled buffers stay allocated
+    EXPECT_TRUE(mPool.release(0));
+    EXPECT_TRUE(isOpen(mAllocations.fds[0]));
+}
+
+TEST_F(AvBufferPoolTest, allocationFailure) {
+    mAllocations.fail = true;
+    EXPECT_EQ(nullptr, write(1, 1));
+    // Once for the pool, once for an overflow buffer
+    EXPECT_EQ(2u, mPool.getStats().allocationFailures);
+    EXPECT_FALSE(mPool.release(1));
+
+    mAllocations.fail = false;
+    EXPECT_NE(nullptr, write(2, 1));
+    EXPECT_EQ(0u, mPool.getStats().overflowAllocations);
+}
+
+TEST(AvBufferPoolDestructionTest, freesAllBuffers) {
+    Allocations allocations;
+    {
+        AvBufferPool pool(std::make_unique<FakeAllocator>(&allocations));
+        for (uint64_t dataId = 0; dataId <= kMaxBuffers; dataId++) {
+            ASSERT_NE(nullptr, pool.write(dataId, nullptr, 0));
+        }
+    }
+    ASSERT_EQ(kMaxBuffers + 1, allocations.fds.size());
+    for (int fd : allocations.fds) {
+        EXPECT_FALSE(isOpen(fd));
+    }
+}
+
+}  // namespace
@@ -0,0 +1,448 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "TsAssembler.h"
+
+namespace {
+
+using ::aidl::android::hardware::tv::tuner::crc32Mpeg2;
+using ::aidl::android::hardware::tv::tuner::TS_PACKET_SIZE;
+using ::aidl::android::hardware::tv::tuner::TsAssembler;
+
+using Bytes = std::vector<uint8_t>;
+
+constexpr uint16_t kPid = 0x123;
+constexpr size_t kMaxPayloadSize = TS_PACKET_SIZE - 4;
+
+// Writes the TS packets of one PID, with consecutive continuity counters
+class TsWriter {
+  public:
+    struct Options {
+        bool unitStart = false;
+        bool discontinuity = false;
+        // Keep the continuity counter of the previous packet, as a duplicate does
+        bool repeatCounter = false;
+    };
+
+    // A packet with the given payload, preceded by an adaptation field that stuffs the
+    // packet when the payload is short
+    void packet(const Bytes& payload, const Options& options) {
+        EXPECT_LE(payload.size(), kMaxPayloadSize - (options.discontinuity ? 2 : 0));
+        const size_t stuffing = kMaxPayloadSize - payload.size();
+        const bool adaptation = stuffing > 0 || options.discontinuity;
+        header(options, adaptation ? 0x30 : 0x10);
+        if (adaptation) {
+            adaptationField(stuffing - 1, options.discontinuity);
+        }
+        mData.insert(mData.end(), payload.begin(), payload.end());
+    }
+
+    // A packet with an adaptation field and no payload, which doesn't count for continuity
+    void adaptationOnly() {
+        Options options;
+        options.repeatCounter = true;
+        header(options, 0x20);
+        adaptationField(kMaxPayloadSize - 1, false);
+    }
+
+    // Split a unit in as many packets as needed, the first one with unitStart set
+    void unit(const Bytes& unit) {
+        for (size_t offset = 0; offset < unit.size(); offset += kMaxPayloadSize) {
+            Options options;
+            options.unitStart = offset == 0;
+            const size_t size = std::min(kMaxPayloadSize, unit.size() - offset);
+            packet(Bytes(unit.begin() + offset, unit.begin() + offset + size), options);
+        }
+    }
+
+    // Section packets carry a pointer_field when a section starts in them, and are
+    // stuffed with 0xff after the last section
+    void sectionPacket(const Bytes& payload, int pointer) {
+        Bytes full;
+        if (pointer >= 0) {
+            full.push_back(static_cast<uint8_t>(pointer));
+        }
+        full.insert(full.end(), payload.begin(), payload.end());
+        EXPECT_LE(full.size(), kMaxPayloadSize);
+        full.resize(kMaxPayloadSize, 0xff);
+        Options options;
+        options.unitStart = pointer >= 0;
+        packet(full, options);
+    }
+
+    const int8_t* data() const { return mData.data(); }
+    size_t size() const { return mData.size(); }
+    size_t packetCount() const { return mData.size() / TS_PACKET_SIZE; }
+    // The data of one packet, to send it again or drop it
+    std::vector<int8_t> takePacket(size_t index) {
+        auto begin = mData.begin() + index * TS_PACKET_SIZE;
+        std::vector<int8_t> packet(begin, begin + TS_PACKET_SIZE);
+        mData.erase(begin, begin + TS_PACKET_SIZE);
+        return packet;
+    }
+    void append(const std::vector<int8_t>& data) {
+        mData.insert(mData.end(), data.begin(), data.end());
+    }
+
+  private:
+    void header(const Options& options, uint8_t adaptationFieldControl) {
+        if (!options.repeatCounter) {
+            mCounter = (mCounter + 1) & 0x0f;
+        }
+        mData.push_back(0x47);
+        mData.push_back(static_cast<int8_t>((options.unitStart ? 0x40 : 0) | (kPid >> 8)));
+        mData.push_back(static_cast<int8_t>(kPid & 0xff));
+        mData.push_back(static_cast<int8_t>(adaptationFieldControl | mCounter));
+    }
+
+    void adaptationField(size_t length, bool discontinuity) {
+        mData.push_back(static_cast<int8_t>(length));
+        if (length > 0) {
+            mData.push_back(static_cast<int8_t>(discontinuity ? 0x80 : 0));
+            mData.insert(mData.end(), length - 1, static_cast<int8_t>(0xff));
+        }
+    }
+
+    std::vector<int8_t> mData;
+    uint8_t mCounter = 0x0f;
+};
+
+Bytes makePattern(size_t size, uint8_t seed) {
+    Bytes data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<uint8_t>(seed + i * 7);
+    }
+    return data;
+}
+
+// A PES packet of a video stream, with PES_packet_length 0 if unbounded
+Bytes makePes(size_t payloadSize, bool bounded, uint8_t seed = 0) {
+    Bytes pes = {0x00, 0x00, 0x01, 0xe0, 0x00, 0x00};
+    Bytes payload = makePattern(payloadSize, seed);
+    pes.insert(pes.end(), payload.begin(), payload.end());
+    if (bounded) {
+        pes[4] = static_cast<uint8_t>(payloadSize >> 8);
+        pes[5] = static_cast<uint8_t>(payloadSize & 0xff);
+    }
+    return pes;
+}
+
+// A section with section_syntax_indicator set, ending with its CRC_32
+Bytes makeSection(uint8_t tableId, size_t bodySize) {
+    const size_t sectionLength = bodySize + 4;
+    Bytes section = {tableId, static_cast<uint8_t>(0xb0 | (sectionLength >> 8)),
+                     static_cast<uint8_t>(sectionLength & 0xff)};
+    Bytes body = makePattern(bodySize, tableId);
+    section.insert(section.end(), body.begin(), body.end());
+    const uint32_t crc = crc32Mpeg2(section.data(), section.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        section.push_back(static_cast<uint8_t>(crc >> shift));
+    }
+    return section;
+}
+
+Bytes concat(const Bytes& a, const Bytes& b) {
+    Bytes out = a;
+    out.insert(out.end(), b.begin(), b.end());
+    return out;
+}
+
+class TsAssemblerTest : public ::testing::Test {
+  protected:
+    TsAssembler makeAssembler(TsAssembler::Kind kind, bool checkCrc = true) {
+        return TsAssembler(kind, checkCrc,
+                           [this](const uint8_t* data, size_t size) {
+                               mUnits.emplace_back(data, data + size);
+                           });
+    }
+
+    std::vector<Bytes> mUnits;
+};
+
+TEST(TsAssemblerCrcTest, validSectionHasZeroCrc) {
+    Bytes section = makeSection(0x42, 20);
+    EXPECT_EQ(0u, crc32Mpeg2(section.data(), section.size()));
+    section[5] ^= 1;
+    EXPECT_NE(0u, crc32Mpeg2(section.data(), section.size()));
+}
+
+TEST_F(TsAssemblerTest, adaptationFields) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(400, true);
+    TsWriter writer;
+    // the last packet of the unit has a stuffing adaptation field and a payload
+    writer.unit(Bytes(pes.begin(), pes.begin() + 2 * kMaxPayloadSize));
+    writer.adaptationOnly();
+    writer.packet(Bytes(pes.begin() + 2 * kMaxPayloadSize, pes.end()), {});
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(pes, mUnits[0]);
+    EXPECT_EQ(4u, assembler.getStats().packets);
+    EXPECT_EQ(0u, assembler.getStats().continuityErrors);
+}
+
+TEST_F(TsAssemblerTest, duplicatePacketIsSkipped) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(500, true);
+    TsWriter writer;
+    writer.unit(pes);
+    std::vector<int8_t> last = writer.takePacket(writer.packetCount() - 1);
+    std::vector<int8_t> middle = writer.takePacket(1);
+    writer.append(middle);
+    writer.append(middle);
+    writer.append(last);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(pes, mUnits[0]);
+    EXPECT_EQ(0u, assembler.getStats().continuityErrors);
+
+    // A third copy is not a duplicate any more
+    assembler.reset();
+    mUnits.clear();
+    TsWriter tripled;
+    tripled.unit(pes);
+    last = tripled.takePacket(tripled.packetCount() - 1);
+    middle = tripled.takePacket(1);
+    tripled.append(middle);
+    tripled.append(middle);
+    tripled.append(middle);
+    tripled.append(last);
+    assembler.push(tripled.data(), tripled.size());
+    EXPECT_TRUE(mUnits.empty());
+    EXPECT_EQ(1u, assembler.getStats().continuityErrors);
+}
+
+TEST_F(TsAssemblerTest, continuityGapDropsUnit) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes first = makePes(500, true, 1);
+    const Bytes second = makePes(300, true, 2);
+    TsWriter writer;
+    writer.unit(first);
+    writer.unit(second);
+    writer.takePacket(1);
+    assembler.push(writer.data(), writer.size());
+
+    // The rest of the first unit is ignored until the next one starts
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(second, mUnits[0]);
+    EXPECT_EQ(1u, assembler.getStats().continuityErrors);
+    EXPECT_EQ(1u, assembler.getStats().droppedUnits);
+    EXPECT_EQ(1u, assembler.getStats().units);
+}
+
+TEST_F(TsAssemblerTest, discontinuityIndicatorAllowsGap) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(100, true);
+    TsWriter writer;
+    writer.unit(pes);
+    writer.unit(pes);
+    writer.takePacket(1);
+    // The counter of this packet doesn't follow the first one
+    TsWriter::Options options;
+    options.unitStart = true;
+    options.discontinuity = true;
+    writer.packet(pes, options);
+    assembler.push(writer.data(), writer.size());
+
+    EXPECT_EQ(2u, mUnits.size());
+    EXPECT_EQ(0u, assembler.getStats().continuityErrors);
+}
+
+TEST_F(TsAssemblerTest, sectionsAfterPointerField) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    const Bytes longSection = makeSection(0x42, 250);
+    const Bytes a = makeSection(0x4e, 10);
+    const Bytes b = makeSection(0x4f, 20);
+    TsWriter writer;
+    // The long section starts right after the pointer_field of the first packet
+    const size_t firstPart = kMaxPayloadSize - 1;
+    writer.sectionPacket(Bytes(longSection.begin(), longSection.begin() + firstPart), 0);
+    // The second packet ends it, then carries two more sections and stuffing
+    const Bytes tail(longSection.begin() + firstPart, longSection.end());
+    writer.sectionPacket(concat(concat(tail, a), b), tail.size());
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(3u, mUnits.size());
+    EXPECT_EQ(longSection, mUnits[0]);
+    EXPECT_EQ(a, mUnits[1]);
+    EXPECT_EQ(b, mUnits[2]);
+    EXPECT_EQ(0u, assembler.getStats().droppedUnits);
+}
+
+TEST_F(TsAssemblerTest, sectionWithoutUnitStartIsIgnored) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    const Bytes section = makeSection(0x42, 10);
+    TsWriter writer;
+    // Joining the PID in the middle of a section, before any pointer_field
+    writer.sectionPacket(section, -1);
+    writer.sectionPacket(section, 0);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(section, mUnits[0]);
+}
+
+TEST_F(TsAssemblerTest, invalidPointerFieldDropsSection) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    const Bytes section = makeSection(0x42, 250);
+    TsWriter writer;
+    writer.sectionPacket(Bytes(section.begin(), section.begin() + kMaxPayloadSize - 1), 0);
+    // pointer_field past the end of the payload
+    Bytes payload(kMaxPayloadSize - 1, 0xff);
+    writer.sectionPacket(payload, kMaxPayloadSize);
+    assembler.push(writer.data(), writer.size());
+
+    EXPECT_TRUE(mUnits.empty());
+    EXPECT_EQ(1u, assembler.getStats().droppedUnits);
+}
+
+TEST_F(TsAssemblerTest, crcMismatchDropsSection) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    Bytes corrupted = makeSection(0x42, 30);
+    corrupted[10] ^= 0x55;
+    const Bytes valid = makeSection(0x43, 30);
+    TsWriter writer;
+    writer.sectionPacket(concat(corrupted, valid), 0);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(valid, mUnits[0]);
+    EXPECT_EQ(1u, assembler.getStats().crcErrors);
+    EXPECT_EQ(1u, assembler.getStats().droppedUnits);
+
+    // Without CRC check the corrupted section is delivered
+    mUnits.clear();
+    TsAssembler unchecked = makeAssembler(TsAssembler::Kind::SECTION, false /* checkCrc */);
+    unchecked.push(writer.data(), writer.size());
+    ASSERT_EQ(2u, mUnits.size());
+    EXPECT_EQ(corrupted, mUnits[0]);
+    EXPECT_EQ(0u, unchecked.getStats().crcErrors);
+}
+
+TEST_F(TsAssemblerTest, shortSectionIsNotCrcChecked) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    // section_syntax_indicator clear: no CRC_32 at the end
+    const Bytes section = {0x70, 0x70, 0x05, 0x01, 0x02, 0x03, 0x04, 0x05};
+    TsWriter writer;
+    writer.sectionPacket(section, 0);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(section, mUnits[0]);
+}
+
+TEST_F(TsAssemblerTest, oversizeSectionIsDropped) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::SECTION);
+    // section_length 0xfff exceeds MAX_SECTION_SIZE with the header
+    TsWriter writer;
+    writer.sectionPacket({0x42, 0xbf, 0xff, 0x00}, 0);
+    const Bytes section = makeSection(0x43, 10);
+    writer.sectionPacket(section, 0);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(section, mUnits[0]);
+    EXPECT_EQ(1u, assembler.getStats().droppedUnits);
+}
+
+TEST_F(TsAssemblerTest, boundedPes) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(1000, true);
+    TsWriter writer;
+    writer.unit(pes);
+    assembler.push(writer.data(), writer.size());
+
+    // Delivered once complete, without waiting for the next unit
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(pes, mUnits[0]);
+}
+
+TEST_F(TsAssemblerTest, boundedPesIgnoresStuffing) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(100, true);
+    TsWriter writer;
+    // stuffing in the payload instead of the adaptation field
+    Bytes payload = pes;
+    payload.resize(kMaxPayloadSize, 0xff);
+    TsWriter::Options options;
+    options.unitStart = true;
+    writer.packet(payload, options);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(pes, mUnits[0]);
+}
+
+TEST_F(TsAssemblerTest, unboundedPesEndsAtNextUnit) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes first = makePes(1000, false, 1);
+    const Bytes second = makePes(200, false, 2);
+    const Bytes third = makePes(10, true, 3);
+    TsWriter writer;
+    writer.unit(first);
+    const size_t firstSize = writer.size();
+    writer.unit(second);
+    writer.unit(third);
+
+    // Nothing tells that the first unit is complete before the second one starts
+    assembler.push(writer.data(), firstSize);
+    EXPECT_TRUE(mUnits.empty());
+    assembler.push(writer.data() + firstSize, writer.size() - firstSize);
+    ASSERT_EQ(3u, mUnits.size());
+    EXPECT_EQ(first, mUnits[0]);
+    EXPECT_EQ(second, mUnits[1]);
+    EXPECT_EQ(third, mUnits[2]);
+}
+
+TEST_F(TsAssemblerTest, oversizePesIsDropped) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes big = makePes(TsAssembler::MAX_PES_SIZE, false);
+    const Bytes small = makePes(100, true);
+    TsWriter writer;
+    writer.unit(big);
+    writer.unit(small);
+    assembler.push(writer.data(), writer.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(small, mUnits[0]);
+    EXPECT_EQ(1u, assembler.getStats().droppedUnits);
+}
+
+TEST_F(TsAssemblerTest, malformedAndPartialPacketsAreSkipped) {
+    TsAssembler assembler = makeAssembler(TsAssembler::Kind::PES);
+    const Bytes pes = makePes(100, true);
+    TsWriter writer;
+    writer.unit(pes);
+    std::vector<int8_t> packet = writer.takePacket(0);
+    std::vector<int8_t> data = packet;
+    data[0] = 0x48;  // no sync byte
+    data.insert(data.end(), packet.begin(), packet.end());
+    data.insert(data.end(), packet.begin(), packet.begin() + 100);
+    assembler.push(data.data(), data.size());
+
+    ASSERT_EQ(1u, mUnits.size());
+    EXPECT_EQ(pes, mUnits[0]);
+    EXPECT_EQ(1u, assembler.getStats().packets);
+}
+
+}  // namespace
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "TsPidTable.h"
+
+namespace {
+
+using ::aidl::android::hardware::tv::tuner::TsPidTable;
+
+constexpr size_t kPacketSize = 188;
+
+struct FakeFilter {
+    explicit FakeFilter(int id) : id(id) {}
+
+    const int id;
+};
+
+using Table = TsPidTable<FakeFilter>;
+
+// One call of the dispatch callback
+struct Delivery {
+    int filterId;
+    size_t offset;  // of the first packet in the stream
+    size_t size;
+
+    bool operator==(const Delivery& other) const {
+        return filterId == other.filterId && offset == other.offset && size == other.size;
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, const Delivery& d) {
+    return os << "{filter " << d.filterId << ", offset " << d.offset << ", size " << d.size
+              << "}";
+}
+
+// A stream of TS packets with the given PIDs
+std::vector<int8_t> makeStream(const std::vector<uint16_t>& pids,
+                               size_t packetSize = kPacketSize) {
+    std::vector<int8_t> stream(pids.size() * packetSize, 0);
+    for (size_t i = 0; i < pids.size(); i++) {
+        int8_t* packet = stream.data() + i * packetSize;
+        packet[0] = 0x47;
+        // keep the error and PUSI bits set to check they are masked out of the PID
+        packet[1] = static_cast<int8_t>(0xe0 | (pids[i] >> 8));
+        packet[2] = static_cast<int8_t>(pids[i] & 0xff);
+        packet[3] = static_cast<int8_t>(0x10 | (i & 0x0f));
+    }
+    return stream;
+}
+
+std::vector<Delivery> dispatch(const Table& table, const std::vector<int8_t>& stream,
+                               size_t size, size_t packetSize = kPacketSize) {
+    std::vector<Delivery> deliveries;
+    table.dispatch(stream.data(), size, packetSize,
+                   [&](FakeFilter& filter, const int8_t* packets, size_t packetsSize) {
+                       deliveries.push_back(
+                               {filter.id, static_cast<size_t>(packets - stream.data()),
+                                packetsSize});
+                   });
+    return deliveries;
+}
+
+std::vector<int> filtersOf(const Table& table, uint16_t pid) {
+    std::vector<int> ids;
+    table.forEachFilter(pid, [&](FakeFilter& filter) { ids.push_back(filter.id); });
+    return ids;
+}
+
+TEST(TsPidTableTest, getPidMasksFlags) {
+    std::vector<int8_t> stream = makeStream({0x1fff, 0, 0x123});
+    EXPECT_EQ(0x1fff, Table::getPid(stream.data()));
+    EXPECT_EQ(0, Table::getPid(stream.data() + kPacketSize));
+    EXPECT_EQ(0x123, Table::getPid(stream.data() + 2 * kPacketSize));
+}
+
+TEST(TsPidTableTest, severalFiltersOnOnePid) {
+    auto a = std::make_shared<FakeFilter>(1);
+    auto b = std::make_shared<FakeFilter>(2);
+    auto c = std::make_shared<FakeFilter>(3);
+    Table table;
+    table.rebuild({{0x100, a}, {0x200, b}, {0x100, c}});
+
+    EXPECT_TRUE(table.hasFilters(0x100));
+    EXPECT_TRUE(table.hasFilters(0x200));
+    EXPECT_FALSE(table.hasFilters(0x101));
+    // in the order of the entries
+    EXPECT_EQ(std::vector<int>({1, 3}), filtersOf(table, 0x100));
+    EXPECT_EQ(std::vector<int>({2}), filtersOf(table, 0x200));
+
+    std::vector<int8_t> stream = makeStream({0x100, 0x100});
+    EXPECT_EQ(std::vector<Delivery>({{1, 0, 2 * kPacketSize}, {3, 0, 2 * kPacketSize}}),
+              dispatch(table, stream, stream.size()));
+}
+
+TEST(TsPidTableTest, pidRange) {
+    auto last = std::make_shared<FakeFilter>(1);
+    auto first = std::make_shared<FakeFilter>(2);
+    auto outOfRange = std::make_shared<FakeFilter>(3);
+    Table table;
+    table.rebuild({{0x1fff, last},
+                   {0, first},
+                   {Table::kPidCount, outOfRange},
+                   {0xffff, outOfRange}});
+
+    EXPECT_EQ(std::vector<int>({2}), filtersOf(table, 0));
+    EXPECT_EQ(std::vector<int>({1}), filtersOf(table, 0x1fff));
+    // PIDs out of range are dropped
+    std::vector<int> all;
+    table.forEachFilter([&](FakeFilter& filter) { all.push_back(filter.id); });
+    EXPECT_EQ(std::vector<int>({2, 1}), all);
+
+    std::vector<int8_t> stream = makeStream({0x1fff, 0, 0x1fff});
+    EXPECT_EQ(std::vector<Delivery>({{1, 0, kPacketSize},
+                                     {2, kPacketSize, kPacketSize},
+                                     {1, 2 * kPacketSize, kPacketSize}}),
+              dispatch(table, stream, stream.size()));
+}
+
+TEST(TsPidTableTest, runsSplitBetweenPids) {
+    auto a = std::make_shared<FakeFilter>(1);
+    auto b = std::make_shared<FakeFilter>(2);
+    Table table;
+    table.rebuild({{0x10, a}, {0x20, b}});
+
+    // the packets of PID 0x30 have no filter and are skipped
+    std::vector<int8_t> stream =
+            makeStream({0x10, 0x10, 0x10, 0x20, 0x30, 0x30, 0x10, 0x20, 0x20});
+    EXPECT_EQ(std::vector<Delivery>({{1, 0, 3 * kPacketSize},
+                                     {2, 3 * kPacketSize, kPacketSize},
+                                     {1, 6 * kPacketSize, kPacketSize},
+                                     {2, 7 * kPacketSize, 2 * kPacketSize}}),
+              dispatch(table, stream, stream.size()));
+}
+
+TEST(TsPidTableTest, trailingPartialPacketIsIgnored) {
+    auto a = std::make_shared<FakeFilter>(1);
+    auto b = std::make_shared<FakeFilter>(2);
+    Table table;
+    table.rebuild({{0x10, a}, {0x20, b}});
+
+    std::vector<int8_t> stream = makeStream({0x10, 0x10, 0x20});
+    EXPECT_EQ(std::vector<Delivery>({{1, 0, 2 * kPacketSize}}),
+              dispatch(table, stream, 3 * kPacketSize - 1));
+    EXPECT_TRUE(dispatch(table, stream, kPacketSize - 1).empty());
+    EXPECT_TRUE(dispatch(table, stream, 0).empty());
+}
+
+TEST(TsPidTableTest, otherPacketSizes) {
+    auto a = std::make_shared<FakeFilter>(1);
+    Table table;
+    table.rebuild({{0x10, a}});
+
+    // 192 byte packets are dispatched in whole packets too
+    std::vector<int8_t> stream = makeStream({0x10, 0x10, 0x11}, 192);
+    EXPECT_EQ(std::vector<Delivery>({{1, 0, 2 * 192}}),
+              dispatch(table, stream, stream.size(), 192));
+    // packets too short for a PID are not dispatched
+    EXPECT_TRUE(dispatch(table, stream, stream.size(), 2).empty());
+    EXPECT_TRUE(dispatch(table, stream, stream.size(), 0).empty());
+}
+
+TEST(TsPidTableTest, rebuildReplacesTable) {
+    auto a = std::make_shared<FakeFilter>(1);
+    auto b = std::make_shared<FakeFilter>(2);
+    Table table;
+    table.rebuild({{0x10, a}, {0x20, b}});
+    table.rebuild({{0x20, a}});
+
+    EXPECT_FALSE(table.hasFilters(0x10));
+    EXPECT_EQ(std::vector<int>({1}), filtersOf(table, 0x20));
+    EXPECT_EQ(1, b.use_count());
+
+    table.rebuild({});
+    EXPECT_FALSE(table.hasFilters(0x20));
+    std::vector<int8_t> stream = makeStream({0x20});
+    EXPECT_TRUE(dispatch(table, stream, stream.size()).empty());
+}
+
+}  // namespace